@@ -17,16 +17,58 @@
 #include "freecusd.h"
 
 #include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
 #include <fcntl.h>
 
-/* /sys/class/leds/<NAME>/brightness; <NAME> is 21 characters max */
-#define FCD_ALERT_LED_BUF_SIZE	49
+/* /sys/class/leds/<NAME>/<ATTRIBUTE>; <NAME> is 21 characters max */
+#define FCD_ALERT_LED_BUF_SIZE	64
+
+/*
+ * The main thread only updates the desired state of each LED as it processes
+ * the monitors' alerts.  Once all monitors have been processed,
+ * fcd_alert_apply() writes any LEDs whose desired state differs from the
+ * state that was last successfully applied.  A failed write (e.g. EIO from
+ * the I2C-attached LED controller) is simply retried the next time.
+ *
+ * Active system warnings and failures are shown by blinking the busy (slow)
+ * and fail (fast) LEDs, using the kernel's timer trigger; an acknowledged
+ * alert is shown by a solid LED.  Disk LEDs are always solid.
+ *
+ * The PCA9532 driver offloads symmetric blink patterns to the chip, but both
+ * LEDs share one of its 2 PWM channels.  So the fast (failure) pattern is
+ * symmetric, and the slow pattern is not -- the kernel blinks the busy LED in
+ * software.  (Activating the timer trigger on either LED reprograms the
+ * channel, so a blinking fail LED's pattern is rewritten afterwards.)
+ */
+
+enum fcd_alert_led_state {
+	FCD_ALERT_LED_UNKNOWN = -1,
+	FCD_ALERT_LED_OFF = 0,
+	FCD_ALERT_LED_ON,
+	FCD_ALERT_LED_SLOW,
+	FCD_ALERT_LED_FAST,
+};
+
+/* Blink patterns (milliseconds on, off); see above */
+static const char *const fcd_alert_led_delays[][2] = {
+	[FCD_ALERT_LED_SLOW]	= { "1000", "1500" },
+	[FCD_ALERT_LED_FAST]	= { "250", "250" },
+};
 
 struct fcd_alert {
 	const char *led_name;
 	size_t mon_offset;
 	int led_fd;
 	int counter;
+	_Bool ackable;		/* can be acknowledged from the front panel */
+	_Bool acked;
+	enum fcd_alert_led_state active;	/* unacknowledged alert */
+	enum fcd_alert_led_state applied;
+	unsigned failures;	/* consecutive failed writes */
+	long long raised;	/* time of oldest unapplied alert; see hist.c */
+	struct fcd_hist *hist;
 };
 
 static struct fcd_alert fcd_alerts[] = {
@@ -34,36 +76,45 @@ static struct fcd_alert fcd_alerts[] = {
 		.led_name	= "n5550:orange:busy",
 		.mon_offset	= offsetof(struct fcd_monitor, sys_warn),
 		.counter	= 0,
+		.ackable	= 1,
+		.active		= FCD_ALERT_LED_SLOW,
 	},
 	{
 		.led_name	= "n5550:red:fail",
 		.mon_offset	= offsetof(struct fcd_monitor, sys_fail),
 		.counter	= 0,
+		.ackable	= 1,
+		.active		= FCD_ALERT_LED_FAST,
 	},
 	{
 		.led_name	= "n5550:red:disk-stat-0",
 		.mon_offset	= offsetof(struct fcd_monitor, disk_alerts[0]),
 		.counter	= 0,
+		.active		= FCD_ALERT_LED_ON,
 	},
 	{
 		.led_name	= "n5550:red:disk-stat-1",
 		.mon_offset	= offsetof(struct fcd_monitor, disk_alerts[1]),
 		.counter	= 0,
+		.active		= FCD_ALERT_LED_ON,
 	},
 	{
 		.led_name	= "n5550:red:disk-stat-2",
 		.mon_offset	= offsetof(struct fcd_monitor, disk_alerts[2]),
 		.counter	= 0,
+		.active		= FCD_ALERT_LED_ON,
 	},
 	{
 		.led_name	= "n5550:red:disk-stat-3",
 		.mon_offset	= offsetof(struct fcd_monitor, disk_alerts[3]),
 		.counter	= 0,
+		.active		= FCD_ALERT_LED_ON,
 	},
 	{
 		.led_name	= "n5550:red:disk-stat-4",
 		.mon_offset	= offsetof(struct fcd_monitor, disk_alerts[4]),
 		.counter	= 0,
+		.active		= FCD_ALERT_LED_ON,
 	},
 };
 
@@ -163,26 +214,239 @@ _Bool fcd_alert_update(enum fcd_alert_msg new, enum fcd_alert_msg *status)
  *
  ******************************************************************************/
 
-static void fcd_alert_led_on(const struct fcd_alert *alert)
+static enum fcd_alert_led_state fcd_alert_led_wanted(
+						const struct fcd_alert *alert)
 {
-	ssize_t ret;
+	if (alert->counter == 0)
+		return FCD_ALERT_LED_OFF;
 
-	ret = write(alert->led_fd, "255", 3);
-	if (ret == -1)
-		FCD_PABORT("write");
-	if (ret != 3)
-		FCD_ABORT("Incomplete write (%zd bytes)\n", ret);
+	return alert->acked ? FCD_ALERT_LED_ON : alert->active;
 }
 
-static void fcd_alert_led_off(const struct fcd_alert *alert)
+static _Bool fcd_alert_led_blinking(const enum fcd_alert_led_state state)
+{
+	return state == FCD_ALERT_LED_SLOW || state == FCD_ALERT_LED_FAST;
+}
+
+/*
+ * Writes value to one of the LED's sysfs attributes (other than brightness).
+ * Only the first of a series of consecutive failures is logged.  Returns 0 on
+ * success, -1 on error (with errno set).
+ */
+static int fcd_alert_led_attr(const struct fcd_alert *alert,
+			      const char *attr, const char *value)
+{
+	char buf[FCD_ALERT_LED_BUF_SIZE];
+	size_t len;
+	int fd, ret, err;
+
+	sprintf(buf, "/sys/class/leds/%s/%s", alert->led_name, attr);
+	len = strlen(value);
+	ret = -1;
+
+	fd = fcd_lib_open(buf, O_WRONLY | O_CLOEXEC);
+	if (fd == -1) {
+		err = errno;
+	}
+	else {
+		if (write(fd, value, len) == (ssize_t)len)
+			ret = 0;
+		else
+			err = errno;
+
+		if (close(fd) == -1)
+			FCD_PERROR("close");
+	}
+
+	if (ret == -1) {
+		if (alert->failures == 0)
+			FCD_WARN("%s: %s\n", buf, strerror(err));
+		errno = err;
+	}
+
+	return ret;
+}
+
+/*
+ * Returns 0 on success, -1 on error
+ */
+static int fcd_alert_led_brightness(const struct fcd_alert *alert,
+				    const _Bool on)
 {
 	ssize_t ret;
+	size_t len;
+
+	len = on ? 3 : 1;
+
+	ret = fcd_lib_write_attr(alert->led_fd, on ? "255" : "0", len);
+	if (ret == -1) {
+		if (alert->failures == 0)
+			FCD_PERROR(alert->led_name);
+		return -1;
+	}
+
+	if ((size_t)ret != len) {
+		if (alert->failures == 0) {
+			FCD_WARN("Incomplete write to %s (%zd bytes)\n",
+				 alert->led_name, ret);
+		}
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * Sets the blink pattern of an LED whose timer trigger is active.  The
+ * delay_on and delay_off attributes are created when the trigger is activated,
+ * so their SELinux context must be restored first.  Returns 0 on success, -1
+ * on error.
+ */
+static int fcd_alert_led_delays_set(const struct fcd_alert *alert,
+				    const enum fcd_alert_led_state state,
+				    const _Bool restorecon)
+{
+	static const char *const attrs[2] = { "delay_on", "delay_off" };
+	char buf[FCD_ALERT_LED_BUF_SIZE];
+	unsigned i;
+
+	for (i = 0; i < 2; ++i) {
+
+		if (restorecon) {
+			sprintf(buf, "/sys/class/leds/%s/%s",
+				alert->led_name, attrs[i]);
+			fcd_lib_restorecon(buf);
+		}
+
+		if (fcd_alert_led_attr(alert, attrs[i],
+				       fcd_alert_led_delays[state][i]) == -1) {
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Changes the LED's state.  If the timer trigger isn't available, the LED's
+ * active state falls back to solid.  Returns 0 on success, -1 on error.
+ */
+static int fcd_alert_led_set(struct fcd_alert *alert,
+			     const enum fcd_alert_led_state state)
+{
+	if (!fcd_alert_led_blinking(state)) {
+
+		/* Deactivate the timer trigger, if it (might be) active */
+		if (alert->active != FCD_ALERT_LED_ON
+				&& alert->applied != FCD_ALERT_LED_OFF
+				&& alert->applied != FCD_ALERT_LED_ON
+				&& fcd_alert_led_attr(alert, "trigger",
+						      "none") == -1) {
+			return -1;
+		}
+
+		return fcd_alert_led_brightness(alert,
+						state == FCD_ALERT_LED_ON);
+	}
+
+	if (fcd_alert_led_attr(alert, "trigger", "timer") == -1) {
+
+		if (errno != EINVAL)
+			return -1;
+
+		FCD_WARN("LED timer trigger not available; %s LED will not "
+			 "blink\n", alert->led_name);
+		alert->active = FCD_ALERT_LED_ON;
+
+		return fcd_alert_led_set(alert, FCD_ALERT_LED_ON);
+	}
+
+	return fcd_alert_led_delays_set(alert, state, 1);
+}
+
+/*
+ * Records the time from an alert being raised (by a monitor thread) to the LED
+ * showing it.
+ */
+static void fcd_alert_led_shown(struct fcd_alert *alert)
+{
+	if (alert->raised == 0)
+		return;
+
+	if (alert->applied != FCD_ALERT_LED_OFF
+			&& alert->applied != FCD_ALERT_LED_UNKNOWN) {
+		if (alert->hist == NULL)
+			alert->hist = fcd_hist_get(FCD_HIST_ALERT_LED,
+						   alert->led_name);
+		fcd_hist_record(alert->hist, fcd_hist_now() - alert->raised);
+	}
 
-	ret = write(alert->led_fd, "0", 1);
-	if (ret == -1)
-		FCD_PABORT("write");
-	if (ret != 1)
-		FCD_ABORT("Incomplete write (%zd bytes)\n", ret);
+	alert->raised = 0;
+}
+
+/*
+ * Writes any LEDs whose state has changed.  Called after all monitors have
+ * been processed.
+ */
+void fcd_alert_apply(void)
+{
+	enum fcd_alert_led_state state;
+	struct fcd_alert *alert;
+	_Bool triggered;
+	size_t i;
+
+	triggered = 0;
+
+	for (i = 0; i < FCD_ARRAY_SIZE(fcd_alerts); ++i) {
+
+		alert = &fcd_alerts[i];
+		state = fcd_alert_led_wanted(alert);
+
+		if (state == alert->applied) {
+			fcd_alert_led_shown(alert);
+			continue;
+		}
+
+		if (fcd_alert_led_set(alert, state) == -1) {
+			/* Trigger state is unknown after a partial change */
+			if (fcd_alert_led_blinking(state)
+				    || fcd_alert_led_blinking(alert->applied))
+				alert->applied = FCD_ALERT_LED_UNKNOWN;
+			if (alert->failures++ == 0) {
+				FCD_WARN("Failed to set %s LED; will retry\n",
+					 alert->led_name);
+			}
+			continue;
+		}
+
+		if (alert->failures != 0) {
+			FCD_INFO("Set %s LED after %u failed attempts\n",
+				 alert->led_name, alert->failures);
+			alert->failures = 0;
+		}
+
+		/* fcd_alert_led_set may have changed alert->active */
+		alert->applied = fcd_alert_led_wanted(alert);
+		fcd_alert_led_shown(alert);
+
+		if (fcd_alert_led_blinking(alert->applied))
+			triggered = 1;
+	}
+
+	if (!triggered)
+		return;
+
+	/* Restore the hardware blink pattern; see above */
+	for (i = 0; i < FCD_ARRAY_SIZE(fcd_alerts); ++i) {
+
+		alert = &fcd_alerts[i];
+
+		if (alert->applied == FCD_ALERT_LED_FAST
+				&& fcd_alert_led_delays_set(alert,
+						FCD_ALERT_LED_FAST, 0) == -1) {
+			alert->applied = FCD_ALERT_LED_UNKNOWN;
+		}
+	}
 }
 
 void fcd_alert_read_monitor(struct fcd_monitor *mon)
@@ -200,10 +464,14 @@ void fcd_alert_read_monitor(struct fcd_monitor *mon)
 		msg = (enum fcd_alert_msg *)(mon_base + alert->mon_offset);
 
 		if (*msg == FCD_ALERT_SET_REQ) {
+			if (mon->alert_time != 0 && (alert->raised == 0
+					|| mon->alert_time < alert->raised)) {
+				alert->raised = mon->alert_time;
+			}
 			++(alert->counter);
 			*msg = FCD_ALERT_SET_ACK;
-			if (alert->counter == 1)
-				fcd_alert_led_on(alert);
+			/* A new alert cancels any acknowledgement */
+			alert->acked = 0;
 		}
 		else if (*msg == FCD_ALERT_CLR_REQ) {
 			--(alert->counter);
@@ -211,7 +479,29 @@ void fcd_alert_read_monitor(struct fcd_monitor *mon)
 				FCD_ABORT("Negative alert counter\n");
 			*msg = FCD_ALERT_CLR_ACK;
 			if (alert->counter == 0)
-				fcd_alert_led_off(alert);
+				alert->acked = 0;
+		}
+	}
+}
+
+/*
+ * Called when the operator acknowledges the current alerts from the front
+ * panel.  The system warning & failure LEDs stop blinking (but stay on) until
+ * a new alert is raised.  (Disk LEDs are not affected; they show which disk to
+ * replace.)
+ */
+void fcd_alert_ack(void)
+{
+	struct fcd_alert *alert;
+	size_t i;
+
+	for (i = 0; i < FCD_ARRAY_SIZE(fcd_alerts); ++i) {
+
+		alert = &fcd_alerts[i];
+
+		if (alert->ackable && alert->counter > 0 && !alert->acked) {
+			FCD_INFO("%s alert acknowledged\n", alert->led_name);
+			alert->acked = 1;
 		}
 	}
 }
@@ -227,20 +517,78 @@ void fcd_alert_leds_close(void)
 	}
 }
 
+/*
+ * Returns the LED's current state (off or on), or FCD_ALERT_LED_UNKNOWN if
+ * it can't be read or a trigger (e.g. a timer left over from a previous run)
+ * is active
+ */
+static enum fcd_alert_led_state fcd_alert_led_read(
+						const struct fcd_alert *alert)
+{
+	char buf[FCD_ALERT_LED_BUF_SIZE], trigger[4096];
+	ssize_t ret;
+	int fd;
+
+	if (alert->active != FCD_ALERT_LED_ON) {
+
+		sprintf(buf, "/sys/class/leds/%s/trigger", alert->led_name);
+
+		fd = fcd_lib_open(buf, O_RDONLY | O_CLOEXEC);
+		if (fd == -1) {
+			FCD_PERROR(buf);
+			return FCD_ALERT_LED_UNKNOWN;
+		}
+
+		ret = read(fd, trigger, sizeof trigger - 1);
+		if (ret == -1)
+			FCD_PERROR(buf);
+
+		if (close(fd) == -1)
+			FCD_PERROR("close");
+
+		if (ret == -1)
+			return FCD_ALERT_LED_UNKNOWN;
+
+		trigger[ret] = 0;
+
+		if (strstr(trigger, "[none]") == NULL)
+			return FCD_ALERT_LED_UNKNOWN;
+	}
+
+	ret = pread(alert->led_fd, buf, sizeof buf - 1, 0);
+	if (ret <= 0) {
+		if (ret == -1)
+			FCD_PERROR(alert->led_name);
+		return FCD_ALERT_LED_UNKNOWN;
+	}
+
+	buf[ret] = 0;
+
+	return (atoi(buf) != 0) ? FCD_ALERT_LED_ON : FCD_ALERT_LED_OFF;
+}
+
+/*
+ * All LEDs should be off initially, but only the ones that are actually on
+ * (or blinking) need to be written.
+ */
 void fcd_alert_leds_open(void)
 {
 	char buf[FCD_ALERT_LED_BUF_SIZE];
+	struct fcd_alert *alert;
 	size_t i;
 
 	for (i = 0; i < FCD_ARRAY_SIZE(fcd_alerts); ++i) {
 
-		sprintf(buf, "/sys/class/leds/%s/brightness",
-			fcd_alerts[i].led_name);
+		alert = &fcd_alerts[i];
+
+		sprintf(buf, "/sys/class/leds/%s/brightness", alert->led_name);
 
-		fcd_alerts[i].led_fd = open(buf, O_WRONLY | O_CLOEXEC);
-		if (fcd_alerts[i].led_fd == -1)
+		alert->led_fd = fcd_lib_open(buf, O_RDWR | O_CLOEXEC);
+		if (alert->led_fd == -1)
 			FCD_PFATAL(buf);
 
-		fcd_alert_led_off(&fcd_alerts[i]);
+		alert->applied = fcd_alert_led_read(alert);
 	}
+
+	fcd_alert_apply();
 }
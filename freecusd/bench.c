@@ -0,0 +1,203 @@
+/*
+ * Copyright 2020 Ian Pilcher <arequipeno@gmail.com>
+ *
+ * This program is free software.  You can redistribute it or modify it under
+ * the terms of version 2 of the GNU General Public License (GPL), as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY -- without even the implied warranty of MERCHANTIBILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the text of the GPL for more details.
+ *
+ * Version 2 of the GNU General Public License is available at:
+ *
+ *   http://www.gnu.org/licenses/old-licenses/gpl-2.0.html
+ */
+
+#include "freecusd.h"
+
+#include <stdio.h>
+#include <time.h>
+
+/*
+ * LCD display path benchmark (freecusd -b FRAMES).  Measures:
+ *
+ *   - latency from fcd_lib_set_mon_status() until the frame has been written
+ *     to the serial port and (if the PIC sends ACKs) until it has been ACKed
+ *     -- i.e. until it is on the (emulated) screen, and
+ *
+ *   - throughput (frames per second) with the LCD thread kept busy.
+ *
+ * No monitor threads are started, and the alert LEDs and fan are not touched,
+ * so this can be run off-box with "-t pty:..." (lcd/fakepic) or "-t null".
+ */
+
+#define FCD_BENCH_TIMEOUT	2000	/* milliseconds */
+
+static struct fcd_monitor fcd_bench_monitor = {
+	.mutex		= PTHREAD_MUTEX_INITIALIZER,
+	.name		= "Benchmark",
+	.enabled	= true,
+	.buf		= "....."
+			  "LCD BENCHMARK       "
+			  "                    "
+			  "                    ",
+};
+
+struct fcd_bench_stats {
+	double min;
+	double max;
+	double total;
+	unsigned count;
+};
+
+static double fcd_bench_now(void)
+{
+	struct timespec now;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &now) == -1)
+		FCD_PABORT("clock_gettime");
+
+	return now.tv_sec * 1000.0 + now.tv_nsec / 1000000.0;
+}
+
+static void fcd_bench_add(struct fcd_bench_stats *const stats,
+			  const double msec)
+{
+	if (stats->count == 0 || msec < stats->min)
+		stats->min = msec;
+	if (stats->count == 0 || msec > stats->max)
+		stats->max = msec;
+
+	stats->total += msec;
+	++(stats->count);
+}
+
+static void fcd_bench_report(const char *const what,
+			     const struct fcd_bench_stats *const stats)
+{
+	if (stats->count == 0) {
+		FCD_INFO("%s latency: no samples\n", what);
+		return;
+	}
+
+	FCD_INFO("%s latency (ms): min %.3f, avg %.3f, max %.3f (%u samples)\n",
+		 what, stats->min, stats->total / stats->count, stats->max,
+		 stats->count);
+}
+
+/* Sets the monitor's status, and asks the main loop code to display it */
+static void fcd_bench_update(const unsigned i)
+{
+	char buf[21];
+	int ret;
+
+	snprintf(buf, sizeof buf, "frame %-14u", i);
+
+	fcd_lib_set_mon_status(&fcd_bench_monitor, buf, 0, 0, NULL, 0);
+
+	ret = pthread_mutex_lock(&fcd_bench_monitor.mutex);
+	if (ret != 0)
+		FCD_PT_ABRT("pthread_mutex_lock", ret);
+
+	fcd_tty_write_msg(&fcd_bench_monitor);
+
+	ret = pthread_mutex_unlock(&fcd_bench_monitor.mutex);
+	if (ret != 0)
+		FCD_PT_ABRT("pthread_mutex_unlock", ret);
+}
+
+static void fcd_bench_latency(const unsigned frames)
+{
+	struct fcd_bench_stats written = { 0 }, acked = { 0 };
+	struct fcd_tty_progress target;
+	unsigned long acks_wanted;
+	_Bool acks;
+	double start;
+	unsigned i;
+
+	acks = 1;
+
+	for (i = 0; i < frames; ++i) {
+
+		fcd_tty_get_progress(&target);
+		++target.sent;
+		acks_wanted = target.acked + 1;
+		target.acked = 0;
+		target.queued = 0;
+
+		start = fcd_bench_now();
+		fcd_bench_update(i);
+
+		if (fcd_tty_wait(&target, FCD_BENCH_TIMEOUT) == -1) {
+			FCD_WARN("Timed out waiting for LCD frame to be sent\n");
+			break;
+		}
+
+		fcd_bench_add(&written, fcd_bench_now() - start);
+
+		if (!acks)
+			continue;
+
+		target.acked = acks_wanted;
+		if (fcd_tty_wait(&target, FCD_BENCH_TIMEOUT) == -1) {
+			FCD_INFO("No ACK from LCD PIC; measuring write "
+				 "latency only\n");
+			acks = 0;
+			continue;
+		}
+
+		fcd_bench_add(&acked, fcd_bench_now() - start);
+	}
+
+	fcd_bench_report("Write", &written);
+	if (acks)
+		fcd_bench_report("Screen (ACK)", &acked);
+}
+
+static void fcd_bench_throughput(const unsigned frames)
+{
+	struct fcd_tty_progress target, start_progress;
+	double start, elapsed;
+	unsigned i;
+
+	fcd_tty_get_progress(&start_progress);
+	start = fcd_bench_now();
+
+	/* Keep one message queued, so the LCD thread is never idle */
+	for (i = 0; i < frames; ++i) {
+
+		target.sent = 0;
+		target.acked = 0;
+		target.queued = 0;
+
+		if (fcd_tty_wait(&target, FCD_BENCH_TIMEOUT) == -1) {
+			FCD_WARN("Timed out waiting for LCD queue space\n");
+			return;
+		}
+
+		fcd_bench_update(frames + i);
+	}
+
+	target.sent = start_progress.sent + frames;
+	target.acked = 0;
+	target.queued = 0;
+
+	if (fcd_tty_wait(&target, FCD_BENCH_TIMEOUT) == -1) {
+		FCD_WARN("Timed out waiting for LCD frames to be sent\n");
+		return;
+	}
+
+	elapsed = fcd_bench_now() - start;
+
+	FCD_INFO("Throughput: %u frames in %.3f ms (%.1f frames/second)\n",
+		 frames, elapsed, frames * 1000.0 / elapsed);
+}
+
+void fcd_bench_run(const unsigned frames)
+{
+	FCD_INFO("Running LCD benchmark (%u frames)\n", frames);
+
+	fcd_bench_latency(frames);
+	fcd_bench_throughput(frames);
+}
@@ -1,5 +1,5 @@
 /*
- * Copyright 2014 Ian Pilcher <arequipeno@gmail.com>
+ * Copyright 2014, 2020 Ian Pilcher <arequipeno@gmail.com>
  *
  * This program is free software.  You can redistribute it or modify it under
  * the terms of version 2 of the GNU General Public License (GPL), as published
@@ -19,6 +19,7 @@
 #include <string.h>
 #include <limits.h>
 #include <errno.h>
+#include <stdint.h>
 
 /*
  * Configuration file name
@@ -26,20 +27,203 @@
 const char *fcd_conf_file_name = NULL;
 
 /*
- * RAID disk configuration
+ * Reloadable settings and RAID disks (struct fcd_conf).  The post-parse
+ * callbacks write into a new object (fcd_conf_parsing), which is then
+ * published by swapping fcd_conf_current.  Each thread that uses the settings
+ * holds a reference to the object that was current when it last called
+ * fcd_conf_get() (fcd_cfg); monitor threads release their reference while they
+ * sleep (see sched.c), and the main thread refreshes its reference whenever it
+ * publishes a new object.  An object that has been replaced is freed when its
+ * last reference is released.
+ *
+ * A new object is also published (with a copy of the current settings) when
+ * RAID disks are added or removed; see disk.c.
+ *
+ * The RAID disk table (disks) and the disk-specific settings (disk_cfg) are
+ * dynamically allocated, and they are owned by (freed with) the object.
  */
-unsigned fcd_conf_disk_count;
-
-struct fcd_raid_disk fcd_conf_disks[FCD_MAX_DISK_COUNT] = {
-
+static const struct fcd_conf fcd_conf_defaults = {
+	.loadavg_warn			= { 12.0, 12.0, 12.0 },	/* load_avg_warn */
+	.loadavg_crit			= { 16.0, 16.0, 16.0 },	/* load_avg_crit */
+	.sysfan_warn			= 1200,		/* sysfan_rpm_warn */
+	.sysfan_fail			= 500,		/* sysfan_rpm_crit */
+	.pwm_values = {
+		[FCD_PWM_STATE_NORMAL]		= 170,	/* sysfan_pwm_normal */
+		[FCD_PWM_STATE_HIGH]		= 215,	/* sysfan_pwm_high */
+		[FCD_PWM_STATE_MAX]		= 255,	/* sysfan_pwm_max */
+	},
+	.temp_core = {
+		[FCD_CONF_TEMP_WARN]		= 43000,	/* cpu_core_temp_warn */
+		[FCD_CONF_TEMP_FAIL]		= 45000,	/* cpu_core_temp_crit */
+		[FCD_CONF_TEMP_FAN_MAX_ON]	= 42000,	/* cpu_core_temp_fan_max_on */
+		[FCD_CONF_TEMP_FAN_MAX_HYST]	= 39000,	/* cpu_core_temp_fan_max_hyst */
+		[FCD_CONF_TEMP_FAN_HIGH_ON]	= 40000,	/* cpu_core_temp_fan_high_on */
+		[FCD_CONF_TEMP_FAN_HIGH_HYST]	= 37000,	/* cpu_core_temp_fan_high_hyst */
+	},
+	.temp_cpu = {
+		[FCD_CONF_TEMP_WARN]		= 43000,	/* cpu_temp_warn */
+		[FCD_CONF_TEMP_FAIL]		= 45000,	/* cpu_temp_crit */
+		[FCD_CONF_TEMP_FAN_MAX_ON]	= 42000,	/* cpu_temp_fan_max_on */
+		[FCD_CONF_TEMP_FAN_MAX_HYST]	= 39000,	/* cpu_temp_fan_max_hyst */
+		[FCD_CONF_TEMP_FAN_HIGH_ON]	= 40000,	/* cpu_temp_fan_high_on */
+		[FCD_CONF_TEMP_FAN_HIGH_HYST]	= 37000,	/* cpu_temp_fan_high_hyst */
+	},
+	.temp_sys = {
+		[FCD_CONF_TEMP_WARN]		= 39000,	/* sys_temp_warn */
+		[FCD_CONF_TEMP_FAIL]		= 40000,	/* sys_temp_crit */
+		[FCD_CONF_TEMP_FAN_MAX_ON]	= 39000,	/* sys_temp_fan_max_on */
+		[FCD_CONF_TEMP_FAN_MAX_HYST]	= 37000,	/* sys_temp_fan_max_hyst */
+		[FCD_CONF_TEMP_FAN_HIGH_ON]	= 38000,	/* sys_temp_fan_high_on */
+		[FCD_CONF_TEMP_FAN_HIGH_HYST]	= 36000,	/* sys_temp_fan_high_hyst */
+	},
+	.temp_ich = {
+		[FCD_CONF_TEMP_WARN]		= 39000,	/* ich_temp_warn */
+		[FCD_CONF_TEMP_FAIL]		= 40000,	/* ich_temp_crit */
+		[FCD_CONF_TEMP_FAN_MAX_ON]	= 39000,	/* ich_temp_fan_max_on */
+		[FCD_CONF_TEMP_FAN_MAX_HYST]	= 37000,	/* ich_temp_fan_max_hyst */
+		[FCD_CONF_TEMP_FAN_HIGH_ON]	= 38000,	/* ich_temp_fan_high_on */
+		[FCD_CONF_TEMP_FAN_HIGH_HYST]	= 36000,	/* ich_temp_fan_high_hyst */
+	},
 	/*
-	 * Used by fcd_conf_disk_idx() to determine whether the [freecusd]
+	 * Used by fcd_smart_disk_pos() to determine whether the [freecusd]
 	 * section has been processed yet.  (Will be set to default/provided
-	 * value of hdd_temp_warn.)
+	 * value of hdd_temp_warn; see smart.c for the other defaults.)
 	 */
-	[0].temps[FCD_CONF_TEMP_WARN] = INT_MIN
+	.disk_default.temps[FCD_CONF_TEMP_WARN]	= INT_MIN,
+	.sched_ramp			= 3.0,		/* monitor_start_ramp */
+	.sched_jitter			= 0.0,		/* monitor_jitter */
+	.page_time			= 3.0,		/* lcd_page_time */
+	.page_warn_weight		= 2,		/* lcd_warn_weight */
+	.page_fail_weight		= 4,		/* lcd_fail_weight */
+	.page_pin_fail			= 0,		/* lcd_pin_failures */
+	.log_burst			= 10,		/* log_rate_burst */
+	.log_interval			= 600,		/* log_rate_interval */
 };
 
+static pthread_mutex_t fcd_conf_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct fcd_conf *fcd_conf_current;	/* fcd_conf_mutex */
+__thread const struct fcd_conf *fcd_cfg;
+
+/* Main thread only */
+static struct fcd_conf *fcd_conf_parsing;
+static _Bool fcd_conf_reloading;
+
+static void fcd_conf_free(struct fcd_conf *const cfg)
+{
+	free(cfg->disks);
+	free(cfg->disk_cfg);
+	free(cfg);
+}
+
+/*
+ * Returns a pointer to the member of the object being parsed, given its
+ * offset (FCD_CONF_OFFSET) as the post-parse data
+ */
+void *fcd_conf_member(void *const post_parse_data)
+{
+	return (char *)fcd_conf_parsing + (uintptr_t)post_parse_data;
+}
+
+/*
+ * Returns the disk-specific settings for position pos ([raid_disk:X]) in the
+ * object being parsed, adding entries (copies of the [freecusd] settings) as
+ * needed.  Returns NULL on error.
+ */
+struct fcd_conf_disk *fcd_conf_parsing_disk(const unsigned pos)
+{
+	struct fcd_conf *const cfg = fcd_conf_parsing;
+	struct fcd_conf_disk *disk_cfg;
+	unsigned i;
+
+	if (pos > cfg->disk_cfg_count) {
+
+		disk_cfg = realloc(cfg->disk_cfg, pos * sizeof *disk_cfg);
+		if (disk_cfg == NULL) {
+			FCD_PERROR("realloc");
+			return NULL;
+		}
+
+		for (i = cfg->disk_cfg_count; i < pos; ++i)
+			disk_cfg[i] = cfg->disk_default;
+
+		cfg->disk_cfg = disk_cfg;
+		cfg->disk_cfg_count = pos;
+	}
+
+	return &cfg->disk_cfg[pos - 1];
+}
+
+void fcd_conf_get(void)
+{
+	int ret;
+
+	ret = pthread_mutex_lock(&fcd_conf_mutex);
+	if (ret != 0)
+		FCD_PT_ABRT("pthread_mutex_lock", ret);
+
+	++(fcd_conf_current->refs);
+	fcd_cfg = fcd_conf_current;
+
+	ret = pthread_mutex_unlock(&fcd_conf_mutex);
+	if (ret != 0)
+		FCD_PT_ABRT("pthread_mutex_unlock", ret);
+}
+
+void fcd_conf_put(void)
+{
+	struct fcd_conf *cfg;
+	int ret;
+
+	if (fcd_cfg == NULL)
+		return;
+
+	cfg = (struct fcd_conf *)fcd_cfg;
+	fcd_cfg = NULL;
+
+	ret = pthread_mutex_lock(&fcd_conf_mutex);
+	if (ret != 0)
+		FCD_PT_ABRT("pthread_mutex_lock", ret);
+
+	if (--(cfg->refs) == 0 && cfg != fcd_conf_current)
+		fcd_conf_free(cfg);
+
+	ret = pthread_mutex_unlock(&fcd_conf_mutex);
+	if (ret != 0)
+		FCD_PT_ABRT("pthread_mutex_unlock", ret);
+}
+
+/* Switches to the current object, if the calling thread's is out of date */
+void fcd_conf_refresh(void)
+{
+	if (fcd_cfg == __atomic_load_n(&fcd_conf_current, __ATOMIC_ACQUIRE))
+		return;
+
+	fcd_conf_put();
+	fcd_conf_get();
+}
+
+static void fcd_conf_publish(struct fcd_conf *const cfg)
+{
+	struct fcd_conf *old;
+	int ret;
+
+	ret = pthread_mutex_lock(&fcd_conf_mutex);
+	if (ret != 0)
+		FCD_PT_ABRT("pthread_mutex_lock", ret);
+
+	old = fcd_conf_current;
+	__atomic_store_n(&fcd_conf_current, cfg, __ATOMIC_RELEASE);
+
+	if (old != NULL && old->refs == 0)
+		fcd_conf_free(old);
+
+	ret = pthread_mutex_unlock(&fcd_conf_mutex);
+	if (ret != 0)
+		FCD_PT_ABRT("pthread_mutex_unlock", ret);
+
+	fcd_err_conf_apply(cfg);
+}
+
 /*
  * Post-parse callback for monitor enable/disable booleans
  */
@@ -55,6 +239,15 @@ int fcd_conf_mon_enable_cb(cip_err_ctx *ctx __attribute__((unused)),
 	mon = (struct fcd_monitor *)post_parse_data;
 	b = (const bool *)(value->value);
 
+	/* Monitor threads are only started (or not) at startup */
+	if (fcd_conf_reloading) {
+		if (*b != mon->enabled) {
+			FCD_WARN("Restart required to %s %s monitor\n",
+				 *b ? "enable" : "disable", mon->name);
+		}
+		return 0;
+	}
+
 	mon->enabled = *b;
 	if (!mon->enabled) {
 		FCD_INFO("%s monitor disabled by configuration setting\n",
@@ -108,12 +301,15 @@ static int fcd_conf_per_mon(cip_err_ctx *ctx, struct fcd_monitor *mon,
 	return 0;
 }
 
-static void fcd_conf_dump(void)
+/*
+ * Dumps the current configuration to stream (or to the log, if stream is
+ * NULL).  Called in the main thread.
+ */
+void fcd_conf_write(FILE *const stream)
 {
 	struct fcd_monitor **mon;
 
-	if (!fcd_err_debug)
-		return;
+	fcd_err_dump_stream = stream;
 
 	for (mon = fcd_monitors; *mon != NULL; ++mon) {
 
@@ -128,75 +324,225 @@ static void fcd_conf_dump(void)
 
 		FCD_DUMP("\n");
 	}
+
+	fcd_sched_dump_cfg();
+	fcd_page_dump_cfg();
+	fcd_err_dump_cfg();
+
+	fcd_err_dump_stream = NULL;
 }
 
-void fcd_conf_parse(void)
+static void fcd_conf_dump(void)
+{
+	if (fcd_err_debug)
+		fcd_conf_write(NULL);
+}
+
+/*
+ * Parses the configuration file into a new object.  Returns NULL on error.
+ */
+static struct fcd_conf *fcd_conf_load(void)
 {
 	cip_sect_schema *freecusd_schema, *raiddisk_schema;
 	cip_file_schema *file_schema;
 	const char *cfg_file_name;
 	struct fcd_monitor **mon;
+	struct fcd_conf *cfg;
 	cip_ini_file *file;
 	cip_err_ctx ctx;
 	FILE *stream;
 	int ret;
 
-	ret = fcd_disk_detect();
-	if (ret < 1) {
-		FCD_WARN("Failed to auto-detect RAID disks\n");
-		fcd_conf_disk_count = 0;
-	}
-	else {
-		fcd_conf_disk_count = ret;
+	cfg = malloc(sizeof *cfg);
+	if (cfg == NULL) {
+		FCD_PERROR("malloc");
+		return NULL;
 	}
 
+	*cfg = fcd_conf_defaults;
+	fcd_conf_parsing = cfg;
+
 	cip_err_ctx_init(&ctx);
 
 	file_schema = cip_file_schema_new1(&ctx);
 	if (file_schema == NULL)
-		FCD_FATAL("%s\n", cip_last_err(&ctx));
+		goto error_ctx;
 
 	freecusd_schema = cip_sect_schema_new1(&ctx, file_schema, "freecusd",
 					       CIP_SECT_CREATE);
 	if (freecusd_schema == NULL)
-		FCD_FATAL("%s\n", cip_last_err(&ctx));
+		goto error_schema;
 
 	raiddisk_schema = cip_sect_schema_new1(&ctx, file_schema, "raid_disk",
 					       CIP_SECT_MULTIPLE);
 	if (raiddisk_schema == NULL)
-		FCD_FATAL("%s\n", cip_last_err(&ctx));
+		goto error_schema;
 
 	for (mon = fcd_monitors; *mon != NULL; ++mon) {
 
 		ret = fcd_conf_per_mon(&ctx, *mon, freecusd_schema,
 				       raiddisk_schema);
 		if (ret == -1)
-			FCD_FATAL("%s\n", cip_last_err(&ctx));
+			goto error_schema;
 	}
 
+	ret = cip_opt_schema_new3(&ctx, freecusd_schema, fcd_sched_opts);
+	if (ret == -1)
+		goto error_schema;
+
+	ret = cip_opt_schema_new3(&ctx, freecusd_schema, fcd_page_opts);
+	if (ret == -1)
+		goto error_schema;
+
+	ret = cip_opt_schema_new3(&ctx, freecusd_schema, fcd_err_opts);
+	if (ret == -1)
+		goto error_schema;
+
 	cfg_file_name = (fcd_conf_file_name != NULL) ? fcd_conf_file_name :
 						"/etc/freecusd.conf";
 	stream = fopen(cfg_file_name, "re");
 	if (stream == NULL) {
-		if (fcd_conf_file_name == NULL && errno == ENOENT)
+		if (fcd_conf_file_name == NULL && errno == ENOENT) {
 			cfg_file_name = "(none)";
-		else
-			FCD_FATAL("Failed to open configuration file: %s: %m\n",
-				  cfg_file_name);
+		}
+		else {
+			FCD_ERR("Failed to open configuration file: %s: %m\n",
+				cfg_file_name);
+			cip_file_schema_free(file_schema);
+			goto error_no_msg;
+		}
 	}
 
 	file = cip_parse_stream(&ctx, stream, cfg_file_name, file_schema,
 				fcd_conf_warn);
-	if (file == NULL)
-		FCD_FATAL("%s\n", cip_last_err(&ctx));
 
 	if (stream != NULL && fclose(stream) == EOF)
 		FCD_PERROR(cfg_file_name);
 
+	if (file == NULL)
+		goto error_schema;
+
 	cip_ini_file_free(file);
 	cip_file_schema_free(file_schema);
 	cip_err_ctx_fini(&ctx);
 
+	fcd_conf_parsing = NULL;
+	return cfg;
+
+error_schema:
+	cip_file_schema_free(file_schema);
+error_ctx:
+	FCD_ERR("%s\n", cip_last_err(&ctx));
+error_no_msg:
+	cip_err_ctx_fini(&ctx);
+	fcd_conf_free(cfg);
+	fcd_conf_parsing = NULL;
+	return NULL;
+}
+
+/*
+ * Called in the main thread at startup.  The main thread holds a reference to
+ * the resulting configuration.
+ */
+void fcd_conf_parse(void)
+{
+	struct fcd_conf *cfg;
+	int ret;
+
+	cfg = fcd_conf_load();
+	if (cfg == NULL)
+		FCD_FATAL("Failed to parse configuration\n");
+
+	ret = fcd_disk_detect(&cfg->disks);
+	if (ret < 1) {
+		FCD_WARN("Failed to auto-detect RAID disks\n");
+		cfg->disk_count = 0;
+	}
+	else {
+		cfg->disk_count = ret;
+	}
+
+	fcd_conf_publish(cfg);
+	fcd_conf_get();
+	fcd_conf_dump();
+}
+
+/*
+ * Called in the main thread (SIGHUP).  Monitors cannot be enabled or disabled.
+ * If the file can't be parsed, the current configuration remains in effect.
+ */
+void fcd_conf_reload(void)
+{
+	struct fcd_conf *cfg;
+
+	FCD_INFO("Reloading configuration\n");
+
+	fcd_conf_reloading = 1;
+	cfg = fcd_conf_load();
+	fcd_conf_reloading = 0;
+
+	if (cfg == NULL) {
+		FCD_ERR("Configuration not reloaded\n");
+		return;
+	}
+
+	if (fcd_cfg->disk_count > 0) {
+
+		cfg->disks = malloc(fcd_cfg->disk_count * sizeof *cfg->disks);
+		if (cfg->disks == NULL) {
+			FCD_PERROR("malloc");
+			FCD_ERR("Configuration not reloaded\n");
+			fcd_conf_free(cfg);
+			return;
+		}
+
+		memcpy(cfg->disks, fcd_cfg->disks,
+		       fcd_cfg->disk_count * sizeof *cfg->disks);
+		cfg->disk_count = fcd_cfg->disk_count;
+	}
+
+	fcd_conf_publish(cfg);
+	fcd_conf_refresh();
 	fcd_conf_dump();
 }
 
+/*
+ * Called in the main thread when RAID disks have been added or removed.  All
+ * other settings are unchanged.  Takes ownership of disks (which must have
+ * been allocated by fcd_disk_detect()), even if an error occurs.
+ */
+void fcd_conf_set_disks(struct fcd_raid_disk *const disks, const unsigned count)
+{
+	struct fcd_conf *cfg;
+	size_t size;
+
+	cfg = malloc(sizeof *cfg);
+	if (cfg == NULL) {
+		FCD_PERROR("malloc");
+		free(disks);
+		return;
+	}
+
+	*cfg = *fcd_cfg;
+	cfg->refs = 0;
+	cfg->disk_count = count;
+	cfg->disks = disks;
+
+	if (cfg->disk_cfg_count > 0) {
+
+		size = cfg->disk_cfg_count * sizeof *cfg->disk_cfg;
+
+		cfg->disk_cfg = malloc(size);
+		if (cfg->disk_cfg == NULL) {
+			FCD_PERROR("malloc");
+			free(disks);
+			free(cfg);
+			return;
+		}
+
+		memcpy(cfg->disk_cfg, fcd_cfg->disk_cfg, size);
+	}
+
+	fcd_conf_publish(cfg);
+	fcd_conf_refresh();
+}
@@ -0,0 +1,638 @@
+/*
+ * Copyright 2020 Ian Pilcher <arequipeno@gmail.com>
+ *
+ * This program is free software.  You can redistribute it or modify it under
+ * the terms of version 2 of the GNU General Public License (GPL), as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY -- without even the implied warranty of MERCHANTIBILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the text of the GPL for more details.
+ *
+ * Version 2 of the GNU General Public License is available at:
+ *
+ *   http://www.gnu.org/licenses/old-licenses/gpl-2.0.html
+ */
+
+#include "freecusd.h"
+
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <strings.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <time.h>
+
+/*
+ * Control socket (freecusctl; see ctl/freecusctl.c).  Each connection carries
+ * a single request -- one line of text -- and its response, after which the
+ * connection is closed.  A response that begins with "error: " reports a
+ * failed request.  Requests:
+ *
+ *	status [json]			monitor & fan status
+ *	config				current (effective) configuration
+ *	stats				latency histograms (see hist.c)
+ *	poll MONITOR			make the monitor poll immediately
+ *	page MONITOR|resume		show & pin a page, or resume rotation
+ *	fan normal|high|max SECONDS	override the fan speed
+ *	fan auto			cancel the override
+ *	trend [HOURS]			sensor min/avg/max (default 24 hours)
+ *
+ * MONITOR is a monitor name, as shown by "status" (case-insensitive).
+ *
+ * All of this runs in the main thread's event loop; connections are non-
+ * blocking, so a slow client can't hold up the LCD, alerts, or fan control.
+ */
+
+#define FCD_CTL_REQ_SIZE	256
+#define FCD_CTL_TIMEOUT		5000		/* msec */
+#define FCD_CTL_MAX_FAN_TIME	3600		/* seconds */
+#define FCD_CTL_MAX_TREND_TIME	(365 * 24)	/* hours */
+
+struct fcd_ctl_client {
+	int fd;
+	long long start;
+	size_t req_len;
+	char req[FCD_CTL_REQ_SIZE];
+	char *resp;
+	size_t resp_len;
+	size_t resp_pos;
+};
+
+static int fcd_ctl_sock = -1;
+static const char *fcd_ctl_path;
+static char fcd_ctl_path_buf[PATH_MAX];
+static struct fcd_ctl_client fcd_ctl_clients[FCD_CTL_MAX_CLIENTS];
+
+static long long fcd_ctl_now(void)
+{
+	struct timespec now;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &now) == -1)
+		FCD_PABORT("clock_gettime");
+
+	return now.tv_sec * 1000LL + now.tv_nsec / 1000000;
+}
+
+/* With a fake root (-r), the socket is created under the root; see lib.c */
+void fcd_ctl_open(const char *path)
+{
+	struct sockaddr_un un;
+	const char *root_path;
+	unsigned i;
+	mode_t mask;
+	int ret;
+
+	for (i = 0; i < FCD_CTL_MAX_CLIENTS; ++i)
+		fcd_ctl_clients[i].fd = -1;
+
+	root_path = fcd_lib_path(fcd_ctl_path_buf, path);
+	if (root_path == NULL) {
+		FCD_PERROR(path);
+		goto error;
+	}
+
+	path = root_path;
+
+	if (strlen(path) >= sizeof un.sun_path) {
+		FCD_ERR("Control socket path too long: %s\n", path);
+		goto error;
+	}
+
+	fcd_ctl_sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC
+							| SOCK_NONBLOCK, 0);
+	if (fcd_ctl_sock == -1) {
+		FCD_PERROR("socket");
+		goto error;
+	}
+
+	memset(&un, 0, sizeof un);
+	un.sun_family = AF_UNIX;
+	strcpy(un.sun_path, path);
+
+	if (unlink(path) == -1 && errno != ENOENT)
+		FCD_PERROR(path);
+
+	/*
+	 * The control socket can change the fan speed; root only.  It must be
+	 * created with that mode -- a later chmod() would leave a window in
+	 * which anyone could connect.  (Called in the main thread before any
+	 * thread that creates files is started, so the umask change is safe.)
+	 */
+	mask = umask(S_IXUSR | S_IRWXG | S_IRWXO);
+	ret = bind(fcd_ctl_sock, (struct sockaddr *)&un, sizeof un);
+	umask(mask);
+
+	if (ret == -1) {
+		FCD_PERROR(path);
+		goto error_close;
+	}
+
+	if (listen(fcd_ctl_sock, FCD_CTL_MAX_CLIENTS) == -1) {
+		FCD_PERROR("listen");
+		goto error_unlink;
+	}
+
+	fcd_ctl_path = path;
+	FCD_INFO("Listening for control connections on %s\n", path);
+	return;
+
+error_unlink:
+	if (unlink(path) == -1)
+		FCD_PERROR(path);
+error_close:
+	if (close(fcd_ctl_sock) == -1)
+		FCD_PERROR("close");
+	fcd_ctl_sock = -1;
+error:
+	FCD_WARN("Control socket disabled\n");
+}
+
+static void fcd_ctl_drop(struct fcd_ctl_client *const client)
+{
+	if (close(client->fd) == -1)
+		FCD_PERROR("close");
+
+	free(client->resp);
+	client->resp = NULL;
+	client->fd = -1;
+}
+
+void fcd_ctl_close(void)
+{
+	unsigned i;
+
+	if (fcd_ctl_sock == -1)
+		return;
+
+	for (i = 0; i < FCD_CTL_MAX_CLIENTS; ++i) {
+		if (fcd_ctl_clients[i].fd != -1)
+			fcd_ctl_drop(&fcd_ctl_clients[i]);
+	}
+
+	if (close(fcd_ctl_sock) == -1)
+		FCD_PERROR("close");
+
+	if (unlink(fcd_ctl_path) == -1)
+		FCD_PERROR(fcd_ctl_path);
+
+	fcd_ctl_sock = -1;
+}
+
+/*
+ * Requests
+ */
+
+static struct fcd_monitor *fcd_ctl_find_mon(const char *const name)
+{
+	struct fcd_monitor **mon;
+
+	for (mon = fcd_monitors; *mon != NULL; ++mon) {
+
+		if ((*mon)->name != NULL && strcasecmp((*mon)->name, name) == 0)
+			return *mon;
+	}
+
+	return NULL;
+}
+
+static _Bool fcd_ctl_alert(const enum fcd_alert_msg msg)
+{
+	return msg == FCD_ALERT_SET_REQ || msg == FCD_ALERT_SET_ACK;
+}
+
+/* Writes an LCD line as a JSON string */
+static void fcd_ctl_json_line(FILE *const out, const char *const line)
+{
+	size_t len;
+	unsigned i;
+
+	for (len = 20; len > 0 && line[len - 1] == ' '; --len);
+
+	fputc('"', out);
+
+	for (i = 0; i < len; ++i) {
+		if (line[i] == '"' || line[i] == '\\')
+			fprintf(out, "\\%c", line[i]);
+		else if (!isprint((unsigned char)line[i]))
+			fprintf(out, "\\u%04x", (unsigned char)line[i]);
+		else
+			fputc(line[i], out);
+	}
+
+	fputc('"', out);
+}
+
+/* Called with the monitor's mutex locked; see fcd_page_fill() */
+static const char *fcd_ctl_mon_line(const struct fcd_monitor *const mon,
+				    const unsigned i)
+{
+	if (mon->page_count != 0 && mon->pages != NULL)
+		return mon->pages + i * 20;
+
+	return (const char *)mon->buf + ((i == 0) ? 5 : 45);
+}
+
+static void fcd_ctl_status_mon(FILE *const out, struct fcd_monitor *const mon,
+			       const _Bool json, _Bool *const first)
+{
+	const char *state;
+	unsigned i, lines;
+	int ret;
+
+	ret = pthread_mutex_lock(&mon->mutex);
+	if (ret != 0)
+		FCD_PT_ABRT("pthread_mutex_lock", ret);
+
+	if (!mon->enabled)
+		state = "disabled";
+	else if (fcd_ctl_alert(mon->sys_fail))
+		state = "FAIL";
+	else if (fcd_ctl_alert(mon->sys_warn))
+		state = "WARN";
+	else
+		state = "OK";
+
+	lines = (mon->page_count != 0 && mon->pages != NULL)
+						? mon->page_count * 2 : 2;
+
+	if (json) {
+		fprintf(out, "%s\n    { \"name\": \"%s\", \"state\": \"%s\", "
+			"\"lcd\": [ ", *first ? "" : ",", mon->name, state);
+		*first = 0;
+		for (i = 0; i < lines; ++i) {
+			fcd_ctl_json_line(out, fcd_ctl_mon_line(mon, i));
+			fputs((i + 1 < lines) ? ", " : " ] }", out);
+		}
+	}
+	else if (mon->silent || !mon->enabled) {
+		fprintf(out, "%-22s %-8s\n", mon->name, state);
+	}
+	else {
+		for (i = 0; i < lines; i += 2) {
+			fprintf(out, "%-22s %-8s %.20s | %.20s\n",
+				(i == 0) ? mon->name : "", (i == 0) ? state : "",
+				fcd_ctl_mon_line(mon, i),
+				fcd_ctl_mon_line(mon, i + 1));
+		}
+	}
+
+	ret = pthread_mutex_unlock(&mon->mutex);
+	if (ret != 0)
+		FCD_PT_ABRT("pthread_mutex_unlock", ret);
+}
+
+static void fcd_ctl_status(FILE *const out, const _Bool json)
+{
+	const struct fcd_monitor *page;
+	enum fcd_pwm_state state;
+	struct fcd_monitor **mon;
+	unsigned override;
+	_Bool paused, first;
+	int value;
+
+	if (json)
+		fputs("{\n  \"monitors\": [", out);
+	else
+		fprintf(out, "%-22s %-8s %s\n", "MONITOR", "STATE", "LCD");
+
+	for (first = 1, mon = fcd_monitors; *mon != NULL; ++mon) {
+		if ((*mon)->name != NULL)
+			fcd_ctl_status_mon(out, *mon, json, &first);
+	}
+
+	page = fcd_page_status(&paused);
+
+	if (json) {
+		fprintf(out, "\n  ],\n  \"lcd\": { \"page\": ");
+		if (page != NULL && page->name != NULL)
+			fprintf(out, "\"%s\"", page->name);
+		else
+			fputs("null", out);
+		fprintf(out, ", \"paused\": %s },\n  \"fan\": ",
+			paused ? "true" : "false");
+	}
+	else {
+		fprintf(out, "\nLCD: %s%s\n",
+			(page != NULL && page->name != NULL) ? page->name
+							     : "logo",
+			paused ? " (paused)" : "");
+	}
+
+	if (fcd_pwm_status(&state, &value, &override) == -1) {
+		fputs(json ? "null\n}\n" : "Fan: not controlled\n", out);
+	}
+	else if (json) {
+		fprintf(out, "{ \"state\": \"%s\", \"pwm\": %d, "
+			"\"override\": %u }\n}\n",
+			fcd_pwm_state_names[state], value, override);
+	}
+	else {
+		fprintf(out, "Fan: %s (PWM %d)", fcd_pwm_state_names[state],
+			value);
+		if (override != 0)
+			fprintf(out, ", overridden for %u seconds", override);
+		fputc('\n', out);
+	}
+}
+
+static void fcd_ctl_poll(FILE *const out, const char *const arg)
+{
+	struct fcd_monitor *mon;
+
+	if ((mon = fcd_ctl_find_mon(arg)) == NULL)
+		fprintf(out, "error: unknown monitor: %s\n", arg);
+	else if (fcd_sched_wake(mon) == -1)
+		fprintf(out, "error: %s monitor isn't running\n", mon->name);
+	else
+		fprintf(out, "%s monitor polling\n", mon->name);
+}
+
+static void fcd_ctl_page(FILE *const out, const char *const arg)
+{
+	struct fcd_monitor *mon;
+
+	if (strcasecmp(arg, "resume") == 0) {
+		fcd_page_pin(NULL);
+		fputs("LCD page rotation resumed\n", out);
+		return;
+	}
+
+	mon = fcd_ctl_find_mon(arg);
+	if (mon == NULL || !mon->enabled || mon->silent) {
+		fprintf(out, "error: no LCD page for monitor: %s\n", arg);
+		return;
+	}
+
+	fcd_page_pin(mon);
+	fprintf(out, "LCD pinned to %s page\n", mon->name);
+}
+
+static void fcd_ctl_fan(FILE *const out, const char *const arg)
+{
+	static const char *const states[FCD_PWM_STATE_ARRAY_SIZE] = {
+		[FCD_PWM_STATE_NORMAL]	= "normal",
+		[FCD_PWM_STATE_HIGH]	= "high",
+		[FCD_PWM_STATE_MAX]	= "max",
+	};
+	unsigned long seconds;
+	char name[8], *end;
+	int i, n;
+
+	if (strcasecmp(arg, "auto") == 0) {
+		if (fcd_pwm_override(FCD_PWM_STATE_NORMAL, 0) == -1)
+			fputs("error: fan speed control is disabled\n", out);
+		else
+			fputs("Fan speed override cancelled\n", out);
+		return;
+	}
+
+	if (sscanf(arg, "%7s %n", name, &n) != 1)
+		n = 0;
+
+	for (i = 0; i < FCD_PWM_STATE_ARRAY_SIZE; ++i) {
+		if (strcasecmp(name, states[i]) == 0)
+			break;
+	}
+
+	errno = 0;
+	seconds = strtoul(arg + n, &end, 10);
+
+	if (n == 0 || i == FCD_PWM_STATE_ARRAY_SIZE || errno != 0
+			|| end == arg + n || *end != 0 || seconds == 0
+			|| seconds > FCD_CTL_MAX_FAN_TIME) {
+		fprintf(out, "error: usage: fan normal|high|max SECONDS "
+			"(1 - %d) or fan auto\n", FCD_CTL_MAX_FAN_TIME);
+		return;
+	}
+
+	if (fcd_pwm_override(i, seconds) == -1) {
+		fputs("error: fan speed control is disabled\n", out);
+		return;
+	}
+
+	fprintf(out, "Fan speed set to %s for %lu seconds\n",
+		fcd_pwm_state_names[i], seconds);
+}
+
+static void fcd_ctl_trend(FILE *const out, const char *const arg)
+{
+	unsigned long hours;
+	char *end;
+
+	if (*arg == 0) {
+		fcd_trend_write(out, 24);
+		return;
+	}
+
+	errno = 0;
+	hours = strtoul(arg, &end, 10);
+
+	if (errno != 0 || end == arg || *end != 0 || hours == 0
+			|| hours > FCD_CTL_MAX_TREND_TIME) {
+		fprintf(out, "error: usage: trend [HOURS] (1 - %d)\n",
+			FCD_CTL_MAX_TREND_TIME);
+		return;
+	}
+
+	fcd_trend_write(out, hours);
+}
+
+/* Processes a complete request (NUL-terminated, without the newline) */
+static void fcd_ctl_request(struct fcd_ctl_client *const client)
+{
+	char *cmd, *arg;
+	FILE *out;
+
+	out = open_memstream(&client->resp, &client->resp_len);
+	if (out == NULL) {
+		FCD_PERROR("open_memstream");
+		fcd_ctl_drop(client);
+		return;
+	}
+
+	cmd = client->req + strspn(client->req, " \t");
+	arg = cmd + strcspn(cmd, " \t");
+	if (*arg != 0)
+		*arg++ = 0;
+	arg += strspn(arg, " \t");
+
+	if (strcmp(cmd, "status") == 0 && *arg == 0)
+		fcd_ctl_status(out, 0);
+	else if (strcmp(cmd, "status") == 0 && strcmp(arg, "json") == 0)
+		fcd_ctl_status(out, 1);
+	else if (strcmp(cmd, "config") == 0 && *arg == 0)
+		fcd_conf_write(out);
+	else if (strcmp(cmd, "stats") == 0 && *arg == 0)
+		fcd_hist_write(out);
+	else if (strcmp(cmd, "poll") == 0)
+		fcd_ctl_poll(out, arg);
+	else if (strcmp(cmd, "page") == 0)
+		fcd_ctl_page(out, arg);
+	else if (strcmp(cmd, "fan") == 0)
+		fcd_ctl_fan(out, arg);
+	else if (strcmp(cmd, "trend") == 0)
+		fcd_ctl_trend(out, arg);
+	else
+		fprintf(out, "error: invalid request: %s\n", cmd);
+
+	if (fclose(out) != 0) {
+		FCD_PERROR("fclose");
+		fcd_ctl_drop(client);
+		return;
+	}
+
+	client->resp_pos = 0;
+}
+
+/*
+ * Event loop integration (main thread)
+ */
+
+static void fcd_ctl_accept(void)
+{
+	struct fcd_ctl_client *client;
+	unsigned i;
+	int fd;
+
+	fd = accept4(fcd_ctl_sock, NULL, NULL, SOCK_CLOEXEC | SOCK_NONBLOCK);
+	if (fd == -1) {
+		if (errno != EAGAIN && errno != EINTR && errno != ECONNABORTED)
+			FCD_PERROR("accept4");
+		return;
+	}
+
+	for (i = 0; i < FCD_CTL_MAX_CLIENTS; ++i) {
+
+		client = &fcd_ctl_clients[i];
+
+		if (client->fd == -1) {
+			client->fd = fd;
+			client->start = fcd_ctl_now();
+			client->req_len = 0;
+			return;
+		}
+	}
+
+	FCD_WARN("Too many control connections\n");
+	if (close(fd) == -1)
+		FCD_PERROR("close");
+}
+
+static void fcd_ctl_read(struct fcd_ctl_client *const client)
+{
+	ssize_t ret;
+	char *nl;
+
+	ret = read(client->fd, client->req + client->req_len,
+		   sizeof client->req - 1 - client->req_len);
+	if (ret == -1) {
+		if (errno != EAGAIN && errno != EINTR)
+			fcd_ctl_drop(client);
+		return;
+	}
+
+	client->req_len += ret;
+	client->req[client->req_len] = 0;
+
+	nl = strchr(client->req, '\n');
+	if (nl != NULL) {
+		*nl = 0;
+	}
+	else if (ret != 0 && client->req_len < sizeof client->req - 1) {
+		return;		/* wait for the rest of the request */
+	}
+
+	fcd_ctl_request(client);
+}
+
+static void fcd_ctl_write(struct fcd_ctl_client *const client)
+{
+	ssize_t ret;
+
+	ret = send(client->fd, client->resp + client->resp_pos,
+		   client->resp_len - client->resp_pos, MSG_NOSIGNAL);
+	if (ret == -1) {
+		if (errno != EAGAIN && errno != EINTR)
+			fcd_ctl_drop(client);
+		return;
+	}
+
+	client->resp_pos += ret;
+
+	if (client->resp_pos == client->resp_len)
+		fcd_ctl_drop(client);
+}
+
+/*
+ * Fills in up to FCD_CTL_POLLFDS entries for poll(); returns the number of
+ * entries.  Connections that have been open too long are dropped.
+ */
+unsigned fcd_ctl_pollfds(struct pollfd *const pfds)
+{
+	struct fcd_ctl_client *client;
+	unsigned i, n;
+	long long now;
+
+	if (fcd_ctl_sock == -1)
+		return 0;
+
+	pfds[0].fd = fcd_ctl_sock;
+	pfds[0].events = POLLIN;
+	now = fcd_ctl_now();
+
+	for (n = 1, i = 0; i < FCD_CTL_MAX_CLIENTS; ++i) {
+
+		client = &fcd_ctl_clients[i];
+
+		if (client->fd != -1 && now - client->start > FCD_CTL_TIMEOUT)
+			fcd_ctl_drop(client);
+
+		if (client->fd == -1)
+			continue;
+
+		pfds[n].fd = client->fd;
+		pfds[n].events = (client->resp != NULL) ? POLLOUT : POLLIN;
+		++n;
+	}
+
+	return n;
+}
+
+/* Handles the results of poll(); pfds & n are from fcd_ctl_pollfds() */
+void fcd_ctl_handle(const struct pollfd *const pfds, const unsigned n)
+{
+	struct fcd_ctl_client *client;
+	unsigned i, j;
+
+	for (i = 1; i < n; ++i) {
+
+		if (pfds[i].revents == 0)
+			continue;
+
+		for (j = 0; j < FCD_CTL_MAX_CLIENTS; ++j) {
+
+			client = &fcd_ctl_clients[j];
+
+			if (client->fd != pfds[i].fd)
+				continue;
+
+			if (pfds[i].revents & (POLLERR | POLLNVAL))
+				fcd_ctl_drop(client);
+			else if (client->resp != NULL)
+				fcd_ctl_write(client);
+			else
+				fcd_ctl_read(client);
+
+			break;
+		}
+	}
+
+	if (n > 0 && pfds[0].revents & POLLIN)
+		fcd_ctl_accept();
+}
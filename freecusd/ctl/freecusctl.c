@@ -0,0 +1,188 @@
+/*
+ * Copyright 2020 Ian Pilcher <arequipeno@gmail.com>
+ *
+ * This program is free software.  You can redistribute it or modify it under
+ * the terms of version 2 of the GNU General Public License (GPL), as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY -- without even the implied warranty of MERCHANTIBILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the text of the GPL for more details.
+ *
+ * Version 2 of the GNU General Public License is available at:
+ *
+ *   http://www.gnu.org/licenses/old-licenses/gpl-2.0.html
+ */
+
+/*
+ * freecusctl - query & control a running freecusd through its control socket
+ *
+ *	gcc -std=gnu99 -Os -Wall -Wextra -o freecusctl freecusctl.c
+ *
+ * Usage: freecusctl [-s SOCKET] COMMAND [ARGS...]
+ *
+ *	status [json]			monitor & fan status
+ *	config				current (effective) configuration
+ *	stats				latency histograms
+ *	poll MONITOR			make the monitor poll immediately
+ *	page MONITOR|resume		show & pin a page, or resume rotation
+ *	fan normal|high|max SECONDS	override the fan speed
+ *	fan auto			cancel the override
+ *	trend [HOURS]			sensor min/avg/max (default 24 hours)
+ *
+ * Monitor names that contain spaces can be quoted or not ("freecusctl poll
+ * SMART status").  See freecusd/ctl.c for the protocol.
+ */
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <errno.h>
+
+/* Must match the default in freecusd/main.c */
+#define FCTL_DEFAULT_PATH	"/run/freecusd.sock"
+
+#define FCTL_REQ_SIZE		256	/* FCD_CTL_REQ_SIZE in freecusd/ctl.c */
+
+static const char *fctl_name;
+
+static void fctl_usage(void)
+{
+	fprintf(stderr,
+		"Usage: %s [-s SOCKET] COMMAND [ARGS...]\n"
+		"\n"
+		"Commands:\n"
+		"  status [json]                monitor & fan status\n"
+		"  config                       current configuration\n"
+		"  stats                        latency histograms\n"
+		"  poll MONITOR                 poll a monitor immediately\n"
+		"  page MONITOR|resume          pin an LCD page, or resume "
+							"rotation\n"
+		"  fan normal|high|max SECONDS  override the fan speed\n"
+		"  fan auto                     cancel the override\n"
+		"  trend [HOURS]                sensor min/avg/max "
+							"(default 24 hours)\n",
+		fctl_name);
+	exit(EXIT_FAILURE);
+}
+
+static void fctl_write_all(const int fd, const char *buf, size_t len)
+{
+	ssize_t ret;
+
+	while (len > 0) {
+
+		ret = write(fd, buf, len);
+		if (ret == -1) {
+			if (errno == EINTR)
+				continue;
+			perror("write");
+			exit(EXIT_FAILURE);
+		}
+
+		buf += ret;
+		len -= ret;
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	char req[FCTL_REQ_SIZE], resp[4096];
+	const char *path = FCTL_DEFAULT_PATH;
+	struct sockaddr_un un;
+	size_t len, arg_len, total;
+	_Bool error;
+	ssize_t ret;
+	int i, fd;
+
+	fctl_name = argv[0];
+
+	i = 1;
+	if (argc > 2 && strcmp(argv[1], "-s") == 0) {
+		path = argv[2];
+		i = 3;
+	}
+
+	if (i >= argc || argv[i][0] == '-')
+		fctl_usage();
+
+	/* Join the remaining arguments into a single request line */
+	for (len = 0; i < argc; ++i) {
+
+		arg_len = strlen(argv[i]);
+		if (len + arg_len + 2 > sizeof req) {
+			fprintf(stderr, "%s: request too long\n", fctl_name);
+			exit(EXIT_FAILURE);
+		}
+
+		if (len != 0)
+			req[len++] = ' ';
+
+		memcpy(req + len, argv[i], arg_len);
+		len += arg_len;
+	}
+
+	req[len++] = '\n';
+
+	if (strlen(path) >= sizeof un.sun_path) {
+		fprintf(stderr, "%s: socket path too long: %s\n", fctl_name, path);
+		exit(EXIT_FAILURE);
+	}
+
+	memset(&un, 0, sizeof un);
+	un.sun_family = AF_UNIX;
+	strcpy(un.sun_path, path);
+
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd == -1) {
+		perror("socket");
+		exit(EXIT_FAILURE);
+	}
+
+	if (connect(fd, (struct sockaddr *)&un, sizeof un) == -1) {
+		perror(path);
+		exit(EXIT_FAILURE);
+	}
+
+	fctl_write_all(fd, req, len);
+
+	if (shutdown(fd, SHUT_WR) == -1) {
+		perror("shutdown");
+		exit(EXIT_FAILURE);
+	}
+
+	/* A response that begins with "error: " goes to stderr */
+	for (error = 0, total = 0; ; total += ret) {
+
+		ret = read(fd, resp, sizeof resp);
+		if (ret == -1) {
+			if (errno == EINTR) {
+				ret = 0;
+				continue;
+			}
+			perror("read");
+			exit(EXIT_FAILURE);
+		}
+
+		if (ret == 0)
+			break;
+
+		if (total == 0)
+			error = (ret >= 7 && memcmp(resp, "error: ", 7) == 0);
+
+		fwrite(resp, 1, ret, error ? stderr : stdout);
+	}
+
+	if (close(fd) == -1)
+		perror("close");
+
+	if (total == 0) {
+		fprintf(stderr, "%s: no response from freecusd\n", fctl_name);
+		exit(EXIT_FAILURE);
+	}
+
+	return error ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -1,5 +1,5 @@
 /*
- * Copyright 2014 Ian Pilcher <arequipeno@gmail.com>
+ * Copyright 2014, 2020 Ian Pilcher <arequipeno@gmail.com>
  *
  * This program is free software.  You can redistribute it or modify it under
  * the terms of version 2 of the GNU General Public License (GPL), as published
@@ -16,12 +16,62 @@
 
 #include "freecusd.h"
 
+#include <linux/netlink.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <limits.h>
 #include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <glob.h>
 
-static const char fcd_disk_glob[] =	"/sys/devices/pci0000:00/0000:00:1f.2/"
-					"ata[0-9]/host[0-9]/target[0-9]:0:0/"
-					"[0-9]:0:0:0/block/sd[a-z]";
+/*
+ * DISK POSITIONS
+ *
+ * Disks attached to ports 2-6 of the N5550's ICH10R SATA controller are in its
+ * internal bays -- positions 1 - FCD_BAY_COUNT.  (The DOM is on port 1.)  The
+ * sysfs path of such a disk looks like:
+ *
+ * /sys/devices/pci0000:00/0000:00:1f.2/ata4/host3/target3:0:0/3:0:0:0/block/sdb
+ *
+ * and its port number is read from:
+ *
+ * /sys/devices/pci0000:00/0000:00:1f.2/ata4/ata_port/ata4/port_no
+ *
+ * Any other SCSI disk (other than a USB disk) is assumed to be in an expansion
+ * enclosure (eSATA, SAS, etc.).  Expansion disks are sorted by sysfs path (so
+ * by controller, port/host and target) and numbered from FCD_BAY_COUNT + 1,
+ * so their positions can change when a disk "ahead" of them is added or
+ * removed.  An expansion disk is only treated as a RAID disk (for array
+ * alerts) if it's a member of an array; see fcd_raid_is_member().
+ */
+
+/*
+ * DISK IDENTITY
+ *
+ * A position can be taken over by a different disk -- a disk is replaced, or
+ * an expansion disk moves up when one ahead of it is removed.  Anything that's
+ * kept by position across such changes (RAID member status, sensor history)
+ * must be reset when that happens, so each disk also has an identity: a hash of
+ * its world-wide identifier (/sys/block/sdX/device/wwid), or of its sysfs
+ * device path if the kernel doesn't provide one.
+ */
+
+#define FCD_DISK_WWID_SIZE	256
+
+static const char fcd_disk_glob[] = "/sys/block/sd*";
+static const char fcd_disk_ich10r[] = "/sys/devices/pci0000:00/0000:00:1f.2/";
+
+#define FCD_DISK_PORT_FILE_SIZE	(sizeof fcd_disk_ich10r \
+					+ sizeof "ata4294967295/ata_port/" \
+					+ sizeof "ata4294967295/port_no")
+
+/* A disk found by fcd_disk_detect(), before expansion disks are numbered */
+struct fcd_disk_found {
+	char *path;		/* sysfs device path */
+	unsigned pos;		/* 0 = expansion disk */
+};
 
 static int fcd_disk_glob_errfn(const char *epath, int eerrno)
 {
@@ -30,41 +80,176 @@ static int fcd_disk_glob_errfn(const char *epath, int eerrno)
 }
 
 /*
- * SYSFS PATH "MAGIC NUMBERS"
- *
- * sysfs paths for disks attached to the ICH10R SATA controller look like:
- *
- * /sys/devices/pci0000:00/0000:00:1f.2/ata4/host3/target3:0:0/3:0:0:0/block/sdb
- * ^         ^         ^         ^         ^         ^         ^         ^   ^
- * |         |         |         |         |         |         |         |   |
- * 0         1         2         3         4         5         6         7   7
- * 0         0         0         0         0         0         0         0   4
- *
- * Port number is read from:
- *
- * /sys/devices/pci0000:00/0000:00:1f.2/ata4/ata_port/ata4/port_no
- * ^         ^         ^         ^      ^  ^ ^       ^^    ^   ^
- * |         |         |         |      |  | |       ||    |   |
- * 0         1         2         3      3  4 4       55    5   6
- * 0         0         0         0      7  0 2       01    6   0
+ * Returns the position of a disk in one of the internal bays (1 -
+ * FCD_BAY_COUNT), 0 for an expansion disk, -1 if the disk isn't a RAID disk
+ * (the DOM, a USB disk, etc.), or -2 on error.  See DISK POSITIONS comment
+ * above.
  */
+static int fcd_disk_position(const char *const path)
+{
+	char port_file[FCD_DISK_PORT_FILE_SIZE];
+	unsigned ata, port_no;
+	FILE *fp;
+	int ret;
+
+	if (strncmp(path, fcd_disk_ich10r, sizeof fcd_disk_ich10r - 1) != 0)
+		return (strstr(path, "/usb") != NULL) ? -1 : 0;
+
+	if (sscanf(path + sizeof fcd_disk_ich10r - 1, "ata%u/", &ata) != 1) {
+		FCD_WARN("Unexpected ICH10R disk path: %s\n", path);
+		return -1;
+	}
+
+	sprintf(port_file, "%sata%u/ata_port/ata%u/port_no",
+		fcd_disk_ich10r, ata, ata);
+
+	fp = fcd_lib_fopen(port_file, "re");
+	if (fp == NULL) {
+		FCD_PERROR(port_file);
+		return -2;
+	}
+
+	ret = fscanf(fp, "%u\n", &port_no);
+
+	if (ret == EOF) {
+		if (ferror(fp))
+			FCD_PERROR(port_file);
+		else
+			FCD_ERR("%s: Unexpected end of file\n", port_file);
+		goto error_close_fp;
+	}
+
+	if (ret != 1) {
+		FCD_ERR("%s: Unexpected match count: %d\n", port_file, ret);
+		goto error_close_fp;
+	}
+
+	if (fclose(fp) != 0) {
+		FCD_PERROR(port_file);
+		return -2;
+	}
+
+	if (port_no < 2 || port_no > FCD_BAY_COUNT + 1)
+		return -1;
+
+	return port_no - 1;
+
+error_close_fp:
+	if (fclose(fp) != 0)
+		FCD_PERROR(port_file);
+	return -2;
+}
+
+/* 64-bit FNV-1a */
+static uint64_t fcd_disk_hash(const char *const s, const size_t len)
+{
+	uint64_t hash;
+	size_t i;
+
+	for (hash = 0xcbf29ce484222325ULL, i = 0; i < len; ++i) {
+		hash ^= (unsigned char)s[i];
+		hash *= 0x100000001b3ULL;
+	}
+
+	return hash;
+}
+
+/* See DISK IDENTITY comment above */
+static uint64_t fcd_disk_id(const char *const path, const char *const name)
+{
+	char wwid_path[sizeof "/sys/block//device/wwid" + FCD_DISK_DEV_SIZE];
+	char wwid[FCD_DISK_WWID_SIZE];
+	const char *block;
+	ssize_t len;
+	int fd;
+
+	sprintf(wwid_path, "/sys/block/%s/device/wwid", name);
+
+	fd = fcd_lib_open(wwid_path, O_RDONLY | O_CLOEXEC);
+	if (fd == -1) {
+		if (errno != ENOENT)
+			FCD_PERROR(wwid_path);
+	}
+	else {
+		len = read(fd, wwid, sizeof wwid);
+		if (len == -1)
+			FCD_PERROR(wwid_path);
+
+		if (close(fd) == -1)
+			FCD_PERROR("close");
+
+		while (len > 0 && isspace((unsigned char)wwid[len - 1]))
+			--len;
+
+		if (len > 0)
+			return fcd_disk_hash(wwid, len);
+	}
+
+	/* Device path, without the (changeable) name of the block device */
+	block = strstr(path, "/block/");
+
+	return fcd_disk_hash(path, (block != NULL) ? (size_t)(block - path)
+						   : strlen(path));
+}
+
+/*
+ * Removes the fake root (if any) from the beginning of a resolved sysfs path, so
+ * that it can be matched against fcd_disk_ich10r.
+ */
+static void fcd_disk_strip_root(char *const path)
+{
+	size_t len;
+
+	if (fcd_lib_root == NULL)
+		return;
+
+	len = strlen(fcd_lib_root);
+
+	if (strncmp(path, fcd_lib_root, len) == 0 && path[len] == '/')
+		memmove(path, path + len, strlen(path + len) + 1);
+}
+
+/* Internal bays (by position), followed by expansion disks (by path) */
+static int fcd_disk_cmp(const void *const a, const void *const b)
+{
+	const struct fcd_disk_found *const x = a, *const y = b;
+
+	if (x->pos == 0 && y->pos == 0)
+		return strverscmp(x->path, y->path);
+
+	if (x->pos == 0)
+		return 1;
+
+	if (y->pos == 0)
+		return -1;
+
+	return (x->pos > y->pos) - (x->pos < y->pos);
+}
 
 /*
- * Populates fcd_conf_disks (name and port_no) with disks connected to ports
- * 2-6 of the ICH10R SATA controller.  Returns number of disks detected, which
- * may be 0; -1 on error.
+ * Sets *disks to a newly allocated array of the RAID disks (names and
+ * positions), sorted by position.  (*disks is NULL if no disks are found.)
+ * Returns number of disks detected, which may be 0; -1 on error.
  */
-int fcd_disk_detect(void)
+int fcd_disk_detect(struct fcd_raid_disk **const disks)
 {
+	struct fcd_disk_found *found;
+	char pattern[PATH_MAX];
+	unsigned count, next, i;
+	const char *name;
 	glob_t disk_glob;
-	unsigned port_no;
-	int count, ret;
 	char *path;
-	FILE *fp;
-	size_t i;
+	int ret;
 
-	ret = glob(fcd_disk_glob, GLOB_NOSORT | GLOB_ONLYDIR,
-		   fcd_disk_glob_errfn, &disk_glob);
+	*disks = NULL;
+
+	name = fcd_lib_path(pattern, fcd_disk_glob);
+	if (name == NULL) {
+		FCD_PERROR(fcd_disk_glob);
+		return -1;
+	}
+
+	ret = glob(name, GLOB_NOSORT, fcd_disk_glob_errfn, &disk_glob);
 
 	if (ret == GLOB_NOMATCH)
 		return 0;
@@ -81,56 +266,354 @@ int fcd_disk_detect(void)
 		return -1;
 	}
 
+	found = calloc(disk_glob.gl_pathc, sizeof *found);
+	if (found == NULL) {
+		FCD_PERROR("calloc");
+		globfree(&disk_glob);
+		return -1;
+	}
+
 	for (count = 0, i = 0; i < disk_glob.gl_pathc; ++i) {
 
-		path = disk_glob.gl_pathv[i];
+		path = realpath(disk_glob.gl_pathv[i], NULL);
+		if (path == NULL) {
+			if (errno == ENOENT)	/* removed since glob() */
+				continue;
+			FCD_PERROR(disk_glob.gl_pathv[i]);
+			goto error;
+		}
 
-		/* See SYSFS PATH "MAGIC NUMBERS" comment above */
-		memcpy(path + 42, "ata_port/", sizeof "ata_port/" - 1);
-		memcpy(path + 51, path + 37, 5);
-		memcpy(path + 56, "port_no", sizeof "port_no");
+		fcd_disk_strip_root(path);
 
-		fp = fopen(path, "re");
-		if (fp == NULL) {
-			FCD_PERROR(path);
-			goto error_free_glob;
+		ret = fcd_disk_position(path);
+		if (ret == -2) {
+			free(path);
+			goto error;
+		}
+		if (ret == -1) {
+			free(path);
+			continue;
 		}
 
-		ret = fscanf(fp, "%u\n", &port_no);
+		name = strrchr(path, '/') + 1;
+		if (strlen(name) >= FCD_DISK_DEV_SIZE) {
+			FCD_WARN("Disk name too long: %s\n", name);
+			free(path);
+			continue;
+		}
 
-		if (ret == EOF) {
-			if (ferror(fp))
-				FCD_PERROR(path);
-			else
-				FCD_ERR("%s: Unexpected end of file\n",	path);
-			goto error_close_fp;
+		found[count].path = path;
+		found[count].pos = ret;
+		++count;
+	}
+
+	qsort(found, count, sizeof *found, fcd_disk_cmp);
+
+	if (count > 0) {
+		*disks = malloc(count * sizeof **disks);
+		if (*disks == NULL) {
+			FCD_PERROR("malloc");
+			goto error;
 		}
+	}
+
+	for (ret = 0, next = FCD_BAY_COUNT + 1, i = 0; i < count; ++i) {
+
+		name = strrchr(found[i].path, '/') + 1;
 
-		if (ret != 1) {
-			FCD_ERR("%s: Unexpected match count: %d\n", path, ret);
-			goto error_close_fp;
+		if (found[i].pos == 0) {
+
+			if (next > FCD_MAX_DISK_POS) {
+				FCD_WARN("Too many disks; ignoring %s\n", name);
+				continue;
+			}
+
+			found[i].pos = next++;
 		}
 
-		if (fclose(fp) != 0) {
-			FCD_PERROR(path);
-			goto error_free_glob;
+		(*disks)[ret].pos = found[i].pos;
+		(*disks)[ret].id = fcd_disk_id(found[i].path, name);
+		sprintf((*disks)[ret].name, "/dev/%s", name);
+		++ret;
+	}
+
+	goto done;
+
+error:
+	ret = -1;
+done:
+	for (i = 0; i < count; ++i)
+		free(found[i].path);
+	free(found);
+	globfree(&disk_glob);
+	return ret;
+}
+
+/*******************************************************************************
+ *
+ * Hotplug
+ *
+ ******************************************************************************/
+
+/*
+ * When the kernel reports that a disk has been added or removed, the disks are
+ * re-detected (in the main thread) and the new list is published with
+ * fcd_conf_set_disks().  Monitor threads pick it up when they next wake.
+ *
+ * For testing, uevents can be read from a Unix datagram socket (freecusd -u
+ * PATH) instead of the kernel.  Messages use the kernel format -- a header
+ * ("ACTION@DEVPATH") followed by KEY=VALUE pairs, each terminated by a NUL.
+ * For example:
+ *
+ *	printf 'add@/block/sdb\0ACTION=add\0SUBSYSTEM=block\0DEVTYPE=disk\0' \
+ *		| socat -u - UNIX-SENDTO:PATH
+ */
+
+#define FCD_DISK_UEVENT_SIZE	8192
+
+static int fcd_disk_hotplug_sock = -1;
+static const char *fcd_disk_hotplug_path;	/* NULL = kernel */
+
+static int fcd_disk_hotplug_socket(const char *const path)
+{
+	struct sockaddr_nl nl;
+	struct sockaddr_un un;
+	int fd;
+
+	if (path == NULL) {
+
+		fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC | SOCK_NONBLOCK,
+			    NETLINK_KOBJECT_UEVENT);
+		if (fd == -1) {
+			FCD_PERROR("socket");
+			return -1;
 		}
 
-		if (port_no < 2 || port_no > 6)
-			continue;
+		memset(&nl, 0, sizeof nl);
+		nl.nl_family = AF_NETLINK;
+		nl.nl_groups = 1;	/* kernel uevents (not udev) */
 
-		sprintf(fcd_conf_disks[count].name, "/dev/%s", path + 74);
-		fcd_conf_disks[count].port_no = port_no;
-		++count;
+		if (bind(fd, (struct sockaddr *)&nl, sizeof nl) == -1) {
+			FCD_PERROR("bind");
+			goto error;
+		}
+
+		return fd;
 	}
 
-	globfree(&disk_glob);
-	return count;
+	if (strlen(path) >= sizeof un.sun_path) {
+		FCD_ERR("Uevent socket path too long: %s\n", path);
+		return -1;
+	}
 
-error_close_fp:
-	if (fclose(fp) != 0)
+	fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+	if (fd == -1) {
+		FCD_PERROR("socket");
+		return -1;
+	}
+
+	memset(&un, 0, sizeof un);
+	un.sun_family = AF_UNIX;
+	strcpy(un.sun_path, path);
+
+	if (unlink(path) == -1 && errno != ENOENT)
 		FCD_PERROR(path);
-error_free_glob:
-	globfree(&disk_glob);
+
+	if (bind(fd, (struct sockaddr *)&un, sizeof un) == -1) {
+		FCD_PERROR(path);
+		goto error;
+	}
+
+	return fd;
+
+error:
+	if (close(fd) == -1)
+		FCD_PERROR("close");
 	return -1;
 }
+
+/*
+ * Called in the main thread at startup.  Failure isn't fatal; disks just
+ * won't be re-detected.
+ */
+void fcd_disk_hotplug_open(const char *const path)
+{
+	fcd_disk_hotplug_path = path;
+	fcd_disk_hotplug_sock = fcd_disk_hotplug_socket(path);
+
+	if (fcd_disk_hotplug_sock == -1)
+		FCD_WARN("Disk hotplug detection disabled\n");
+	else if (path != NULL)
+		FCD_INFO("Reading uevents from %s\n", path);
+}
+
+/* For poll(); -1 (ignored by poll) if hotplug detection is disabled */
+int fcd_disk_hotplug_fd(void)
+{
+	return fcd_disk_hotplug_sock;
+}
+
+void fcd_disk_hotplug_close(void)
+{
+	if (fcd_disk_hotplug_sock == -1)
+		return;
+
+	if (close(fcd_disk_hotplug_sock) == -1)
+		FCD_PERROR("close");
+
+	if (fcd_disk_hotplug_path != NULL && unlink(fcd_disk_hotplug_path) == -1)
+		FCD_PERROR(fcd_disk_hotplug_path);
+
+	fcd_disk_hotplug_sock = -1;
+}
+
+/*
+ * Returns 1 if the uevent (which must be NUL-terminated at buf[len]) reports
+ * that a disk has been added or removed.
+ */
+static _Bool fcd_disk_uevent_match(const char *const buf, const size_t len)
+{
+	_Bool block, disk, action;
+	const char *p;
+
+	block = disk = action = 0;
+
+	for (p = buf; p < buf + len; p += strlen(p) + 1) {
+
+		if (strcmp(p, "SUBSYSTEM=block") == 0)
+			block = 1;
+		else if (strcmp(p, "DEVTYPE=disk") == 0)
+			disk = 1;
+		else if (strcmp(p, "ACTION=add") == 0
+				|| strcmp(p, "ACTION=remove") == 0)
+			action = 1;
+	}
+
+	return block && disk && action;
+}
+
+static const struct fcd_raid_disk *fcd_disk_find(
+				const struct fcd_raid_disk *const disks,
+				const unsigned count, const unsigned pos)
+{
+	unsigned i;
+
+	for (i = 0; i < count; ++i) {
+		if (disks[i].pos == pos)
+			return &disks[i];
+	}
+
+	return NULL;
+}
+
+/*
+ * Logs the disks in a that aren't (by position, name & identity) in b.  Returns
+ * 1 if there are any.
+ */
+static _Bool fcd_disk_diff(const struct fcd_raid_disk *const a,
+			   const unsigned a_count,
+			   const struct fcd_raid_disk *const b,
+			   const unsigned b_count, const _Bool added)
+{
+	const struct fcd_raid_disk *other;
+	_Bool changed;
+	unsigned i;
+
+	for (changed = 0, i = 0; i < a_count; ++i) {
+
+		other = fcd_disk_find(b, b_count, a[i].pos);
+		if (other != NULL && strcmp(a[i].name, other->name) == 0
+				&& a[i].id == other->id) {
+			continue;
+		}
+
+		if (added)
+			FCD_INFO("RAID disk %u (%s) added\n", a[i].pos, a[i].name);
+		else
+			FCD_WARN("RAID disk %u (%s) removed\n", a[i].pos, a[i].name);
+
+		changed = 1;
+	}
+
+	return changed;
+}
+
+/*
+ * Re-detects the RAID disks, logs any changes, and publishes the new list if
+ * anything has changed.
+ */
+static void fcd_disk_rescan(void)
+{
+	struct fcd_raid_disk *disks;
+	_Bool changed;
+	int count;
+
+	count = fcd_disk_detect(&disks);
+	if (count == -1) {
+		FCD_WARN("Failed to re-detect RAID disks\n");
+		return;
+	}
+
+	changed = fcd_disk_diff(fcd_cfg->disks, fcd_cfg->disk_count,
+				disks, count, 0);
+	changed |= fcd_disk_diff(disks, count, fcd_cfg->disks,
+				 fcd_cfg->disk_count, 1);
+
+	if (changed)
+		fcd_conf_set_disks(disks, count);
+	else
+		free(disks);
+}
+
+/*
+ * Called in the main thread when the socket is readable.  Reads all pending
+ * uevents, and re-detects the disks (once) if any of them is relevant.
+ */
+void fcd_disk_hotplug_read(void)
+{
+	static char buf[FCD_DISK_UEVENT_SIZE + 1];
+
+	struct sockaddr_storage addr;
+	socklen_t addr_len;
+	_Bool rescan;
+	ssize_t len;
+
+	rescan = 0;
+
+	while (1) {
+
+		addr_len = sizeof addr;
+		len = recvfrom(fcd_disk_hotplug_sock, buf, sizeof buf - 1, 0,
+			       (struct sockaddr *)&addr, &addr_len);
+		if (len == -1) {
+
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				break;
+
+			if (errno == EINTR)
+				continue;
+
+			/* Socket buffer overflowed; events were lost */
+			if (errno == ENOBUFS) {
+				rescan = 1;
+				continue;
+			}
+
+			FCD_PERROR("recvfrom");
+			break;
+		}
+
+		/* Only trust uevents that come from the kernel */
+		if (fcd_disk_hotplug_path == NULL
+				&& ((struct sockaddr_nl *)&addr)->nl_pid != 0)
+			continue;
+
+		buf[len] = 0;
+
+		if (fcd_disk_uevent_match(buf, len))
+			rescan = 1;
+	}
+
+	if (rescan)
+		fcd_disk_rescan();
+}
@@ -20,6 +20,9 @@
 #include <stdarg.h>
 #include <string.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
 
 int fcd_err_child_errfd = STDERR_FILENO;
 _Bool fcd_err_foreground = 0;
@@ -31,17 +34,431 @@ static const char *const fcd_err_severities[] = {
 	"ABORT",
 };
 
-void fcd_err_vmsg(const int priority, const char *const format, va_list ap)
+/*******************************************************************************
+ *
+ * Rate limiting
+ *
+ ******************************************************************************/
+
+/*
+ * Each FCD_ERR, FCD_WARN, FCD_INFO, and FCD_PERROR call site has its own token
+ * bucket, which holds up to log_rate_burst tokens and gains a token every
+ * log_rate_interval seconds.  A message is only logged if a token is
+ * available; otherwise it is counted, and the count is logged (as
+ * "suppressed N similar messages") before the next message from the same call
+ * site.  (DEBUG, DUMP, FATAL, and ABORT messages are never suppressed.)
+ */
+
+/*
+ * Copied from struct fcd_conf by fcd_err_conf_apply(), because the limits
+ * also apply to threads that don't hold a reference to the configuration.
+ * Protected by fcd_err_limit_mutex (but fcd_err_burst is also read without it,
+ * to check whether rate limiting is enabled at all).
+ */
+static int fcd_err_burst = 10;		/* log_rate_burst; 0 = no limit */
+static int fcd_err_interval = 600;	/* log_rate_interval (seconds) */
+
+static int fcd_err_limit_cb();
+
+const cip_opt_info fcd_err_opts[] = {
+	{
+		.name			= "log_rate_burst",
+		.type			= CIP_OPT_TYPE_INT,
+		.post_parse_fn		= fcd_err_limit_cb,
+		.post_parse_data	= FCD_CONF_OFFSET(log_burst),
+	},
+	{
+		.name			= "log_rate_interval",
+		.type			= CIP_OPT_TYPE_INT,
+		.post_parse_fn		= fcd_err_limit_cb,
+		.post_parse_data	= FCD_CONF_OFFSET(log_interval),
+	},
+	{
+		.name			= NULL
+	}
+};
+
+/* Protects all of the per-call-site buckets */
+static pthread_mutex_t fcd_err_limit_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static int fcd_err_limit_cb(cip_err_ctx *ctx, const cip_ini_value *value,
+			    const cip_ini_sect *sect __attribute__((unused)),
+			    const cip_ini_file *file __attribute__((unused)),
+			    void *post_parse_data)
+{
+	const int *p;
+	int min, max;
+
+	p = (const int *)(value->value);
+
+	if (post_parse_data == FCD_CONF_OFFSET(log_burst)) {
+		min = 0;
+		max = 1000;
+	}
+	else {
+		min = 1;
+		max = 86400;
+	}
+
+	if (*p < min || *p > max) {
+		cip_err(ctx, "Log rate limit (%d) outside valid range (%d - %d)",
+			*p, min, max);
+		return -1;
+	}
+
+	*(int *)fcd_conf_member(post_parse_data) = *p;
+
+	return 0;
+}
+
+/*
+ * Called after the configuration has been (re)loaded
+ */
+void fcd_err_conf_apply(const struct fcd_conf *const cfg)
+{
+	int ret;
+
+	ret = pthread_mutex_lock(&fcd_err_limit_mutex);
+	if (ret != 0)
+		FCD_PT_ABRT("pthread_mutex_lock", ret);
+
+	__atomic_store_n(&fcd_err_burst, cfg->log_burst, __ATOMIC_RELAXED);
+	fcd_err_interval = cfg->log_interval;
+
+	ret = pthread_mutex_unlock(&fcd_err_limit_mutex);
+	if (ret != 0)
+		FCD_PT_ABRT("pthread_mutex_unlock", ret);
+}
+
+/*
+ * Returns 1 if the message should be logged.  Preserves errno (for
+ * FCD_PERROR).
+ */
+_Bool fcd_err_limit(struct fcd_err_limit *const limit, const int priority)
+{
+	unsigned long suppressed;
+	struct timespec ts;
+	long long now, interval, tokens;
+	_Bool allowed;
+	int ret, err;
+
+	if (__atomic_load_n(&fcd_err_burst, __ATOMIC_RELAXED) == 0)
+		return 1;
+
+	err = errno;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) == -1) {
+		errno = err;
+		return 1;
+	}
+
+	now = ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+
+	ret = pthread_mutex_lock(&fcd_err_limit_mutex);
+	if (ret != 0)
+		FCD_PT_ABRT("pthread_mutex_lock", ret);
+
+	interval = fcd_err_interval * 1000LL;
+
+	if (!limit->started) {
+		limit->tokens = fcd_err_burst;
+		limit->refill = now;
+		limit->started = 1;
+	}
+
+	tokens = limit->tokens + (now - limit->refill) / interval;
+	if (tokens >= fcd_err_burst) {
+		limit->tokens = fcd_err_burst;
+		limit->refill = now;
+	}
+	else {
+		limit->refill += (tokens - limit->tokens) * interval;
+		limit->tokens = tokens;
+	}
+
+	suppressed = 0;
+
+	if (limit->tokens > 0) {
+		--(limit->tokens);
+		suppressed = limit->suppressed;
+		limit->suppressed = 0;
+		allowed = 1;
+	}
+	else {
+		++(limit->suppressed);
+		allowed = 0;
+	}
+
+	ret = pthread_mutex_unlock(&fcd_err_limit_mutex);
+	if (ret != 0)
+		FCD_PT_ABRT("pthread_mutex_unlock", ret);
+
+	if (suppressed != 0) {
+		fcd_err_msg(priority, "%s: suppressed %lu similar messages\n",
+			    limit->site, suppressed);
+	}
+
+	errno = err;
+	return allowed;
+}
+
+void fcd_err_dump_cfg(void)
+{
+	FCD_DUMP("Log rate limit configuration:\n");
+	FCD_DUMP("\tburst: %d messages\n", fcd_cfg->log_burst);
+	FCD_DUMP("\tinterval: %d seconds\n", fcd_cfg->log_interval);
+	FCD_DUMP("\n");
+}
+
+/*******************************************************************************
+ *
+ * Asynchronous logging
+ *
+ ******************************************************************************/
+
+/*
+ * Once the logger thread has been started, messages are formatted into a ring
+ * buffer by the thread that logs them and written to syslog (or stderr) by the
+ * logger thread, so a stalled syslog daemon can't stall the main thread (fan
+ * control, etc.) or the monitors.
+ *
+ * Any number of threads can add messages (without locking); a thread claims a
+ * slot by advancing fcd_err_head, formats its message, and then sets the
+ * slot's sequence number to mark it ready.  If the buffer is full, the
+ * message is counted as dropped.  FATAL and ABORT messages (and everything
+ * logged before the logger thread starts or after it stops) are written
+ * directly.
+ *
+ * Slot i is free for the producer that claims position p (p % RING_SIZE == i)
+ * when its sequence number is p, and ready for the logger thread when its
+ * sequence number is p + 1.
+ */
+
+#define FCD_ERR_RING_SIZE	128	/* must be a power of 2 */
+#define FCD_ERR_MSG_SIZE	256
+
+struct fcd_err_slot {
+	unsigned long seq;
+	int priority;
+	char msg[FCD_ERR_MSG_SIZE];
+};
+
+static struct fcd_err_slot fcd_err_ring[FCD_ERR_RING_SIZE];
+static unsigned long fcd_err_head;	/* next position to be claimed */
+static unsigned long fcd_err_tail;	/* next position to be logged */
+static unsigned long fcd_err_dropped;
+static int fcd_err_async;		/* logger thread is running */
+static int fcd_err_sleeping;		/* logger thread is (about to be) idle */
+static int fcd_err_wake_pipe[2];
+
+static void fcd_err_write(const int priority, const char *const msg)
+{
+	if (fcd_err_foreground)
+		fputs(msg, stderr);
+	else
+		syslog(priority, "%s", msg);
+}
+
+static void fcd_err_vwrite(const int priority, const char *const format,
+			   va_list ap)
+{
+	if (fcd_err_foreground)
+		vfprintf(stderr, format, ap);
+	else
+		vsyslog(priority, format, ap);
+}
+
+/*
+ * Returns 0 if the message was queued, -1 if the buffer is full.
+ */
+static int fcd_err_enqueue(const int priority, const char *const format,
+			   va_list ap)
+{
+	struct fcd_err_slot *slot;
+	unsigned long pos, seq;
+	int len, err;
+
+	pos = __atomic_load_n(&fcd_err_head, __ATOMIC_RELAXED);
+
+	while (1) {
+
+		slot = &fcd_err_ring[pos % FCD_ERR_RING_SIZE];
+		seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+
+		if (seq == pos) {
+			/* Slot is free; claim it (or reload pos and retry) */
+			if (__atomic_compare_exchange_n(&fcd_err_head, &pos,
+							pos + 1, 1,
+							__ATOMIC_RELAXED,
+							__ATOMIC_RELAXED)) {
+				break;
+			}
+		}
+		else if ((long)(seq - pos) < 0) {
+			/* Slot still holds a message from the last lap */
+			__atomic_add_fetch(&fcd_err_dropped, 1,
+					   __ATOMIC_RELAXED);
+			return -1;
+		}
+		else {
+			/* Another thread claimed this position */
+			pos = __atomic_load_n(&fcd_err_head, __ATOMIC_RELAXED);
+		}
+	}
+
+	slot->priority = priority;
+	len = vsnprintf(slot->msg, sizeof slot->msg, format, ap);
+	if (len >= (int)sizeof slot->msg)
+		slot->msg[sizeof slot->msg - 2] = '\n';
+
+	__atomic_store_n(&slot->seq, pos + 1, __ATOMIC_SEQ_CST);
+
+	if (__atomic_exchange_n(&fcd_err_sleeping, 0, __ATOMIC_SEQ_CST)) {
+		/* Non-blocking; if the pipe is full, the logger is awake */
+		err = errno;
+		if (write(fcd_err_wake_pipe[1], "", 1) == -1)
+			errno = err;
+	}
+
+	return 0;
+}
+
+/* Logger thread only */
+static _Bool fcd_err_ready(void)
+{
+	const struct fcd_err_slot *slot;
+
+	slot = &fcd_err_ring[fcd_err_tail % FCD_ERR_RING_SIZE];
+
+	return __atomic_load_n(&slot->seq, __ATOMIC_SEQ_CST)
+							== fcd_err_tail + 1;
+}
+
+/* Logger thread only; writes all ready messages */
+static void fcd_err_drain(void)
 {
-	if (priority != LOG_DEBUG || fcd_err_debug) {
+	struct fcd_err_slot *slot;
+	unsigned long dropped;
+
+	while (fcd_err_ready()) {
+
+		slot = &fcd_err_ring[fcd_err_tail % FCD_ERR_RING_SIZE];
+		fcd_err_write(slot->priority, slot->msg);
+		__atomic_store_n(&slot->seq, fcd_err_tail + FCD_ERR_RING_SIZE,
+				 __ATOMIC_RELEASE);
+		++fcd_err_tail;
+	}
 
-		if (fcd_err_foreground)
-			vfprintf(stderr, format, ap);
-		else
-			vsyslog(priority, format, ap);
+	dropped = __atomic_exchange_n(&fcd_err_dropped, 0, __ATOMIC_RELAXED);
+	if (dropped != 0) {
+		fcd_err_msg_sync(LOG_WARNING, "WARNING: " __FILE__ ":"
+				 FCD_STRINGIFY(__LINE__) ": Log buffer full; "
+				 "%lu messages dropped\n", dropped);
 	}
 }
 
+/*
+ * Don't fork() while another thread holds the rate limiting mutex.  (A fork()ed
+ * child has no logger thread.)
+ */
+static void fcd_err_atfork_prepare(void)
+{
+	int ret;
+
+	ret = pthread_mutex_lock(&fcd_err_limit_mutex);
+	if (ret != 0)
+		FCD_PT_ABRT("pthread_mutex_lock", ret);
+}
+
+static void fcd_err_atfork_parent(void)
+{
+	int ret;
+
+	ret = pthread_mutex_unlock(&fcd_err_limit_mutex);
+	if (ret != 0)
+		FCD_PT_ABRT("pthread_mutex_unlock", ret);
+}
+
+static void fcd_err_atfork_child(void)
+{
+	fcd_err_async = 0;
+	fcd_err_atfork_parent();
+}
+
+/*
+ * Called in the main thread before the logger thread is created
+ */
+void fcd_err_log_init(void)
+{
+	unsigned long i;
+	int ret;
+
+	for (i = 0; i < FCD_ERR_RING_SIZE; ++i)
+		fcd_err_ring[i].seq = i;
+
+	if (pipe2(fcd_err_wake_pipe, O_NONBLOCK | O_CLOEXEC) == -1)
+		FCD_PABORT("pipe2");
+
+	ret = pthread_atfork(fcd_err_atfork_prepare, fcd_err_atfork_parent,
+			     fcd_err_atfork_child);
+	if (ret != 0)
+		FCD_PT_ABRT("pthread_atfork", ret);
+
+	__atomic_store_n(&fcd_err_async, 1, __ATOMIC_SEQ_CST);
+}
+
+__attribute__((noreturn))
+void *fcd_err_log_fn(void *arg __attribute__((unused)))
+{
+	struct pollfd pfd;
+	char buf[32];
+
+	pfd.fd = fcd_err_wake_pipe[0];
+	pfd.events = POLLIN;
+
+	while (!fcd_thread_exit_flag) {
+
+		fcd_err_drain();
+
+		__atomic_store_n(&fcd_err_sleeping, 1, __ATOMIC_SEQ_CST);
+		if (fcd_err_ready()) {
+			__atomic_store_n(&fcd_err_sleeping, 0,
+					 __ATOMIC_SEQ_CST);
+			continue;
+		}
+
+		if (ppoll(&pfd, 1, NULL, &fcd_mon_ppoll_sigmask) == -1) {
+			if (errno == EINTR)
+				continue;
+			FCD_PABORT("ppoll");
+		}
+
+		while (read(fcd_err_wake_pipe[0], buf, sizeof buf) > 0);
+	}
+
+	/* Anything logged from now on is written directly */
+	__atomic_store_n(&fcd_err_async, 0, __ATOMIC_SEQ_CST);
+	fcd_err_drain();
+
+	if (close(fcd_err_wake_pipe[0]) == -1)
+		FCD_PERROR("close");
+	if (close(fcd_err_wake_pipe[1]) == -1)
+		FCD_PERROR("close");
+
+	pthread_exit(NULL);
+}
+
+void fcd_err_vmsg(const int priority, const char *const format, va_list ap)
+{
+	if (priority == LOG_DEBUG && !fcd_err_debug)
+		return;
+
+	if (__atomic_load_n(&fcd_err_async, __ATOMIC_SEQ_CST))
+		fcd_err_enqueue(priority, format, ap);
+	else
+		fcd_err_vwrite(priority, format, ap);
+}
+
 void fcd_err_msg(int priority, const char *format, ...)
 {
 	va_list ap;
@@ -51,17 +468,46 @@ void fcd_err_msg(int priority, const char *format, ...)
 	va_end(ap);
 }
 
+/* If set, FCD_DUMP output goes here, rather than the log; see ctl.c */
+__thread FILE *fcd_err_dump_stream;
+
+void fcd_err_dump(const char *format, ...)
+{
+	va_list ap;
+
+	va_start(ap, format);
+
+	if (fcd_err_dump_stream != NULL)
+		vfprintf(fcd_err_dump_stream, format, ap);
+	else
+		fcd_err_vmsg(LOG_DEBUG, format, ap);
+
+	va_end(ap);
+}
+
+/* Bypasses the logger thread; used for FATAL & ABORT messages */
+void fcd_err_msg_sync(int priority, const char *format, ...)
+{
+	va_list ap;
+
+	va_start(ap, format);
+	fcd_err_vwrite(priority, format, ap);
+	va_end(ap);
+}
+
 void fcd_err_perror(const char *msg, const char *file, int line, int sev)
 {
-	fcd_err_msg(LOG_ERR, "%s: %s:%d: %s: %m\n", fcd_err_severities[sev],
-		    file, line, msg);
+	(sev == 0 ? fcd_err_msg : fcd_err_msg_sync)(LOG_ERR,
+			"%s: %s:%d: %s: %m\n", fcd_err_severities[sev],
+			file, line, msg);
 }
 
 void fcd_err_pt_err(const char *msg, int err, const char *file, int line,
 		    int sev)
 {
-	fcd_err_msg(LOG_ERR, "%s: %s:%d: %s: %s\n", fcd_err_severities[sev],
-		    file, line, msg, strerror(err));
+	(sev == 0 ? fcd_err_msg : fcd_err_msg_sync)(LOG_ERR,
+			"%s: %s:%d: %s: %s\n", fcd_err_severities[sev],
+			file, line, msg, strerror(err));
 }
 
 /*******************************************************************************
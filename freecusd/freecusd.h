@@ -22,6 +22,7 @@
 #include <inttypes.h>
 #include <stdarg.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <pthread.h>
 #include <syslog.h>
 #include <stdlib.h>
@@ -31,6 +32,8 @@
 
 #include <libcip.h>
 
+#include "pwmstate.h"
+
 
 /*
  * Error reporting stuff
@@ -39,6 +42,9 @@
 /* "Private" functions and macros */
 
 extern void fcd_err_msg(int priority, const char *format, ...);
+extern void fcd_err_msg_sync(int priority, const char *format, ...);
+extern void fcd_err_dump(const char *format, ...);
+extern __thread FILE *fcd_err_dump_stream;
 extern void fcd_err_perror(const char *msg, const char *file, int line,
 			   int sev);
 extern void fcd_err_pt_err(const char *msg, int err, const char *file,
@@ -50,28 +56,53 @@ extern void fcd_err_child_pabort(const char *msg, const char *file, int line);
 #define FCD_RAW_STRINGIFY(x)	#x
 #define FCD_STRINGIFY(x)	FCD_RAW_STRINGIFY(x)
 
+/*
+ * Per-call-site rate limiting (token bucket); see err.c.  site is the message
+ * prefix (severity, file & line), which is used in "suppressed" summaries.
+ */
+struct fcd_err_limit {
+	const char *site;
+	long long refill;		/* time of last refill (msec) */
+	unsigned long suppressed;
+	unsigned tokens;
+	_Bool started;
+};
+
+extern _Bool fcd_err_limit(struct fcd_err_limit *limit, int priority);
+
+#define FCD_LIMIT_SITE(prefix)	static struct fcd_err_limit fcd_err_limit_ = { \
+					.site = prefix \
+				}
+
+#define FCD_LIMITED(priority, prefix, ...) \
+				do { \
+					FCD_LIMIT_SITE(prefix); \
+					if (fcd_err_limit(&fcd_err_limit_, \
+							  (priority))) \
+						fcd_err_msg((priority), prefix \
+							": " __VA_ARGS__); \
+				} while (0)
+
 /* "Public" macros begin here */
 
-#define FCD_ERR(...)		fcd_err_msg(LOG_ERR, "ERROR: " __FILE__ ":" \
-					FCD_STRINGIFY(__LINE__) ": " \
-					__VA_ARGS__)
+#define FCD_ERR(...)		FCD_LIMITED(LOG_ERR, "ERROR: " __FILE__ ":" \
+					FCD_STRINGIFY(__LINE__), __VA_ARGS__)
 
-#define FCD_WARN(...)		fcd_err_msg(LOG_WARNING, "WARNING: " __FILE__ \
-					":" FCD_STRINGIFY(__LINE__) ": " \
+#define FCD_WARN(...)		FCD_LIMITED(LOG_WARNING, "WARNING: " \
+					__FILE__ ":" FCD_STRINGIFY(__LINE__), \
 					__VA_ARGS__)
 
-#define FCD_INFO(...)		fcd_err_msg(LOG_INFO, "INFO: " __FILE__ ":" \
-					FCD_STRINGIFY(__LINE__) ": " \
-					__VA_ARGS__)
+#define FCD_INFO(...)		FCD_LIMITED(LOG_INFO, "INFO: " __FILE__ ":" \
+					FCD_STRINGIFY(__LINE__), __VA_ARGS__)
 
 #define FCD_DEBUG(...)		fcd_err_msg(LOG_DEBUG, "DEBUG: " __FILE__ ":" \
 					FCD_STRINGIFY(__LINE__) ": " \
 					__VA_ARGS__)
 
-#define FCD_DUMP(...)		fcd_err_msg(LOG_DEBUG, __VA_ARGS__)
+#define FCD_DUMP(...)		fcd_err_dump(__VA_ARGS__)
 
 #define FCD_FATAL(...)		do { \
-					fcd_err_msg(LOG_ERR, "FATAL: " \
+					fcd_err_msg_sync(LOG_ERR, "FATAL: " \
 						__FILE__ ":" \
 						FCD_STRINGIFY(__LINE__) ": " \
 						__VA_ARGS__); \
@@ -79,14 +110,21 @@ extern void fcd_err_child_pabort(const char *msg, const char *file, int line);
 				} while (0)
 
 #define FCD_ABORT(...)		do { \
-					fcd_err_msg(LOG_ERR, "FATAL: " \
+					fcd_err_msg_sync(LOG_ERR, "FATAL: " \
 						__FILE__ ":" \
 						FCD_STRINGIFY(__LINE__) ": " \
 						__VA_ARGS__); \
 					abort(); \
 				} while (0)
 
-#define FCD_PERROR(msg)		fcd_err_perror((msg), __FILE__, __LINE__, 0)
+#define FCD_PERROR(msg)		do { \
+					FCD_LIMIT_SITE("ERROR: " __FILE__ ":" \
+						FCD_STRINGIFY(__LINE__)); \
+					if (fcd_err_limit(&fcd_err_limit_, \
+							  LOG_ERR)) \
+						fcd_err_perror((msg), \
+							__FILE__, __LINE__, 0); \
+				} while (0)
 
 #define FCD_PFATAL(msg)		do { \
 					fcd_err_perror((msg), __FILE__, \
@@ -136,44 +174,19 @@ extern void fcd_err_child_pabort(const char *msg, const char *file, int line);
  */
 
 /* Used to set the size of various structures & buffers */
-#define FCD_DISK_NAME_SIZE             (sizeof "/dev/sd_")
-#define FCD_DISK_DEV_SIZE	       (sizeof "sd_")
-#define FCD_MAX_DISK_COUNT             5
-
-/* Each monitored temperature has these associated settings */
-enum fcd_conf_temp_type {
-	FCD_CONF_TEMP_WARN		= 0,
-	FCD_CONF_TEMP_FAIL,
-	FCD_CONF_TEMP_FAN_MAX_ON,
-	FCD_CONF_TEMP_FAN_MAX_HYST,
-	FCD_CONF_TEMP_FAN_HIGH_ON,
-	FCD_CONF_TEMP_FAN_HIGH_HYST
-};
-#define FCD_CONF_TEMP_ARRAY_SIZE	(FCD_CONF_TEMP_FAN_HIGH_HYST + 1)
-
-/* Monitor PWM flags */
-#define FCD_FAN_HIGH_HYST	0x01	/* above fan high hysteresis threshold */
-#define FCD_FAN_HIGH_ON		0x02	/* at or above fan high on threshold */
-#define FCD_FAN_MAX_HYST	0x04	/* above fan max hysteresis threshold */
-#define FCD_FAN_MAX_ON		0x08	/* at or above fan max on threshold */
+#define FCD_DISK_NAME_SIZE             (sizeof "/dev/sd___")
+#define FCD_DISK_DEV_SIZE	       (sizeof "sd___")
 
-/* Compute PWM flags from a temperature and a set of thresholds */
-__attribute__((always_inline))
-static inline uint8_t fcd_pwm_temp_flags(const int temp, const int *const conf)
-{
-	return	(temp >= conf[FCD_CONF_TEMP_FAN_MAX_ON])	* FCD_FAN_MAX_ON	|
-		(temp >  conf[FCD_CONF_TEMP_FAN_MAX_HYST])	* FCD_FAN_MAX_HYST	|
-		(temp >= conf[FCD_CONF_TEMP_FAN_HIGH_ON])	* FCD_FAN_HIGH_ON	|
-		(temp >  conf[FCD_CONF_TEMP_FAN_HIGH_HYST])	* FCD_FAN_HIGH_HYST;
-}
+/*
+ * RAID disk positions.  Positions 1 - FCD_BAY_COUNT are the N5550's internal
+ * bays (which have alert LEDs); disks in expansion enclosures are numbered
+ * from FCD_BAY_COUNT + 1.  See disk.c.
+ */
+#define FCD_BAY_COUNT			5
+#define FCD_MAX_DISK_POS		999
 
-/* Fan PWM states */
-enum fcd_pwm_state {
-	FCD_PWM_STATE_NORMAL	= 0,
-	FCD_PWM_STATE_HIGH	= 1,
-	FCD_PWM_STATE_MAX	= 2
-};
-#define FCD_PWM_STATE_ARRAY_SIZE	(FCD_PWM_STATE_MAX + 1)
+/* LCD text of a monitor "subpage" (upper & lower lines); see page.c */
+#define FCD_PAGE_LINES_SIZE		40
 
 /* String representations of the PWM states */
 extern const char *const fcd_pwm_state_names[FCD_PWM_STATE_ARRAY_SIZE];
@@ -186,6 +199,30 @@ enum fcd_alert_msg {
 	FCD_ALERT_SET_REQ,
 };
 
+/* Front-panel buttons, as reported by the LCD PIC */
+enum fcd_button {
+	FCD_BUTTON_NONE = 0,
+	FCD_BUTTON_UP,
+	FCD_BUTTON_DOWN,
+	FCD_BUTTON_ENTER,
+	FCD_BUTTON_ESC,
+};
+
+/* LCD thread progress - see fcd_tty_wait() */
+struct fcd_tty_progress {
+	unsigned long sent;
+	unsigned long acked;
+	unsigned queued;
+};
+
+/* Metrics (Prometheus text format) of a monitor; see metrics.c */
+struct fcd_metrics_text {
+	char *buf;
+	size_t size;
+	size_t len;
+	_Bool failed;
+};
+
 /*
  * Data about a "monitor" - which monitors, displays, and/or controls some
  * aspect of the NAS.  Most monitors run as a separate thread, but a single
@@ -209,33 +246,89 @@ struct fcd_monitor {
 	void *(*monitor_fn)(void *);
 	void (*cfg_dump_fn)(void);
 	pthread_t tid;
+	unsigned sched_slot;					/* see sched.c */
 	_Bool enabled;
 	_Bool silent;						/* no front-panel message */
+	_Bool no_replay;					/* see rec.c */
 	uint8_t current_pwm_flags;
 	uint8_t new_pwm_flags;					/* SYNCHRONIZED */
 	enum fcd_alert_msg sys_warn;				/* SYNCHRONIZED */
 	enum fcd_alert_msg sys_fail;				/* SYNCHRONIZED */
-	enum fcd_alert_msg disk_alerts[FCD_MAX_DISK_COUNT];	/* SYNCHRONIZED */
+	enum fcd_alert_msg disk_alerts[FCD_BAY_COUNT];		/* SYNCHRONIZED */
 	uint8_t buf[66];					/* SYNCHRONIZED */
+	char *pages;						/* SYNCHRONIZED */
+	unsigned page_count;					/* SYNCHRONIZED */
+	unsigned subpage;					/* see page.c */
+	unsigned subpage_count;					/* see page.c */
+	uint8_t page_cache[60];					/* see page.c */
+	unsigned page_unchanged;				/* see page.c */
+	uint8_t page_level;					/* see page.c */
+	_Bool page_changed;					/* see page.c */
+	struct fcd_metrics_text metrics_new;			/* see metrics.c */
+	struct fcd_metrics_text metrics;			/* see metrics.c */
+	long long alert_time;					/* SYNCHRONIZED */
+	struct fcd_hist *lock_wait_hist;			/* see main.c */
+	struct fcd_hist *lock_hold_hist;			/* see main.c */
 };
 
 /* Config info about a RAID disk */
 struct fcd_raid_disk {
-	unsigned port_no;
+	unsigned pos;				/* position; see disk.c */
+	uint64_t id;				/* identity; see disk.c */
+	char name[FCD_DISK_NAME_SIZE];
+};
+
+/* Disk-specific settings; see fcd_conf_disk() */
+struct fcd_conf_disk {
 	int temps[FCD_CONF_TEMP_ARRAY_SIZE];
-#if 0
-	int temp_warn;
-	int temp_crit;
-	int temp_fan_max_on;
-	int temp_fan_max_hyst;
-	int temp_fan_high_on;
-	int temp_fan_high_hyst;
-#endif
 	_Bool temp_ignore;
 	_Bool smart_ignore;
-	char name[FCD_DISK_NAME_SIZE];
 };
 
+/*
+ * Settings that can be changed by reloading the configuration file (SIGHUP).
+ * A new object is created each time the file is parsed, and it is never
+ * modified after it has been published; see conf.c.
+ */
+struct fcd_conf {
+	/* loadavg.c */
+	double loadavg_warn[3];
+	double loadavg_crit[3];
+	/* sysfan.c */
+	int sysfan_warn;
+	int sysfan_fail;
+	/* pwm.c */
+	int pwm_values[FCD_PWM_STATE_ARRAY_SIZE];
+	/* temp.c */
+	int temp_core[FCD_CONF_TEMP_ARRAY_SIZE];
+	int temp_cpu[FCD_CONF_TEMP_ARRAY_SIZE];
+	int temp_sys[FCD_CONF_TEMP_ARRAY_SIZE];
+	int temp_ich[FCD_CONF_TEMP_ARRAY_SIZE];
+	/* disk.c; detected at startup, updated on hotplug (sorted by pos) */
+	unsigned disk_count;
+	struct fcd_raid_disk *disks;
+	/* smart.c; [raid_disk:X] settings are in disk_cfg[X - 1] */
+	struct fcd_conf_disk disk_default;
+	unsigned disk_cfg_count;
+	struct fcd_conf_disk *disk_cfg;
+	/* sched.c */
+	float sched_ramp;
+	float sched_jitter;
+	/* page.c */
+	float page_time;
+	int page_warn_weight;
+	int page_fail_weight;
+	bool page_pin_fail;
+	/* err.c */
+	int log_burst;
+	int log_interval;
+	/* conf.c */
+	unsigned refs;
+};
+
+/* For post_parse_data; see fcd_conf_member() */
+#define FCD_CONF_OFFSET(member)	((void *)offsetof(struct fcd_conf, member))
+
 /*
  * Global variables
  */
@@ -270,22 +363,9 @@ extern struct fcd_monitor fcd_hddtemp_monitor;
 extern struct fcd_monitor fcd_smart_monitor;
 extern struct fcd_monitor fcd_raid_monitor;
 extern struct fcd_monitor fcd_pwm_monitor;
+extern struct fcd_monitor fcd_trend_monitor;
 extern struct fcd_monitor *fcd_monitors[];
 
-/* Number and names of disks to monitor */
-extern unsigned fcd_conf_disk_count;
-extern struct fcd_raid_disk fcd_conf_disks[FCD_MAX_DISK_COUNT];
-
-/*
- * Given a pointer to a member of fcd_conf_disks[0], returns a pointer to the
- * corresponding member of fcd_conf_disks[idx].
- */
-__attribute__((always_inline))
-static inline void *fcd_conf_disk_member(unsigned char *member, unsigned idx)
-{
-	return member + (idx * sizeof(struct fcd_raid_disk));
-}
-
 /*
  * Non-static functions
  */
@@ -295,10 +375,25 @@ extern _Bool fcd_alert_update(enum fcd_alert_msg new, enum fcd_alert_msg *status
 extern void fcd_alert_read_monitor(struct fcd_monitor *mon);
 extern void fcd_alert_leds_close(void);
 extern void fcd_alert_leds_open(void);
+extern void fcd_alert_ack(void);
+extern void fcd_alert_apply(void);
 
 /* Serial port stuff  - tty.c */
-extern int fcd_tty_open(const char *tty);
-extern void fcd_tty_write_msg(int fd, struct fcd_monitor *mon);
+extern void fcd_tty_open(const char *spec);
+extern void fcd_tty_write_msg(struct fcd_monitor *mon);
+extern void fcd_tty_close(void);
+extern int fcd_tty_button_fd(void);
+extern enum fcd_button fcd_tty_read_button(void);
+extern void fcd_tty_get_progress(struct fcd_tty_progress *progress);
+extern int fcd_tty_wait(const struct fcd_tty_progress *target, int timeout);
+__attribute__((noreturn)) extern void *fcd_tty_fn(void *arg);
+
+/* Asynchronous logging & rate limiting - err.c */
+extern const cip_opt_info fcd_err_opts[];
+extern void fcd_err_conf_apply(const struct fcd_conf *cfg);
+extern void fcd_err_dump_cfg(void);
+extern void fcd_err_log_init(void);
+__attribute__((noreturn)) extern void *fcd_err_log_fn(void *arg);
 
 /* LCD PIC stuff - pic.c */
 extern void fcd_pic_setup_gpio(void);
@@ -323,6 +418,11 @@ extern void fcd_lib_set_mon_status2(struct fcd_monitor *const mon,
 				    const int fail,
 				    const int *const disks,
 				    const uint8_t pwm_flags);
+extern void fcd_lib_set_mon_pages(struct fcd_monitor *mon, const char *pages,
+				  unsigned count, int warn, int fail,
+				  const int *disks, uint8_t pwm_flags);
+extern int fcd_lib_grow(void *array, unsigned *capacity, unsigned count,
+			size_t size);
 extern int fcd_lib_monitor_sleep(time_t seconds);
 extern ssize_t fcd_lib_read(int fd, void *buf, size_t count,
 			    struct timespec *timeout);
@@ -339,15 +439,183 @@ extern void fcd_lib_fail_and_exit(struct fcd_monitor *mon);
 extern void fcd_lib_fail(struct fcd_monitor *mon);
 __attribute__((noreturn))
 extern void fcd_lib_parent_fail_and_exit(struct fcd_monitor *mon, const int *pipe_fds, char *buf);
-extern int fcd_lib_disk_index(char c);
+extern int fcd_lib_disk_index(const char *dev, size_t len);
 //extern void fcd_lib_disk_mutex_lock(void);
 //extern void fcd_lib_disk_mutex_unlock(void);
 __attribute__((format(printf, 3, 4)))
 extern int fcd_lib_snprintf(char *restrict str, size_t size, const char *restrict format, ...);
 extern void fcd_lib_dump_temp_cfg(const int *const cfg);
+extern int fcd_lib_restorecon(const char *path);
+extern const char *fcd_lib_root;
+extern const char *fcd_lib_path(char *buf, const char *path);
+extern int fcd_lib_open(const char *path, int flags);
+extern FILE *fcd_lib_fopen(const char *path, const char *mode);
+extern int fcd_lib_access(const char *path, int mode);
+extern ssize_t fcd_lib_write_attr(int fd, const void *buf, size_t count);
+extern ssize_t fcd_lib_read_attr(FILE *fp, const char *path, char *buf,
+				 size_t size);
+extern ssize_t fcd_lib_read_file(int fd, const char *path, char **buf,
+				 size_t *buf_size, size_t max_size,
+				 struct timespec *timeout);
+
+/*
+ * Sensor history - trend.c.  Temperatures are in tenths of a degree Celsius,
+ * fan speed in RPM, and the (1-minute) load average in hundredths.
+ */
+enum fcd_trend_id {
+	FCD_TREND_CORE0 = 0,
+	FCD_TREND_CORE1,
+	FCD_TREND_CPU,
+	FCD_TREND_ICH,
+	FCD_TREND_SYS,
+	FCD_TREND_FAN,
+	FCD_TREND_LOADAVG,
+	FCD_TREND_DISK,		/* + disk position - 1 */
+};
+#define FCD_TREND_DISKS			(2 * FCD_BAY_COUNT)
+#define FCD_TREND_ID_ARRAY_SIZE		(FCD_TREND_DISK + FCD_TREND_DISKS)
+struct fcd_trend_stats {
+	int min;
+	int max;
+	int avg;
+};
+enum fcd_trend_tier_id {
+	FCD_TREND_MINUTES = 0,
+	FCD_TREND_HOURS,
+};
+#define FCD_TREND_TIER_ARRAY_SIZE	(FCD_TREND_HOURS + 1)
+struct fcd_trend_tier {
+	unsigned period;	/* seconds */
+	unsigned size;		/* buckets */
+};
+extern const struct fcd_trend_tier fcd_trend_tiers[FCD_TREND_TIER_ARRAY_SIZE];
+extern void fcd_trend_init(void);
+extern void fcd_trend_fini(void);
+extern void fcd_trend_add(unsigned id, int value);
+extern void fcd_trend_disk(unsigned pos, uint64_t id);
+extern int fcd_trend_query(unsigned id, unsigned seconds,
+			   struct fcd_trend_stats *stats);
+extern void fcd_trend_write(FILE *out, unsigned hours);
+extern int fcd_trend_get_bucket(unsigned id, enum fcd_trend_tier_id tier,
+				uint32_t n, struct fcd_trend_stats *stats);
+extern void fcd_trend_restore_bucket(unsigned id, enum fcd_trend_tier_id tier,
+				     uint32_t n,
+				     const struct fcd_trend_stats *stats);
+extern void fcd_trend_get_disk(unsigned pos, uint64_t *id, uint32_t *since);
+extern void fcd_trend_restore_disk(unsigned pos, uint64_t id, uint32_t since);
+
+/* Sensor history file - histfile.c */
+extern int fcd_histfile_open(const char *path);
+extern void *fcd_histfile_fn(void *arg);
+extern void fcd_histfile_close(void);
+
+/* Record & replay - rec.c */
+enum fcd_rec_mode {
+	FCD_REC_MODE_OFF = 0,
+	FCD_REC_MODE_RECORD,
+	FCD_REC_MODE_REPLAY,
+};
+enum fcd_rec_type {
+	FCD_REC_FILE = 0,	/* sysfs, procfs & /etc files */
+	FCD_REC_CMD,		/* external command output & exit status */
+	FCD_REC_TTY,		/* bytes received from the LCD PIC */
+};
+extern enum fcd_rec_mode fcd_rec_mode;
+extern void fcd_rec_open(const char *path, enum fcd_rec_mode mode);
+extern void fcd_rec_close(void);
+extern void fcd_rec_write(enum fcd_rec_type type, const char *label,
+			  int status, const void *data, size_t len);
+extern void fcd_rec_read(enum fcd_rec_type type, const char *label,
+			 int *status, const char **data, size_t *len);
+extern void fcd_rec_output(const struct fcd_monitor *mon);
+extern void fcd_rec_set_readers(unsigned readers);
+extern void fcd_rec_stop(void);
+
+/* Monitor thread scheduling - sched.c */
+extern const cip_opt_info fcd_sched_opts[];
+extern void fcd_sched_init(unsigned slots);
+extern void *fcd_sched_thread_fn(void *arg);
+extern unsigned fcd_sched_speedup;
+extern int fcd_sched_sleep(time_t seconds);
+extern int fcd_sched_wake(const struct fcd_monitor *mon);
+extern void fcd_sched_log_stats(void);
+extern void fcd_sched_dump_cfg(void);
+
+/* Latency histograms - hist.c */
+enum fcd_hist_kind {
+	FCD_HIST_CYCLE = 0,
+	FCD_HIST_CYCLE_CPU,
+	FCD_HIST_CMD,
+	FCD_HIST_LCD_WRITE,
+	FCD_HIST_LOCK_WAIT,
+	FCD_HIST_LOCK_HOLD,
+	FCD_HIST_ALERT_LED,
+};
+#define FCD_HIST_KIND_ARRAY_SIZE	(FCD_HIST_ALERT_LED + 1)
+struct fcd_hist;
+extern long long fcd_hist_now(void);
+extern long long fcd_hist_cpu_now(void);
+extern struct fcd_hist *fcd_hist_get(enum fcd_hist_kind kind,
+				     const char *label);
+extern void fcd_hist_record(struct fcd_hist *hist, long long nsec);
+extern void fcd_hist_write(FILE *stream);
+extern void fcd_hist_write_metrics(FILE *stream);
+
+/* Metrics exporter - metrics.c */
+__attribute__((format(printf, 2, 3)))
+extern void fcd_metrics_add(struct fcd_monitor *mon, const char *format, ...);
+extern void fcd_metrics_publish(struct fcd_monitor *mon);
+extern int fcd_metrics_open(const char *spec);
+extern void fcd_metrics_close(void);
+__attribute__((noreturn)) extern void *fcd_metrics_fn(void *arg);
+
+/* Control socket - ctl.c */
+#define FCD_CTL_MAX_CLIENTS	4
+#define FCD_CTL_POLLFDS		(FCD_CTL_MAX_CLIENTS + 1)
+struct pollfd;
+extern void fcd_ctl_open(const char *path);
+extern void fcd_ctl_close(void);
+extern unsigned fcd_ctl_pollfds(struct pollfd *pfds);
+extern void fcd_ctl_handle(const struct pollfd *pfds, unsigned n);
+
+/* Shared memory status segment - shm.c (layout in shm.h) */
+struct fcd_shm_status;
+extern struct fcd_shm_status *fcd_shm_write_begin(void);
+extern void fcd_shm_write_end(struct fcd_shm_status *shm);
+extern void fcd_shm_update_monitor(const struct fcd_monitor *mon);
+extern void fcd_shm_open(void);
+extern void fcd_shm_close(void);
+
+/* LCD benchmark - bench.c */
+extern void fcd_bench_run(unsigned frames);
+
+/* mdstat parser benchmark - raid.c */
+extern int fcd_raid_bench(char **files, int count);
+
+/* LCD page scheduling - page.c */
+extern const cip_opt_info fcd_page_opts[];
+extern void fcd_page_update(struct fcd_monitor *mon);
+extern void fcd_page_fill(struct fcd_monitor *mon);
+extern void fcd_page_shown(struct fcd_monitor *mon);
+extern struct fcd_monitor *fcd_page_select(void);
+extern int fcd_page_timeout(void);
+extern void fcd_page_step(int dir);
+extern void fcd_page_toggle_pause(void);
+extern void fcd_page_pin(struct fcd_monitor *mon);
+extern const struct fcd_monitor *fcd_page_status(_Bool *paused);
+extern void fcd_page_dump_cfg(void);
 
 /* Config file parsing - conf.c */
+extern __thread const struct fcd_conf *fcd_cfg;
 extern void fcd_conf_parse(void);
+extern void fcd_conf_reload(void);
+extern void fcd_conf_get(void);
+extern void fcd_conf_put(void);
+extern void fcd_conf_refresh(void);
+extern void fcd_conf_write(FILE *stream);
+extern void *fcd_conf_member(void *post_parse_data);
+extern void fcd_conf_set_disks(struct fcd_raid_disk *disks, unsigned count);
+extern struct fcd_conf_disk *fcd_conf_parsing_disk(unsigned pos);
 extern int fcd_conf_disk_bool_cb(cip_err_ctx *ctx, const cip_ini_value *value,
 				 const cip_ini_sect *sect,
 				 const cip_ini_file *file,
@@ -358,13 +626,36 @@ extern int fcd_conf_disk_int_cb_help(cip_err_ctx *ctx,
 				     const cip_ini_file *file,
 				     void *post_parse_data, int *result);
 
-/* RAID disk auto-detection - disk.c */
-extern int fcd_disk_detect(void);
+/*
+ * Returns the settings for a RAID disk -- from its [raid_disk:X] section, if
+ * there is one
+ */
+__attribute__((always_inline))
+static inline const struct fcd_conf_disk *fcd_conf_disk(
+					const struct fcd_raid_disk *const disk)
+{
+	if (disk->pos <= fcd_cfg->disk_cfg_count)
+		return &fcd_cfg->disk_cfg[disk->pos - 1];
+
+	return &fcd_cfg->disk_default;
+}
+
+/* RAID disk auto-detection & hotplug - disk.c */
+extern int fcd_disk_detect(struct fcd_raid_disk **disks);
+extern void fcd_disk_hotplug_open(const char *path);
+extern int fcd_disk_hotplug_fd(void);
+extern void fcd_disk_hotplug_read(void);
+extern void fcd_disk_hotplug_close(void);
 
 /* Fan speed (PWM) - pwm.c */
 extern void fcd_pwm_update(struct fcd_monitor *mon);
 extern void fcd_pwm_init(void);
 extern void fcd_pwm_fini(void);
+extern void fcd_pwm_reload(void);
+extern int fcd_pwm_override(enum fcd_pwm_state state, unsigned seconds);
+extern void fcd_pwm_expire(void);
+extern int fcd_pwm_status(enum fcd_pwm_state *state, int *value,
+			  unsigned *override);
 
 /* Low level logging (for libselinux callback) */
 extern void fcd_err_vmsg(int priority, const char *format, va_list ap);
@@ -0,0 +1,424 @@
+/*
+ * Copyright 2020 Ian Pilcher <arequipeno@gmail.com>
+ *
+ * This program is free software.  You can redistribute it or modify it under
+ * the terms of version 2 of the GNU General Public License (GPL), as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY -- without even the implied warranty of MERCHANTIBILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the text of the GPL for more details.
+ *
+ * Version 2 of the GNU General Public License is available at:
+ *
+ *   http://www.gnu.org/licenses/old-licenses/gpl-2.0.html
+ */
+
+#include "freecusd.h"
+
+#include <string.h>
+#include <time.h>
+
+/*
+ * Latency histograms of freecusd's own work -- monitor cycles, external
+ * commands, LCD writes, monitor mutex wait/hold times, and the time from an
+ * alert being raised to its LED being written.  They are logged on SIGUSR2 (and
+ * at exit), shown by "freecusctl stats", and exported by the metrics exporter.
+ *
+ * Values are recorded in microseconds, in log-linear ("HDR-style") buckets:
+ * each power of 2 is split into FCD_HIST_SUB linear sub-buckets, so every
+ * bucket is within 12.5% of its lower bound, from 1 usec to ~71 minutes.
+ * Recording is lock-free (atomic increments), so it can be done from any
+ * thread, including with a monitor's mutex held.
+ *
+ * Histograms are never freed.  The table is only locked when a histogram is
+ * looked up (fcd_hist_get); callers in hot paths keep the pointer.
+ */
+
+#define FCD_HIST_SUB_BITS	3
+#define FCD_HIST_SUB		(1U << FCD_HIST_SUB_BITS)
+#define FCD_HIST_MAX_BITS	32			/* values < 2^32 usec */
+#define FCD_HIST_BUCKETS	((FCD_HIST_MAX_BITS - FCD_HIST_SUB_BITS + 1) \
+							<< FCD_HIST_SUB_BITS)
+#define FCD_HIST_MAX_HISTS	64
+#define FCD_HIST_LABEL_SIZE	32
+
+struct fcd_hist {
+	enum fcd_hist_kind kind;
+	char label[FCD_HIST_LABEL_SIZE];
+	unsigned long counts[FCD_HIST_BUCKETS];
+	unsigned long long sum;			/* usec */
+	unsigned long long max;			/* usec */
+};
+
+static const struct {
+	const char *desc;		/* for the log */
+	const char *metric;		/* Prometheus metric name */
+	const char *label;		/* Prometheus label name (or NULL) */
+	const char *help;
+} fcd_hist_kinds[FCD_HIST_KIND_ARRAY_SIZE] = {
+	[FCD_HIST_CYCLE] = {
+		.desc	= "monitor cycle",
+		.metric	= "freecusd_monitor_cycle_seconds",
+		.label	= "monitor",
+		.help	= "Wall-clock time of monitor thread activations",
+	},
+	[FCD_HIST_CYCLE_CPU] = {
+		.desc	= "monitor cycle CPU",
+		.metric	= "freecusd_monitor_cycle_cpu_seconds",
+		.label	= "monitor",
+		.help	= "CPU time of monitor thread activations",
+	},
+	[FCD_HIST_CMD] = {
+		.desc	= "command",
+		.metric	= "freecusd_command_seconds",
+		.label	= "command",
+		.help	= "Time from spawning an external command to its exit",
+	},
+	[FCD_HIST_LCD_WRITE] = {
+		.desc	= "LCD message",
+		.metric	= "freecusd_lcd_write_seconds",
+		.label	= NULL,
+		.help	= "Time to queue a message for the LCD",
+	},
+	[FCD_HIST_LOCK_WAIT] = {
+		.desc	= "monitor lock wait",
+		.metric	= "freecusd_monitor_lock_wait_seconds",
+		.label	= "monitor",
+		.help	= "Time the main thread waited for a monitor's mutex",
+	},
+	[FCD_HIST_LOCK_HOLD] = {
+		.desc	= "monitor lock hold",
+		.metric	= "freecusd_monitor_lock_hold_seconds",
+		.label	= "monitor",
+		.help	= "Time the main thread held a monitor's mutex",
+	},
+	[FCD_HIST_ALERT_LED] = {
+		.desc	= "alert to LED",
+		.metric	= "freecusd_alert_led_seconds",
+		.label	= "led",
+		.help	= "Time from an alert being raised to its LED being set",
+	},
+};
+
+/* Exported (cumulative) buckets hold values below these powers of 2 usec */
+static const unsigned fcd_hist_export_bits[] = {
+	4, 7, 10, 13, 16, 19, 22, 25
+};
+
+static pthread_mutex_t fcd_hist_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct fcd_hist fcd_hists[FCD_HIST_MAX_HISTS];
+static unsigned fcd_hist_count;		/* read without the mutex */
+
+static long long fcd_hist_clock(const clockid_t clock)
+{
+	struct timespec now;
+
+	if (clock_gettime(clock, &now) == -1)
+		FCD_PABORT("clock_gettime");
+
+	return now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+/* Monotonic time, in nanoseconds */
+long long fcd_hist_now(void)
+{
+	return fcd_hist_clock(CLOCK_MONOTONIC);
+}
+
+/* CPU time of the calling thread, in nanoseconds */
+long long fcd_hist_cpu_now(void)
+{
+	return fcd_hist_clock(CLOCK_THREAD_CPUTIME_ID);
+}
+
+/*
+ * Returns the histogram of the given kind & label (NULL for none), creating it
+ * if necessary.  Returns NULL if the table is full; fcd_hist_record() ignores
+ * a NULL histogram.
+ */
+struct fcd_hist *fcd_hist_get(const enum fcd_hist_kind kind,
+			      const char *const label)
+{
+	struct fcd_hist *hist;
+	unsigned i;
+	int ret;
+
+	ret = pthread_mutex_lock(&fcd_hist_mutex);
+	if (ret != 0)
+		FCD_PT_ABRT("pthread_mutex_lock", ret);
+
+	for (i = 0; i < fcd_hist_count; ++i) {
+
+		hist = &fcd_hists[i];
+
+		if (hist->kind == kind && strncmp(hist->label,
+				(label != NULL) ? label : "",
+				sizeof hist->label - 1) == 0) {
+			goto done;
+		}
+	}
+
+	if (fcd_hist_count == FCD_HIST_MAX_HISTS) {
+		FCD_WARN("Too many histograms; not recording %s (%s)\n",
+			 fcd_hist_kinds[kind].desc,
+			 (label != NULL) ? label : "");
+		hist = NULL;
+		goto done;
+	}
+
+	hist = &fcd_hists[fcd_hist_count];
+	hist->kind = kind;
+	if (label != NULL)
+		strncpy(hist->label, label, sizeof hist->label - 1);
+
+	/* Readers that don't take the mutex only see initialized entries */
+	__atomic_store_n(&fcd_hist_count, fcd_hist_count + 1, __ATOMIC_RELEASE);
+
+done:
+	ret = pthread_mutex_unlock(&fcd_hist_mutex);
+	if (ret != 0)
+		FCD_PT_ABRT("pthread_mutex_unlock", ret);
+
+	return hist;
+}
+
+static unsigned fcd_hist_bucket(const unsigned long long usec)
+{
+	unsigned msb, shift;
+
+	if (usec < FCD_HIST_SUB)
+		return usec;
+
+	if (usec >> FCD_HIST_MAX_BITS)
+		return FCD_HIST_BUCKETS - 1;
+
+	msb = 63 - __builtin_clzll(usec);
+	shift = msb - FCD_HIST_SUB_BITS;
+
+	return ((shift + 1) << FCD_HIST_SUB_BITS)
+			+ ((usec >> shift) & (FCD_HIST_SUB - 1));
+}
+
+/* Lowest value (usec) that falls into the bucket */
+static unsigned long long fcd_hist_bucket_min(const unsigned bucket)
+{
+	unsigned shift;
+
+	if (bucket < FCD_HIST_SUB)
+		return bucket;
+
+	shift = (bucket >> FCD_HIST_SUB_BITS) - 1;
+
+	return (unsigned long long)(FCD_HIST_SUB + (bucket & (FCD_HIST_SUB - 1)))
+								<< shift;
+}
+
+/* Records a duration (nanoseconds) */
+void fcd_hist_record(struct fcd_hist *const hist, const long long nsec)
+{
+	unsigned long long usec, max;
+
+	if (hist == NULL)
+		return;
+
+	usec = (nsec > 0) ? (unsigned long long)nsec / 1000 : 0;
+
+	__atomic_fetch_add(&hist->counts[fcd_hist_bucket(usec)], 1,
+			   __ATOMIC_RELAXED);
+	__atomic_fetch_add(&hist->sum, usec, __ATOMIC_RELAXED);
+
+	max = __atomic_load_n(&hist->max, __ATOMIC_RELAXED);
+	while (usec > max && !__atomic_compare_exchange_n(&hist->max, &max,
+				usec, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+/*
+ * Reporting
+ */
+
+/* Copy of a histogram's counters, which may be changing */
+struct fcd_hist_snap {
+	unsigned long counts[FCD_HIST_BUCKETS];
+	unsigned long count;
+	unsigned long long sum;
+	unsigned long long max;
+};
+
+static void fcd_hist_snap(const struct fcd_hist *const hist,
+			  struct fcd_hist_snap *const snap)
+{
+	unsigned i;
+
+	snap->count = 0;
+
+	for (i = 0; i < FCD_HIST_BUCKETS; ++i) {
+		snap->counts[i] = __atomic_load_n(&hist->counts[i],
+						  __ATOMIC_RELAXED);
+		snap->count += snap->counts[i];
+	}
+
+	snap->sum = __atomic_load_n(&hist->sum, __ATOMIC_RELAXED);
+	snap->max = __atomic_load_n(&hist->max, __ATOMIC_RELAXED);
+}
+
+/* Upper bound (usec) of the given percentile */
+static unsigned long long fcd_hist_pct(const struct fcd_hist_snap *const snap,
+				       const unsigned pct)
+{
+	unsigned long long rank, upper;
+	unsigned long seen;
+	unsigned i;
+
+	rank = ((unsigned long long)snap->count * pct + 99) / 100;
+
+	for (seen = 0, i = 0; i < FCD_HIST_BUCKETS - 1; ++i) {
+		seen += snap->counts[i];
+		if (seen >= rank)
+			break;
+	}
+
+	upper = (i < FCD_HIST_BUCKETS - 1) ? fcd_hist_bucket_min(i + 1) - 1
+					   : snap->max;
+
+	return (upper < snap->max) ? upper : snap->max;
+}
+
+/* Formats a duration (usec) for the log */
+static const char *fcd_hist_fmt(char *const buf, const size_t size,
+				const unsigned long long usec)
+{
+	if (usec < 10000)
+		snprintf(buf, size, "%lluus", usec);
+	else if (usec < 10000000)
+		snprintf(buf, size, "%llums", usec / 1000);
+	else
+		snprintf(buf, size, "%llus", usec / 1000000);
+
+	return buf;
+}
+
+/*
+ * Writes a summary of each histogram to the stream, or logs it (at LOG_INFO)
+ * if stream is NULL.
+ */
+void fcd_hist_write(FILE *const stream)
+{
+	static const unsigned pcts[] = { 50, 90, 99 };
+	char buf[5][16], line[160];
+	const struct fcd_hist *hist;
+	struct fcd_hist_snap snap;
+	unsigned i, j, count;
+
+	count = __atomic_load_n(&fcd_hist_count, __ATOMIC_ACQUIRE);
+
+	for (i = 0; i < count; ++i) {
+
+		hist = &fcd_hists[i];
+		fcd_hist_snap(hist, &snap);
+
+		if (snap.count == 0)
+			continue;
+
+		for (j = 0; j < FCD_ARRAY_SIZE(pcts); ++j) {
+			fcd_hist_fmt(buf[j], sizeof buf[j],
+				     fcd_hist_pct(&snap, pcts[j]));
+		}
+
+		snprintf(line, sizeof line, "Latency: %s%s%s%s: count=%lu "
+			 "mean=%s p50=%s p90=%s p99=%s max=%s\n",
+			 fcd_hist_kinds[hist->kind].desc,
+			 (hist->label[0] != 0) ? " (" : "", hist->label,
+			 (hist->label[0] != 0) ? ")" : "", snap.count,
+			 fcd_hist_fmt(buf[3], sizeof buf[3],
+				      snap.sum / snap.count),
+			 buf[0], buf[1], buf[2],
+			 fcd_hist_fmt(buf[4], sizeof buf[4], snap.max));
+
+		if (stream != NULL)
+			fputs(line, stream);
+		else
+			FCD_INFO("%s", line);
+	}
+}
+
+/*
+ * Writes all of the histograms to the stream in the Prometheus text format;
+ * see metrics.c.  (The caller must ensure that '.' is the decimal point.)
+ */
+void fcd_hist_write_metrics(FILE *const stream)
+{
+	const struct fcd_hist *hist;
+	struct fcd_hist_snap snap;
+	unsigned i, j, k, b, count;
+	unsigned long long bound;
+	unsigned long cumulative;
+	char labels[80];
+
+	count = __atomic_load_n(&fcd_hist_count, __ATOMIC_ACQUIRE);
+
+	for (k = 0; k < FCD_HIST_KIND_ARRAY_SIZE; ++k) {
+
+		for (i = 0; i < count && fcd_hists[i].kind != k; ++i);
+		if (i == count)
+			continue;
+
+		fprintf(stream, "# HELP %s %s\n# TYPE %s histogram\n",
+			fcd_hist_kinds[k].metric, fcd_hist_kinds[k].help,
+			fcd_hist_kinds[k].metric);
+
+		for (; i < count; ++i) {
+
+			hist = &fcd_hists[i];
+			if (hist->kind != k)
+				continue;
+
+			fcd_hist_snap(hist, &snap);
+
+			if (fcd_hist_kinds[k].label != NULL) {
+				snprintf(labels, sizeof labels, "%s=\"%s\",",
+					 fcd_hist_kinds[k].label, hist->label);
+			}
+			else {
+				labels[0] = 0;
+			}
+
+			for (cumulative = 0, b = 0, j = 0;
+				    j < FCD_ARRAY_SIZE(fcd_hist_export_bits);
+				    ++j) {
+
+				/*
+				 * Buckets below 2^n usec.  Prometheus bounds
+				 * are inclusive, and values are whole usec, so
+				 * the bound is 2^n - 1 usec; a value of exactly
+				 * 2^n is in the bucket that starts there.
+				 */
+				bound = 1ULL << fcd_hist_export_bits[j];
+
+				for (; fcd_hist_bucket_min(b) < bound; ++b)
+					cumulative += snap.counts[b];
+
+				fprintf(stream,
+					"%s_bucket{%sle=\"%.6f\"} %lu\n",
+					fcd_hist_kinds[k].metric, labels,
+					(bound - 1) / 1000000.0, cumulative);
+			}
+
+			/* Remove the trailing comma for _sum & _count */
+			if (labels[0] != 0)
+				labels[strlen(labels) - 1] = 0;
+
+			fprintf(stream, "%s_bucket{%s%sle=\"+Inf\"} %lu\n"
+				"%s_sum%s%s%s %.6f\n%s_count%s%s%s %lu\n",
+				fcd_hist_kinds[k].metric, labels,
+				(labels[0] != 0) ? "," : "", snap.count,
+				fcd_hist_kinds[k].metric,
+				(labels[0] != 0) ? "{" : "", labels,
+				(labels[0] != 0) ? "}" : "",
+				snap.sum / 1000000.0,
+				fcd_hist_kinds[k].metric,
+				(labels[0] != 0) ? "{" : "", labels,
+				(labels[0] != 0) ? "}" : "", snap.count);
+		}
+	}
+}
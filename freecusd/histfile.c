@@ -0,0 +1,555 @@
+/*
+ * Copyright 2020 Ian Pilcher <arequipeno@gmail.com>
+ *
+ * This program is free software.  You can redistribute it or modify it under
+ * the terms of version 2 of the GNU General Public License (GPL), as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY -- without even the implied warranty of MERCHANTIBILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the text of the GPL for more details.
+ *
+ * Version 2 of the GNU General Public License is available at:
+ *
+ *   http://www.gnu.org/licenses/old-licenses/gpl-2.0.html
+ */
+
+#include "freecusd.h"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <limits.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+
+/*
+ * Sensor history file (/var/lib/freecusd/history by default; -H).  Keeps the
+ * minute & hour buckets of the in-memory history (see trend.c) across
+ * restarts.
+ *
+ * The file has a fixed size.  After a header page, it holds one ring of slots
+ * for each tier (a week of minutes, a year of hours).  Each slot holds every
+ * series' bucket for one period, and its position is determined by its time
+ * (bucket number % ring size), so there is no head pointer to update -- the
+ * header (apart from the disk table; see below) is only written when the file
+ * is created.  Each slot has its own CRC; a slot that was torn by a crash or
+ * power loss is simply ignored when the file is loaded.
+ *
+ * Disk series are kept by position, so the header page also holds the
+ * identity of the disk at each position (see fcd_trend_disk()) and the time it
+ * was found there.  It is rewritten (before any slots) when a disk is
+ * replaced, and a disk's buckets from before that time aren't restored.  If
+ * the table is damaged, no earlier disk history is restored.
+ *
+ * The root device is usually a small flash module, so writes are batched.
+ * The file is mapped, but slots are only copied into the mapping every
+ * FCD_HISTFILE_INTERVAL seconds (and when freecusd exits), immediately
+ * followed by msync() of the dirty pages -- a page or two of sequential slots
+ * per flush.  (The buckets themselves are kept in memory by trend.c, so
+ * nothing is buffered here.)
+ *
+ * Integers are in native byte order.  Any change to the layout (including the
+ * number of series) must increment FCD_HISTFILE_VERSION; a file with a
+ * different version or geometry is replaced.
+ */
+
+#define FCD_HISTFILE_MAGIC	"FCDHIST"
+#define FCD_HISTFILE_VERSION	2
+#define FCD_HISTFILE_HDR_SIZE	4096
+#define FCD_HISTFILE_DISKS_OFFSET	2048
+#define FCD_HISTFILE_SLOT_SIZE	128
+#define FCD_HISTFILE_INTERVAL	300		/* seconds */
+
+struct fcd_histfile_hdr {
+	char magic[8];
+	uint32_t version;
+	uint32_t slot_size;
+	uint32_t series;
+	uint32_t slots[FCD_TREND_TIER_ARRAY_SIZE];
+	uint32_t crc;
+};
+
+struct fcd_histfile_disks {
+	uint64_t ids[FCD_TREND_DISKS];		/* 0 = unknown */
+	uint32_t since[FCD_TREND_DISKS];	/* time; 0 = always there */
+	uint32_t crc;
+};
+
+struct fcd_histfile_value {
+	int16_t min;
+	int16_t max;
+	int16_t avg;
+};
+
+struct fcd_histfile_slot {
+	uint32_t time;		/* bucket number; 0 = never written */
+	uint32_t valid;		/* series with a value (bitmap) */
+	struct fcd_histfile_value values[FCD_TREND_ID_ARRAY_SIZE];
+	uint8_t reserved[FCD_HISTFILE_SLOT_SIZE - 12
+			 - FCD_TREND_ID_ARRAY_SIZE
+				* sizeof(struct fcd_histfile_value)];
+	uint32_t crc;		/* of everything before it */
+};
+
+_Static_assert(sizeof(struct fcd_histfile_slot) == FCD_HISTFILE_SLOT_SIZE,
+	       "history file slot size");
+_Static_assert(FCD_TREND_ID_ARRAY_SIZE <= 32, "too many series for bitmap");
+_Static_assert(sizeof(struct fcd_histfile_hdr) <= FCD_HISTFILE_DISKS_OFFSET
+		&& FCD_HISTFILE_DISKS_OFFSET + sizeof(struct fcd_histfile_disks)
+						<= FCD_HISTFILE_HDR_SIZE,
+	       "history file header size");
+
+static int fcd_histfile_fd = -1;
+static char *fcd_histfile_map;
+static size_t fcd_histfile_size;
+static const char *fcd_histfile_path;
+static char fcd_histfile_path_buf[PATH_MAX];
+static struct fcd_histfile_slot *fcd_histfile_rings[FCD_TREND_TIER_ARRAY_SIZE];
+static uint32_t fcd_histfile_saved[FCD_TREND_TIER_ARRAY_SIZE];
+/* Disk buckets that start before these times aren't restored */
+static uint32_t fcd_histfile_disk_since[FCD_TREND_DISKS];
+
+/* CRC-32 (IEEE 802.3) */
+static uint32_t fcd_histfile_crc(const void *const buf, const size_t len)
+{
+	static uint32_t table[256];
+	const uint8_t *p;
+	uint32_t crc;
+	unsigned i, j;
+
+	/* Only called in the main thread before the history thread starts */
+	if (table[1] == 0) {
+		for (i = 0; i < 256; ++i) {
+			for (crc = i, j = 0; j < 8; ++j)
+				crc = (crc >> 1) ^ (crc & 1 ? 0xedb88320 : 0);
+			table[i] = crc;
+		}
+	}
+
+	for (crc = 0xffffffff, p = buf; p < (const uint8_t *)buf + len; ++p)
+		crc = (crc >> 8) ^ table[(crc ^ *p) & 0xff];
+
+	return ~crc;
+}
+
+static void fcd_histfile_init_hdr(struct fcd_histfile_hdr *const hdr)
+{
+	unsigned i;
+
+	memset(hdr, 0, sizeof *hdr);
+	memcpy(hdr->magic, FCD_HISTFILE_MAGIC, sizeof FCD_HISTFILE_MAGIC);
+	hdr->version = FCD_HISTFILE_VERSION;
+	hdr->slot_size = FCD_HISTFILE_SLOT_SIZE;
+	hdr->series = FCD_TREND_ID_ARRAY_SIZE;
+
+	for (i = 0; i < FCD_TREND_TIER_ARRAY_SIZE; ++i)
+		hdr->slots[i] = fcd_trend_tiers[i].size;
+
+	hdr->crc = fcd_histfile_crc(hdr, offsetof(struct fcd_histfile_hdr, crc));
+}
+
+/* (Re)creates the file; returns 0 on success, -1 on error */
+static int fcd_histfile_create(const int fd)
+{
+	struct fcd_histfile_disks disks;
+	struct fcd_histfile_hdr hdr;
+	int ret;
+
+	if (ftruncate(fd, 0) == -1) {
+		FCD_PERROR(fcd_histfile_path);
+		return -1;
+	}
+
+	/* Allocate all blocks now, so writes to the mapping can't SIGBUS */
+	ret = posix_fallocate(fd, 0, fcd_histfile_size);
+	if (ret != 0) {
+		FCD_ERR("%s: %s\n", fcd_histfile_path, strerror(ret));
+		return -1;
+	}
+
+	fcd_histfile_init_hdr(&hdr);
+
+	memset(&disks, 0, sizeof disks);
+	disks.crc = fcd_histfile_crc(&disks,
+				     offsetof(struct fcd_histfile_disks, crc));
+
+	if (pwrite(fd, &hdr, sizeof hdr, 0) != sizeof hdr
+			|| pwrite(fd, &disks, sizeof disks,
+				  FCD_HISTFILE_DISKS_OFFSET) != sizeof disks
+			|| fsync(fd) == -1) {
+		FCD_PERROR(fcd_histfile_path);
+		return -1;
+	}
+
+	FCD_INFO("Created sensor history file %s\n", fcd_histfile_path);
+
+	return 0;
+}
+
+/* Returns 0 if the header matches this build, -1 if not */
+static int fcd_histfile_check_hdr(const int fd)
+{
+	struct fcd_histfile_hdr hdr, expected;
+	struct stat st;
+
+	if (fstat(fd, &st) == -1) {
+		FCD_PERROR(fcd_histfile_path);
+		return -1;
+	}
+
+	if ((size_t)st.st_size != fcd_histfile_size)
+		return -1;
+
+	if (pread(fd, &hdr, sizeof hdr, 0) != sizeof hdr)
+		return -1;
+
+	fcd_histfile_init_hdr(&expected);
+
+	return memcmp(&hdr, &expected, sizeof hdr) == 0 ? 0 : -1;
+}
+
+/* Restores the valid slots of a tier that are still within its ring */
+static unsigned fcd_histfile_load(const enum fcd_trend_tier_id i,
+				  const uint32_t now)
+{
+	const struct fcd_trend_tier *const tier = &fcd_trend_tiers[i];
+	const struct fcd_histfile_slot *slot;
+	struct fcd_trend_stats stats;
+	unsigned j, id, count;
+	uint32_t current;
+
+	current = now / tier->period;
+
+	for (count = 0, j = 0; j < tier->size; ++j) {
+
+		slot = &fcd_histfile_rings[i][j];
+
+		if (slot->time == 0 || slot->time > current
+				|| current - slot->time >= tier->size
+				|| slot->time % tier->size != j) {
+			continue;
+		}
+
+		if (slot->crc != fcd_histfile_crc(slot,
+				offsetof(struct fcd_histfile_slot, crc))) {
+			FCD_WARN("%s: Ignoring corrupt slot (%u/%u)\n",
+				 fcd_histfile_path, i, j);
+			continue;
+		}
+
+		for (id = 0; id < FCD_TREND_ID_ARRAY_SIZE; ++id) {
+
+			if (!(slot->valid & (1U << id)))
+				continue;
+
+			if (id >= FCD_TREND_DISK
+				&& (uint64_t)slot->time * tier->period
+				    < fcd_histfile_disk_since[id - FCD_TREND_DISK]) {
+				continue;
+			}
+
+			stats.min = slot->values[id].min;
+			stats.max = slot->values[id].max;
+			stats.avg = slot->values[id].avg;
+			fcd_trend_restore_bucket(id, i, slot->time, &stats);
+		}
+
+		++count;
+	}
+
+	return count;
+}
+
+/* Restores the identities of the disks; see fcd_trend_disk() */
+static void fcd_histfile_load_disks(void)
+{
+	const struct fcd_histfile_disks *disks;
+	uint32_t now;
+	unsigned i;
+
+	disks = (const struct fcd_histfile_disks *)
+			(fcd_histfile_map + FCD_HISTFILE_DISKS_OFFSET);
+
+	if (disks->crc != fcd_histfile_crc(disks,
+				offsetof(struct fcd_histfile_disks, crc))) {
+		FCD_WARN("%s: Ignoring corrupt disk table; "
+			 "disk history not restored\n", fcd_histfile_path);
+		/* Don't restore anything older next time either */
+		now = time(NULL);
+		for (i = 0; i < FCD_TREND_DISKS; ++i) {
+			fcd_trend_restore_disk(i + 1, 0, now);
+			fcd_histfile_disk_since[i] = now;
+		}
+		return;
+	}
+
+	for (i = 0; i < FCD_TREND_DISKS; ++i) {
+		fcd_trend_restore_disk(i + 1, disks->ids[i], disks->since[i]);
+		fcd_histfile_disk_since[i] = disks->since[i];
+	}
+}
+
+/*
+ * Opens (or creates) the history file and restores its contents.  Called in the
+ * main thread after fcd_trend_init() and before any monitor threads are
+ * started.  Returns 0 on success, or -1 if history won't be saved.  Under a
+ * fake root (-r), path is relative to the root.
+ */
+int fcd_histfile_open(const char *const path)
+{
+	unsigned i, counts[FCD_TREND_TIER_ARRAY_SIZE];
+	size_t offset;
+	uint32_t now;
+	int fd;
+
+	fcd_histfile_path = fcd_lib_path(fcd_histfile_path_buf, path);
+	if (fcd_histfile_path == NULL) {
+		FCD_PERROR(path);
+		FCD_WARN("Sensor history will not be saved\n");
+		return -1;
+	}
+
+	fcd_histfile_size = FCD_HISTFILE_HDR_SIZE;
+	for (i = 0; i < FCD_TREND_TIER_ARRAY_SIZE; ++i)
+		fcd_histfile_size += fcd_trend_tiers[i].size * FCD_HISTFILE_SLOT_SIZE;
+
+	fd = open(fcd_histfile_path, O_RDWR | O_CREAT | O_CLOEXEC,
+		  S_IRUSR | S_IWUSR);
+	if (fd == -1) {
+		FCD_PERROR(fcd_histfile_path);
+		FCD_WARN("Sensor history will not be saved\n");
+		return -1;
+	}
+
+	if (fcd_histfile_check_hdr(fd) != 0) {
+
+		if (lseek(fd, 0, SEEK_END) > 0) {
+			FCD_WARN("%s: Incompatible or damaged history file; "
+				 "replacing it\n", fcd_histfile_path);
+		}
+
+		if (fcd_histfile_create(fd) == -1)
+			goto error;
+	}
+
+	fcd_histfile_map = mmap(NULL, fcd_histfile_size, PROT_READ | PROT_WRITE,
+				MAP_SHARED, fd, 0);
+	if (fcd_histfile_map == MAP_FAILED) {
+		FCD_PERROR("mmap");
+		fcd_histfile_map = NULL;
+		goto error;
+	}
+
+	offset = FCD_HISTFILE_HDR_SIZE;
+	for (i = 0; i < FCD_TREND_TIER_ARRAY_SIZE; ++i) {
+		fcd_histfile_rings[i] =
+			(struct fcd_histfile_slot *)(fcd_histfile_map + offset);
+		offset += fcd_trend_tiers[i].size * FCD_HISTFILE_SLOT_SIZE;
+	}
+
+	fcd_histfile_load_disks();
+
+	now = time(NULL);
+
+	for (i = 0; i < FCD_TREND_TIER_ARRAY_SIZE; ++i) {
+		counts[i] = fcd_histfile_load(i, now);
+		/* Everything older has been restored (or never existed) */
+		fcd_histfile_saved[i] = now / fcd_trend_tiers[i].period - 1;
+	}
+
+	FCD_INFO("Restored %u minutes & %u hours of sensor history from %s\n",
+		 counts[FCD_TREND_MINUTES], counts[FCD_TREND_HOURS],
+		 fcd_histfile_path);
+
+	fcd_histfile_fd = fd;
+
+	return 0;
+
+error:
+	if (close(fd) == -1)
+		FCD_PERROR("close");
+
+	FCD_WARN("Sensor history will not be saved\n");
+
+	return -1;
+}
+
+/*
+ * Copies buckets n into a slot; returns 0 if any series has a value, -1 if
+ * the slot would be empty.
+ */
+static int fcd_histfile_fill(struct fcd_histfile_slot *const slot,
+			     const enum fcd_trend_tier_id i, const uint32_t n)
+{
+	struct fcd_trend_stats stats;
+	unsigned id;
+
+	memset(slot, 0, sizeof *slot);
+
+	for (id = 0; id < FCD_TREND_ID_ARRAY_SIZE; ++id) {
+
+		if (fcd_trend_get_bucket(id, i, n, &stats) != 0)
+			continue;
+
+		/* Values are already clamped to 16 bits; see trend.c */
+		slot->values[id].min = stats.min;
+		slot->values[id].max = stats.max;
+		slot->values[id].avg = stats.avg;
+		slot->valid |= 1U << id;
+	}
+
+	if (slot->valid == 0)
+		return -1;
+
+	slot->time = n;
+	slot->crc = fcd_histfile_crc(slot,
+				     offsetof(struct fcd_histfile_slot, crc));
+
+	return 0;
+}
+
+/*
+ * Writes the buckets of a tier that have been completed since the last flush
+ * (or also the current, incomplete, bucket if final is set) and syncs them.
+ */
+static void fcd_histfile_flush_tier(const enum fcd_trend_tier_id i,
+				    const uint32_t now, const _Bool final)
+{
+	const struct fcd_trend_tier *const tier = &fcd_trend_tiers[i];
+	struct fcd_histfile_slot slot, *dst;
+	uintptr_t lo, hi, page;
+	uint32_t n, first, last;
+
+	last = now / tier->period;
+	if (!final)
+		--last;
+
+	if (last <= fcd_histfile_saved[i])
+		return;		/* nothing new (or clock went backwards) */
+
+	first = fcd_histfile_saved[i] + 1;
+	if (last - first >= tier->size)
+		first = last - tier->size + 1;
+
+	lo = UINTPTR_MAX;
+	hi = 0;
+
+	for (n = first; n <= last; ++n) {
+
+		if (fcd_histfile_fill(&slot, i, n) != 0)
+			continue;
+
+		dst = &fcd_histfile_rings[i][n % tier->size];
+		memcpy(dst, &slot, sizeof slot);
+
+		if ((uintptr_t)dst < lo)
+			lo = (uintptr_t)dst;
+		if ((uintptr_t)(dst + 1) > hi)
+			hi = (uintptr_t)(dst + 1);
+	}
+
+	/* An incomplete bucket will be written again when it's complete */
+	fcd_histfile_saved[i] = final ? last - 1 : last;
+
+	if (lo > hi)
+		return;
+
+	page = sysconf(_SC_PAGESIZE);
+	lo &= ~(page - 1);
+
+	if (msync((void *)lo, hi - lo, MS_SYNC) == -1)
+		FCD_PERROR("msync");
+}
+
+/*
+ * Writes the identities of the disks, if any have changed.  This is done
+ * before any slots are written, so a replaced disk's old buckets are never
+ * restored as the new disk's history.
+ */
+static void fcd_histfile_save_disks(void)
+{
+	struct fcd_histfile_disks disks, *dst;
+	unsigned i;
+
+	memset(&disks, 0, sizeof disks);
+
+	for (i = 0; i < FCD_TREND_DISKS; ++i)
+		fcd_trend_get_disk(i + 1, &disks.ids[i], &disks.since[i]);
+
+	disks.crc = fcd_histfile_crc(&disks,
+				     offsetof(struct fcd_histfile_disks, crc));
+
+	dst = (struct fcd_histfile_disks *)
+			(fcd_histfile_map + FCD_HISTFILE_DISKS_OFFSET);
+
+	if (memcmp(dst, &disks, sizeof disks) == 0)
+		return;
+
+	memcpy(dst, &disks, sizeof disks);
+
+	if (msync(fcd_histfile_map, FCD_HISTFILE_HDR_SIZE, MS_SYNC) == -1)
+		FCD_PERROR("msync");
+}
+
+static void fcd_histfile_flush(const _Bool final)
+{
+	uint32_t now;
+	unsigned i;
+
+	fcd_histfile_save_disks();
+
+	now = time(NULL);
+
+	for (i = 0; i < FCD_TREND_TIER_ARRAY_SIZE; ++i)
+		fcd_histfile_flush_tier(i, now, final);
+}
+
+/*
+ * History file thread.  Only started if fcd_histfile_open() succeeded.  Saves
+ * new buckets every FCD_HISTFILE_INTERVAL seconds, and once more (including
+ * incomplete buckets) when it's told to exit.
+ */
+void *fcd_histfile_fn(void *arg __attribute__((unused)))
+{
+	struct timespec timeout;
+	int ret;
+
+	timeout.tv_sec = FCD_HISTFILE_INTERVAL;
+	timeout.tv_nsec = 0;
+
+	while (!fcd_thread_exit_flag) {
+
+		ret = ppoll(NULL, 0, &timeout, &fcd_mon_ppoll_sigmask);
+		if (ret == -1) {
+			if (errno == EINTR)
+				continue;
+			FCD_PERROR("ppoll");
+			break;
+		}
+
+		fcd_histfile_flush(0);
+	}
+
+	fcd_histfile_flush(1);
+
+	pthread_exit(NULL);
+}
+
+/* Called in the main thread after the history file thread has exited */
+void fcd_histfile_close(void)
+{
+	if (fcd_histfile_fd == -1)
+		return;
+
+	if (munmap(fcd_histfile_map, fcd_histfile_size) == -1)
+		FCD_PERROR("munmap");
+
+	if (close(fcd_histfile_fd) == -1)
+		FCD_PERROR(fcd_histfile_path);
+
+	fcd_histfile_fd = -1;
+	fcd_histfile_map = NULL;
+}
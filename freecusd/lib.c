@@ -17,39 +17,34 @@
 #include "freecusd.h"
 
 #include <sys/wait.h>
+#include <limits.h>
 #include <string.h>
+#include <ctype.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <time.h>
 #include <poll.h>
 #include <stdarg.h>
 
+#include <selinux/restorecon.h>
+#include <selinux/selinux.h>
+
 #define FCD_LIB_BUF_CHUNK	2000
 
 sigset_t fcd_mon_ppoll_sigmask;
 
 /*
- * Sleeps for the specified number of seconds, unless interrupted by a signal
- * (SIGUSR1).  Returns the thread-local value of fcd_thread_exit_flag (or -1 on
- * error).
+ * Sleeps until the calling monitor thread's next scheduled activation, which is
+ * (approximately) the specified number of seconds after its previous one,
+ * unless interrupted by a signal (SIGUSR1).  Returns the thread-local value of
+ * fcd_thread_exit_flag (or -1 on error).  See sched.c.
  *
  * NOTE: Does not check fcd_thread_exit_flag before sleeping (assumes that
  * 	 SIGUSR1 has been blocked).
  */
 int fcd_lib_monitor_sleep(time_t seconds)
 {
-	struct timespec ts;
-
-	ts.tv_sec = seconds;
-	ts.tv_nsec = 0;
-
-	if (ppoll(NULL, 0, &ts, &fcd_mon_ppoll_sigmask) == -1
-						&& errno != EINTR) {
-		FCD_PERROR("ppoll");
-		return -1;
-	}
-
-	return fcd_thread_exit_flag;
+	return fcd_sched_sleep(seconds);
 }
 
 /*
@@ -207,6 +202,33 @@ static int fcd_lib_grow_buf(char **buf, size_t *buf_size, size_t max_size)
 	return 0;
 }
 
+/*
+ * Grows a dynamically allocated array (*(T **)array) to hold at least count
+ * elements, if *capacity is smaller.  (The array is always allocated, even if
+ * count is 0.)  Returns 0 on success, -1 on error (array unchanged).
+ */
+int fcd_lib_grow(void *const array, unsigned *const capacity,
+		 const unsigned count, const size_t size)
+{
+	void *p;
+
+	memcpy(&p, array, sizeof p);
+
+	if (p != NULL && count <= *capacity)
+		return 0;
+
+	p = realloc(p, (count > 0 ? count : 1) * size);
+	if (p == NULL) {
+		FCD_PERROR("realloc");
+		return -1;
+	}
+
+	memcpy(array, &p, sizeof p);
+	*capacity = count;
+
+	return 0;
+}
+
 /*
  * Reads from fd until EOF, timeout, interrupted by signal (SIGUSR1), max buffer
  * size is exceeded or error occurs.  Input buffer is grown as necessary.
@@ -248,6 +270,83 @@ ssize_t fcd_lib_read_all(int fd, char **buf, size_t *buf_size, size_t max_size,
 	return total;
 }
 
+/*
+ * Copies a replayed input (see rec.c) into the buffer at buf, which is grown as
+ * necessary.  Returns the number of bytes copied, -1 on error, or -4 if the
+ * maximum buffer size would be exceeded.
+ */
+static ssize_t fcd_lib_replay_buf(char **buf, size_t *buf_size,
+				  const size_t max_size, const char *const data,
+				  const size_t len)
+{
+	int ret;
+
+	while (*buf == NULL || len >= *buf_size) {
+		ret = fcd_lib_grow_buf(buf, buf_size, max_size);
+		if (ret < 0)
+			return ret;	/* -1 or -4 */
+	}
+
+	memcpy(*buf, data, len);
+	(*buf)[len] = 0;
+
+	return len;
+}
+
+/*
+ * fcd_lib_read_all(), for a file whose contents are recorded or replayed (see
+ * rec.c).  path identifies the file in the recording.
+ */
+ssize_t fcd_lib_read_file(int fd, const char *const path, char **buf,
+			  size_t *buf_size, size_t max_size,
+			  struct timespec *timeout)
+{
+	const char *data;
+	size_t len;
+	ssize_t ret;
+
+	if (fcd_rec_mode == FCD_REC_MODE_REPLAY) {
+		fcd_rec_read(FCD_REC_FILE, path, NULL, &data, &len);
+		return fcd_lib_replay_buf(buf, buf_size, max_size, data, len);
+	}
+
+	ret = fcd_lib_read_all(fd, buf, buf_size, max_size, timeout);
+	if (ret >= 0)
+		fcd_rec_write(FCD_REC_FILE, path, 0, *buf, ret);
+
+	return ret;
+}
+
+/*
+ * Reads the current value of a sysfs (or procfs) attribute from fp, which must
+ * be unbuffered, into buf (0-terminated).  Returns the number of bytes read or
+ * -1 on error.  Recorded or replayed (see rec.c).
+ */
+ssize_t fcd_lib_read_attr(FILE *const fp, const char *const path,
+			  char *const buf, const size_t size)
+{
+	const char *data;
+	size_t len;
+
+	if (fcd_rec_mode == FCD_REC_MODE_REPLAY) {
+		fcd_rec_read(FCD_REC_FILE, path, NULL, &data, &len);
+		if (len >= size)
+			len = size - 1;
+		memcpy(buf, data, len);
+	}
+	else {
+		rewind(fp);
+		len = fread(buf, 1, size - 1, fp);
+		if (ferror(fp))
+			return -1;
+		fcd_rec_write(FCD_REC_FILE, path, 0, buf, len);
+	}
+
+	buf[len] = 0;
+
+	return len;
+}
+
 /*
  * Mark a monitor as failed
  */
@@ -262,7 +361,8 @@ void fcd_lib_fail(struct fcd_monitor *const mon)
 	if (ret != 0)
 		FCD_PT_ABRT("pthread_mutex_lock", ret);
 
-	fcd_alert_update(FCD_ALERT_SET_REQ, &mon->sys_fail);
+	if (fcd_alert_update(FCD_ALERT_SET_REQ, &mon->sys_fail))
+		mon->alert_time = fcd_hist_now();
 	memcpy(mon->buf + 45, disabled_msg, 20);
 
 	ret = pthread_mutex_unlock(&mon->mutex);
@@ -279,6 +379,11 @@ __attribute__((noreturn))
 void fcd_lib_fail_and_exit(struct fcd_monitor *mon)
 {
 	fcd_lib_fail(mon);
+
+	/* Don't keep a replay waiting for this thread */
+	if (fcd_rec_mode == FCD_REC_MODE_REPLAY && !mon->no_replay)
+		fcd_rec_stop();
+
 	pthread_exit(NULL);
 }
 
@@ -299,66 +404,110 @@ void fcd_lib_parent_fail_and_exit(struct fcd_monitor *mon, const int *pipe_fds,
 }
 
 /*
- * Called by monitor threads to update message buffer, alerts, and PWM flags in
- * monitor structure - where main thread will act upon them.
+ * Updates the alerts and PWM flags in the monitor structure.  Called with the
+ * monitor's mutex locked.  Disk alerts (LEDs) only exist for the N5550's
+ * internal bays; alerts for disks in expansion enclosures are reflected only
+ * in the system warning/failure status (which the monitor sets).  The time of
+ * the latest new alert is recorded, so the main thread can measure how long it
+ * takes to set the LED (see alert.c).
  */
-void fcd_lib_set_mon_status2(struct fcd_monitor *const mon,
-			     const char *const restrict upper,
-			     const char *const restrict lower,
-			     const int warn,
-			     const int fail,
-			     const int *const disks,
-			     const uint8_t pwm_flags)
+static void fcd_lib_set_mon_alerts(struct fcd_monitor *const mon,
+				   const int warn,
+				   const int fail,
+				   const int *const disks,
+				   const uint8_t pwm_flags)
 {
+	_Bool present[FCD_BAY_COUNT] = { 0 };
 	enum fcd_alert_msg new;
-	unsigned i, hw_disk;
-	int ret;
-
-	ret = pthread_mutex_lock(&mon->mutex);
-	if (ret != 0)
-		FCD_PT_ABRT("pthread_mutex_lock", ret);
-
-	if (upper != NULL)
-		memcpy(mon->buf + 5, upper, 20);
-
-	memcpy(mon->buf + 45, lower, 20);
+	unsigned i, bay;
 
 	if (fcd_alert_update(warn ? FCD_ALERT_SET_REQ : FCD_ALERT_CLR_REQ, &mon->sys_warn)) {
-		if (warn)
+		if (warn) {
 			FCD_WARN("%s monitor system WARNING status set\n", mon->name);
-		else
+			mon->alert_time = fcd_hist_now();
+		}
+		else {
 			FCD_INFO("%s monitor system warning status cleared\n", mon->name);
+		}
 	}
 
 	if (fcd_alert_update(fail ? FCD_ALERT_SET_REQ : FCD_ALERT_CLR_REQ, &mon->sys_fail)) {
-		if (fail)
+		if (fail) {
 			FCD_ERR("%s monitor system CRITICAL status set\n", mon->name);
-		else
+			mon->alert_time = fcd_hist_now();
+		}
+		else {
 			FCD_INFO("%s monitor system critical status cleared\n", mon->name);
+		}
 	}
 
 	mon->new_pwm_flags = pwm_flags;
 
-	if (disks != NULL) {
+	if (disks == NULL)
+		return;
+
+	for (i = 0; i < fcd_cfg->disk_count; ++i) {
 
-		for (i = 0; i < fcd_conf_disk_count; ++i) {
+		if (fcd_cfg->disks[i].pos > FCD_BAY_COUNT)
+			continue;
 
-			new = disks[i] ? FCD_ALERT_SET_REQ : FCD_ALERT_CLR_REQ;
-			hw_disk = fcd_conf_disks[i].port_no - 2;
+		new = disks[i] ? FCD_ALERT_SET_REQ : FCD_ALERT_CLR_REQ;
+		bay = fcd_cfg->disks[i].pos - 1;
+		present[bay] = 1;
 
-			if (fcd_alert_update(new, &mon->disk_alerts[hw_disk])) {
-				if (new == FCD_ALERT_SET_REQ) {
-					FCD_WARN("%s monitor disk %u (%s) ALERT status set\n",
-						 mon->name, hw_disk + 1, fcd_conf_disks[i].name);
-				}
-				else {
-					FCD_INFO("%s monitor disk %u (%s) alert status cleared\n",
-						 mon->name, hw_disk + 1, fcd_conf_disks[i].name);
-				}
+		if (fcd_alert_update(new, &mon->disk_alerts[bay])) {
+			if (new == FCD_ALERT_SET_REQ) {
+				FCD_WARN("%s monitor disk %u (%s) ALERT status set\n",
+					 mon->name, bay + 1, fcd_cfg->disks[i].name);
+				mon->alert_time = fcd_hist_now();
+			}
+			else {
+				FCD_INFO("%s monitor disk %u (%s) alert status cleared\n",
+					 mon->name, bay + 1, fcd_cfg->disks[i].name);
 			}
 		}
 	}
 
+	/* Clear any alerts for disks that have been removed */
+	for (bay = 0; bay < FCD_BAY_COUNT; ++bay) {
+
+		if (present[bay])
+			continue;
+
+		if (fcd_alert_update(FCD_ALERT_CLR_REQ, &mon->disk_alerts[bay])) {
+			FCD_INFO("%s monitor disk %u alert status cleared (disk removed)\n",
+				 mon->name, bay + 1);
+		}
+	}
+}
+
+/*
+ * Called by monitor threads to update message buffer, alerts, and PWM flags in
+ * monitor structure - where main thread will act upon them.
+ */
+void fcd_lib_set_mon_status2(struct fcd_monitor *const mon,
+			     const char *const restrict upper,
+			     const char *const restrict lower,
+			     const int warn,
+			     const int fail,
+			     const int *const disks,
+			     const uint8_t pwm_flags)
+{
+	int ret;
+
+	ret = pthread_mutex_lock(&mon->mutex);
+	if (ret != 0)
+		FCD_PT_ABRT("pthread_mutex_lock", ret);
+
+	if (upper != NULL)
+		memcpy(mon->buf + 5, upper, 20);
+
+	memcpy(mon->buf + 45, lower, 20);
+
+	fcd_lib_set_mon_alerts(mon, warn, fail, disks, pwm_flags);
+	fcd_shm_update_monitor(mon);
+	fcd_rec_output(mon);
+
 	ret = pthread_mutex_unlock(&mon->mutex);
 	if (ret != 0)
 		FCD_PT_ABRT("pthread_mutex_unlock", ret);
@@ -374,6 +523,59 @@ void fcd_lib_set_mon_status(struct fcd_monitor *const mon,
 	fcd_lib_set_mon_status2(mon, NULL, buf, warn, fail, disks, pwm_flags);
 }
 
+/*
+ * Like fcd_lib_set_mon_status2(), but for a monitor whose text doesn't fit on
+ * a single LCD page.  pages contains count "subpages" (FCD_PAGE_LINES_SIZE
+ * characters each; upper line followed by lower line), which are shown in
+ * turn; see page.c.  If the text can't be copied, only the first subpage is
+ * shown.
+ */
+void fcd_lib_set_mon_pages(struct fcd_monitor *const mon,
+			   const char *const pages,
+			   const unsigned count,
+			   const int warn,
+			   const int fail,
+			   const int *const disks,
+			   const uint8_t pwm_flags)
+{
+	char *new_pages;
+	int ret;
+
+	ret = pthread_mutex_lock(&mon->mutex);
+	if (ret != 0)
+		FCD_PT_ABRT("pthread_mutex_lock", ret);
+
+	if (count > mon->page_count || mon->pages == NULL) {
+
+		new_pages = realloc(mon->pages, count * FCD_PAGE_LINES_SIZE);
+		if (new_pages == NULL) {
+			FCD_PERROR("realloc");
+			free(mon->pages);
+		}
+
+		mon->pages = new_pages;
+	}
+
+	if (mon->pages != NULL) {
+		memcpy(mon->pages, pages, count * FCD_PAGE_LINES_SIZE);
+		mon->page_count = count;
+	}
+	else {
+		memcpy(mon->buf + 5, pages, FCD_PAGE_LINES_SIZE / 2);
+		memcpy(mon->buf + 45, pages + FCD_PAGE_LINES_SIZE / 2,
+		       FCD_PAGE_LINES_SIZE / 2);
+		mon->page_count = 0;
+	}
+
+	fcd_lib_set_mon_alerts(mon, warn, fail, disks, pwm_flags);
+	fcd_shm_update_monitor(mon);
+	fcd_rec_output(mon);
+
+	ret = pthread_mutex_unlock(&mon->mutex);
+	if (ret != 0)
+		FCD_PT_ABRT("pthread_mutex_unlock", ret);
+}
+
 /*
  * Called only from fcd_lib_cmd_child().  Sets the CLOEXEC flag on fd.  Aborts
  * on error.
@@ -480,6 +682,42 @@ static int fcd_lib_cmd_spawn(pid_t *child, char **cmd, const int *reaper_pipe,
 	return create_output_pipe ? output_pipe[0] : 0;
 }
 
+/*
+ * Records the time from spawning a command to its exit (see hist.c).  Commands
+ * are identified by the name of the executable.
+ */
+static void fcd_lib_cmd_record(char **const cmd, const long long start)
+{
+	const char *name;
+
+	name = strrchr(cmd[0], '/');
+	name = (name != NULL) ? name + 1 : cmd[0];
+
+	fcd_hist_record(fcd_hist_get(FCD_HIST_CMD, name), fcd_hist_now() - start);
+}
+
+/*
+ * Identifies a command in a recording (see rec.c) -- the name of the executable
+ * and its arguments, separated by spaces (truncated if necessary).
+ */
+static void fcd_lib_cmd_label(char **const cmd, char *const buf,
+			      const size_t size)
+{
+	const char *name;
+	size_t len, n;
+	unsigned i;
+
+	name = strrchr(cmd[0], '/');
+	name = (name != NULL) ? name + 1 : cmd[0];
+
+	len = snprintf(buf, size, "%s", name);
+
+	for (i = 2; cmd[i] != NULL && len < size - 1; ++i) {
+		n = snprintf(buf + len, size - len, " %s", cmd[i]);
+		len = (n < size - len) ? len + n : size - 1;
+	}
+}
+
 /*
  * Executes an external program in a child process, reads its output into the
  * buffer at buf (which is grown as necessary, up to max_size bytes), and
@@ -492,9 +730,23 @@ ssize_t fcd_lib_cmd_output(int *status, char **cmd, char **buf,
 			   size_t *buf_size, size_t max_size,
 			   struct timespec *timeout, const int *pipe_fds)
 {
+	char label[UINT8_MAX + 1];
 	ssize_t bytes_read;
+	const char *data;
+	long long start;
 	int ret, fd;
 	pid_t child;
+	size_t len;
+
+	if (fcd_rec_mode != FCD_REC_MODE_OFF)
+		fcd_lib_cmd_label(cmd, label, sizeof label);
+
+	if (fcd_rec_mode == FCD_REC_MODE_REPLAY) {
+		fcd_rec_read(FCD_REC_CMD, label, status, &data, &len);
+		return fcd_lib_replay_buf(buf, buf_size, max_size, data, len);
+	}
+
+	start = fcd_hist_now();
 
 	fd = fcd_lib_cmd_spawn(&child, cmd, pipe_fds, 1);
 	if (fd == -1)
@@ -526,6 +778,10 @@ ssize_t fcd_lib_cmd_output(int *status, char **cmd, char **buf,
 	}
 
 	*status = WEXITSTATUS(*status);
+	fcd_lib_cmd_record(cmd, start);
+
+	if (fcd_rec_mode == FCD_REC_MODE_RECORD)
+		fcd_rec_write(FCD_REC_CMD, label, *status, *buf, bytes_read);
 
 	return bytes_read;
 }
@@ -538,9 +794,12 @@ ssize_t fcd_lib_cmd_output(int *status, char **cmd, char **buf,
 int fcd_lib_cmd_status(char **cmd, struct timespec *timeout,
 		       const int *pipe_fds)
 {
+	long long start;
 	int status, ret;
 	pid_t child;
 
+	start = fcd_hist_now();
+
 	if (fcd_lib_cmd_spawn(&child, cmd, pipe_fds, 0) == -1)
 		return -1;
 
@@ -555,19 +814,30 @@ int fcd_lib_cmd_status(char **cmd, struct timespec *timeout,
 		return -1;
 	}
 
+	fcd_lib_cmd_record(cmd, start);
+
 	return WEXITSTATUS(status);
 }
 
 /*
- * Returns the index of the RAID disk identified by c, -1 on error
+ * Returns the index of the RAID disk identified by dev (not 0-terminated),
+ * which is either a disk (sdX, sdXY, etc.) or a partition on a disk (sdXn,
+ * sdXYn, etc.).  Returns -1 if dev isn't a RAID disk.
  */
-int fcd_lib_disk_index(char c)
+int fcd_lib_disk_index(const char *const dev, const size_t len)
 {
+	const char *name;
+	size_t n;
 	int i;
 
-	for (i = 0; i < (int)fcd_conf_disk_count; ++i) {
+	/* Length of the disk name, without any partition number */
+	for (n = 0; n < len && !isdigit((unsigned char)dev[n]); ++n);
+
+	for (i = 0; i < (int)fcd_cfg->disk_count; ++i) {
+
+		name = fcd_cfg->disks[i].name + sizeof "/dev/" - 1;
 
-		if (c == fcd_conf_disks[i].name[FCD_DISK_NAME_SIZE - 2])
+		if (strlen(name) == n && memcmp(name, dev, n) == 0)
 			return i;
 	}
 
@@ -636,3 +906,161 @@ void fcd_lib_dump_temp_cfg(const int *const cfg)
 	FCD_DUMP("\t\tfan high on: %d\n", cfg[FCD_CONF_TEMP_FAN_HIGH_ON]);
 	FCD_DUMP("\t\tfan high hysteresis: %d\n", cfg[FCD_CONF_TEMP_FAN_HIGH_HYST]);
 }
+
+static int fcd_lib_selinux_log(const int type, const char *const format, ...)
+{
+	va_list ap;
+	int priority;
+
+	switch (type) {
+
+		case SELINUX_INFO:
+			priority = LOG_DEBUG;
+			break;
+
+		case SELINUX_WARNING:
+			priority = LOG_WARNING;
+			break;
+
+		default:
+			FCD_WARN("Unknown libselinux message type: %d\n", type);
+		case SELINUX_ERROR:
+		case SELINUX_AVC:
+			priority = LOG_ERR;
+	}
+
+	va_start(ap, format);
+	fcd_err_vmsg(priority, format, ap);
+	va_end(ap);
+
+	return 0;
+}
+
+static pthread_once_t fcd_lib_selinux_once = PTHREAD_ONCE_INIT;
+
+static void fcd_lib_selinux_init(void)
+{
+	selinux_set_callback(SELINUX_CB_LOG,
+			     (union selinux_callback)fcd_lib_selinux_log);
+}
+
+/*
+ * Restores the SELinux context of a sysfs file that didn't exist when
+ * systemd-tmpfiles ran (GPIO attributes, LED trigger attributes, etc.).
+ * Symbolic links (/sys/class/...) are resolved, so that the path matches the
+ * file contexts.  Returns 0 on success (or if SELinux is disabled), -1 on error.
+ * Called in multiple threads.
+ */
+int fcd_lib_restorecon(const char *const path)
+{
+	int ret;
+
+	/* Fixture files aren't sysfs files; leave their contexts alone */
+	if (!is_selinux_enabled() || fcd_lib_root != NULL)
+		return 0;
+
+	ret = pthread_once(&fcd_lib_selinux_once, fcd_lib_selinux_init);
+	if (ret != 0)
+		FCD_PT_ABRT("pthread_once", ret);
+
+	/*
+	 * Despite what the man page says, selinux_restorecon doesn't seem to
+	 * actually set errno on CentOS 7, but it does log its errors via the
+	 * callback.
+	 */
+
+	if (selinux_restorecon(path, SELINUX_RESTORECON_REALPATH) != 0) {
+		FCD_WARN("Failed to restore SELinux context: %s\n", path);
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * Fake root directory (-r DIR or FREECUSD_ROOT) for sysfs & procfs files and
+ * /etc/mdadm.conf, so that the whole daemon can run unprivileged against a
+ * fixture tree.  NULL means the real root.  Set (to an absolute path) before
+ * any threads start.  The control socket (-S), the shared memory segment and
+ * the history file (-H) are also created under the root, so a test instance
+ * never replaces the real daemon's.
+ *
+ * Only files opened by freecusd itself are affected -- not the configuration
+ * file (-c), the LCD device (-t), the metrics socket (-m), or anything opened
+ * by child processes (mdadm, smartctl, hddtemp).
+ */
+const char *fcd_lib_root = NULL;
+
+/*
+ * Returns path with fcd_lib_root prepended (in buf, which must be PATH_MAX
+ * bytes), path itself if there is no fake root, or NULL (errno = ENAMETOOLONG).
+ */
+const char *fcd_lib_path(char *const buf, const char *const path)
+{
+	if (fcd_lib_root == NULL)
+		return path;
+
+	if (snprintf(buf, PATH_MAX, "%s%s", fcd_lib_root, path) >= PATH_MAX) {
+		errno = ENAMETOOLONG;
+		return NULL;
+	}
+
+	return buf;
+}
+
+/*
+ * open(2), relative to fcd_lib_root.  In a fixture tree, sysfs attributes are
+ * regular files, so opening one write-only truncates it (as if each write
+ * replaced the attribute's value).
+ */
+int fcd_lib_open(const char *path, int flags)
+{
+	char buf[PATH_MAX];
+
+	if ((path = fcd_lib_path(buf, path)) == NULL)
+		return -1;
+
+	if (fcd_lib_root != NULL && (flags & O_ACCMODE) == O_WRONLY)
+		flags |= O_TRUNC;
+
+	return open(path, flags);
+}
+
+/* fopen(3), relative to fcd_lib_root */
+FILE *fcd_lib_fopen(const char *path, const char *const mode)
+{
+	char buf[PATH_MAX];
+
+	if ((path = fcd_lib_path(buf, path)) == NULL)
+		return NULL;
+
+	return fopen(path, mode);
+}
+
+/* access(2), relative to fcd_lib_root */
+int fcd_lib_access(const char *path, const int mode)
+{
+	char buf[PATH_MAX];
+
+	if ((path = fcd_lib_path(buf, path)) == NULL)
+		return -1;
+
+	return access(path, mode);
+}
+
+/*
+ * Writes a new value to a sysfs attribute that is kept open (PWM, LED
+ * brightness).  In a fixture tree, the file is truncated first, so that it only
+ * contains the latest value.
+ */
+ssize_t fcd_lib_write_attr(const int fd, const void *const buf,
+			   const size_t count)
+{
+	if (fcd_lib_root == NULL)
+		return write(fd, buf, count);
+
+	if (ftruncate(fd, 0) == -1)
+		return -1;
+
+	return pwrite(fd, buf, count, 0);
+}
@@ -15,13 +15,11 @@
  */
 
 #include "freecusd.h"
+#include "shm.h"
 
 #include <string.h>
 
-/* Alert thresholds */
-static double fcd_loadavg_warn[3] = { 12.0, 12.0, 12.0 };
-static double fcd_loadavg_crit[3] = { 16.0, 16.0, 16.0 };
-
+/* Alert thresholds; see struct fcd_conf */
 static int fcd_loadavg_cb();
 
 static const cip_opt_info fcd_loadavg_opts[] = {
@@ -29,13 +27,13 @@ static const cip_opt_info fcd_loadavg_opts[] = {
 		.name			= "load_avg_warn",
 		.type			= CIP_OPT_TYPE_FLOAT_LIST,
 		.post_parse_fn		= fcd_loadavg_cb,
-		.post_parse_data	= fcd_loadavg_warn,
+		.post_parse_data	= FCD_CONF_OFFSET(loadavg_warn),
 	},
 	{
 		.name			= "load_avg_crit",
 		.type			= CIP_OPT_TYPE_FLOAT_LIST,
 		.post_parse_fn		= fcd_loadavg_cb,
-		.post_parse_data	= fcd_loadavg_crit,
+		.post_parse_data	= FCD_CONF_OFFSET(loadavg_crit),
 	},
 	{	.name			= NULL		}
 };
@@ -58,7 +56,7 @@ static int fcd_loadavg_cb(cip_err_ctx *ctx, const cip_ini_value *value,
 		return -1;
 	}
 
-	p = post_parse_data;
+	p = fcd_conf_member(post_parse_data);
 
 	for (i = 0; i < 3; ++i) {
 
@@ -90,13 +88,14 @@ static void *fcd_loadavg_fn(void *arg)
 {
 	static const char path[] = "/proc/loadavg";
 	struct fcd_monitor *mon = arg;
+	struct fcd_shm_status *shm;
 	int warn, fail, ret;
 	double avgs[3];
-	char buf[21];
+	char buf[21], attr[64];
 	unsigned i;
 	FILE *fp;
 
-	fp = fopen(path, "re");
+	fp = fcd_lib_fopen(path, "re");
 	if (fp == NULL) {
 		FCD_PERROR(path);
 		fcd_lib_fail_and_exit(mon);
@@ -108,28 +107,28 @@ static void *fcd_loadavg_fn(void *arg)
 	}
 
 	do {
-		rewind(fp);
 		memset(buf, ' ', sizeof buf);
 
-		ret = fscanf(fp, "%lf %lf %lf", &avgs[0], &avgs[1], &avgs[2]);
-		if (ret == EOF) {
-			FCD_PERROR("fscanf");
+		ret = fcd_lib_read_attr(fp, path, attr, sizeof attr);
+		if (ret == -1) {
+			FCD_PERROR(path);
 			fcd_loadavg_close_and_disable(fp, mon);
 		}
-		else if (ret != 3) {
+		else if (sscanf(attr, "%lf %lf %lf",
+				&avgs[0], &avgs[1], &avgs[2]) != 3) {
 			FCD_WARN("Failed to parse contents of /proc/loadavg\n");
 			fcd_loadavg_close_and_disable(fp, mon);
 		}
 
 		for (fail = 0, warn = 0, i = 0; i < FCD_ARRAY_SIZE(avgs); ++i) {
 
-			if (avgs[i] >= fcd_loadavg_crit[i]) {
+			if (avgs[i] >= fcd_cfg->loadavg_crit[i]) {
 				fail = 1;
 				warn = 0;
 				break;
 			}
 
-			if (avgs[i] >= fcd_loadavg_warn[i])
+			if (avgs[i] >= fcd_cfg->loadavg_warn[i])
 				warn = 1;
 		}
 
@@ -140,6 +139,22 @@ static void *fcd_loadavg_fn(void *arg)
 
 		fcd_lib_set_mon_status(mon, buf, warn, fail, NULL, 0);
 
+		fcd_metrics_add(mon,
+			"# HELP freecusd_load_average System load average\n"
+			"# TYPE freecusd_load_average gauge\n"
+			"freecusd_load_average{period=\"1m\"} %g\n"
+			"freecusd_load_average{period=\"5m\"} %g\n"
+			"freecusd_load_average{period=\"15m\"} %g\n",
+			avgs[0], avgs[1], avgs[2]);
+		fcd_metrics_publish(mon);
+
+		if ((shm = fcd_shm_write_begin()) != NULL) {
+			memcpy(shm->loadavg, avgs, sizeof shm->loadavg);
+			fcd_shm_write_end(shm);
+		}
+
+		fcd_trend_add(FCD_TREND_LOADAVG, avgs[0] * 100.0 + 0.5);
+
 		ret = fcd_lib_monitor_sleep(30);
 		if (ret == -1)
 			fcd_loadavg_close_and_disable(fp, mon);
@@ -155,9 +170,11 @@ static void *fcd_loadavg_fn(void *arg)
 static void fcd_loadavg_dump_cfg(void)
 {
 	FCD_DUMP("\twarning: %.2f %.2f %.2f\n",
-		 fcd_loadavg_warn[0], fcd_loadavg_warn[1], fcd_loadavg_warn[2]);
+		 fcd_cfg->loadavg_warn[0], fcd_cfg->loadavg_warn[1],
+		 fcd_cfg->loadavg_warn[2]);
 	FCD_DUMP("\tcritical: %.2f %.2f %.2f\n",
-		 fcd_loadavg_crit[0], fcd_loadavg_crit[1], fcd_loadavg_crit[2]);
+		 fcd_cfg->loadavg_crit[0], fcd_cfg->loadavg_crit[1],
+		 fcd_cfg->loadavg_crit[2]);
 }
 
 struct fcd_monitor fcd_loadavg_monitor = {
@@ -21,8 +21,11 @@
 #include <sys/un.h>
 #include <stdarg.h>
 #include <locale.h>
+#include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <time.h>
+#include <poll.h>
 
 static struct fcd_monitor fcd_main_logo = {
 	/* see https://github.com/ipilcher/n5550/issues/15 */
@@ -45,11 +48,25 @@ struct fcd_monitor *fcd_monitors[] = {
 	&fcd_smart_monitor,
 	&fcd_hddtemp_monitor,		/* Part of the S.M.A.R.T. monitor */
 	&fcd_raid_monitor,
+	&fcd_trend_monitor,
 	NULL
 };
 
 static volatile sig_atomic_t fcd_main_got_exit_signal = 0;
+static volatile sig_atomic_t fcd_main_got_reload_signal = 0;
+static volatile sig_atomic_t fcd_main_got_stats_signal = 0;
 static _Bool fcd_main_systemd = 0;
+static const char *fcd_main_tty = "/dev/ttyS0";
+static unsigned fcd_main_bench_frames = 0;
+static char **fcd_main_mdstat_files = NULL;
+static int fcd_main_mdstat_count = 0;
+static const char *fcd_main_uevent_path = NULL;
+static const char *fcd_main_metrics_spec = NULL;
+static const char *fcd_main_ctl_path = "/run/freecusd.sock";
+static const char *fcd_main_root = NULL;
+static const char *fcd_main_history_path = "/var/lib/freecusd/history";
+static const char *fcd_main_rec_path = NULL;
+static enum fcd_rec_mode fcd_main_rec_mode = FCD_REC_MODE_OFF;
 
 /*
  * See https://sourceware.org/ml/libc-alpha/2012-06/msg00335.html for a
@@ -57,10 +74,14 @@ static _Bool fcd_main_systemd = 0;
  */
 __thread volatile sig_atomic_t fcd_thread_exit_flag = 0;
 
-static const struct timespec fcd_main_sleep = {
-	.tv_sec		= 3,
-	.tv_nsec	= 0,
-};
+/*
+ * Maximum time (milliseconds) between alert/PWM updates.  The LCD page
+ * rotation is handled separately (see page.c).
+ */
+static const int fcd_main_tick = 1000;
+
+/* For timing startup phases */
+static struct timespec fcd_main_start_time;
 
 static const struct sockaddr_un fcd_main_log_addr = {
 	.sun_family	= AF_UNIX,
@@ -80,10 +101,34 @@ static void fcd_main_sig_handler(int signum)
 	if (signum == SIGINT || signum == SIGTERM)
 		fcd_main_got_exit_signal = 1;
 
+	if (signum == SIGHUP)
+		fcd_main_got_reload_signal = 1;
+
+	if (signum == SIGUSR2)
+		fcd_main_got_stats_signal = 1;
+
 	if (signum == SIGUSR1)
 		fcd_thread_exit_flag = 1;
 }
 
+/*
+ * Logs the time since the daemon started.  (The fan is forced to full speed by
+ * fcd_pwm_init(), so the "fan control" phase is the one that matters most.)
+ */
+static void fcd_main_phase(const char *const phase)
+{
+	struct timespec now;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &now) == -1) {
+		FCD_PERROR("clock_gettime");
+		return;
+	}
+
+	FCD_INFO("Startup: %s after %.1f ms\n", phase,
+		 (now.tv_sec - fcd_main_start_time.tv_sec) * 1000.0
+		 + (now.tv_nsec - fcd_main_start_time.tv_nsec) / 1000000.0);
+}
+
 static void fcd_main_enable_coredump(void)
 {
 	static const struct rlimit unlimited = { RLIM_INFINITY, RLIM_INFINITY};
@@ -121,12 +166,154 @@ static void fcd_main_parse_args(int argc, char *argv[])
 					 "file name\n");
 			}
 		}
+		else if (strcmp("-t", argv[i]) == 0) {
+			if (++i < argc) {
+				fcd_main_tty = argv[i];
+			}
+			else {
+				FCD_WARN("Option '-t' not followed by "
+					 "device name\n");
+			}
+		}
+		else if (strcmp("-u", argv[i]) == 0) {
+			if (++i < argc) {
+				fcd_main_uevent_path = argv[i];
+			}
+			else {
+				FCD_WARN("Option '-u' not followed by "
+					 "socket path\n");
+			}
+		}
+		else if (strcmp("-m", argv[i]) == 0) {
+			if (++i < argc) {
+				fcd_main_metrics_spec = argv[i];
+			}
+			else {
+				FCD_WARN("Option '-m' not followed by "
+					 "socket address\n");
+			}
+		}
+		else if (strcmp("-S", argv[i]) == 0) {
+			if (++i < argc) {
+				fcd_main_ctl_path = argv[i];
+			}
+			else {
+				FCD_WARN("Option '-S' not followed by "
+					 "socket path\n");
+			}
+		}
+		else if (strcmp("-b", argv[i]) == 0) {
+			if (++i < argc && atoi(argv[i]) > 0) {
+				fcd_main_bench_frames = atoi(argv[i]);
+			}
+			else {
+				FCD_WARN("Option '-b' not followed by "
+					 "frame count\n");
+			}
+		}
+		else if (strcmp("-r", argv[i]) == 0) {
+			if (++i < argc) {
+				fcd_main_root = argv[i];
+			}
+			else {
+				FCD_WARN("Option '-r' not followed by "
+					 "directory name\n");
+			}
+		}
+		else if (strcmp("-R", argv[i]) == 0
+				|| strcmp("-P", argv[i]) == 0) {
+			if (++i < argc) {
+				fcd_main_rec_path = argv[i];
+				fcd_main_rec_mode = (argv[i - 1][1] == 'R')
+							? FCD_REC_MODE_RECORD
+							: FCD_REC_MODE_REPLAY;
+			}
+			else {
+				FCD_WARN("Option '%s' not followed by "
+					 "file name\n", argv[i - 1]);
+			}
+		}
+		else if (strcmp("-H", argv[i]) == 0) {
+			if (++i < argc) {
+				/* "-H none" disables the history file */
+				fcd_main_history_path =
+					(strcmp(argv[i], "none") == 0) ? NULL
+								       : argv[i];
+			}
+			else {
+				FCD_WARN("Option '-H' not followed by "
+					 "file name\n");
+			}
+		}
+		else if (strcmp("-x", argv[i]) == 0) {
+			if (++i < argc && atoi(argv[i]) > 0) {
+				fcd_sched_speedup = atoi(argv[i]);
+			}
+			else {
+				FCD_WARN("Option '-x' not followed by "
+					 "speedup factor\n");
+			}
+		}
+		else if (strcmp("-M", argv[i]) == 0) {
+			/* All remaining arguments are mdstat captures */
+			if (++i < argc) {
+				fcd_main_mdstat_files = &argv[i];
+				fcd_main_mdstat_count = argc - i;
+				break;
+			}
+			FCD_WARN("Option '-M' not followed by file name\n");
+		}
 		else {
 			FCD_WARN("Unknown option: '%s'\n", argv[i]);
 		}
 	}
 }
 
+/*
+ * Sets the fake root directory (see lib.c).  -r takes precedence over
+ * FREECUSD_ROOT.  The path must be resolved before daemon() changes the
+ * working directory.
+ */
+static void fcd_main_set_root(void)
+{
+	char *root;
+
+	if (fcd_main_root == NULL)
+		fcd_main_root = getenv("FREECUSD_ROOT");
+
+	if (fcd_main_root == NULL || *fcd_main_root == 0)
+		return;
+
+	root = realpath(fcd_main_root, NULL);
+	if (root == NULL)
+		FCD_PFATAL(fcd_main_root);
+
+	if (strcmp(root, "/") == 0) {
+		free(root);
+		return;
+	}
+
+	/* Never freed */
+	fcd_lib_root = root;
+	FCD_INFO("Using fake root directory: %s\n", root);
+}
+
+/*
+ * Opens the recording or replay file (see rec.c).  Must be called after
+ * fcd_main_set_root() and before daemon() changes the working directory.
+ */
+static void fcd_main_rec_open(void)
+{
+	if (fcd_main_rec_mode == FCD_REC_MODE_OFF)
+		return;
+
+	/* Don't let a replay drive the real fan & LEDs */
+	if (fcd_main_rec_mode == FCD_REC_MODE_REPLAY && fcd_lib_root == NULL)
+		FCD_FATAL("Replay (-P) requires a fake root directory (-r)\n");
+
+	fcd_rec_open(fcd_main_rec_path, fcd_main_rec_mode);
+}
+
 /*
  * If not running in foreground mode, open a file descriptor to the syslog
  * daemon that a forked child can use for (pre-exec) error reporting.
@@ -144,20 +331,65 @@ static void fcd_main_child_log_open(void)
 		FCD_PABORT(fcd_main_log_addr.sun_path);
 }
 
+/*
+ * A single thread can manage multiple monitors (e.g. the core & IT87
+ * temperature monitors).  Returns the monitor that "owns" the thread that
+ * runs mon (which may be mon itself), or NULL if mon has no thread.
+ */
+static struct fcd_monitor *fcd_main_thread_owner(struct fcd_monitor *mon)
+{
+	struct fcd_monitor **m;
+
+	if (mon->monitor_fn == 0 || !mon->enabled)
+		return NULL;
+
+	for (m = fcd_monitors; *m != mon; ++m) {
+
+		if ((*m)->monitor_fn == mon->monitor_fn && (*m)->enabled)
+			return *m;
+	}
+
+	return mon;
+}
+
 static void fcd_main_start_mon_threads(void)
 {
 	struct fcd_monitor *mon, **m;
+	unsigned slots, readers;
 	int ret;
 
+	for (slots = 0, readers = 0, m = fcd_monitors; mon = *m, mon != NULL;
+									++m) {
+		if (fcd_main_thread_owner(mon) != mon)
+			continue;
+
+		mon->sched_slot = slots++;
+		if (!mon->no_replay)
+			++readers;
+	}
+
+	/* Known before any thread can run out of input; see rec.c */
+	if (fcd_rec_mode == FCD_REC_MODE_REPLAY)
+		fcd_rec_set_readers(readers);
+
+	/* Monitors that share a thread also share its slot; see sched.c */
 	for (m = fcd_monitors; mon = *m, mon != NULL; ++m) {
 
-		if (mon->monitor_fn != 0 && mon->enabled) {
+		if (fcd_main_thread_owner(mon) != NULL)
+			mon->sched_slot = fcd_main_thread_owner(mon)->sched_slot;
+	}
 
-			ret = pthread_create(&mon->tid, NULL,
-					     mon->monitor_fn, mon);
-			if (ret != 0)
-				FCD_PT_ABRT("pthread_create", ret);
-		}
+	fcd_sched_init(slots);
+
+	for (m = fcd_monitors; mon = *m, mon != NULL; ++m) {
+
+		if (fcd_main_thread_owner(mon) != mon)
+			continue;
+
+		ret = pthread_create(&mon->tid, NULL,
+				     fcd_sched_thread_fn, mon);
+		if (ret != 0)
+			FCD_PT_ABRT("pthread_create", ret);
 	}
 }
 
@@ -182,9 +414,12 @@ static void fcd_main_stop_mon_threads(void)
 
 	for (mon = fcd_monitors; *mon != NULL; ++mon) {
 
-		if ((*mon)->monitor_fn != 0 && (*mon)->enabled)
+		if (fcd_main_thread_owner(*mon) == *mon)
 			fcd_main_stop_thread((*mon)->tid);
 	}
+
+	fcd_sched_log_stats();
+	fcd_hist_write(NULL);
 }
 
 static void fcd_main_sigmask(sigset_t *mask, ...)
@@ -235,40 +470,177 @@ static void fcd_main_set_sig_handler(void)
 		FCD_PABORT("sigaction");
 	if (sigaction(SIGUSR1, &sa, NULL) == -1)
 		FCD_PABORT("sigaction");
+	if (sigaction(SIGHUP, &sa, NULL) == -1)
+		FCD_PABORT("sigaction");
+	if (sigaction(SIGUSR2, &sa, NULL) == -1)
+		FCD_PABORT("sigaction");
 	if (sigaction(SIGCHLD, &sa, NULL) == -1)
 		FCD_PABORT("sigaction");
 }
 
-static void fcd_main_read_monitor(int tty_fd, struct fcd_monitor *mon)
+/*
+ * Also records how long the main thread waits for (and holds) the monitor's
+ * mutex; see hist.c.
+ */
+static void fcd_main_read_monitor(struct fcd_monitor *mon)
 {
+	long long start, locked;
 	int ret;
 
 	if (mon->enabled) {
 
+		if (mon->lock_wait_hist == NULL) {
+			mon->lock_wait_hist = fcd_hist_get(FCD_HIST_LOCK_WAIT,
+							   mon->name);
+			mon->lock_hold_hist = fcd_hist_get(FCD_HIST_LOCK_HOLD,
+							   mon->name);
+		}
+
+		start = fcd_hist_now();
+
 		ret = pthread_mutex_lock(&mon->mutex);
 		if (ret != 0)
 			FCD_PT_ABRT("pthread_mutex_lock", ret);
 
-		if (!mon->silent)
-			fcd_tty_write_msg(tty_fd, mon);
+		locked = fcd_hist_now();
 
 		fcd_alert_read_monitor(mon);
 		fcd_pwm_update(mon);
+		fcd_page_update(mon);
 
 		ret = pthread_mutex_unlock(&mon->mutex);
 		if (ret != 0)
 			FCD_PT_ABRT("pthread_mutex_unlock", ret);
+
+		fcd_hist_record(mon->lock_hold_hist, fcd_hist_now() - locked);
+		fcd_hist_record(mon->lock_wait_hist, locked - start);
+	}
+}
+
+static void fcd_main_show_page(struct fcd_monitor *mon)
+{
+	static struct fcd_hist *hist;
+	long long start;
+	int ret;
+
+	if (hist == NULL)
+		hist = fcd_hist_get(FCD_HIST_LCD_WRITE, NULL);
+
+	ret = pthread_mutex_lock(&mon->mutex);
+	if (ret != 0)
+		FCD_PT_ABRT("pthread_mutex_lock", ret);
+
+	fcd_page_fill(mon);
+	start = fcd_hist_now();
+	fcd_tty_write_msg(mon);
+	fcd_hist_record(hist, fcd_hist_now() - start);
+	fcd_page_shown(mon);
+
+	ret = pthread_mutex_unlock(&mon->mutex);
+	if (ret != 0)
+		FCD_PT_ABRT("pthread_mutex_unlock", ret);
+}
+
+/*
+ * Waits for a button press, for the current page to expire, or for the next
+ * tick.  Disk hotplug events and control socket requests are handled while
+ * waiting.  Returns the button
+ * pressed (FCD_BUTTON_NONE on timeout, signal, or hotplug event).
+ */
+static enum fcd_button fcd_main_wait(void)
+{
+	struct pollfd pfds[2 + FCD_CTL_POLLFDS];
+	unsigned ctl_fds;
+	int ret, timeout;
+
+	pfds[0].fd = fcd_tty_button_fd();
+	pfds[0].events = POLLIN;
+	pfds[1].fd = fcd_disk_hotplug_fd();
+	pfds[1].events = POLLIN;
+	ctl_fds = fcd_ctl_pollfds(pfds + 2);
+
+	timeout = fcd_page_timeout();
+	if (timeout < 0 || timeout > fcd_main_tick)
+		timeout = fcd_main_tick;
+
+	ret = poll(pfds, 2 + ctl_fds, timeout);
+	if (ret == -1) {
+		if (errno != EINTR)
+			FCD_PABORT("poll");
+		return FCD_BUTTON_NONE;
+	}
+
+	if (pfds[1].revents != 0)
+		fcd_disk_hotplug_read();
+
+	fcd_ctl_handle(pfds + 2, ctl_fds);
+
+	if (pfds[0].revents == 0)
+		return FCD_BUTTON_NONE;
+
+	return fcd_tty_read_button();
+}
+
+/*
+ * Front panel buttons:
+ *
+ *	UP/DOWN	- immediately display the previous/next page
+ *	ENTER	- pause/resume page rotation
+ *	ESC	- acknowledge the system warning & failure LEDs (stop blinking)
+ *
+ * SIGHUP reloads the configuration file.  SIGUSR2 logs the latency histograms
+ * (see hist.c).
+ */
+static void fcd_main_loop(void)
+{
+	struct fcd_monitor **mon;
+
+	while (!fcd_main_got_exit_signal) {
+
+		if (fcd_main_got_reload_signal) {
+			fcd_main_got_reload_signal = 0;
+			fcd_conf_reload();
+			fcd_pwm_reload();
+		}
+
+		if (fcd_main_got_stats_signal) {
+			fcd_main_got_stats_signal = 0;
+			fcd_hist_write(NULL);
+		}
+
+		for (mon = fcd_monitors; *mon != NULL; ++mon)
+			fcd_main_read_monitor(*mon);
+
+		fcd_alert_apply();
+		fcd_pwm_expire();
+
+		fcd_main_show_page(fcd_page_select());
+
+		switch (fcd_main_wait()) {
+
+			case FCD_BUTTON_UP:	fcd_page_step(-1);	break;
+			case FCD_BUTTON_DOWN:	fcd_page_step(1);	break;
+			case FCD_BUTTON_ENTER:	fcd_page_toggle_pause();	break;
+			case FCD_BUTTON_ESC:	fcd_alert_ack();	break;
+			case FCD_BUTTON_NONE:	break;
+		}
 	}
 }
 
 int main(int argc, char *argv[])
 {
 	sigset_t worker_sigmask, main_sigmask;
-	struct fcd_monitor **mon;
-	pthread_t reaper_thread;
-	int tty_fd, ret;
+	pthread_t log_thread, reaper_thread, tty_thread, metrics_thread;
+	pthread_t history_thread;
+	_Bool metrics, history;
+	int ret;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &fcd_main_start_time) == -1)
+		FCD_PABORT("clock_gettime");
 
 	fcd_main_parse_args(argc, argv);
+	fcd_main_set_root();
+	fcd_main_rec_open();
 	if (fcd_err_foreground) {
 		fcd_main_enable_coredump();
 	}
@@ -281,13 +653,25 @@ int main(int argc, char *argv[])
 
 	fcd_conf_parse();
 	setlocale(LC_NUMERIC, "");
+	fcd_main_phase("configuration parsed");
 
-	fcd_main_sigmask(&worker_sigmask, SIGINT, SIGTERM, SIGCHLD, SIGUSR1, 0);
-	fcd_main_sigmask(&main_sigmask, -SIGINT, -SIGTERM, SIGCHLD, SIGUSR1, 0);
+	/* Parser benchmark runs without any threads */
+	if (fcd_main_mdstat_count != 0) {
+		ret = fcd_raid_bench(fcd_main_mdstat_files,
+				     fcd_main_mdstat_count);
+		exit(ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+	}
+
+	fcd_main_sigmask(&worker_sigmask,
+			 SIGINT, SIGTERM, SIGCHLD, SIGUSR1, SIGHUP, SIGUSR2, 0);
+	fcd_main_sigmask(&main_sigmask,
+			 -SIGINT, -SIGTERM, SIGCHLD, SIGUSR1, -SIGHUP, -SIGUSR2,
+			 0);
 	fcd_main_sigmask(&fcd_mon_ppoll_sigmask,
-			 SIGINT, SIGTERM, SIGCHLD, -SIGUSR1, 0);
+			 SIGINT, SIGTERM, SIGCHLD, -SIGUSR1, SIGHUP, SIGUSR2, 0);
 	fcd_main_sigmask(&fcd_proc_ppoll_sigmask,
-			 SIGINT, SIGTERM, -SIGCHLD, -SIGUSR1, 0);
+			 SIGINT, SIGTERM, -SIGCHLD, -SIGUSR1, SIGHUP, SIGUSR2,
+			 0);
 
 	ret = pthread_sigmask(SIG_SETMASK, &worker_sigmask, NULL);
 	if (ret != 0)
@@ -295,46 +679,99 @@ int main(int argc, char *argv[])
 
 	fcd_main_set_sig_handler();
 
+	/* Everything logged from here on goes through the logger thread */
+	fcd_err_log_init();
+	ret = pthread_create(&log_thread, NULL, fcd_err_log_fn, NULL);
+	if (ret != 0)
+		FCD_PT_ABRT("pthread_create", ret);
+
+	/*
+	 * Take control of the fan and alert LEDs first.  The LCD (PIC reset,
+	 * etc.) is brought up asynchronously by the LCD thread.
+	 */
+	/* Before the fan is touched, so the initial PWM state is exported */
+	metrics = fcd_main_bench_frames == 0 && fcd_main_metrics_spec != NULL
+			&& fcd_metrics_open(fcd_main_metrics_spec) == 0;
+	if (fcd_main_bench_frames == 0)
+		fcd_shm_open();
+
+	if (fcd_main_bench_frames == 0) {
+		fcd_pwm_init();
+		fcd_main_phase("fan control");
+		fcd_alert_leds_open();
+		fcd_main_phase("alert LEDs");
+		fcd_disk_hotplug_open(fcd_main_uevent_path);
+		fcd_ctl_open(fcd_main_ctl_path);
+	}
+
 	ret = pthread_create(&reaper_thread, NULL, fcd_proc_fn, NULL);
 	if (ret != 0)
 		FCD_PT_ABRT("pthread_create", ret);
 
-	fcd_main_start_mon_threads();
+	fcd_tty_open(fcd_main_tty);
 
-	ret = pthread_sigmask(SIG_SETMASK, &main_sigmask, NULL);
+	ret = pthread_create(&tty_thread, NULL, fcd_tty_fn, NULL);
 	if (ret != 0)
-		FCD_PT_ABRT("pthread_sigmask", ret);
+		FCD_PT_ABRT("pthread_create", ret);
 
-	fcd_pic_setup_gpio();
-	fcd_pic_reset();
-	tty_fd = fcd_tty_open("/dev/ttyS0");
-	fcd_alert_leds_open();
-	fcd_pwm_init();
+	history = 0;
+	if (fcd_main_bench_frames == 0) {
+		fcd_trend_init();
+		history = fcd_main_history_path != NULL
+				&& fcd_histfile_open(fcd_main_history_path) == 0;
+		fcd_main_start_mon_threads();
+	}
 
-	while (!fcd_main_got_exit_signal) {
+	if (history) {
+		ret = pthread_create(&history_thread, NULL, fcd_histfile_fn,
+				     NULL);
+		if (ret != 0)
+			FCD_PT_ABRT("pthread_create", ret);
+	}
 
-		for (mon = fcd_monitors; *mon != NULL; ++mon) {
+	if (metrics) {
+		ret = pthread_create(&metrics_thread, NULL, fcd_metrics_fn,
+				     NULL);
+		if (ret != 0)
+			FCD_PT_ABRT("pthread_create", ret);
+	}
 
-			fcd_main_read_monitor(tty_fd, *mon);
+	ret = pthread_sigmask(SIG_SETMASK, &main_sigmask, NULL);
+	if (ret != 0)
+		FCD_PT_ABRT("pthread_sigmask", ret);
 
-			if (!(*mon)->silent) {
-				ret = nanosleep(&fcd_main_sleep, NULL);
-				if (ret == -1 && errno != EINTR)
-					FCD_PABORT("nanosleep");
-			}
+	fcd_main_phase("threads started");
 
-			if (fcd_main_got_exit_signal)
-				break;
-		}
+	if (fcd_main_bench_frames != 0) {
+		fcd_bench_run(fcd_main_bench_frames);
+	}
+	else {
+		fcd_main_loop();
+		fcd_ctl_close();
+		fcd_disk_hotplug_close();
+		fcd_alert_leds_close();
+		fcd_pwm_fini();
 	}
 
-	fcd_alert_leds_close();
-	fcd_pwm_fini();
-	if (close(tty_fd) == -1)
-		FCD_PERROR("close");
-
-	fcd_main_stop_mon_threads();
+	fcd_main_stop_thread(tty_thread);
+	fcd_tty_close();
+
+	if (metrics)
+		fcd_main_stop_thread(metrics_thread);
+	if (fcd_main_bench_frames == 0)
+		fcd_main_stop_mon_threads();
+	/* After the monitors, so it saves their last samples */
+	if (history) {
+		fcd_main_stop_thread(history_thread);
+		fcd_histfile_close();
+	}
+	if (fcd_main_bench_frames == 0)
+		fcd_trend_fini();
+	fcd_metrics_close();
+	fcd_shm_close();
 	fcd_main_stop_thread(reaper_thread);
+	fcd_rec_close();
+	fcd_main_stop_thread(log_thread);
 	if (!fcd_err_foreground && close(fcd_err_child_errfd) == -1)
 		FCD_PERROR(fcd_main_log_addr.sun_path);
 
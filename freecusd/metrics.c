@@ -0,0 +1,724 @@
+/*
+ * Copyright 2020 Ian Pilcher <arequipeno@gmail.com>
+ *
+ * This program is free software.  You can redistribute it or modify it under
+ * the terms of version 2 of the GNU General Public License (GPL), as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY -- without even the implied warranty of MERCHANTIBILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the text of the GPL for more details.
+ *
+ * Version 2 of the GNU General Public License is available at:
+ *
+ *   http://www.gnu.org/licenses/old-licenses/gpl-2.0.html
+ */
+
+#include "freecusd.h"
+
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <string.h>
+#include <locale.h>
+#include <errno.h>
+#include <time.h>
+#include <poll.h>
+
+/*
+ * Metrics exporter (freecusd -m unix:PATH or -m tcp:PORT).  Serves the values
+ * behind the LCD pages in the Prometheus text exposition format, as a minimal
+ * HTTP/1.0 response, so it can be scraped by Prometheus (TCP) or with
+ * "curl --unix-socket PATH http://localhost/metrics".  TCP connections are
+ * only accepted on the loopback interface.
+ *
+ * Each monitor builds its metrics "fragment" with fcd_metrics_add() as it
+ * updates its LCD text, and publishes it with fcd_metrics_publish().  The
+ * fragment buffers are swapped (no copy), and the complete response (HTTP
+ * header and all of the fragments) is rendered into a new reference-counted
+ * buffer.  Serving a scrape is just taking a reference to the current response
+ * and writing it; no locks are held while writing to the client.
+ *
+ * The latency histograms (see hist.c) change constantly, so they are rendered
+ * separately for each scrape and appended to the current response.
+ *
+ * Everything is a no-op if the exporter is not enabled.
+ */
+
+#define FCD_METRICS_REQ_SIZE	2048
+#define FCD_METRICS_TIMEOUT	2000	/* msec, per connection */
+#define FCD_METRICS_MAX_CLIENTS	8
+
+struct fcd_metrics_resp {
+	unsigned refs;
+	size_t len;
+	size_t body;		/* offset of the body (after the header) */
+	char data[];
+};
+
+static const char fcd_metrics_header[] =
+	"HTTP/1.0 200 OK\r\n"
+	"Content-Type: text/plain; version=0.0.4\r\n"
+	"Connection: close\r\n"
+	"Content-Length: %zu\r\n"
+	"\r\n";
+
+/*
+ * A scrape in progress.  resp is NULL until the request has been read; then
+ * iov[iov_next] - iov[iov_count - 1] are what remains to be sent.
+ */
+struct fcd_metrics_client {
+	int fd;
+	long long start;
+	size_t req_len;
+	struct fcd_metrics_resp *resp;
+	char *hist;
+	struct iovec iov[3];
+	unsigned iov_next;
+	unsigned iov_count;
+	char header[sizeof fcd_metrics_header + 20];
+	char req[FCD_METRICS_REQ_SIZE + 1];
+};
+
+static _Bool fcd_metrics_enabled;
+static int fcd_metrics_sock = -1;
+static const char *fcd_metrics_path;		/* NULL = TCP */
+static locale_t fcd_metrics_locale;
+
+/* Protects fcd_metrics_current, its reference count & monitors' metrics */
+static pthread_mutex_t fcd_metrics_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct fcd_metrics_resp *fcd_metrics_current;
+
+static void fcd_metrics_lock(void)
+{
+	int ret;
+
+	ret = pthread_mutex_lock(&fcd_metrics_mutex);
+	if (ret != 0)
+		FCD_PT_ABRT("pthread_mutex_lock", ret);
+}
+
+static void fcd_metrics_unlock(void)
+{
+	int ret;
+
+	ret = pthread_mutex_unlock(&fcd_metrics_mutex);
+	if (ret != 0)
+		FCD_PT_ABRT("pthread_mutex_unlock", ret);
+}
+
+/* Must be called with fcd_metrics_mutex locked */
+static void fcd_metrics_resp_put(struct fcd_metrics_resp *const resp)
+{
+	if (resp != NULL && --(resp->refs) == 0)
+		free(resp);
+}
+
+/*
+ * Renders a new response from all of the published fragments.  Called (with
+ * fcd_metrics_mutex locked) every time a monitor publishes.  On failure, the
+ * previous response continues to be served.
+ */
+static void fcd_metrics_render(void)
+{
+	struct fcd_metrics_resp *resp;
+	struct fcd_monitor **mon;
+	size_t body_len, size;
+	char *c;
+	int ret;
+
+	for (body_len = 0, mon = fcd_monitors; *mon != NULL; ++mon)
+		body_len += (*mon)->metrics.len;
+
+	ret = snprintf(NULL, 0, fcd_metrics_header, body_len);
+	if (ret < 0) {
+		FCD_PERROR("snprintf");
+		return;
+	}
+
+	size = ret + 1 + body_len;
+
+	resp = malloc(sizeof *resp + size);
+	if (resp == NULL) {
+		FCD_PERROR("malloc");
+		return;
+	}
+
+	resp->body = sprintf(resp->data, fcd_metrics_header, body_len);
+	c = resp->data + resp->body;
+
+	for (mon = fcd_monitors; *mon != NULL; ++mon) {
+		if ((*mon)->metrics.len == 0)
+			continue;	/* buf may be NULL */
+		memcpy(c, (*mon)->metrics.buf, (*mon)->metrics.len);
+		c += (*mon)->metrics.len;
+	}
+
+	resp->len = c - resp->data;
+	resp->refs = 1;
+
+	fcd_metrics_resp_put(fcd_metrics_current);
+	fcd_metrics_current = resp;
+}
+
+/*
+ * Called from the monitor thread (or the main thread for the PWM "monitor")
+ */
+
+void fcd_metrics_add(struct fcd_monitor *const mon, const char *const format,
+		     ...)
+{
+	struct fcd_metrics_text *const m = &mon->metrics_new;
+	locale_t old;
+	va_list ap;
+	size_t size;
+	char *buf;
+	int ret;
+
+	if (!fcd_metrics_enabled || m->failed)
+		return;
+
+	/* Prometheus requires '.' as the decimal point; see main() */
+	old = uselocale(fcd_metrics_locale);
+	if (old == (locale_t)0)
+		FCD_PABORT("uselocale");
+
+	while (1) {
+
+		va_start(ap, format);
+		ret = vsnprintf(m->buf + m->len, m->size - m->len, format, ap);
+		va_end(ap);
+
+		if (ret < 0) {
+			FCD_PERROR("vsnprintf");
+			m->failed = 1;
+			break;
+		}
+
+		if ((size_t)ret < m->size - m->len) {
+			m->len += ret;
+			break;
+		}
+
+		size = (m->size == 0) ? 1024 : m->size;
+		while (size <= m->len + ret)
+			size *= 2;
+
+		buf = realloc(m->buf, size);
+		if (buf == NULL) {
+			FCD_PERROR("realloc");
+			m->failed = 1;
+			break;
+		}
+
+		m->buf = buf;
+		m->size = size;
+	}
+
+	if (uselocale(old) == (locale_t)0)
+		FCD_PABORT("uselocale");
+}
+
+void fcd_metrics_publish(struct fcd_monitor *const mon)
+{
+	struct fcd_metrics_text tmp;
+
+	if (!fcd_metrics_enabled)
+		return;
+
+	if (!mon->metrics_new.failed) {
+
+		fcd_metrics_lock();
+
+		tmp = mon->metrics;
+		mon->metrics = mon->metrics_new;
+		mon->metrics_new = tmp;
+
+		fcd_metrics_render();
+
+		fcd_metrics_unlock();
+	}
+
+	mon->metrics_new.len = 0;
+	mon->metrics_new.failed = 0;
+}
+
+/*
+ * Setup & cleanup (main thread)
+ */
+
+static int fcd_metrics_socket(const char *const spec)
+{
+	struct sockaddr_in in;
+	struct sockaddr_un un;
+	struct sockaddr *addr;
+	socklen_t addr_len;
+	char *end;
+	long port;
+	int fd, one;
+
+	if (strncmp(spec, "unix:", 5) == 0) {
+
+		fcd_metrics_path = spec + 5;
+
+		if (strlen(fcd_metrics_path) >= sizeof un.sun_path) {
+			FCD_ERR("Metrics socket path too long: %s\n",
+				fcd_metrics_path);
+			return -1;
+		}
+
+		memset(&un, 0, sizeof un);
+		un.sun_family = AF_UNIX;
+		strcpy(un.sun_path, fcd_metrics_path);
+		addr = (struct sockaddr *)&un;
+		addr_len = sizeof un;
+	}
+	else if (strncmp(spec, "tcp:", 4) == 0) {
+
+		errno = 0;
+		port = strtol(spec + 4, &end, 10);
+		if (errno != 0 || *end != 0 || port < 1 || port > 65535) {
+			FCD_ERR("Invalid metrics port: %s\n", spec + 4);
+			return -1;
+		}
+
+		memset(&in, 0, sizeof in);
+		in.sin_family = AF_INET;
+		in.sin_port = htons((uint16_t)port);
+		in.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		addr = (struct sockaddr *)&in;
+		addr_len = sizeof in;
+	}
+	else {
+		FCD_ERR("Invalid metrics socket (not unix:PATH or tcp:PORT): "
+			"%s\n", spec);
+		return -1;
+	}
+
+	fd = socket(addr->sa_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd == -1) {
+		FCD_PERROR("socket");
+		return -1;
+	}
+
+	if (fcd_metrics_path != NULL) {
+		if (unlink(fcd_metrics_path) == -1 && errno != ENOENT)
+			FCD_PERROR(fcd_metrics_path);
+	}
+	else {
+		one = 1;
+		if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one,
+			       sizeof one) == -1) {
+			FCD_PERROR("setsockopt");
+		}
+	}
+
+	if (bind(fd, addr, addr_len) == -1) {
+		FCD_PERROR((fcd_metrics_path != NULL) ? fcd_metrics_path
+						      : "bind");
+		goto error;
+	}
+
+	if (listen(fd, 8) == -1) {
+		FCD_PERROR("listen");
+		goto error;
+	}
+
+	return fd;
+
+error:
+	if (close(fd) == -1)
+		FCD_PERROR("close");
+	return -1;
+}
+
+/* Returns 0 if the exporter is enabled (thread should be started), else -1 */
+int fcd_metrics_open(const char *const spec)
+{
+	fcd_metrics_locale = newlocale(LC_NUMERIC_MASK, "C", (locale_t)0);
+	if (fcd_metrics_locale == (locale_t)0) {
+		FCD_PERROR("newlocale");
+		goto error;
+	}
+
+	fcd_metrics_sock = fcd_metrics_socket(spec);
+	if (fcd_metrics_sock == -1) {
+		freelocale(fcd_metrics_locale);
+		goto error;
+	}
+
+	fcd_metrics_enabled = 1;
+
+	/* Empty response until the monitors publish */
+	fcd_metrics_lock();
+	fcd_metrics_render();
+	fcd_metrics_unlock();
+
+	FCD_INFO("Serving metrics on %s\n", spec);
+	return 0;
+
+error:
+	FCD_WARN("Metrics exporter disabled\n");
+	return -1;
+}
+
+/* Called after the exporter & monitor threads have exited */
+void fcd_metrics_close(void)
+{
+	struct fcd_monitor **mon;
+
+	if (!fcd_metrics_enabled)
+		return;
+
+	if (close(fcd_metrics_sock) == -1)
+		FCD_PERROR("close");
+
+	if (fcd_metrics_path != NULL && unlink(fcd_metrics_path) == -1)
+		FCD_PERROR(fcd_metrics_path);
+
+	for (mon = fcd_monitors; *mon != NULL; ++mon) {
+		free((*mon)->metrics.buf);
+		free((*mon)->metrics_new.buf);
+	}
+
+	fcd_metrics_resp_put(fcd_metrics_current);
+	fcd_metrics_current = NULL;
+	freelocale(fcd_metrics_locale);
+	fcd_metrics_sock = -1;
+	fcd_metrics_enabled = 0;
+}
+
+/*
+ * Exporter thread.  Clients are served concurrently with ppoll() on non-
+ * blocking sockets, so an idle or slow client can't hold up other scrapes.  A
+ * connection that hasn't been served within FCD_METRICS_TIMEOUT is closed.
+ */
+
+/* Only used by the exporter thread */
+static struct fcd_metrics_client fcd_metrics_clients[FCD_METRICS_MAX_CLIENTS];
+
+static long long fcd_metrics_now(void)
+{
+	struct timespec now;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &now) == -1)
+		FCD_PABORT("clock_gettime");
+
+	return now.tv_sec * 1000LL + now.tv_nsec / 1000000;
+}
+
+static void fcd_metrics_drop(struct fcd_metrics_client *const client)
+{
+	if (close(client->fd) == -1)
+		FCD_PERROR("close");
+
+	if (client->resp != NULL) {
+		fcd_metrics_lock();
+		fcd_metrics_resp_put(client->resp);
+		fcd_metrics_unlock();
+	}
+
+	free(client->hist);
+
+	client->fd = -1;
+	client->resp = NULL;
+	client->hist = NULL;
+}
+
+static void fcd_metrics_accept(void)
+{
+	struct fcd_metrics_client *client;
+	unsigned i;
+	int fd;
+
+	fd = accept4(fcd_metrics_sock, NULL, NULL,
+		     SOCK_CLOEXEC | SOCK_NONBLOCK);
+	if (fd == -1) {
+		if (errno != EAGAIN && errno != EINTR && errno != ECONNABORTED)
+			FCD_PERROR("accept4");
+		return;
+	}
+
+	for (i = 0; i < FCD_METRICS_MAX_CLIENTS; ++i) {
+
+		client = &fcd_metrics_clients[i];
+
+		if (client->fd == -1) {
+			client->fd = fd;
+			client->start = fcd_metrics_now();
+			client->req_len = 0;
+			return;
+		}
+	}
+
+	FCD_WARN("Too many metrics connections\n");
+	if (close(fd) == -1)
+		FCD_PERROR("close");
+}
+
+/*
+ * Renders the histograms; returns NULL on error.  (Called in the exporter
+ * thread, so it can switch its own locale.)
+ */
+static char *fcd_metrics_hist(size_t *const len)
+{
+	locale_t old;
+	char *buf;
+	FILE *out;
+
+	out = open_memstream(&buf, len);
+	if (out == NULL) {
+		FCD_PERROR("open_memstream");
+		return NULL;
+	}
+
+	old = uselocale(fcd_metrics_locale);
+	if (old == (locale_t)0)
+		FCD_PABORT("uselocale");
+
+	fcd_hist_write_metrics(out);
+
+	if (uselocale(old) == (locale_t)0)
+		FCD_PABORT("uselocale");
+
+	if (fclose(out) != 0) {
+		FCD_PERROR("fclose");
+		free(buf);
+		return NULL;
+	}
+
+	return buf;
+}
+
+/*
+ * Sets up the response, once the request has been read.  The histograms (see
+ * hist.c) change constantly, so they're rendered for each scrape; if that
+ * fails, the response is sent without them.
+ */
+static void fcd_metrics_respond(struct fcd_metrics_client *const client)
+{
+	struct fcd_metrics_resp *resp;
+	size_t hist_len;
+	int ret;
+
+	fcd_metrics_lock();
+	resp = fcd_metrics_current;
+	if (resp != NULL)
+		++(resp->refs);
+	fcd_metrics_unlock();
+
+	if (resp == NULL) {		/* fcd_metrics_render() failed */
+		fcd_metrics_drop(client);
+		return;
+	}
+
+	client->resp = resp;
+	client->hist = fcd_metrics_hist(&hist_len);
+	client->iov_next = 0;
+
+	if (client->hist == NULL || hist_len == 0) {
+		client->iov[0].iov_base = resp->data;
+		client->iov[0].iov_len = resp->len;
+		client->iov_count = 1;
+		return;
+	}
+
+	ret = snprintf(client->header, sizeof client->header,
+		       fcd_metrics_header, resp->len - resp->body + hist_len);
+	if (ret < 0 || (size_t)ret >= sizeof client->header)
+		FCD_ABORT("Metrics header too long\n");
+
+	client->iov[0].iov_base = client->header;
+	client->iov[0].iov_len = ret;
+	client->iov[1].iov_base = resp->data + resp->body;
+	client->iov[1].iov_len = resp->len - resp->body;
+	client->iov[2].iov_base = client->hist;
+	client->iov[2].iov_len = hist_len;
+	client->iov_count = 3;
+}
+
+/*
+ * Reads (and ignores) the request, so that closing the connection doesn't
+ * reset it before the client has read the response.  Every request gets the
+ * same response.
+ */
+static void fcd_metrics_read(struct fcd_metrics_client *const client)
+{
+	ssize_t ret;
+
+	ret = read(client->fd, client->req + client->req_len,
+		   FCD_METRICS_REQ_SIZE - client->req_len);
+	if (ret == -1) {
+		if (errno != EAGAIN && errno != EINTR)
+			fcd_metrics_drop(client);
+		return;
+	}
+
+	client->req_len += ret;
+	client->req[client->req_len] = 0;
+
+	if (ret != 0 && client->req_len < FCD_METRICS_REQ_SIZE
+			&& strstr(client->req, "\r\n\r\n") == NULL
+			&& strstr(client->req, "\n\n") == NULL) {
+		return;		/* wait for the rest of the request */
+	}
+
+	fcd_metrics_respond(client);
+}
+
+static void fcd_metrics_write(struct fcd_metrics_client *const client)
+{
+	struct msghdr msg;
+	struct iovec *iov;
+	size_t sent;
+	ssize_t ret;
+
+	memset(&msg, 0, sizeof msg);
+	msg.msg_iov = client->iov + client->iov_next;
+	msg.msg_iovlen = client->iov_count - client->iov_next;
+
+	ret = sendmsg(client->fd, &msg, MSG_NOSIGNAL);
+	if (ret == -1) {
+		if (errno == EAGAIN || errno == EINTR)
+			return;
+		if (errno != EPIPE && errno != ECONNRESET)
+			FCD_PERROR("sendmsg");
+		fcd_metrics_drop(client);
+		return;
+	}
+
+	for (sent = ret; client->iov_next < client->iov_count; ) {
+
+		iov = &client->iov[client->iov_next];
+
+		if (sent < iov->iov_len) {
+			iov->iov_base = (char *)iov->iov_base + sent;
+			iov->iov_len -= sent;
+			return;
+		}
+
+		sent -= iov->iov_len;
+		++client->iov_next;
+	}
+
+	fcd_metrics_drop(client);	/* response complete */
+}
+
+/*
+ * Fills in pfds (listening socket first) and returns the number of entries.
+ * Drops connections that have been open too long, and sets *timeout to when
+ * the next one will expire (NULL if there are none).
+ */
+static unsigned fcd_metrics_pollfds(struct pollfd *const pfds,
+				    struct timespec **const timeout,
+				    struct timespec *const ts)
+{
+	struct fcd_metrics_client *client;
+	long long now, next, left;
+	unsigned i, n;
+
+	pfds[0].fd = fcd_metrics_sock;
+	pfds[0].events = POLLIN;
+	now = fcd_metrics_now();
+	next = -1;
+
+	for (n = 1, i = 0; i < FCD_METRICS_MAX_CLIENTS; ++i) {
+
+		client = &fcd_metrics_clients[i];
+
+		if (client->fd == -1)
+			continue;
+
+		left = client->start + FCD_METRICS_TIMEOUT - now;
+		if (left <= 0) {
+			fcd_metrics_drop(client);
+			continue;
+		}
+
+		if (next == -1 || left < next)
+			next = left;
+
+		pfds[n].fd = client->fd;
+		pfds[n].events = (client->resp != NULL) ? POLLOUT : POLLIN;
+		++n;
+	}
+
+	if (next == -1) {
+		*timeout = NULL;
+	}
+	else {
+		ts->tv_sec = next / 1000;
+		ts->tv_nsec = next % 1000 * 1000000;
+		*timeout = ts;
+	}
+
+	return n;
+}
+
+static void fcd_metrics_handle(const struct pollfd *const pfds,
+			       const unsigned n)
+{
+	struct fcd_metrics_client *client;
+	unsigned i, j;
+
+	for (i = 1; i < n; ++i) {
+
+		if (pfds[i].revents == 0)
+			continue;
+
+		for (j = 0; j < FCD_METRICS_MAX_CLIENTS; ++j) {
+
+			client = &fcd_metrics_clients[j];
+
+			if (client->fd != pfds[i].fd)
+				continue;
+
+			if (pfds[i].revents & (POLLERR | POLLNVAL))
+				fcd_metrics_drop(client);
+			else if (client->resp != NULL)
+				fcd_metrics_write(client);
+			else
+				fcd_metrics_read(client);
+
+			break;
+		}
+	}
+
+	if (pfds[0].revents & POLLIN)
+		fcd_metrics_accept();
+}
+
+__attribute__((noreturn))
+void *fcd_metrics_fn(void *arg __attribute__((unused)))
+{
+	struct pollfd pfds[FCD_METRICS_MAX_CLIENTS + 1];
+	struct timespec ts, *timeout;
+	unsigned i, n;
+	int ret;
+
+	for (i = 0; i < FCD_METRICS_MAX_CLIENTS; ++i)
+		fcd_metrics_clients[i].fd = -1;
+
+	while (!fcd_thread_exit_flag) {
+
+		n = fcd_metrics_pollfds(pfds, &timeout, &ts);
+
+		ret = ppoll(pfds, n, timeout, &fcd_mon_ppoll_sigmask);
+		if (ret == -1) {
+			if (errno == EINTR)
+				continue;
+			FCD_PERROR("ppoll");
+			break;
+		}
+
+		fcd_metrics_handle(pfds, n);
+	}
+
+	for (i = 0; i < FCD_METRICS_MAX_CLIENTS; ++i) {
+		if (fcd_metrics_clients[i].fd != -1)
+			fcd_metrics_drop(&fcd_metrics_clients[i]);
+	}
+
+	pthread_exit(NULL);
+}
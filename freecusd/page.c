@@ -0,0 +1,458 @@
+/*
+ * Copyright 2020 Ian Pilcher <arequipeno@gmail.com>
+ *
+ * This program is free software.  You can redistribute it or modify it under
+ * the terms of version 2 of the GNU General Public License (GPL), as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY -- without even the implied warranty of MERCHANTIBILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the text of the GPL for more details.
+ *
+ * Version 2 of the GNU General Public License is available at:
+ *
+ *   http://www.gnu.org/licenses/old-licenses/gpl-2.0.html
+ */
+
+#include "freecusd.h"
+
+#include <string.h>
+#include <time.h>
+
+/*
+ * Chooses which monitor "page" is shown on the LCD.  Each page is shown for
+ * lcd_page_time seconds, multiplied by lcd_warn_weight or lcd_fail_weight if
+ * the monitor has an active warning or failure.  If lcd_pin_failures is set,
+ * rotation is limited to failed pages while any failure is active.  A page
+ * whose text hasn't changed since it was last shown (and which has no active
+ * alert) is only shown on every FCD_PAGE_IDLE_RATIO-th rotation.
+ *
+ * A monitor whose text doesn't fit on the LCD (e.g. the SMART and HDD
+ * temperature monitors, when there are more than FCD_BAY_COUNT disks) provides
+ * multiple "subpages" (see fcd_lib_set_mon_pages()).  Each subpage is shown
+ * for the page's full time before the next one; the UP and DOWN buttons also
+ * step through the subpages.
+ *
+ * Everything in this file is called in the main thread only.
+ */
+
+#define FCD_PAGE_IDLE_RATIO	2
+#define FCD_PAGE_TEXT_OFFSET	5	/* see tty.c */
+#define FCD_PAGE_TEXT_SIZE	60
+
+enum fcd_page_level {
+	FCD_PAGE_OK = 0,
+	FCD_PAGE_WARN,
+	FCD_PAGE_FAIL,
+};
+
+/* Page time, weights, etc.; see struct fcd_conf */
+static int fcd_page_time_cb();
+static int fcd_page_weight_cb();
+static int fcd_page_pin_cb();
+
+const cip_opt_info fcd_page_opts[] = {
+	{
+		.name			= "lcd_page_time",
+		.type			= CIP_OPT_TYPE_FLOAT,
+		.post_parse_fn		= fcd_page_time_cb,
+		.post_parse_data	= FCD_CONF_OFFSET(page_time),
+	},
+	{
+		.name			= "lcd_warn_weight",
+		.type			= CIP_OPT_TYPE_INT,
+		.post_parse_fn		= fcd_page_weight_cb,
+		.post_parse_data	= FCD_CONF_OFFSET(page_warn_weight),
+	},
+	{
+		.name			= "lcd_fail_weight",
+		.type			= CIP_OPT_TYPE_INT,
+		.post_parse_fn		= fcd_page_weight_cb,
+		.post_parse_data	= FCD_CONF_OFFSET(page_fail_weight),
+	},
+	{
+		.name			= "lcd_pin_failures",
+		.type			= CIP_OPT_TYPE_BOOL,
+		.post_parse_fn		= fcd_page_pin_cb,
+		.post_parse_data	= FCD_CONF_OFFSET(page_pin_fail),
+	},
+	{
+		.name			= NULL
+	}
+};
+
+static struct fcd_monitor **fcd_page_current;
+static long long fcd_page_start;	/* milliseconds */
+static _Bool fcd_page_paused;
+static _Bool fcd_page_manual;		/* current page chosen by button */
+static unsigned fcd_page_fail_count;
+
+/*
+ * Configuration callbacks
+ */
+static int fcd_page_time_cb(cip_err_ctx *ctx, const cip_ini_value *value,
+			    const cip_ini_sect *sect __attribute__((unused)),
+			    const cip_ini_file *file __attribute__((unused)),
+			    void *post_parse_data)
+{
+	const float *p;
+
+	p = (const float *)(value->value);
+
+	if (*p < 0.5 || *p > 60.0) {
+		cip_err(ctx, "LCD page time (%g) outside valid range "
+			"(0.5 - 60 seconds)", *p);
+		return -1;
+	}
+
+	*(float *)fcd_conf_member(post_parse_data) = *p;
+
+	return 0;
+}
+
+static int fcd_page_weight_cb(cip_err_ctx *ctx, const cip_ini_value *value,
+			      const cip_ini_sect *sect __attribute__((unused)),
+			      const cip_ini_file *file __attribute__((unused)),
+			      void *post_parse_data)
+{
+	const int *p;
+
+	p = (const int *)(value->value);
+
+	if (*p < 1 || *p > 10) {
+		cip_err(ctx, "LCD page weight (%d) outside valid range "
+			"(1 - 10)", *p);
+		return -1;
+	}
+
+	*(int *)fcd_conf_member(post_parse_data) = *p;
+
+	return 0;
+}
+
+static int fcd_page_pin_cb(cip_err_ctx *ctx __attribute__((unused)),
+			   const cip_ini_value *value,
+			   const cip_ini_sect *sect __attribute__((unused)),
+			   const cip_ini_file *file __attribute__((unused)),
+			   void *post_parse_data)
+{
+	*(bool *)fcd_conf_member(post_parse_data) =
+					*(const bool *)(value->value);
+	return 0;
+}
+
+/* Number of entries in fcd_monitors (not including the terminating NULL) */
+static size_t fcd_page_count(void)
+{
+	static size_t count;
+
+	if (count == 0) {
+		while (fcd_monitors[count] != NULL)
+			++count;
+	}
+
+	return count;
+}
+
+static long long fcd_page_now(void)
+{
+	struct timespec now;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &now) == -1)
+		FCD_PABORT("clock_gettime");
+
+	return now.tv_sec * 1000LL + now.tv_nsec / 1000000;
+}
+
+static _Bool fcd_page_alert_active(const enum fcd_alert_msg msg)
+{
+	return msg == FCD_ALERT_SET_REQ || msg == FCD_ALERT_SET_ACK;
+}
+
+static _Bool fcd_page_displayable(const struct fcd_monitor *const mon)
+{
+	return mon->enabled && !mon->silent;
+}
+
+static _Bool fcd_page_pinned(void)
+{
+	return fcd_cfg->page_pin_fail && fcd_page_fail_count > 0;
+}
+
+/* How long the page should be shown (milliseconds) */
+static long long fcd_page_duration(const struct fcd_monitor *const mon)
+{
+	int weight;
+
+	switch (mon->page_level) {
+		case FCD_PAGE_FAIL:	weight = fcd_cfg->page_fail_weight;
+					break;
+		case FCD_PAGE_WARN:	weight = fcd_cfg->page_warn_weight;
+					break;
+		default:		weight = 1;
+	}
+
+	return (long long)(fcd_cfg->page_time * 1000.0) * weight;
+}
+
+/*
+ * Called (with the monitor's mutex locked) to copy the current subpage's text
+ * (if the monitor has subpages) into the monitor's message buffer.
+ */
+void fcd_page_fill(struct fcd_monitor *mon)
+{
+	const char *text;
+
+	if (mon->page_count == 0)
+		return;
+
+	if (mon->subpage >= mon->page_count)
+		mon->subpage = 0;
+
+	text = mon->pages + mon->subpage * FCD_PAGE_LINES_SIZE;
+
+	memcpy(mon->buf + FCD_PAGE_TEXT_OFFSET, text, FCD_PAGE_LINES_SIZE / 2);
+	memcpy(mon->buf + FCD_PAGE_TEXT_OFFSET + FCD_PAGE_TEXT_SIZE
+						- FCD_PAGE_LINES_SIZE / 2,
+	       text + FCD_PAGE_LINES_SIZE / 2, FCD_PAGE_LINES_SIZE / 2);
+}
+
+/*
+ * Called (with the monitor's mutex locked) after the monitor's alerts have
+ * been processed.  Records the monitor's alert level, its number of subpages,
+ * and whether its text has changed since it was last shown.
+ */
+void fcd_page_update(struct fcd_monitor *mon)
+{
+	unsigned level;
+
+	if (fcd_page_alert_active(mon->sys_fail))
+		level = FCD_PAGE_FAIL;
+	else if (fcd_page_alert_active(mon->sys_warn))
+		level = FCD_PAGE_WARN;
+	else
+		level = FCD_PAGE_OK;
+
+	if (mon->page_level == FCD_PAGE_FAIL && level != FCD_PAGE_FAIL)
+		--fcd_page_fail_count;
+	else if (mon->page_level != FCD_PAGE_FAIL && level == FCD_PAGE_FAIL)
+		++fcd_page_fail_count;
+
+	mon->page_level = level;
+	mon->subpage_count = mon->page_count;
+
+	fcd_page_fill(mon);
+	mon->page_changed = memcmp(mon->page_cache,
+				   mon->buf + FCD_PAGE_TEXT_OFFSET,
+				   FCD_PAGE_TEXT_SIZE) != 0;
+}
+
+/*
+ * Called (with the monitor's mutex locked) when the page has been sent to the
+ * LCD.
+ */
+void fcd_page_shown(struct fcd_monitor *mon)
+{
+	memcpy(mon->page_cache, mon->buf + FCD_PAGE_TEXT_OFFSET,
+	       FCD_PAGE_TEXT_SIZE);
+	mon->page_changed = 0;
+}
+
+/*
+ * Returns 1 if the page should be skipped during automatic rotation.
+ */
+static _Bool fcd_page_skip(struct fcd_monitor *const mon)
+{
+	if (!fcd_page_displayable(mon))
+		return 1;
+
+	if (fcd_page_pinned())
+		return mon->page_level != FCD_PAGE_FAIL;
+
+	if (mon->page_level != FCD_PAGE_OK || mon->page_changed) {
+		mon->page_unchanged = 0;
+		return 0;
+	}
+
+	return ++(mon->page_unchanged) % FCD_PAGE_IDLE_RATIO != 0;
+}
+
+static void fcd_page_set(struct fcd_monitor **const page, const _Bool manual)
+{
+	(*page)->subpage = 0;
+	fcd_page_current = page;
+	fcd_page_start = fcd_page_now();
+	fcd_page_manual = manual;
+}
+
+/*
+ * Moves to the next (dir == 1) or previous (dir == -1) subpage of the current
+ * page.  Returns 0 if there isn't one.
+ */
+static _Bool fcd_page_next_subpage(const int dir)
+{
+	struct fcd_monitor *const mon = *fcd_page_current;
+
+	if (dir > 0 && mon->subpage + 1 >= mon->subpage_count)
+		return 0;
+
+	if (dir < 0 && mon->subpage == 0)
+		return 0;
+
+	mon->subpage += dir;
+	fcd_page_start = fcd_page_now();
+
+	return 1;
+}
+
+/*
+ * Automatic rotation.  If every page is skipped (e.g. nothing has changed),
+ * the first displayable page after the current one is shown.
+ */
+static void fcd_page_rotate(void)
+{
+	struct fcd_monitor **page, **fallback;
+	size_t num_pages, i, j;
+
+	num_pages = fcd_page_count();
+	i = fcd_page_current - fcd_monitors;
+	fallback = NULL;
+
+	for (j = 1; j <= num_pages; ++j) {
+
+		page = &fcd_monitors[(i + j) % num_pages];
+
+		if (fallback == NULL && fcd_page_displayable(*page)
+				&& (!fcd_page_pinned()
+				    || (*page)->page_level == FCD_PAGE_FAIL)) {
+			fallback = page;
+		}
+
+		if (!fcd_page_skip(*page)) {
+			fcd_page_set(page, 0);
+			return;
+		}
+	}
+
+	fcd_page_set((fallback != NULL) ? fallback : fcd_page_current, 0);
+}
+
+/*
+ * Returns the page that should currently be displayed.
+ */
+struct fcd_monitor *fcd_page_select(void)
+{
+	if (fcd_page_current == NULL)
+		fcd_page_set(fcd_monitors, 0);	/* logo */
+
+	if (fcd_page_paused)
+		return *fcd_page_current;
+
+	if (fcd_page_pinned() && !fcd_page_manual
+			&& (*fcd_page_current)->page_level != FCD_PAGE_FAIL) {
+		fcd_page_rotate();
+	}
+	else if (fcd_page_now() - fcd_page_start
+					>= fcd_page_duration(*fcd_page_current)
+			&& !fcd_page_next_subpage(1)) {
+		fcd_page_rotate();
+	}
+
+	return *fcd_page_current;
+}
+
+/*
+ * Returns the number of milliseconds until the current page expires.
+ */
+int fcd_page_timeout(void)
+{
+	long long remaining;
+
+	if (fcd_page_current == NULL)
+		return 0;
+
+	if (fcd_page_paused)
+		return -1;
+
+	remaining = fcd_page_duration(*fcd_page_current)
+					- (fcd_page_now() - fcd_page_start);
+
+	return (remaining > 0) ? (int)remaining : 0;
+}
+
+/*
+ * Immediately shows the next (dir == 1) or previous (dir == -1) subpage or
+ * displayable page, ignoring weights.  (The logo is always enabled, so there's
+ * always at least one.)
+ */
+void fcd_page_step(const int dir)
+{
+	struct fcd_monitor **page;
+	size_t num_pages, i;
+
+	if (fcd_page_current != NULL && fcd_page_next_subpage(dir)) {
+		fcd_page_manual = 1;
+		return;
+	}
+
+	num_pages = fcd_page_count();
+	page = (fcd_page_current != NULL) ? fcd_page_current : fcd_monitors;
+	i = page - fcd_monitors;
+
+	do {
+		i = (i + num_pages + dir) % num_pages;
+		page = &fcd_monitors[i];
+	} while (!fcd_page_displayable(*page));
+
+	fcd_page_set(page, 1);
+}
+
+void fcd_page_toggle_pause(void)
+{
+	fcd_page_paused = !fcd_page_paused;
+	FCD_INFO("LCD page rotation %s\n",
+		 fcd_page_paused ? "paused" : "resumed");
+
+	if (!fcd_page_paused && fcd_page_current != NULL)
+		fcd_page_start = fcd_page_now();
+}
+
+/*
+ * Shows a monitor's page and pauses rotation ("freecusctl page"), or resumes
+ * rotation if mon is NULL.
+ */
+void fcd_page_pin(struct fcd_monitor *const mon)
+{
+	struct fcd_monitor **page;
+
+	if (mon == NULL) {
+		if (fcd_page_paused)
+			fcd_page_toggle_pause();
+		return;
+	}
+
+	for (page = fcd_monitors; *page != mon; ++page);
+
+	fcd_page_set(page, 1);
+
+	if (!fcd_page_paused)
+		fcd_page_toggle_pause();
+}
+
+/* Returns the page currently shown (NULL before the first page) */
+const struct fcd_monitor *fcd_page_status(_Bool *const paused)
+{
+	*paused = fcd_page_paused;
+	return (fcd_page_current != NULL) ? *fcd_page_current : NULL;
+}
+
+void fcd_page_dump_cfg(void)
+{
+	FCD_DUMP("LCD page configuration:\n");
+	FCD_DUMP("\tpage time: %.3f seconds\n", fcd_cfg->page_time);
+	FCD_DUMP("\twarning weight: %d\n", fcd_cfg->page_warn_weight);
+	FCD_DUMP("\tfailure weight: %d\n", fcd_cfg->page_fail_weight);
+	FCD_DUMP("\tpin failures: %s\n",
+		 fcd_cfg->page_pin_fail ? "true" : "false");
+	FCD_DUMP("\n");
+}
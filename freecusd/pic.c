@@ -22,15 +22,12 @@
 #include <fcntl.h>
 #include <time.h>
 
-#include <selinux/restorecon.h>
-#include <selinux/selinux.h>
-
 static int fcd_pic_gpio_is_exported(void)
 {
 	static const char path[] = "/sys/class/gpio/gpio31";
 	int ret;
 
-	ret = access(path, F_OK);
+	ret = fcd_lib_access(path, F_OK);
 	if (ret == -1) {
 		if (errno != ENOENT)
 			FCD_PERROR(path);
@@ -40,35 +37,6 @@ static int fcd_pic_gpio_is_exported(void)
 	return 1;
 }
 
-static int fcd_pic_selinux_log(const int type, const char *const format, ...)
-{
-	va_list ap;
-	int priority;
-
-	switch (type) {
-
-		case SELINUX_INFO:
-			priority = LOG_DEBUG;
-			break;
-
-		case SELINUX_WARNING:
-			priority = LOG_WARNING;
-			break;
-
-		default:
-			FCD_WARN("Unknown libselinux message type: %d\n", type);
-		case SELINUX_ERROR:
-		case SELINUX_AVC:
-			priority = LOG_ERR;
-	}
-
-	va_start(ap, format);
-	fcd_err_vmsg(priority, format, ap);
-	va_end(ap);
-
-	return 0;
-}
-
 static void fcd_pic_export_gpio(void)
 {
 	static const char export_path[] = "/sys/class/gpio/export";
@@ -80,7 +48,7 @@ static void fcd_pic_export_gpio(void)
 
 	int i, fd, warn = 0;
 
-	fd = open(export_path, O_WRONLY | O_CLOEXEC);
+	fd = fcd_lib_open(export_path, O_WRONLY | O_CLOEXEC);
 	if (fd == -1) {
 		FCD_PERROR(export_path);
 		warn = 1;
@@ -100,21 +68,8 @@ static void fcd_pic_export_gpio(void)
 		return;
 	}
 
-	if (!is_selinux_enabled())
-		return;
-
-	selinux_set_callback(SELINUX_CB_LOG, (union selinux_callback)fcd_pic_selinux_log);
-
-	/*
-	 * Despite what the man page says, selinux_restorecon doesn't seem to
-	 * actually set errno on CentOS 7, but it does log its errors via the
-	 * callback.
-	 */
-
-	for (i = 0; i < 2; ++i) {
-		if (selinux_restorecon(restorecon_paths[i], 0) != 0)
-			FCD_WARN("Failed to restore SELinux context: %s\n", restorecon_paths[i]);
-	}
+	for (i = 0; i < 2; ++i)
+		fcd_lib_restorecon(restorecon_paths[i]);
 }
 
 static void fcd_pic_set_gpio_direction(void)
@@ -122,7 +77,7 @@ static void fcd_pic_set_gpio_direction(void)
 	static const char path[] = "/sys/class/gpio/gpio31/direction";
 	int fd, warn = 0;
 
-	fd = open(path, O_WRONLY | O_CLOEXEC);
+	fd = fcd_lib_open(path, O_WRONLY | O_CLOEXEC);
 	if (fd == -1) {
 		FCD_PERROR(path);
 		warn = 1;
@@ -154,7 +109,7 @@ void fcd_pic_reset(void)
 	struct timespec req, rem;
 	int fd, ret, warn = 1;
 
-	fd = open(path, O_WRONLY | O_CLOEXEC);
+	fd = fcd_lib_open(path, O_WRONLY | O_CLOEXEC);
 	if (fd == -1) {
 		FCD_PERROR(path);
 	}
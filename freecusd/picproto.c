@@ -0,0 +1,397 @@
+/*
+ * Copyright 2013, 2020 Ian Pilcher <arequipeno@gmail.com>
+ *
+ * This program is free software.  You can redistribute it or modify it under
+ * the terms of version 2 of the GNU General Public License (GPL), as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY -- without even the implied warranty of MERCHANTIBILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the text of the GPL for more details.
+ *
+ * Version 2 of the GNU General Public License is available at:
+ *
+ *   http://www.gnu.org/licenses/old-licenses/gpl-2.0.html
+ */
+
+/*
+ * See picproto.h.  This file is also built into the tools in the lcd
+ * directory, so it must not use anything from freecusd.h (including the
+ * FCD_ERR, etc. macros).  Errors are reported through return values only.
+ */
+
+#include "picproto.h"
+
+#include <string.h>
+
+/*******************************************************************************
+ *
+ * Encoding
+ *
+ ******************************************************************************/
+
+static size_t fcd_picproto_strnlen(const char *const s, const size_t max)
+{
+	const char *end;
+
+	/* Doesn't read past max, so s needn't be terminated */
+	end = memchr(s, 0, max);
+
+	return (end == NULL) ? max : (size_t)(end - s);
+}
+
+/*
+ * 2-line message; 20 characters on each line.  (The display RAM apparently has
+ * a 20-character "line" between the 2 visible lines.)
+ */
+size_t fcd_picproto_msg(uint8_t *const body, const char *const line1,
+			const char *const line2)
+{
+	memset(body, ' ', FCD_PICPROTO_MSG_SIZE);
+	body[0] = FCD_PICPROTO_CMD_MSG;
+
+	memcpy(body + 1, line1,
+	       fcd_picproto_strnlen(line1, FCD_PICPROTO_LINE_LEN));
+	memcpy(body + 1 + 2 * FCD_PICPROTO_LINE_LEN, line2,
+	       fcd_picproto_strnlen(line2, FCD_PICPROTO_LINE_LEN));
+
+	return FCD_PICPROTO_MSG_SIZE;
+}
+
+/* 2-line message, already laid out as FCD_PICPROTO_TEXT_SIZE characters */
+size_t fcd_picproto_msg_text(uint8_t *const body, const uint8_t *const text)
+{
+	body[0] = FCD_PICPROTO_CMD_MSG;
+	memcpy(body + 1, text, FCD_PICPROTO_TEXT_SIZE);
+
+	return FCD_PICPROTO_MSG_SIZE;
+}
+
+size_t fcd_picproto_logo(uint8_t *const body, const char *const logo)
+{
+	size_t len;
+
+	len = strlen(logo);
+	if (len > FCD_PICPROTO_MAX_BODY - 1)
+		return 0;
+
+	body[0] = FCD_PICPROTO_CMD_MSG;
+	memcpy(body + 1, logo, len);
+
+	return len + 1;
+}
+
+size_t fcd_picproto_setbto(uint8_t *const body, const int bto)
+{
+	if (bto < 0 || bto > 255)
+		return 0;
+
+	body[0] = FCD_PICPROTO_CMD_SETBTO;
+	body[1] = (uint8_t)bto;
+
+	return 2;
+}
+
+/* Captured from the Thecus software; meaning unknown */
+static const uint8_t fcd_picproto_btmsg_hdr[] = {
+	FCD_PICPROTO_CMD_BTMSG, 0x61, 0x67, 0x65, 0x6e, 0x74, 0x32, 0x00, 0xb4,
+	0x0c, 0x00
+};
+
+size_t fcd_picproto_btmsg(uint8_t *const body, const char *const msg)
+{
+	static const size_t size = sizeof fcd_picproto_btmsg_hdr
+						+ FCD_PICPROTO_LINE_LEN + 1;
+
+	memset(body, 0, size);
+	memcpy(body, fcd_picproto_btmsg_hdr, sizeof fcd_picproto_btmsg_hdr);
+	memcpy(body + sizeof fcd_picproto_btmsg_hdr, msg,
+	       fcd_picproto_strnlen(msg, FCD_PICPROTO_LINE_LEN));
+
+	return size;
+}
+
+size_t fcd_picproto_status(uint8_t *const body, const char *const msg)
+{
+	static const size_t size = 34;
+	size_t len;
+
+	len = strlen(msg);
+	if (len > size - 1)
+		return 0;
+
+	memset(body, 0, size);
+	body[0] = FCD_PICPROTO_CMD_STATUS;
+	memcpy(body + 1, msg, len);
+
+	return size;
+}
+
+/* Each item is 20 characters plus a terminating NUL */
+size_t fcd_picproto_menu(uint8_t *const body, const char *const *const items,
+			 const unsigned num_items)
+{
+	static const size_t item_size = FCD_PICPROTO_LINE_LEN + 1;
+	size_t size;
+	unsigned i;
+
+	if (num_items < 1 || num_items > FCD_PICPROTO_MENU_MAX)
+		return 0;
+
+	size = 3 + num_items * item_size;
+
+	memset(body, 0, size);
+	body[0] = FCD_PICPROTO_CMD_MENU;
+	body[1] = 0x00;
+	body[2] = (uint8_t)num_items;
+
+	for (i = 0; i < num_items; ++i) {
+		memcpy(body + 3 + i * item_size, items[i],
+		       fcd_picproto_strnlen(items[i], FCD_PICPROTO_LINE_LEN));
+	}
+
+	return size;
+}
+
+size_t fcd_picproto_encode(uint8_t *const frame, const uint8_t seq,
+			   const uint8_t *const body, const size_t body_size)
+{
+	if (body_size > FCD_PICPROTO_MAX_BODY)
+		return 0;
+
+	frame[0] = FCD_PICPROTO_STX;
+	frame[1] = seq;
+	frame[2] = 0x00;
+	frame[3] = (uint8_t)body_size;
+	memcpy(frame + 4, body, body_size);
+	frame[body_size + 4] = FCD_PICPROTO_ETX;
+
+	return body_size + 5;
+}
+
+/*******************************************************************************
+ *
+ * Decoding
+ *
+ ******************************************************************************/
+
+enum fcd_picproto_state {
+	FCD_PICPROTO_ST_STX = 0,
+	FCD_PICPROTO_ST_SEQ,
+	FCD_PICPROTO_ST_ZERO,
+	FCD_PICPROTO_ST_LEN,
+	FCD_PICPROTO_ST_BODY,
+	FCD_PICPROTO_ST_ETX,
+};
+
+void fcd_picproto_parser_init(struct fcd_picproto_parser *const parser)
+{
+	parser->state = FCD_PICPROTO_ST_STX;
+}
+
+enum fcd_picproto_result fcd_picproto_parse(
+			struct fcd_picproto_parser *const parser, const uint8_t c)
+{
+	switch (parser->state) {
+
+		case FCD_PICPROTO_ST_STX:
+			if (c != FCD_PICPROTO_STX)
+				return FCD_PICPROTO_DISCARD;
+			parser->state = FCD_PICPROTO_ST_SEQ;
+			return FCD_PICPROTO_MORE;
+
+		case FCD_PICPROTO_ST_SEQ:
+			parser->seq = c;
+			parser->state = FCD_PICPROTO_ST_ZERO;
+			return FCD_PICPROTO_MORE;
+
+		case FCD_PICPROTO_ST_ZERO:
+			if (c != 0x00) {
+				parser->state = FCD_PICPROTO_ST_STX;
+				return FCD_PICPROTO_BAD;
+			}
+			parser->state = FCD_PICPROTO_ST_LEN;
+			return FCD_PICPROTO_MORE;
+
+		case FCD_PICPROTO_ST_LEN:
+			parser->len = c;
+			parser->pos = 0;
+			parser->state = (c == 0) ? FCD_PICPROTO_ST_ETX
+						 : FCD_PICPROTO_ST_BODY;
+			return FCD_PICPROTO_MORE;
+
+		case FCD_PICPROTO_ST_BODY:
+			parser->body[parser->pos++] = c;
+			if (parser->pos == parser->len)
+				parser->state = FCD_PICPROTO_ST_ETX;
+			return FCD_PICPROTO_MORE;
+
+		case FCD_PICPROTO_ST_ETX:
+			parser->state = FCD_PICPROTO_ST_STX;
+			return (c == FCD_PICPROTO_ETX) ? FCD_PICPROTO_FRAME
+						       : FCD_PICPROTO_BAD;
+	}
+
+	/* Corrupted parser state; start over */
+	parser->state = FCD_PICPROTO_ST_STX;
+	return FCD_PICPROTO_BAD;
+}
+
+int fcd_picproto_button(const struct fcd_picproto_parser *const parser)
+{
+	if (parser->len != 2 || parser->body[0] != FCD_PICPROTO_CMD_BUTTON)
+		return 0;
+
+	return parser->body[1];
+}
+
+int fcd_picproto_is_ack(const struct fcd_picproto_parser *const parser)
+{
+	return parser->len == 0;
+}
+
+/*******************************************************************************
+ *
+ * ACK tracking
+ *
+ ******************************************************************************/
+
+void fcd_picproto_tracker_init(struct fcd_picproto_tracker *const tracker,
+			       const uint8_t first_seq, const unsigned timeout,
+			       const unsigned max_tries)
+{
+	memset(tracker, 0, sizeof *tracker);
+	tracker->next_seq = first_seq;
+	tracker->timeout = timeout;
+	tracker->max_tries = max_tries;
+}
+
+size_t fcd_picproto_send(struct fcd_picproto_tracker *const tracker,
+			 uint8_t *const frame, const uint8_t *const body,
+			 const size_t body_size, const long long now)
+{
+	struct fcd_picproto_pending *p, *slot;
+	size_t size;
+	unsigned i;
+
+	/* A body builder failed; don't send an empty (ACK-like) frame */
+	if (body_size == 0)
+		return 0;
+
+	size = fcd_picproto_encode(frame, tracker->next_seq, body, body_size);
+	if (size == 0)
+		return 0;
+
+	++(tracker->next_seq);
+
+	/* Find a free slot, or the oldest outstanding frame */
+	for (slot = NULL, i = 0; i < FCD_PICPROTO_WINDOW; ++i) {
+
+		p = &tracker->pending[i];
+
+		if (!p->in_use) {
+			slot = p;
+			break;
+		}
+
+		if (slot == NULL || p->sent < slot->sent)
+			slot = p;
+	}
+
+	if (slot->in_use)
+		++(tracker->evicted);
+
+	memcpy(slot->frame, frame, size);
+	slot->size = size;
+	slot->sent = now;
+	slot->tries = 1;
+	slot->in_use = 1;
+
+	return size;
+}
+
+long long fcd_picproto_ack(struct fcd_picproto_tracker *const tracker,
+			   const uint8_t seq, const long long now)
+{
+	struct fcd_picproto_pending *p;
+	unsigned i;
+
+	for (i = 0; i < FCD_PICPROTO_WINDOW; ++i) {
+
+		p = &tracker->pending[i];
+
+		if (p->in_use && p->frame[1] == seq) {
+			p->in_use = 0;
+			++(tracker->acked);
+			return now - p->sent;
+		}
+	}
+
+	return -1;
+}
+
+const struct fcd_picproto_pending *fcd_picproto_retransmit(
+		struct fcd_picproto_tracker *const tracker, const long long now)
+{
+	struct fcd_picproto_pending *p, *oldest;
+	unsigned i;
+
+	for (oldest = NULL, i = 0; i < FCD_PICPROTO_WINDOW; ++i) {
+
+		p = &tracker->pending[i];
+
+		if (!p->in_use || now - p->sent < tracker->timeout)
+			continue;
+
+		if (p->tries >= tracker->max_tries) {
+			p->in_use = 0;
+			++(tracker->expired);
+			continue;
+		}
+
+		if (oldest == NULL || p->sent < oldest->sent)
+			oldest = p;
+	}
+
+	if (oldest != NULL) {
+		oldest->sent = now;
+		++(oldest->tries);
+		++(tracker->retransmits);
+	}
+
+	return oldest;
+}
+
+long long fcd_picproto_next_timeout(
+		const struct fcd_picproto_tracker *const tracker,
+		const long long now)
+{
+	const struct fcd_picproto_pending *p;
+	long long next, t;
+	unsigned i;
+
+	for (next = -1, i = 0; i < FCD_PICPROTO_WINDOW; ++i) {
+
+		p = &tracker->pending[i];
+
+		if (!p->in_use)
+			continue;
+
+		t = p->sent + tracker->timeout - now;
+		if (t < 0)
+			t = 0;
+
+		if (next == -1 || t < next)
+			next = t;
+	}
+
+	return next;
+}
+
+void fcd_picproto_cancel(struct fcd_picproto_tracker *const tracker)
+{
+	unsigned i;
+
+	for (i = 0; i < FCD_PICPROTO_WINDOW; ++i)
+		tracker->pending[i].in_use = 0;
+}
@@ -0,0 +1,164 @@
+/*
+ * Copyright 2020 Ian Pilcher <arequipeno@gmail.com>
+ *
+ * This program is free software.  You can redistribute it or modify it under
+ * the terms of version 2 of the GNU General Public License (GPL), as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY -- without even the implied warranty of MERCHANTIBILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the text of the GPL for more details.
+ *
+ * Version 2 of the GNU General Public License is available at:
+ *
+ *   http://www.gnu.org/licenses/old-licenses/gpl-2.0.html
+ */
+
+/*
+ * Front-panel PIC (LCD micro-controller) serial protocol.  Shared by freecusd
+ * and the tools in the lcd directory, so it must not depend on freecusd.h.
+ *
+ * Every frame (in either direction) is:
+ *
+ *	0x02 (STX), sequence number, 0x00, body length, body, 0x03 (ETX)
+ *
+ * The first byte of the body identifies the command.
+ */
+
+#ifndef FREECUSD_PICPROTO_H
+#define FREECUSD_PICPROTO_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define FCD_PICPROTO_STX		0x02
+#define FCD_PICPROTO_ETX		0x03
+#define FCD_PICPROTO_MAX_BODY		255
+#define FCD_PICPROTO_MAX_FRAME		(FCD_PICPROTO_MAX_BODY + 5)
+
+/* Commands sent to the PIC */
+#define FCD_PICPROTO_CMD_MSG		0x11	/* 2-line message or logo */
+#define FCD_PICPROTO_CMD_SETBTO		0x13
+#define FCD_PICPROTO_CMD_MENU		0x16
+#define FCD_PICPROTO_CMD_STATUS		0x19
+#define FCD_PICPROTO_CMD_BTMSG		0x1d
+
+/*
+ * Sent by the PIC.  NOTE: Neither of these has been confirmed on real hardware
+ * (see README); they are what lcd/fakepic.c sends.
+ *
+ *	button press - 2-byte body; FCD_PICPROTO_CMD_BUTTON, button code (1-4)
+ *	ACK - empty body; sequence number of the acknowledged frame
+ */
+#define FCD_PICPROTO_CMD_BUTTON		0x20
+
+#define FCD_PICPROTO_LINE_LEN		20
+#define FCD_PICPROTO_TEXT_SIZE		60	/* 3 "lines"; middle unused */
+#define FCD_PICPROTO_MSG_SIZE		(FCD_PICPROTO_TEXT_SIZE + 1)
+#define FCD_PICPROTO_MENU_MAX		10
+
+/*
+ * Message body builders.  body must point to at least FCD_PICPROTO_MAX_BODY
+ * bytes.  Each returns the size of the body, or 0 if the arguments are invalid
+ * (too long, etc.).
+ */
+extern size_t fcd_picproto_msg(uint8_t *body, const char *line1,
+			       const char *line2);
+extern size_t fcd_picproto_msg_text(uint8_t *body, const uint8_t *text);
+extern size_t fcd_picproto_logo(uint8_t *body, const char *logo);
+extern size_t fcd_picproto_setbto(uint8_t *body, int bto);
+extern size_t fcd_picproto_btmsg(uint8_t *body, const char *msg);
+extern size_t fcd_picproto_status(uint8_t *body, const char *msg);
+extern size_t fcd_picproto_menu(uint8_t *body, const char *const *items,
+				unsigned num_items);
+
+/*
+ * Builds a complete frame.  frame must point to at least
+ * FCD_PICPROTO_MAX_FRAME bytes.  Returns the size of the frame, or 0 if the
+ * body is too large.
+ */
+extern size_t fcd_picproto_encode(uint8_t *frame, uint8_t seq,
+				  const uint8_t *body, size_t body_size);
+
+/*
+ * Incremental decoder for frames received from the PIC
+ */
+
+enum fcd_picproto_result {
+	FCD_PICPROTO_MORE = 0,		/* byte consumed; frame incomplete */
+	FCD_PICPROTO_FRAME,		/* frame complete (see parser) */
+	FCD_PICPROTO_DISCARD,		/* byte outside of any frame */
+	FCD_PICPROTO_BAD,		/* malformed frame discarded */
+};
+
+struct fcd_picproto_parser {
+	int state;
+	uint8_t seq;
+	uint8_t len;
+	uint8_t pos;
+	uint8_t body[FCD_PICPROTO_MAX_BODY];
+};
+
+extern void fcd_picproto_parser_init(struct fcd_picproto_parser *parser);
+extern enum fcd_picproto_result fcd_picproto_parse(
+				struct fcd_picproto_parser *parser, uint8_t c);
+/* Returns the button code if the frame is a button press, 0 otherwise */
+extern int fcd_picproto_button(const struct fcd_picproto_parser *parser);
+/* Returns 1 if the frame is an ACK */
+extern int fcd_picproto_is_ack(const struct fcd_picproto_parser *parser);
+
+/*
+ * Sequence number assignment and ACK tracking.  Up to FCD_PICPROTO_WINDOW
+ * frames can be outstanding (sent but not acknowledged); if another frame is
+ * sent, the oldest outstanding frame is forgotten.  Unacknowledged frames are
+ * retransmitted after timeout milliseconds, up to max_tries times in total.
+ *
+ * The tracker doesn't read any clock; callers pass in the current time (in
+ * milliseconds, from any monotonic source).  It is not thread-safe.
+ */
+
+#define FCD_PICPROTO_WINDOW		8
+
+struct fcd_picproto_pending {
+	uint8_t frame[FCD_PICPROTO_MAX_FRAME];
+	size_t size;
+	long long sent;
+	unsigned tries;
+	_Bool in_use;
+};
+
+struct fcd_picproto_tracker {
+	struct fcd_picproto_pending pending[FCD_PICPROTO_WINDOW];
+	unsigned timeout;
+	unsigned max_tries;
+	uint8_t next_seq;
+	/* Statistics */
+	unsigned long acked;
+	unsigned long retransmits;
+	unsigned long expired;		/* no ACK after max_tries */
+	unsigned long evicted;		/* forgotten to make room */
+};
+
+extern void fcd_picproto_tracker_init(struct fcd_picproto_tracker *tracker,
+				      uint8_t first_seq, unsigned timeout,
+				      unsigned max_tries);
+/*
+ * Encodes & tracks a frame; returns its size (0 if the body is empty or too
+ * large)
+ */
+extern size_t fcd_picproto_send(struct fcd_picproto_tracker *tracker,
+				uint8_t *frame, const uint8_t *body,
+				size_t body_size, long long now);
+/* Returns the time (msec) between sending and the ACK, or -1 if no match */
+extern long long fcd_picproto_ack(struct fcd_picproto_tracker *tracker,
+				  uint8_t seq, long long now);
+/* Returns a frame that should be resent now, or NULL */
+extern const struct fcd_picproto_pending *fcd_picproto_retransmit(
+		struct fcd_picproto_tracker *tracker, long long now);
+/* Returns msec until the next retransmit is due, or -1 if nothing pending */
+extern long long fcd_picproto_next_timeout(
+		const struct fcd_picproto_tracker *tracker, long long now);
+/* Forgets all outstanding frames */
+extern void fcd_picproto_cancel(struct fcd_picproto_tracker *tracker);
+
+#endif		/* FREECUSD_PICPROTO_H */
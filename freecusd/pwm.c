@@ -15,15 +15,10 @@
  */
 
 #include "freecusd.h"
+#include "shm.h"
 
 #include <fcntl.h>
-
-/* Parsed PWM value */
-struct fcd_pwm_value {
-	size_t	len;		/* strlen(s) */
-	int	value;		/* 0 - 255 */
-	char	s[4];		/* value as a string */
-};
+#include <time.h>
 
 const char *const fcd_pwm_state_names[FCD_PWM_STATE_ARRAY_SIZE] = {
 	"NORMAL",
@@ -33,13 +28,14 @@ const char *const fcd_pwm_state_names[FCD_PWM_STATE_ARRAY_SIZE] = {
 
 static const char fcd_pwm_file[] = "/sys/devices/platform/it87.656/pwm3";
 static enum fcd_pwm_state fcd_pwm_current_state = FCD_PWM_STATE_NORMAL;
+static int fcd_pwm_current_value = -1;
 static int fcd_pwm_fd;
 
-static struct fcd_pwm_value fcd_pwm_values[FCD_PWM_STATE_ARRAY_SIZE] = {
-	[FCD_PWM_STATE_NORMAL]	= { .value = 170, .s = "170", .len = 3 },
-	[FCD_PWM_STATE_HIGH]	= { .value = 215, .s = "215", .len = 3 },
-	[FCD_PWM_STATE_MAX]	= { .value = 255, .s = "255", .len = 3 }
-};
+/* Manual override; end is CLOCK_MONOTONIC milliseconds (0 = no override) */
+static enum fcd_pwm_state fcd_pwm_override_state;
+static long long fcd_pwm_override_end;
+
+/* PWM values (0 - 255); see struct fcd_conf */
 
 static int fcd_pwm_cb();
 
@@ -48,19 +44,19 @@ static const cip_opt_info fcd_pwm_opts[] = {
 		.name			= "sysfan_pwm_normal",
 		.type			= CIP_OPT_TYPE_INT,
 		.post_parse_fn		= fcd_pwm_cb,
-		.post_parse_data	= &fcd_pwm_values[FCD_PWM_STATE_NORMAL],
+		.post_parse_data	= FCD_CONF_OFFSET(pwm_values[FCD_PWM_STATE_NORMAL]),
 	},
 	{
 		.name			= "sysfan_pwm_high",
 		.type			= CIP_OPT_TYPE_INT,
 		.post_parse_fn		= fcd_pwm_cb,
-		.post_parse_data	= &fcd_pwm_values[FCD_PWM_STATE_HIGH],
+		.post_parse_data	= FCD_CONF_OFFSET(pwm_values[FCD_PWM_STATE_HIGH]),
 	},
 	{
 		.name			= "sysfan_pwm_max",
 		.type			= CIP_OPT_TYPE_INT,
 		.post_parse_fn		= fcd_pwm_cb,
-		.post_parse_data	= &fcd_pwm_values[FCD_PWM_STATE_MAX],
+		.post_parse_data	= FCD_CONF_OFFSET(pwm_values[FCD_PWM_STATE_MAX]),
 	},
 	{	.name			= NULL		}
 };
@@ -73,93 +69,210 @@ static int fcd_pwm_cb(cip_err_ctx *const ctx, const cip_ini_value *const value,
 		      const cip_ini_file *const file __attribute__((unused)),
 		      void *const post_parse_data)
 {
-	struct fcd_pwm_value *pwm;
 	const int *p;
 
 	p = (const int *)(value->value);
-	pwm = post_parse_data;
-	pwm->value = *p;
 
-	if (pwm->value < 0 || pwm->value > 255) {
-		cip_err(ctx, "PWM value (%d) outside value range (0 - 255)", pwm->value);
+	if (*p < 0 || *p > 255) {
+		cip_err(ctx, "PWM value (%d) outside value range (0 - 255)", *p);
 		return -1;
 	}
 
-	pwm->len = sprintf(pwm->s, "%d", pwm->value);
+	*(int *)fcd_conf_member(post_parse_data) = *p;
 
 	return 0;
 }
 
-static void fcd_pwm_set(const enum fcd_pwm_state new)
+static void fcd_pwm_write(const int value)
 {
 	ssize_t ret;
+	char s[4];
+	int len;
+
+	len = sprintf(s, "%d", value);
+
+	ret = fcd_lib_write_attr(fcd_pwm_fd, s, len);
+	if (ret < 0)
+		FCD_PABORT(fcd_pwm_file);
+	if (ret != len)
+		FCD_ABORT("Incomplete write (%zd bytes)\n", ret);
 
+	fcd_pwm_current_value = value;
+}
+
+/* Called (in the main thread) whenever the PWM state or value changes */
+static void fcd_pwm_export(void)
+{
+	struct fcd_shm_status *shm;
+
+	fcd_metrics_add(&fcd_pwm_monitor,
+		"# HELP freecusd_fan_pwm System fan PWM value (0 - 255)\n"
+		"# TYPE freecusd_fan_pwm gauge\n"
+		"freecusd_fan_pwm %d\n"
+		"# HELP freecusd_fan_pwm_state System fan speed state\n"
+		"# TYPE freecusd_fan_pwm_state gauge\n"
+		"freecusd_fan_pwm_state{state=\"normal\"} %d\n"
+		"freecusd_fan_pwm_state{state=\"high\"} %d\n"
+		"freecusd_fan_pwm_state{state=\"max\"} %d\n",
+		fcd_pwm_current_value,
+		fcd_pwm_current_state == FCD_PWM_STATE_NORMAL,
+		fcd_pwm_current_state == FCD_PWM_STATE_HIGH,
+		fcd_pwm_current_state == FCD_PWM_STATE_MAX);
+	fcd_metrics_publish(&fcd_pwm_monitor);
+
+	if ((shm = fcd_shm_write_begin()) != NULL) {
+		shm->pwm_state = fcd_pwm_current_state;
+		shm->pwm_value = fcd_pwm_current_value;
+		fcd_shm_write_end(shm);
+	}
+}
+
+static void fcd_pwm_set(const enum fcd_pwm_state new)
+{
 	if (fcd_pwm_current_state == new)
 		return;
 
 	FCD_INFO("Changing fan speed from %s to %s\n",
 		 fcd_pwm_state_names[fcd_pwm_current_state], fcd_pwm_state_names[new]);
 
-	ret = write(fcd_pwm_fd, fcd_pwm_values[new].s, fcd_pwm_values[new].len);
-	if (ret < 0)
-		FCD_PABORT(fcd_pwm_file);
-	if ((size_t)ret != fcd_pwm_values[new].len)
-		FCD_ABORT("Incomplete write (%zd bytes)\n", ret);
-
+	fcd_pwm_write(fcd_cfg->pwm_values[new]);
 	fcd_pwm_current_state = new;
+	fcd_pwm_export();
 }
 
-void fcd_pwm_update(struct fcd_monitor *const mon)
+/*
+ * Called in the main thread after the configuration has been reloaded, in case
+ * the value for the current state has changed.
+ */
+void fcd_pwm_reload(void)
 {
-	uint8_t flags;
-	int i;
+	int value;
 
 	if (!fcd_pwm_monitor.enabled)
 		return;
 
-	if (mon->current_pwm_flags == mon->new_pwm_flags)
+	value = fcd_cfg->pwm_values[fcd_pwm_current_state];
+	if (value == fcd_pwm_current_value)
 		return;
 
-	mon->current_pwm_flags = mon->new_pwm_flags;
+	FCD_INFO("Changing %s fan speed PWM value from %d to %d\n",
+		 fcd_pwm_state_names[fcd_pwm_current_state],
+		 fcd_pwm_current_value, value);
+
+	fcd_pwm_write(value);
+	fcd_pwm_export();
+}
+
+/* Sets the fan speed from all monitors' current PWM flags; see pwmstate.c */
+static void fcd_pwm_apply(void)
+{
+	uint8_t flags;
+	int i;
 
 	for (flags = 0, i = 0; fcd_monitors[i] != NULL; ++i)
 		flags |= fcd_monitors[i]->current_pwm_flags;
 
-	/* Should fan be set to max speed? */
+	/* A manual override can't prevent max speed */
 
-	if (flags & FCD_FAN_MAX_ON) {
-		fcd_pwm_set(FCD_PWM_STATE_MAX);
+	if (fcd_pwm_override_end != 0 && !(flags & FCD_FAN_MAX_ON)) {
+		fcd_pwm_set(fcd_pwm_override_state);
 		return;
 	}
 
-	if (flags & FCD_FAN_MAX_HYST && fcd_pwm_current_state == FCD_PWM_STATE_MAX) {
-		/* Already set to max; nothing to do */
-		return;
-	}
+	fcd_pwm_set(fcd_pwm_next_state(flags, fcd_pwm_current_state));
+}
 
-	/* NOT max speed; what about high speed? */
+void fcd_pwm_update(struct fcd_monitor *const mon)
+{
+	if (!fcd_pwm_monitor.enabled)
+		return;
 
-	if (flags & FCD_FAN_HIGH_ON) {
-		fcd_pwm_set(FCD_PWM_STATE_HIGH);
+	if (mon->current_pwm_flags == mon->new_pwm_flags)
 		return;
+
+	mon->current_pwm_flags = mon->new_pwm_flags;
+	fcd_pwm_apply();
+}
+
+static long long fcd_pwm_now(void)
+{
+	struct timespec now;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &now) == -1)
+		FCD_PABORT("clock_gettime");
+
+	return now.tv_sec * 1000LL + now.tv_nsec / 1000000;
+}
+
+/*
+ * Manual fan speed override ("freecusctl fan"); main thread only.  The state
+ * is used for the given number of seconds (0 cancels the override), unless a
+ * monitor reports a temperature at or above its fan_max_on threshold.  Returns
+ * -1 if PWM control is disabled.
+ */
+int fcd_pwm_override(const enum fcd_pwm_state state, const unsigned seconds)
+{
+	if (!fcd_pwm_monitor.enabled)
+		return -1;
+
+	if (seconds == 0) {
+		if (fcd_pwm_override_end != 0)
+			FCD_INFO("Fan speed override cancelled\n");
+		fcd_pwm_override_end = 0;
+	}
+	else {
+		FCD_INFO("Fan speed overridden to %s for %u seconds\n",
+			 fcd_pwm_state_names[state], seconds);
+		fcd_pwm_override_state = state;
+		fcd_pwm_override_end = fcd_pwm_now() + seconds * 1000LL;
 	}
 
-	if (flags & FCD_FAN_HIGH_HYST && fcd_pwm_current_state >= FCD_PWM_STATE_HIGH) {
-		/* Not necessarily a no-op; fan may be set to max */
-		fcd_pwm_set(FCD_PWM_STATE_HIGH);
+	fcd_pwm_apply();
+	return 0;
+}
+
+/* Called in the main loop; ends the override when its time is up */
+void fcd_pwm_expire(void)
+{
+	if (fcd_pwm_override_end == 0 || fcd_pwm_now() < fcd_pwm_override_end)
 		return;
-	}
 
-	/* Normal speed it is */
+	FCD_INFO("Fan speed override expired\n");
+	fcd_pwm_override_end = 0;
+	fcd_pwm_apply();
+}
+
+/*
+ * Current state, PWM value, and override time remaining (seconds; 0 if none);
+ * main thread only.  Returns -1 if PWM control is disabled.
+ */
+int fcd_pwm_status(enum fcd_pwm_state *const state, int *const value,
+		   unsigned *const override)
+{
+	long long remaining;
+
+	if (!fcd_pwm_monitor.enabled)
+		return -1;
+
+	*state = fcd_pwm_current_state;
+	*value = fcd_pwm_current_value;
 
-	fcd_pwm_set(FCD_PWM_STATE_NORMAL);
+	if (fcd_pwm_override_end == 0) {
+		*override = 0;
+	}
+	else {
+		remaining = fcd_pwm_override_end - fcd_pwm_now();
+		*override = (remaining > 0) ? (remaining + 999) / 1000 : 1;
+	}
+
+	return 0;
 }
 
 void fcd_pwm_init(void)
 {
 	if (fcd_pwm_monitor.enabled) {
 
-		if ((fcd_pwm_fd = open(fcd_pwm_file, O_WRONLY | O_CLOEXEC)) < 0)
+		if ((fcd_pwm_fd = fcd_lib_open(fcd_pwm_file, O_WRONLY | O_CLOEXEC)) < 0)
 			FCD_PFATAL(fcd_pwm_file);
 
 		fcd_pwm_set(FCD_PWM_STATE_MAX);
@@ -185,10 +298,8 @@ static void fcd_pwm_dump_cfg(void)
 
 	for (i = 0; i < FCD_PWM_STATE_ARRAY_SIZE; ++i) {
 
-		FCD_DUMP("\t\t%s: %d (\"%s\"[%zd])\n", fcd_pwm_state_names[i],
-						       fcd_pwm_values[i].value,
-						       fcd_pwm_values[i].s,
-						       fcd_pwm_values[i].len);
+		FCD_DUMP("\t\t%s: %d\n", fcd_pwm_state_names[i],
+					 fcd_cfg->pwm_values[i]);
 	}
 }
 
@@ -0,0 +1,48 @@
+/*
+ * Copyright 2020 Ian Pilcher <arequipeno@gmail.com>
+ *
+ * This program is free software.  You can redistribute it or modify it under
+ * the terms of version 2 of the GNU General Public License (GPL), as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY -- without even the implied warranty of MERCHANTIBILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the text of the GPL for more details.
+ *
+ * Version 2 of the GNU General Public License is available at:
+ *
+ *   http://www.gnu.org/licenses/old-licenses/gpl-2.0.html
+ */
+
+/*
+ * See pwmstate.h.  This file is also built into sim/thermsim, so it must not
+ * use anything from freecusd.h.
+ */
+
+#include "pwmstate.h"
+
+enum fcd_pwm_state fcd_pwm_next_state(const uint8_t flags,
+				      const enum fcd_pwm_state current)
+{
+	/* Should fan be set to max speed? */
+
+	if (flags & FCD_FAN_MAX_ON)
+		return FCD_PWM_STATE_MAX;
+
+	if (flags & FCD_FAN_MAX_HYST && current == FCD_PWM_STATE_MAX)
+		return FCD_PWM_STATE_MAX;
+
+	/* NOT max speed; what about high speed? */
+
+	if (flags & FCD_FAN_HIGH_ON)
+		return FCD_PWM_STATE_HIGH;
+
+	/* Not necessarily the current state; fan may be set to max */
+
+	if (flags & FCD_FAN_HIGH_HYST && current >= FCD_PWM_STATE_HIGH)
+		return FCD_PWM_STATE_HIGH;
+
+	/* Normal speed it is */
+
+	return FCD_PWM_STATE_NORMAL;
+}
@@ -0,0 +1,70 @@
+/*
+ * Copyright 2020 Ian Pilcher <arequipeno@gmail.com>
+ *
+ * This program is free software.  You can redistribute it or modify it under
+ * the terms of version 2 of the GNU General Public License (GPL), as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY -- without even the implied warranty of MERCHANTIBILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the text of the GPL for more details.
+ *
+ * Version 2 of the GNU General Public License is available at:
+ *
+ *   http://www.gnu.org/licenses/old-licenses/gpl-2.0.html
+ */
+
+/*
+ * Fan speed decisions -- temperature thresholds to PWM flags, and PWM flags to
+ * a fan speed state.  Shared by freecusd (pwm.c) and the thermal simulator
+ * (sim/thermsim.c), so it must not depend on freecusd.h.
+ */
+
+#ifndef FREECUSD_PWMSTATE_H
+#define FREECUSD_PWMSTATE_H
+
+#include <stdint.h>
+
+/* Each monitored temperature has these associated settings */
+enum fcd_conf_temp_type {
+	FCD_CONF_TEMP_WARN		= 0,
+	FCD_CONF_TEMP_FAIL,
+	FCD_CONF_TEMP_FAN_MAX_ON,
+	FCD_CONF_TEMP_FAN_MAX_HYST,
+	FCD_CONF_TEMP_FAN_HIGH_ON,
+	FCD_CONF_TEMP_FAN_HIGH_HYST
+};
+#define FCD_CONF_TEMP_ARRAY_SIZE	(FCD_CONF_TEMP_FAN_HIGH_HYST + 1)
+
+/* Monitor PWM flags */
+#define FCD_FAN_HIGH_HYST	0x01	/* above fan high hysteresis threshold */
+#define FCD_FAN_HIGH_ON		0x02	/* at or above fan high on threshold */
+#define FCD_FAN_MAX_HYST	0x04	/* above fan max hysteresis threshold */
+#define FCD_FAN_MAX_ON		0x08	/* at or above fan max on threshold */
+
+/* Compute PWM flags from a temperature and a set of thresholds */
+__attribute__((always_inline))
+static inline uint8_t fcd_pwm_temp_flags(const int temp, const int *const conf)
+{
+	return	(temp >= conf[FCD_CONF_TEMP_FAN_MAX_ON])	* FCD_FAN_MAX_ON	|
+		(temp >  conf[FCD_CONF_TEMP_FAN_MAX_HYST])	* FCD_FAN_MAX_HYST	|
+		(temp >= conf[FCD_CONF_TEMP_FAN_HIGH_ON])	* FCD_FAN_HIGH_ON	|
+		(temp >  conf[FCD_CONF_TEMP_FAN_HIGH_HYST])	* FCD_FAN_HIGH_HYST;
+}
+
+/* Fan PWM states */
+enum fcd_pwm_state {
+	FCD_PWM_STATE_NORMAL	= 0,
+	FCD_PWM_STATE_HIGH	= 1,
+	FCD_PWM_STATE_MAX	= 2
+};
+#define FCD_PWM_STATE_ARRAY_SIZE	(FCD_PWM_STATE_MAX + 1)
+
+/*
+ * Fan speed state for the combined PWM flags of all sensors, given the current
+ * state (which determines whether the hysteresis thresholds apply).
+ */
+extern enum fcd_pwm_state fcd_pwm_next_state(uint8_t flags,
+					     enum fcd_pwm_state current);
+
+#endif		/* FREECUSD_PWMSTATE_H */
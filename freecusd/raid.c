@@ -15,8 +15,10 @@
  */
 
 #include "freecusd.h"
+#include "shm.h"
 
 #include <limits.h>
+#include <ctype.h>
 #include <string.h>
 #include <regex.h>
 #include <errno.h>
@@ -52,9 +54,9 @@ static regmatch_t fcd_raid_mdstat_array_matches_1[5];
 static const char fcd_raid_mdstat_dev_pattern[] =
 	"^([[:alnum:]-]+)"			// 1 - device name
 	"\\[([[:digit:]]+)\\]"			// 2 - device number
-	"(\\([WFSR]\\))?";			// 3 - device status
+	"((\\([WJFSR]\\))*)";			// 3 - device status flags
 
-static regmatch_t fcd_raid_mdstat_dev_matches[4];
+static regmatch_t fcd_raid_mdstat_dev_matches[5];
 
 /*
  * Regex to match/parse the end of the second line of an array in /proc/mdstat
@@ -143,6 +145,14 @@ static char *fcd_raid_mdadm_cmd[] = {
 static char *fcd_raid_uuid_buf = NULL;
 static size_t fcd_raid_uuid_buf_size = 0;
 
+/* Per-disk alerts (indexed like fcd_cfg->disks) */
+static int *fcd_raid_disks = NULL;
+static unsigned fcd_raid_disks_size = 0;
+
+/* Identity of the disk at each position (pos - 1) last time; see disk.c */
+static uint64_t *fcd_raid_disk_ids = NULL;
+static unsigned fcd_raid_disk_ids_size = 0;
+
 enum fcd_raid_type {
 	FCD_RAID_TYPE_FAULTY,
 	FCD_RAID_TYPE_LINEAR,
@@ -190,6 +200,7 @@ enum fcd_raid_dev_stat {
 	FCD_RAID_DEV_SPARE,
 	FCD_RAID_DEV_WRITEMOSTLY,
 	FCD_RAID_DEV_REPLACEMENT,
+	FCD_RAID_DEV_JOURNAL,
 };
 
 struct fcd_raid_array {
@@ -202,7 +213,8 @@ struct fcd_raid_array {
 	unsigned current_devs;
 	enum fcd_raid_type type;
 	enum fcd_raid_arr_stat array_status;
-	enum fcd_raid_dev_stat dev_status[FCD_MAX_DISK_COUNT];
+	enum fcd_raid_dev_stat *dev_status;	/* indexed by disk pos - 1 */
+	unsigned dev_count;			/* see fcd_lib_grow() */
 };
 
 static struct fcd_raid_array *fcd_raid_list = NULL;
@@ -235,7 +247,7 @@ static struct fcd_raid_array *fcd_raid_find_by_uuid(const uint32_t *uuid)
 
 	for (array = fcd_raid_list; array != NULL; array = array->next) {
 
-		if (memcmp(array->uuid, uuid, sizeof *uuid) == 0)
+		if (memcmp(array->uuid, uuid, sizeof array->uuid) == 0)
 			return array;
 	}
 
@@ -261,6 +273,10 @@ static int fcd_raid_array_unchanged(struct fcd_raid_array *array)
 	ssize_t ret;
 	char c;
 
+	/* Benchmarking or replaying; see fcd_raid_bench_lookup() & rec.c */
+	if (array->sysfs_fd == -1)
+		return 1;
+
 	if (lseek(array->sysfs_fd, SEEK_SET, 0) == -1) {
 		FCD_PERROR("lseek");
 		return -1;
@@ -361,9 +377,55 @@ static struct fcd_raid_array *fcd_raid_array_alloc(void)
 	return array;
 }
 
+/*
+ * Opens the array's sysfs array_state file (*sysfs_fd) and gets its UUID from
+ * mdadm.  Returns 0 on success, 1 if the array has gone away (-1 = error, -2 =
+ * timeout, -3 = exit signal received, -4 = mdadm output buffer size exceeded).
+ */
+static int fcd_raid_lookup(uint32_t *uuid, int *sysfs_fd, const char *buf,
+			   const regmatch_t *match, const int *pipe_fds)
+{
+	static char sysfs_file[FCD_RAID_SYSFS_FILE_SIZE];
+	int ret;
+
+	/*
+	 * When replaying (see rec.c), there is no array_state file to detect
+	 * an array being stopped and reassembled with the same name, so each
+	 * array is only looked up once.
+	 */
+	if (fcd_rec_mode == FCD_REC_MODE_REPLAY) {
+		*sysfs_fd = -1;
+		return fcd_raid_get_uuid(uuid, buf, match, pipe_fds);
+	}
+
+	sprintf(sysfs_file, "/sys/devices/virtual/block/%.*s/md/array_state",
+		(int)(match->rm_eo - match->rm_so), buf + match->rm_so);
+	*sysfs_fd = fcd_lib_open(sysfs_file, O_RDONLY | O_CLOEXEC);
+	if (*sysfs_fd == -1) {
+		if (errno == ENOENT)
+			return 1;
+		FCD_PERROR(sysfs_file);
+		return -1;
+	}
+
+	ret = fcd_raid_get_uuid(uuid, buf, match, pipe_fds);
+	if (ret < 0) {
+		if (close(*sysfs_fd) == -1)
+			FCD_PERROR("close");
+		return ret;
+	}
+
+	return 0;
+}
+
+/* Replaced when benchmarking the parser; see fcd_raid_bench() */
+static int (*fcd_raid_lookup_fn)(uint32_t *uuid, int *sysfs_fd,
+				 const char *buf, const regmatch_t *match,
+				 const int *pipe_fds) = fcd_raid_lookup;
+
 static int fcd_raid_find_array_error(int fd, int ret)
 {
-	if (close(fd) == -1) {
+	if (fd != -1 && close(fd) == -1) {
 		FCD_PERROR("close");
 		return -1;
 	}
@@ -379,7 +441,6 @@ static int fcd_raid_find_array_error(int fd, int ret)
 static int fcd_raid_find_array(struct fcd_raid_array **array, const char *buf,
 			       const regmatch_t *match, const int *pipe_fds)
 {
-	static char sysfs_file[FCD_RAID_SYSFS_FILE_SIZE];
 	int ret, sysfs_fd;
 	uint32_t uuid[4];
 	size_t name_len;
@@ -405,19 +466,9 @@ static int fcd_raid_find_array(struct fcd_raid_array **array, const char *buf,
 			return 0;
 	}
 
-	sprintf(sysfs_file, "/sys/devices/virtual/block/%.*s/md/array_state",
-		(int)name_len, buf + match->rm_so);
-	sysfs_fd = open(sysfs_file, O_RDONLY | O_CLOEXEC);
-	if (sysfs_fd == -1) {
-		if (errno == ENOENT)
-			return 1;
-		FCD_PERROR(sysfs_file);
-		return -1;
-	}
-
-	ret = fcd_raid_get_uuid(uuid, buf, match, pipe_fds);
-	if (ret < 0)
-		return fcd_raid_find_array_error(sysfs_fd, ret);
+	ret = fcd_raid_lookup_fn(uuid, &sysfs_fd, buf, match, pipe_fds);
+	if (ret != 0)
+		return ret;
 
 	*array = fcd_raid_find_by_uuid(uuid);
 	if (*array == NULL) {
@@ -460,6 +511,40 @@ static enum fcd_raid_type fcd_raid_parse_type(const char *buf,
 	FCD_ABORT("Unknown personality: %.20s\n", match);
 }
 
+/*
+ * Returns the status of a RAID disk (by position) in an array, if known
+ */
+static enum fcd_raid_dev_stat fcd_raid_dev_status(
+				const struct fcd_raid_array *const array,
+				const struct fcd_raid_disk *const disk)
+{
+	if (disk->pos > array->dev_count)
+		return FCD_RAID_DEV_UNKNOWN;
+
+	return array->dev_status[disk->pos - 1];
+}
+
+/*
+ * A device can have more than one status flag -- e.g. "sdb1[1](W)(F)" -- in the
+ * order W, J, F, S, R (see md_seq_show() in drivers/md/md.c).
+ */
+static enum fcd_raid_dev_stat fcd_raid_dev_flags(const char *const flags,
+						 const size_t len)
+{
+	if (memchr(flags, 'F', len) != NULL)
+		return FCD_RAID_DEV_FAILED;
+	if (memchr(flags, 'S', len) != NULL)
+		return FCD_RAID_DEV_SPARE;
+	if (memchr(flags, 'R', len) != NULL)
+		return FCD_RAID_DEV_REPLACEMENT;
+	if (memchr(flags, 'J', len) != NULL)
+		return FCD_RAID_DEV_JOURNAL;
+	if (memchr(flags, 'W', len) != NULL)
+		return FCD_RAID_DEV_WRITEMOSTLY;
+
+	return FCD_RAID_DEV_ACTIVE;
+}
+
 /*
  * Returns # of characters matched (0 = no match, -1 = error)
  */
@@ -467,17 +552,19 @@ static regoff_t fcd_raid_parse_dev(const char *c, struct fcd_raid_array *array)
 {
 	static const struct fcd_raid_regex *const regex = &fcd_raid_regexes[1];
 	static regmatch_t *const matches = fcd_raid_mdstat_dev_matches;
+	unsigned old_count;
 	int i;
 
 	if (regexec(&regex->regex, c, regex->nmatch, matches, 0) != 0)
 		return 0;
 
 	/*
-	 * Assume that device (match 1) is either a SCSI disk (sdX) or a
-	 * partition on a SCSI disk (sdXyy), where X is in the range a-z
+	 * Assume that device (match 1) is either a SCSI disk (sdX, sdXY, etc.)
+	 * or a partition on a SCSI disk (sdXnn, sdXYnn, etc.)
 	 */
 
-	i = fcd_lib_disk_index((c + matches[1].rm_so)[2]);
+	i = fcd_lib_disk_index(c + matches[1].rm_so,
+			       matches[1].rm_eo - matches[1].rm_so);
 	if (i == -1) {
 		FCD_WARN("Unexpected RAID array member: %.*s\n",
 			 (int)(matches[1].rm_eo - matches[1].rm_so),
@@ -485,29 +572,19 @@ static regoff_t fcd_raid_parse_dev(const char *c, struct fcd_raid_array *array)
 		return -1;
 	}
 
-	if (matches[3].rm_so == -1) {
-		array->dev_status[i] = FCD_RAID_DEV_ACTIVE;
+	/* Status is tracked by position, which survives disk hotplug */
+	old_count = array->dev_count;
+	if (fcd_lib_grow(&array->dev_status, &array->dev_count,
+			 fcd_cfg->disks[i].pos, sizeof *array->dev_status) == -1)
+		return -1;
+	if (array->dev_count > old_count) {
+		memset(array->dev_status + old_count, 0,
+		       (array->dev_count - old_count) * sizeof *array->dev_status);
 	}
-	else {
-		switch (c[matches[3].rm_so + 1])
-		{
-			case 'W':
-				array->dev_status[i] = FCD_RAID_DEV_WRITEMOSTLY;
-				break;
 
-			case 'F':
-				array->dev_status[i] = FCD_RAID_DEV_FAILED;
-				break;
-
-			case 'S':
-				array->dev_status[i] = FCD_RAID_DEV_SPARE;
-				break;
-
-			case 'R':
-				array->dev_status[i] = FCD_RAID_DEV_REPLACEMENT;
-				break;
-		}
-	}
+	array->dev_status[fcd_cfg->disks[i].pos - 1] = fcd_raid_dev_flags(
+				c + matches[3].rm_so,
+				matches[3].rm_eo - matches[3].rm_so);
 
 	return matches[0].rm_eo;
 }
@@ -517,7 +594,7 @@ static int fcd_raid_parse_devs(const char *c, struct fcd_raid_array *array)
 	regoff_t ret;
 	size_t i;
 
-	for (i = 0; i < FCD_ARRAY_SIZE(array->dev_status); ++i) {
+	for (i = 0; i < array->dev_count; ++i) {
 
 		if (array->dev_status[i] != FCD_RAID_DEV_UNKNOWN)
 			array->dev_status[i] = FCD_RAID_DEV_EXPECTED;
@@ -526,19 +603,23 @@ static int fcd_raid_parse_devs(const char *c, struct fcd_raid_array *array)
 	while (1) {
 
 		ret = fcd_raid_parse_dev(c, array);
-		if (ret < 1)
-			return ret;
+		if (ret == -1)
+			return -1;
+		if (ret == 0)
+			break;
 
 		c += ret;
 		if (*c == ' ')
 			++c;
 	}
 
-	for (i = 0; i < FCD_ARRAY_SIZE(array->dev_status); ++i) {
+	for (i = 0; i < array->dev_count; ++i) {
 
 		if (array->dev_status[i] == FCD_RAID_DEV_EXPECTED)
 			array->dev_status[i] = FCD_RAID_DEV_MISSING;
 	}
+
+	return 0;
 }
 
 /*
@@ -691,6 +772,13 @@ static int fcd_raid_parse_array(int *names_changed, const char *c,
 	if (array->array_status == FCD_RAID_ARRAY_INACTIVE)
 		return 1;
 
+	/* No "[n/m] [UU...]" status for personalities without redundancy */
+	if (array->type == FCD_RAID_TYPE_FAULTY
+			|| array->type == FCD_RAID_TYPE_LINEAR
+			|| array->type == FCD_RAID_TYPE_RAID0) {
+		return 1;
+	}
+
 	c = strchr(c, '\n');
 	if (c == NULL) {
 		FCD_WARN("Error parsing /proc/mdstat\n");
@@ -803,7 +891,9 @@ regcomp_error:
 	return -1;
 }
 
-static ssize_t fcd_raid_read_file(int fd, char **buf, size_t *buf_size)
+/* path is NULL when benchmarking the parser (not recorded or replayed) */
+static ssize_t fcd_raid_read_file(int fd, const char *path, char **buf,
+				  size_t *buf_size)
 {
 	struct timespec timeout;
 	ssize_t ret;
@@ -811,8 +901,15 @@ static ssize_t fcd_raid_read_file(int fd, char **buf, size_t *buf_size)
 	timeout.tv_sec = 0;
 	timeout.tv_nsec = 0;
 
-	ret = fcd_lib_read_all(fd, buf, buf_size, FCD_RAID_FILE_BUF_SIZE,
-			       &timeout);
+	if (path == NULL) {
+		ret = fcd_lib_read_all(fd, buf, buf_size, FCD_RAID_FILE_BUF_SIZE,
+				       &timeout);
+	}
+	else {
+		ret = fcd_lib_read_file(fd, path, buf, buf_size,
+					FCD_RAID_FILE_BUF_SIZE, &timeout);
+	}
+
 	if (ret == -2) {
 		FCD_WARN("Read from regular file timed out\n");
 		return -1;
@@ -830,7 +927,7 @@ static int fcd_raid_read_mdadm_conf(char **buf, size_t *buf_size)
 	int ret, fd;
 	char *c;
 
-	fd = open(path, O_RDONLY | O_CLOEXEC);
+	fd = fcd_lib_open(path, O_RDONLY | O_CLOEXEC);
 	if (fd == -1) {
 		if (errno == ENOENT)
 			return 0;
@@ -838,7 +935,7 @@ static int fcd_raid_read_mdadm_conf(char **buf, size_t *buf_size)
 		return -1;
 	}
 
-	ret = fcd_raid_read_file(fd, buf, buf_size);
+	ret = fcd_raid_read_file(fd, path, buf, buf_size);
 	if (ret < 0) {
 		if (close(fd) == -1)
 			FCD_PERROR("close");
@@ -887,6 +984,7 @@ static void fcd_raid_cleanup(char *mdstat_buf, int mdstat_fd, int *pipe_fds)
 			FCD_PERROR("close");
 
 		next = array->next;
+		free(array->dev_status);
 		free(array);
 	}
 
@@ -898,6 +996,8 @@ static void fcd_raid_cleanup(char *mdstat_buf, int mdstat_fd, int *pipe_fds)
 		FCD_PERROR("close");
 
 	free(fcd_raid_uuid_buf);
+	free(fcd_raid_disks);
+	free(fcd_raid_disk_ids);
 	free(mdstat_buf);
 }
 
@@ -931,7 +1031,7 @@ static int fcd_raid_setup(int *pipe_fds, int *mdstat_fd, char **mdstat_buf,
 	if (ret < 0)
 		return ret;
 
-	*mdstat_fd = open(path, O_RDONLY | O_CLOEXEC);
+	*mdstat_fd = fcd_lib_open(path, O_RDONLY | O_CLOEXEC);
 	if (*mdstat_fd == -1) {
 		FCD_PERROR(path);
 		return -1;
@@ -940,8 +1040,82 @@ static int fcd_raid_setup(int *pipe_fds, int *mdstat_fd, char **mdstat_buf,
 	return 0;
 }
 
+/*
+ * Member status is kept by disk position, so forget it when a different disk
+ * takes over a position (see DISK IDENTITY in disk.c).  Otherwise the new disk
+ * would "inherit" the old one's status -- e.g. appear to be missing from an
+ * array of which it was never a member.  Returns -1 on error.
+ */
+static int fcd_raid_check_disks(void)
+{
+	const struct fcd_raid_disk *disk;
+	struct fcd_raid_array *array;
+	unsigned i, old_size;
+
+	for (i = 0; i < fcd_cfg->disk_count; ++i) {
+
+		disk = &fcd_cfg->disks[i];
+
+		old_size = fcd_raid_disk_ids_size;
+		if (fcd_lib_grow(&fcd_raid_disk_ids, &fcd_raid_disk_ids_size,
+				 disk->pos, sizeof *fcd_raid_disk_ids) == -1) {
+			return -1;
+		}
+		if (fcd_raid_disk_ids_size > old_size) {
+			memset(fcd_raid_disk_ids + old_size, 0,
+			       (fcd_raid_disk_ids_size - old_size)
+						* sizeof *fcd_raid_disk_ids);
+		}
+
+		if (fcd_raid_disk_ids[disk->pos - 1] == disk->id)
+			continue;
+
+		for (array = fcd_raid_list; array != NULL; array = array->next) {
+			if (disk->pos <= array->dev_count)
+				array->dev_status[disk->pos - 1] =
+							FCD_RAID_DEV_UNKNOWN;
+		}
+
+		fcd_raid_disk_ids[disk->pos - 1] = disk->id;
+	}
+
+	return 0;
+}
+
+/*
+ * Returns 1 if the disk is a RAID disk -- i.e. it's in one of the internal bays,
+ * or it's an expansion disk that's a member (in any state) of at least one
+ * array.  (An expansion enclosure may also hold disks that aren't used for
+ * RAID.)
+ */
+static _Bool fcd_raid_is_member(const struct fcd_raid_disk *const disk)
+{
+	const struct fcd_raid_array *array;
+
+	if (disk->pos <= FCD_BAY_COUNT)
+		return 1;
+
+	for (array = fcd_raid_list; array != NULL; array = array->next) {
+		if (fcd_raid_dev_status(array, disk) != FCD_RAID_DEV_UNKNOWN)
+			return 1;
+	}
+
+	return 0;
+}
+
+static unsigned fcd_raid_member_count(void)
+{
+	unsigned i, count;
+
+	for (count = 0, i = 0; i < fcd_cfg->disk_count; ++i)
+		count += fcd_raid_is_member(&fcd_cfg->disks[i]);
+
+	return count;
+}
+
 static void fcd_raid_result(int *ok, int *warn, int *fail, int *disks,
-			    const struct fcd_raid_array *array)
+			    const struct fcd_raid_array *array,
+			    const unsigned members)
 {
 	unsigned i;
 
@@ -968,9 +1142,9 @@ static void fcd_raid_result(int *ok, int *warn, int *fail, int *disks,
 	if (array->array_status == FCD_RAID_ARRAY_STOPPED)
 		return;
 
-	for (i = 0; i < fcd_conf_disk_count; ++i) {
+	for (i = 0; i < fcd_cfg->disk_count; ++i) {
 
-		switch (array->dev_status[i]) {
+		switch (fcd_raid_dev_status(array, &fcd_cfg->disks[i])) {
 
 			case FCD_RAID_DEV_UNKNOWN:
 
@@ -978,11 +1152,15 @@ static void fcd_raid_result(int *ok, int *warn, int *fail, int *disks,
 				 * We have no status for this disk, but we know
 				 * that the array is at least degraded.  We can
 				 * conclude that this is disk is part of the
-				 * problem ONLY if all RAID disks are supposed
-				 * to be members of the array.
+				 * problem ONLY if it is a RAID disk and all RAID
+				 * disks are supposed to be members of the
+				 * array.
 				 */
-				if (array->ideal_devs != fcd_conf_disk_count)
+				if (array->ideal_devs != members
+						|| !fcd_raid_is_member(
+							&fcd_cfg->disks[i])) {
 					break;
+				}
 				/* else fall through */
 
 			case FCD_RAID_DEV_FAILED:
@@ -1000,8 +1178,10 @@ __attribute__((noreturn))
 static void *fcd_raid_fn(void *arg)
 {
 	struct fcd_monitor *mon = arg;
-	int ret, fd, ok, warn, fail, disks[FCD_MAX_DISK_COUNT], pipe_fds[2];
+	int ret, fd, ok, warn, fail, pipe_fds[2];
 	const struct fcd_raid_array *array;
+	unsigned members;
+	struct fcd_shm_status *shm;
 	char buf[21], *mdstat_buf;
 	size_t mdstat_size;
 
@@ -1016,25 +1196,37 @@ static void *fcd_raid_fn(void *arg)
 			fcd_raid_disable(mdstat_buf, fd, pipe_fds, mon);
 		}
 
-		ret = fcd_raid_read_file(fd, &mdstat_buf, &mdstat_size);
+		ret = fcd_raid_read_file(fd, "/proc/mdstat", &mdstat_buf,
+					 &mdstat_size);
 		if (ret == -3)
 			break;
 		if (ret < 0)
 			fcd_raid_disable(mdstat_buf, fd, pipe_fds, mon);
 
+		if (fcd_raid_check_disks() == -1)
+			fcd_raid_disable(mdstat_buf, fd, pipe_fds, mon);
+
 		ret = fcd_raid_parse_mdstat(mdstat_buf, pipe_fds);
 		if (ret == -3)
 			break;
 		if (ret < 0)
 			fcd_raid_disable(mdstat_buf, fd, pipe_fds, mon);
 
+		ret = fcd_lib_grow(&fcd_raid_disks, &fcd_raid_disks_size,
+				   fcd_cfg->disk_count, sizeof *fcd_raid_disks);
+		if (ret == -1)
+			fcd_raid_disable(mdstat_buf, fd, pipe_fds, mon);
+
 		ok = warn = fail = 0;
-		memset(disks, 0, sizeof disks);
+		memset(fcd_raid_disks, 0,
+		       fcd_cfg->disk_count * sizeof *fcd_raid_disks);
+		members = fcd_raid_member_count();
 
 		for (array = fcd_raid_list; array != NULL;
 					    array = array->next) {
 
-			fcd_raid_result(&ok, &warn, &fail, disks, array);
+			fcd_raid_result(&ok, &warn, &fail, fcd_raid_disks,
+					array, members);
 		}
 
 		ret = fcd_lib_snprintf(buf, sizeof buf, "OK:%d WARN:%d FAIL:%d",
@@ -1042,7 +1234,23 @@ static void *fcd_raid_fn(void *arg)
 		if (ret < 0)
 			fcd_raid_disable(mdstat_buf, fd, pipe_fds, mon);
 
-		fcd_lib_set_mon_status(mon, buf, warn, fail, disks, 0);
+		fcd_lib_set_mon_status(mon, buf, warn, fail, fcd_raid_disks, 0);
+
+		fcd_metrics_add(mon,
+			"# HELP freecusd_raid_arrays RAID arrays by status\n"
+			"# TYPE freecusd_raid_arrays gauge\n"
+			"freecusd_raid_arrays{status=\"ok\"} %d\n"
+			"freecusd_raid_arrays{status=\"warn\"} %d\n"
+			"freecusd_raid_arrays{status=\"fail\"} %d\n",
+			ok, warn, fail);
+		fcd_metrics_publish(mon);
+
+		if ((shm = fcd_shm_write_begin()) != NULL) {
+			shm->raid_ok = ok;
+			shm->raid_warn = warn;
+			shm->raid_fail = fail;
+			fcd_shm_write_end(shm);
+		}
 
 		ret = fcd_lib_monitor_sleep(30);
 		if (ret == -1)
@@ -1064,3 +1272,383 @@ struct fcd_monitor fcd_raid_monitor = {
 	.enabled		= true,
 	.enabled_opt_name	= "enable_raid_monitor",
 };
+
+/*******************************************************************************
+ *
+ * Parser benchmark (freecusd -f -M FILE...)
+ *
+ ******************************************************************************/
+
+/*
+ * Parses captured copies of /proc/mdstat -- from any system -- and prints the
+ * status of each array and RAID disk, along with the time per parse.  If a
+ * capture named FOO.mdstat has a FOO.expected file alongside it, the printed
+ * status must match that file exactly (see the mdstat directory).  The
+ * array lookup (sysfs & mdadm) is replaced with a stub that derives each
+ * array's "UUID" from its name, and the RAID disks are replaced with the array
+ * members in each capture (numbered in the order in which they first appear).
+ * No monitor threads are started.
+ */
+
+#define FCD_RAID_BENCH_TIME		1000000000LL	/* nsec per file */
+#define FCD_RAID_BENCH_MAX_PARSES	100000
+
+static const char *const fcd_raid_arr_stat_names[] = {
+	[FCD_RAID_ARRAY_STOPPED]	= "stopped",
+	[FCD_RAID_ARRAY_INACTIVE]	= "inactive",
+	[FCD_RAID_ARRAY_ACTIVE]		= "active",
+	[FCD_RAID_ARRAY_READONLY]	= "read-only",
+	[FCD_RAID_ARRAY_DEGRADED]	= "DEGRADED",
+	[FCD_RAID_ARRAY_FAILED]		= "FAILED",
+};
+
+static const char *const fcd_raid_dev_stat_names[] = {
+	[FCD_RAID_DEV_UNKNOWN]		= "-",
+	[FCD_RAID_DEV_MISSING]		= "MISSING",
+	[FCD_RAID_DEV_ACTIVE]		= "active",
+	[FCD_RAID_DEV_FAILED]		= "FAILED",
+	[FCD_RAID_DEV_SPARE]		= "spare",
+	[FCD_RAID_DEV_WRITEMOSTLY]	= "write-mostly",
+	[FCD_RAID_DEV_REPLACEMENT]	= "replacement",
+	[FCD_RAID_DEV_JOURNAL]		= "journal",
+};
+
+static int fcd_raid_bench_lookup(uint32_t *uuid, int *sysfs_fd,
+				 const char *buf, const regmatch_t *match,
+				 const int *pipe_fds __attribute__((unused)))
+{
+	/* Name length is checked by fcd_raid_find_array() */
+	memset(uuid, 0, 4 * sizeof *uuid);
+	memcpy(uuid, buf + match->rm_so, match->rm_eo - match->rm_so);
+	*sysfs_fd = -1;
+
+	return 0;
+}
+
+/*
+ * Replaces the RAID disks with the members of the arrays in buf.  Returns 0 on
+ * success, -1 on error.
+ */
+static int fcd_raid_bench_disks(const char *c)
+{
+	const struct fcd_raid_regex *const array_re = &fcd_raid_regexes[0];
+	const struct fcd_raid_regex *const dev_re = &fcd_raid_regexes[1];
+	struct fcd_raid_disk *disks, *new;
+	unsigned i, count;
+	size_t len;
+
+	disks = NULL;
+	count = 0;
+
+	for (; c != NULL; c = strchr(c, '\n'), c = (c != NULL) ? c + 1 : NULL) {
+
+		if (regexec(&array_re->regex, c, array_re->nmatch,
+			    array_re->matches, 0) != 0) {
+			continue;
+		}
+
+		c += array_re->matches[0].rm_eo;
+
+		while (regexec(&dev_re->regex, c, dev_re->nmatch,
+			       dev_re->matches, 0) == 0) {
+
+			/* Disk name, without any partition number; see lib.c */
+			for (len = 0; len < (size_t)dev_re->matches[1].rm_eo
+					&& !isdigit((unsigned char)c[len]);
+					++len);
+
+			for (i = 0; i < count; ++i) {
+				if (strlen(disks[i].name) == len + 5
+					    && memcmp(disks[i].name + 5, c,
+						      len) == 0) {
+					break;
+				}
+			}
+
+			if (i == count) {
+
+				if (len + 5 >= sizeof disks->name) {
+					FCD_ERR("Disk name too long: %.*s\n",
+						(int)len, c);
+					free(disks);
+					return -1;
+				}
+
+				new = realloc(disks, (count + 1) * sizeof *disks);
+				if (new == NULL) {
+					FCD_PERROR("realloc");
+					free(disks);
+					return -1;
+				}
+
+				disks = new;
+				disks[count].pos = count + 1;
+				disks[count].id = 0;
+				sprintf(disks[count].name, "/dev/%.*s",
+					(int)len, c);
+				++count;
+			}
+
+			c += dev_re->matches[0].rm_eo;
+			if (*c == ' ')
+				++c;
+		}
+	}
+
+	fcd_conf_set_disks(disks, count);
+
+	return 0;
+}
+
+static void fcd_raid_bench_free(void)
+{
+	struct fcd_raid_array *array, *next;
+
+	for (array = fcd_raid_list; array != NULL; array = next) {
+		next = array->next;
+		free(array->dev_status);
+		free(array);
+	}
+
+	fcd_raid_list = NULL;
+	fcd_raid_list_end = &fcd_raid_list;
+}
+
+/*
+ * Writes the status of each array and the resulting alerts to out.  Returns 0
+ * on success, -1 on error.
+ */
+static int fcd_raid_bench_status(FILE *const out)
+{
+	const struct fcd_raid_array *array;
+	int ok, warn, fail, *disks;
+	unsigned i, members;
+
+	disks = calloc(fcd_cfg->disk_count + 1, sizeof *disks);
+	if (disks == NULL) {
+		FCD_PERROR("calloc");
+		return -1;
+	}
+
+	ok = warn = fail = 0;
+	members = fcd_raid_member_count();
+
+	for (array = fcd_raid_list; array != NULL; array = array->next) {
+
+		fcd_raid_result(&ok, &warn, &fail, disks, array, members);
+
+		fprintf(out, "  %s: %s", array->name,
+			fcd_raid_arr_stat_names[array->array_status]);
+
+		if (array->array_status != FCD_RAID_ARRAY_INACTIVE) {
+			/* Personality match includes a trailing space */
+			fprintf(out, " %.*s",
+				(int)strlen(fcd_raid_type_matches[array->type].match)
+									- 1,
+				fcd_raid_type_matches[array->type].match);
+			if (array->ideal_devs != 0) {
+				fprintf(out, " [%u/%u]", array->ideal_devs,
+					array->current_devs);
+			}
+		}
+
+		for (i = 0; i < array->dev_count; ++i) {
+			if (array->dev_status[i] != FCD_RAID_DEV_UNKNOWN) {
+				fprintf(out, " %s=%s",
+					fcd_cfg->disks[i].name + 5,
+					fcd_raid_dev_stat_names[
+						array->dev_status[i]]);
+			}
+		}
+
+		fputc('\n', out);
+	}
+
+	fprintf(out, "  alerts: OK=%d WARN=%d FAIL=%d disks=", ok, warn, fail);
+
+	for (ok = 0, i = 0; i < fcd_cfg->disk_count; ++i) {
+		if (disks[i] != 0) {
+			fprintf(out, "%s%s", ok++ ? "," : "",
+				fcd_cfg->disks[i].name + 5);
+		}
+	}
+
+	fprintf(out, "%s\n", ok ? "" : "none");
+	free(disks);
+
+	return 0;
+}
+
+/*
+ * Compares status with the expected results for a capture (FOO.mdstat ->
+ * FOO.expected), if the capture has any.  Returns 0 if they match (or there
+ * are no expected results), 1 if they don't, -1 on error.
+ */
+static int fcd_raid_bench_check(const char *const file,
+				const char *const status)
+{
+	static const char suffix[] = ".mdstat";
+	size_t len, buf_size;
+	char *path, *buf;
+	ssize_t ret;
+	int fd;
+
+	len = strlen(file);
+	if (len < sizeof suffix - 1 ||
+			strcmp(file + len - (sizeof suffix - 1), suffix) != 0) {
+		return 0;
+	}
+
+	len -= sizeof suffix - 1;
+
+	path = malloc(len + sizeof ".expected");
+	if (path == NULL) {
+		FCD_PERROR("malloc");
+		return -1;
+	}
+
+	memcpy(path, file, len);
+	strcpy(path + len, ".expected");
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd == -1) {
+		ret = (errno == ENOENT) ? 0 : -1;
+		if (ret == -1)
+			FCD_PERROR(path);
+		free(path);
+		return ret;
+	}
+
+	buf = NULL;
+	buf_size = 0;
+	ret = fcd_raid_read_file(fd, NULL, &buf, &buf_size);
+	if (close(fd) == -1)
+		FCD_PERROR("close");
+
+	if (ret < 0) {
+		free(path);
+		free(buf);
+		return -1;
+	}
+
+	if (strcmp(buf, status) == 0) {
+		ret = 0;
+	}
+	else {
+		printf("  MISMATCH; %s:\n%s", path, buf);
+		ret = 1;
+	}
+
+	free(path);
+	free(buf);
+
+	return ret;
+}
+
+/*
+ * Returns 0 if the file was parsed (and matches its expected results, if
+ * any), -1 otherwise.  Report goes to stdout; one line per array would trip
+ * the log rate limit.
+ */
+static int fcd_raid_bench_file(const char *const file, char **buf,
+			       size_t *buf_size)
+{
+	long long start, elapsed;
+	unsigned parses;
+	size_t status_len;
+	char *status;
+	int fd, ret;
+	FILE *out;
+
+	fd = open(file, O_RDONLY | O_CLOEXEC);
+	if (fd == -1) {
+		FCD_PERROR(file);
+		return -1;
+	}
+
+	ret = fcd_raid_read_file(fd, NULL, buf, buf_size);
+	if (close(fd) == -1)
+		FCD_PERROR("close");
+	if (ret < 0)
+		return -1;
+
+	if (fcd_raid_bench_disks(*buf) == -1)
+		return -1;
+
+	/* First parse "discovers" the arrays */
+	if (fcd_raid_parse_mdstat(*buf, NULL) != 0) {
+		FCD_ERR("%s: parse failed\n", file);
+		fcd_raid_bench_free();
+		return -1;
+	}
+
+	status = NULL;
+	out = open_memstream(&status, &status_len);
+	if (out == NULL) {
+		FCD_PERROR("open_memstream");
+		fcd_raid_bench_free();
+		return -1;
+	}
+
+	ret = fcd_raid_bench_status(out);
+	if (fclose(out) != 0) {
+		FCD_PERROR("fclose");
+		ret = -1;
+	}
+
+	if (ret == -1) {
+		free(status);
+		fcd_raid_bench_free();
+		return -1;
+	}
+
+	start = fcd_hist_now();
+	parses = 0;
+
+	do {
+		if (fcd_raid_parse_mdstat(*buf, NULL) != 0)
+			FCD_ABORT("%s: parse failed on repeat\n", file);
+		elapsed = fcd_hist_now() - start;
+	} while (++parses < FCD_RAID_BENCH_MAX_PARSES
+					&& elapsed < FCD_RAID_BENCH_TIME);
+
+	printf("%s:\n%s", file, status);
+	ret = fcd_raid_bench_check(file, status);
+	printf("  %u parses, %lld ns/parse\n", parses, elapsed / parses);
+
+	free(status);
+	fcd_raid_bench_free();
+
+	return (ret == 0) ? 0 : -1;
+}
+
+/*
+ * Called in the main thread instead of starting the monitors.  Returns the
+ * number of files that could not be parsed or did not match their expected
+ * results.
+ */
+int fcd_raid_bench(char **const files, const int count)
+{
+	size_t buf_size;
+	int i, failed;
+	char *buf;
+
+	if (fcd_raid_regcomp() == -1)
+		return count;
+
+	fcd_raid_lookup_fn = fcd_raid_bench_lookup;
+	buf = NULL;
+	buf_size = 0;
+
+	for (failed = 0, i = 0; i < count; ++i) {
+		if (fcd_raid_bench_file(files[i], &buf, &buf_size) != 0)
+			++failed;
+	}
+
+	for (i = 0; i < (int)FCD_ARRAY_SIZE(fcd_raid_regexes); ++i)
+		regfree(&fcd_raid_regexes[i].regex);
+
+	free(buf);
+
+	return failed;
+}
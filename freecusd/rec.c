@@ -0,0 +1,554 @@
+/*
+ * Copyright 2020 Ian Pilcher <arequipeno@gmail.com>
+ *
+ * This program is free software.  You can redistribute it or modify it under
+ * the terms of version 2 of the GNU General Public License (GPL), as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY -- without even the implied warranty of MERCHANTIBILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the text of the GPL for more details.
+ *
+ * Version 2 of the GNU General Public License is available at:
+ *
+ *   http://www.gnu.org/licenses/old-licenses/gpl-2.0.html
+ */
+
+#include "freecusd.h"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <string.h>
+#include <signal.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+
+/*
+ * Record & replay of the monitors' raw inputs.
+ *
+ * With -R FILE, every input that a monitor consumes is appended to FILE:
+ * sysfs & procfs files (temperatures, fan speed, load average, mdstat,
+ * mdadm.conf), the output and exit status of external commands (mdadm and the
+ * S.M.A.R.T. helper), and the bytes received from the LCD PIC.
+ *
+ * With -P FILE, the monitors read their inputs from FILE instead, in the order
+ * in which they were recorded -- each file or command line is a separate
+ * stream -- so each monitor produces the same sequence of LCD messages, alerts
+ * and fan speed requests.  (Monitor threads still run concurrently, so the
+ * interleaving of their outputs isn't guaranteed to be the same.)  -x N makes
+ * the monitors poll N times as often.  A monitor thread whose input runs out
+ * (or that was never recorded) stops, and freecusd exits when every monitor
+ * thread that reads recorded input -- all of them except those marked
+ * no_replay, counted before they start -- has stopped.  LCD PIC input isn't
+ * replayed.
+ *
+ * At the end of a replay, a digest of each monitor's outputs (LCD text, alerts
+ * and fan speed flags) is printed to stdout; two replays of the same recording
+ * print the same digests.  Monitors that don't read recorded input (e.g. the
+ * sensor trends) are left out, because their outputs depend on timing.
+ *
+ * The file is a header (FCD_REC_MAGIC), followed by records, each of which is a
+ * struct fcd_rec_hdr, the label (not 0-terminated) and the data.  Integers are
+ * in native byte order.  Each record is appended with a single writev() on an
+ * O_APPEND file descriptor, so records from different threads never interleave
+ * and no lock is needed.  When appending to an existing recording, the clock
+ * continues from its last record, so times never go backwards.
+ */
+
+#define FCD_REC_MAGIC		"FCDREC1\n"
+
+struct fcd_rec_hdr {
+	uint64_t time;			/* nsec since recording started */
+	uint32_t len;			/* data length */
+	uint8_t type;			/* enum fcd_rec_type */
+	uint8_t label_len;
+	int16_t status;			/* command exit status */
+};
+
+/* Replay -- the records of a single file, command line, etc. */
+struct fcd_rec_stream {
+	const char *label;		/* in the mapped file */
+	size_t *offsets;		/* record headers */
+	unsigned count;			/* see fcd_lib_grow() */
+	unsigned used;
+	unsigned next;
+	uint8_t label_len;
+	uint8_t type;
+};
+
+/* Replay -- outputs of a single monitor; see fcd_rec_output() */
+struct fcd_rec_digest {
+	uint64_t hash;			/* FNV-1a */
+	unsigned updates;
+};
+
+enum fcd_rec_mode fcd_rec_mode = FCD_REC_MODE_OFF;
+
+static int fcd_rec_fd = -1;
+static long long fcd_rec_start;
+
+static const char *fcd_rec_map;
+static size_t fcd_rec_map_size;
+static struct fcd_rec_stream *fcd_rec_streams;
+static unsigned fcd_rec_stream_count;
+static unsigned fcd_rec_streams_size;
+static pthread_mutex_t fcd_rec_mutex = PTHREAD_MUTEX_INITIALIZER;
+static unsigned fcd_rec_readers;	/* set before monitor threads start */
+static unsigned fcd_rec_stopped;	/* fcd_rec_mutex */
+static __thread _Bool fcd_rec_reader;
+static struct fcd_rec_digest *fcd_rec_digests;	/* one per fcd_monitors[] */
+
+/*
+ * Appends a record.  Called in multiple threads.  If the write fails, recording
+ * stops (and the error is logged once).
+ */
+void fcd_rec_write(const enum fcd_rec_type type, const char *const label,
+		   const int status, const void *const data, const size_t len)
+{
+	struct fcd_rec_hdr hdr;
+	struct iovec iov[3];
+	size_t label_len;
+	ssize_t ret;
+	int fd;
+
+	fd = __atomic_load_n(&fcd_rec_fd, __ATOMIC_RELAXED);
+	if (fd == -1)
+		return;
+
+	label_len = strlen(label);
+	if (label_len > UINT8_MAX)
+		label_len = UINT8_MAX;
+
+	hdr.time = fcd_hist_now() - fcd_rec_start;
+	hdr.len = len;
+	hdr.type = type;
+	hdr.label_len = label_len;
+	hdr.status = status;
+
+	iov[0].iov_base = &hdr;
+	iov[0].iov_len = sizeof hdr;
+	iov[1].iov_base = (void *)label;
+	iov[1].iov_len = label_len;
+	iov[2].iov_base = (void *)data;
+	iov[2].iov_len = len;
+
+	ret = writev(fd, iov, 3);
+	if (ret == (ssize_t)(sizeof hdr + label_len + len))
+		return;
+
+	if (__atomic_exchange_n(&fcd_rec_fd, -1, __ATOMIC_RELAXED) == -1)
+		return;		/* another thread got here first */
+
+	if (ret == -1)
+		FCD_PERROR("writev");
+	else
+		FCD_ERR("Incomplete write to recording (%zd bytes)\n", ret);
+
+	FCD_WARN("Recording stopped\n");
+
+	if (close(fd) == -1)
+		FCD_PERROR("close");
+}
+
+static struct fcd_rec_stream *fcd_rec_find(const enum fcd_rec_type type,
+					   const char *const label,
+					   const size_t label_len)
+{
+	struct fcd_rec_stream *s;
+	unsigned i;
+
+	for (i = 0; i < fcd_rec_stream_count; ++i) {
+
+		s = &fcd_rec_streams[i];
+
+		if (s->type == type && s->label_len == label_len
+				&& memcmp(s->label, label, label_len) == 0) {
+			return s;
+		}
+	}
+
+	return NULL;
+}
+
+/*
+ * Sets the number of monitor threads that read recorded input.  Called in the
+ * main thread, during a replay, before the monitor threads are started.
+ */
+void fcd_rec_set_readers(const unsigned readers)
+{
+	if (readers == 0)
+		FCD_FATAL("No enabled monitor reads recorded input\n");
+
+	fcd_rec_readers = readers;
+}
+
+/*
+ * Called in a monitor thread (not marked no_replay) that is about to stop,
+ * either because its input has run out or because it has disabled itself.
+ * The last thread to stop asks the main thread to shut down.
+ */
+void fcd_rec_stop(void)
+{
+	_Bool last;
+	int ret;
+
+	ret = pthread_mutex_lock(&fcd_rec_mutex);
+	if (ret != 0)
+		FCD_PT_ABRT("pthread_mutex_lock", ret);
+
+	last = (++fcd_rec_stopped == fcd_rec_readers);
+
+	ret = pthread_mutex_unlock(&fcd_rec_mutex);
+	if (ret != 0)
+		FCD_PT_ABRT("pthread_mutex_unlock", ret);
+
+	if (last) {
+		FCD_INFO("Replay finished\n");
+		if (kill(getpid(), SIGTERM) == -1)
+			FCD_PABORT("kill");
+	}
+}
+
+/*
+ * Called in a monitor thread when its input stream has run out.  Waits for the
+ * exit signal and exits the thread.
+ */
+__attribute__((noreturn))
+static void fcd_rec_replay_done(const char *const label, size_t label_len)
+{
+	FCD_INFO("Replay of %.*s finished\n", (int)label_len, label);
+
+	fcd_rec_stop();
+
+	while (!fcd_thread_exit_flag) {
+		if (ppoll(NULL, 0, NULL, &fcd_mon_ppoll_sigmask) == -1
+				&& errno != EINTR) {
+			FCD_PABORT("ppoll");
+		}
+	}
+
+	pthread_exit(NULL);
+}
+
+/*
+ * Returns the next record of a stream (*data points into the mapped file).  If
+ * the stream has run out, the calling (monitor) thread exits.
+ */
+void fcd_rec_read(const enum fcd_rec_type type, const char *const label,
+		  int *const status, const char **const data, size_t *const len)
+{
+	struct fcd_rec_stream *s;
+	struct fcd_rec_hdr hdr;
+	size_t label_len, offset;
+	int ret;
+
+	label_len = strlen(label);
+	if (label_len > UINT8_MAX)
+		label_len = UINT8_MAX;
+
+	ret = pthread_mutex_lock(&fcd_rec_mutex);
+	if (ret != 0)
+		FCD_PT_ABRT("pthread_mutex_lock", ret);
+
+	fcd_rec_reader = 1;
+
+	s = fcd_rec_find(type, label, label_len);
+	if (s == NULL || s->next == s->used) {
+		offset = 0;
+	}
+	else {
+		offset = s->offsets[s->next];
+		++s->next;
+	}
+
+	ret = pthread_mutex_unlock(&fcd_rec_mutex);
+	if (ret != 0)
+		FCD_PT_ABRT("pthread_mutex_unlock", ret);
+
+	if (offset == 0)
+		fcd_rec_replay_done(label, label_len);
+
+	/* Records aren't aligned */
+	memcpy(&hdr, fcd_rec_map + offset, sizeof hdr);
+
+	if (status != NULL)
+		*status = hdr.status;
+	*data = fcd_rec_map + offset + sizeof hdr + hdr.label_len;
+	*len = hdr.len;
+}
+
+static uint8_t fcd_rec_alert(const enum fcd_alert_msg alert)
+{
+	return alert == FCD_ALERT_SET_REQ || alert == FCD_ALERT_SET_ACK;
+}
+
+static uint64_t fcd_rec_hash(uint64_t hash, const void *const data,
+			     const size_t len)
+{
+	const uint8_t *p;
+	size_t i;
+
+	for (p = data, i = 0; i < len; ++i) {
+		hash ^= p[i];
+		hash *= UINT64_C(0x100000001b3);
+	}
+
+	return hash;
+}
+
+/*
+ * Adds a monitor's current LCD text, alerts and fan speed flags to its digest.
+ * Called (during replay) with the monitor's mutex locked, whenever its thread
+ * publishes a status, so a monitor's outputs are always hashed in order.
+ */
+void fcd_rec_output(const struct fcd_monitor *const mon)
+{
+	struct fcd_rec_digest *d;
+	uint8_t alerts[2 + FCD_BAY_COUNT];
+	unsigned i;
+
+	if (fcd_rec_mode != FCD_REC_MODE_REPLAY || !fcd_rec_reader)
+		return;
+
+	for (i = 0; fcd_monitors[i] != mon; ++i) {
+		if (fcd_monitors[i] == NULL)
+			return;
+	}
+
+	d = &fcd_rec_digests[i];
+
+	if (mon->pages != NULL && mon->page_count != 0) {
+		d->hash = fcd_rec_hash(d->hash, mon->pages,
+				       mon->page_count * FCD_PAGE_LINES_SIZE);
+	}
+	else {
+		d->hash = fcd_rec_hash(d->hash, mon->buf + 5, 20);
+		d->hash = fcd_rec_hash(d->hash, mon->buf + 45, 20);
+	}
+
+	/* Not the request/acknowledgement states; those depend on timing */
+	alerts[0] = fcd_rec_alert(mon->sys_warn);
+	alerts[1] = fcd_rec_alert(mon->sys_fail);
+	for (i = 0; i < FCD_BAY_COUNT; ++i)
+		alerts[2 + i] = fcd_rec_alert(mon->disk_alerts[i]);
+
+	d->hash = fcd_rec_hash(d->hash, alerts, sizeof alerts);
+	d->hash = fcd_rec_hash(d->hash, &mon->new_pwm_flags,
+			       sizeof mon->new_pwm_flags);
+	++d->updates;
+}
+
+/* Indexes the records in the mapped file by stream; called in main thread */
+static void fcd_rec_index(const char *const path)
+{
+	struct fcd_rec_hdr hdr;
+	struct fcd_rec_stream *s;
+	const char *label;
+	size_t offset;
+	unsigned records;
+
+	records = 0;
+	offset = sizeof FCD_REC_MAGIC - 1;
+
+	while (offset < fcd_rec_map_size) {
+
+		if (fcd_rec_map_size - offset < sizeof hdr) {
+			FCD_WARN("%s: Truncated record at offset %zu\n",
+				 path, offset);
+			break;
+		}
+
+		/* Records aren't aligned */
+		memcpy(&hdr, fcd_rec_map + offset, sizeof hdr);
+
+		if (fcd_rec_map_size - offset - sizeof hdr
+						< hdr.label_len + (size_t)hdr.len) {
+			FCD_WARN("%s: Truncated record at offset %zu\n",
+				 path, offset);
+			break;
+		}
+
+		label = fcd_rec_map + offset + sizeof hdr;
+
+		s = fcd_rec_find(hdr.type, label, hdr.label_len);
+		if (s == NULL) {
+
+			if (fcd_lib_grow(&fcd_rec_streams, &fcd_rec_streams_size,
+					 fcd_rec_stream_count + 1,
+					 sizeof *fcd_rec_streams) == -1) {
+				FCD_ABORT("Failed to index recording\n");
+			}
+
+			s = &fcd_rec_streams[fcd_rec_stream_count++];
+			memset(s, 0, sizeof *s);
+			s->label = label;
+			s->label_len = hdr.label_len;
+			s->type = hdr.type;
+		}
+
+		if (fcd_lib_grow(&s->offsets, &s->count, s->used + 1,
+				 sizeof *s->offsets) == -1) {
+			FCD_ABORT("Failed to index recording\n");
+		}
+
+		s->offsets[s->used++] = offset;
+		++records;
+
+		offset += sizeof hdr + hdr.label_len + hdr.len;
+	}
+
+	FCD_INFO("Replaying %u records (%u streams) from %s\n", records,
+		 fcd_rec_stream_count, path);
+}
+
+/*
+ * Checks an existing recording, to which new records will be appended, and
+ * returns the time of its last record.  Exits if the file isn't a recording or
+ * its last record is truncated (since new records would be misread).
+ */
+static long long fcd_rec_last_time(const int fd, const char *const path,
+				   const off_t size)
+{
+	char magic[sizeof FCD_REC_MAGIC - 1];
+	struct fcd_rec_hdr hdr;
+	long long last;
+	off_t offset;
+	ssize_t ret;
+
+	ret = pread(fd, magic, sizeof magic, 0);
+	if (ret == -1)
+		FCD_PFATAL(path);
+
+	if (ret != (ssize_t)sizeof magic
+			|| memcmp(magic, FCD_REC_MAGIC, sizeof magic) != 0) {
+		FCD_FATAL("%s: Not a freecusd recording\n", path);
+	}
+
+	last = 0;
+
+	for (offset = sizeof magic; offset < size;
+			offset += sizeof hdr + hdr.label_len + hdr.len) {
+
+		ret = pread(fd, &hdr, sizeof hdr, offset);
+		if (ret == -1)
+			FCD_PFATAL(path);
+
+		if (ret != (ssize_t)sizeof hdr
+				|| size - offset - (off_t)sizeof hdr
+					< hdr.label_len + (off_t)hdr.len) {
+			FCD_FATAL("%s: Truncated record at offset %lld\n",
+				  path, (long long)offset);
+		}
+
+		last = hdr.time;
+	}
+
+	return last;
+}
+
+/*
+ * Opens a recording (-R) or replay (-P) file.  Called in the main thread before
+ * any other threads are started.
+ */
+void fcd_rec_open(const char *const path, const enum fcd_rec_mode mode)
+{
+	struct stat st;
+	long long last;
+	unsigned i;
+	ssize_t ret;
+	int fd;
+
+	if (mode == FCD_REC_MODE_RECORD) {
+
+		fd = open(path, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC,
+			  S_IRUSR | S_IWUSR);
+		if (fd == -1)
+			FCD_PFATAL(path);
+
+		if (fstat(fd, &st) == -1)
+			FCD_PFATAL(path);
+
+		if (st.st_size == 0) {
+			ret = write(fd, FCD_REC_MAGIC, sizeof FCD_REC_MAGIC - 1);
+			if (ret != sizeof FCD_REC_MAGIC - 1)
+				FCD_PFATAL(path);
+			last = 0;
+		}
+		else {
+			last = fcd_rec_last_time(fd, path, st.st_size);
+		}
+
+		fcd_rec_start = fcd_hist_now() - last;
+		fcd_rec_fd = fd;
+		fcd_rec_mode = mode;
+		FCD_INFO("Recording monitor inputs to %s\n", path);
+		return;
+	}
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd == -1)
+		FCD_PFATAL(path);
+
+	if (fstat(fd, &st) == -1)
+		FCD_PFATAL(path);
+
+	if ((size_t)st.st_size < sizeof FCD_REC_MAGIC - 1)
+		FCD_FATAL("%s: Not a freecusd recording\n", path);
+
+	fcd_rec_map_size = st.st_size;
+	fcd_rec_map = mmap(NULL, fcd_rec_map_size, PROT_READ, MAP_PRIVATE, fd,
+			   0);
+	if (fcd_rec_map == MAP_FAILED)
+		FCD_PFATAL(path);
+
+	if (close(fd) == -1)
+		FCD_PERROR("close");
+
+	if (memcmp(fcd_rec_map, FCD_REC_MAGIC, sizeof FCD_REC_MAGIC - 1) != 0)
+		FCD_FATAL("%s: Not a freecusd recording\n", path);
+
+	fcd_rec_index(path);
+
+	for (i = 0; fcd_monitors[i] != NULL; ++i);
+
+	fcd_rec_digests = calloc(i, sizeof *fcd_rec_digests);
+	if (fcd_rec_digests == NULL)
+		FCD_PFATAL("calloc");
+
+	while (i-- > 0)
+		fcd_rec_digests[i].hash = UINT64_C(0xcbf29ce484222325);
+
+	fcd_rec_mode = mode;
+}
+
+/* Called in the main thread after all other threads have exited */
+void fcd_rec_close(void)
+{
+	unsigned i;
+
+	if (fcd_rec_mode == FCD_REC_MODE_RECORD) {
+		if (fcd_rec_fd != -1 && close(fcd_rec_fd) == -1)
+			FCD_PERROR("close");
+		fcd_rec_fd = -1;
+	}
+	else if (fcd_rec_mode == FCD_REC_MODE_REPLAY) {
+		for (i = 0; fcd_monitors[i] != NULL; ++i) {
+			if (fcd_rec_digests[i].updates == 0)
+				continue;
+			printf("%s: %u updates, digest %016" PRIx64 "\n",
+			       fcd_monitors[i]->name,
+			       fcd_rec_digests[i].updates,
+			       fcd_rec_digests[i].hash);
+		}
+		free(fcd_rec_digests);
+		for (i = 0; i < fcd_rec_stream_count; ++i)
+			free(fcd_rec_streams[i].offsets);
+		free(fcd_rec_streams);
+		if (munmap((void *)fcd_rec_map, fcd_rec_map_size) == -1)
+			FCD_PERROR("munmap");
+	}
+
+	fcd_rec_mode = FCD_REC_MODE_OFF;
+}
@@ -0,0 +1,386 @@
+/*
+ * Copyright 2020 Ian Pilcher <arequipeno@gmail.com>
+ *
+ * This program is free software.  You can redistribute it or modify it under
+ * the terms of version 2 of the GNU General Public License (GPL), as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY -- without even the implied warranty of MERCHANTIBILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the text of the GPL for more details.
+ *
+ * Version 2 of the GNU General Public License is available at:
+ *
+ *   http://www.gnu.org/licenses/old-licenses/gpl-2.0.html
+ */
+
+#include "freecusd.h"
+
+#include <sys/eventfd.h>
+#include <errno.h>
+#include <time.h>
+#include <poll.h>
+
+/*
+ * Monitor threads are assigned evenly spaced "slots" within their polling
+ * interval, so that (for example) the S.M.A.R.T. helper and mdadm aren't
+ * forked at the same instant every 30 seconds.  At startup, the first
+ * activation of each thread is spread across a (shorter) ramp period, so the
+ * LCD doesn't have to wait a full interval for every monitor to report.
+ *
+ * A sleeping thread can be woken early (e.g. "freecusctl poll"), through its
+ * slot's eventfd.  This doesn't change its schedule.
+ */
+
+#define FCD_SCHED_NSEC		1000000000LL
+
+/* Ramp & jitter times; see struct fcd_conf */
+static int fcd_sched_cb();
+
+const cip_opt_info fcd_sched_opts[] = {
+	{
+		.name			= "monitor_start_ramp",
+		.type			= CIP_OPT_TYPE_FLOAT,
+		.post_parse_fn		= fcd_sched_cb,
+		.post_parse_data	= FCD_CONF_OFFSET(sched_ramp),
+	},
+	{
+		.name			= "monitor_jitter",
+		.type			= CIP_OPT_TYPE_FLOAT,
+		.post_parse_fn		= fcd_sched_cb,
+		.post_parse_data	= FCD_CONF_OFFSET(sched_jitter),
+	},
+	{
+		.name			= NULL
+	}
+};
+
+/* Replay speedup factor (-x); see rec.c */
+unsigned fcd_sched_speedup = 1;
+
+/* Start time; all slots are relative to this */
+static struct timespec fcd_sched_epoch;
+static unsigned fcd_sched_slots;
+static int *fcd_sched_wake_fds;		/* one per slot; -1 on error */
+
+/* Instrumentation; protected by fcd_sched_mutex */
+static pthread_mutex_t fcd_sched_mutex = PTHREAD_MUTEX_INITIALIZER;
+static unsigned fcd_sched_busy_threads;
+static unsigned long fcd_sched_activations;
+static unsigned long fcd_sched_overlaps;
+
+/* Per-thread state */
+static __thread long long fcd_sched_deadline;	/* nanoseconds since epoch */
+static __thread unsigned fcd_sched_slot;
+static __thread unsigned fcd_sched_seed;
+static __thread _Bool fcd_sched_busy;
+static __thread _Bool fcd_sched_woken;
+static __thread struct fcd_hist *fcd_sched_cycle_hist;	/* see hist.c */
+static __thread struct fcd_hist *fcd_sched_cpu_hist;
+static __thread long long fcd_sched_cycle_start;
+static __thread long long fcd_sched_cycle_cpu;
+
+/*
+ * Configuration callback for ramp & jitter times
+ */
+static int fcd_sched_cb(cip_err_ctx *ctx, const cip_ini_value *value,
+			const cip_ini_sect *sect __attribute__((unused)),
+			const cip_ini_file *file __attribute__((unused)),
+			void *post_parse_data)
+{
+	const float *p;
+
+	p = (const float *)(value->value);
+
+	if (*p < 0.0 || *p >= 30.0) {
+		cip_err(ctx, "Monitor scheduling time (%g) outside valid range "
+			"(0 - 30 seconds)", *p);
+		return -1;
+	}
+
+	*(float *)fcd_conf_member(post_parse_data) = *p;
+
+	return 0;
+}
+
+static long long fcd_sched_ts_to_ns(const struct timespec *const ts)
+{
+	return ts->tv_sec * FCD_SCHED_NSEC + ts->tv_nsec;
+}
+
+static void fcd_sched_ns_to_ts(struct timespec *const ts, const long long ns)
+{
+	ts->tv_sec = ns / FCD_SCHED_NSEC;
+	ts->tv_nsec = ns % FCD_SCHED_NSEC;
+}
+
+/*
+ * Returns the number of nanoseconds since fcd_sched_epoch (or -1 on error).
+ */
+static long long fcd_sched_now(void)
+{
+	struct timespec now;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &now) == -1) {
+		FCD_PERROR("clock_gettime");
+		return -1;
+	}
+
+	return fcd_sched_ts_to_ns(&now) - fcd_sched_ts_to_ns(&fcd_sched_epoch);
+}
+
+/*
+ * Marks the calling thread as active (busy == 1) or sleeping (busy == 0),
+ * counts activations that overlap another monitor thread's activity, and
+ * records the wall-clock & CPU time of each activation.
+ */
+static void fcd_sched_set_busy(const _Bool busy)
+{
+	int ret;
+
+	if (busy == fcd_sched_busy)
+		return;
+
+	ret = pthread_mutex_lock(&fcd_sched_mutex);
+	if (ret != 0)
+		FCD_PT_ABRT("pthread_mutex_lock", ret);
+
+	if (busy) {
+		++fcd_sched_activations;
+		if (fcd_sched_busy_threads > 0)
+			++fcd_sched_overlaps;
+		++fcd_sched_busy_threads;
+	}
+	else {
+		--fcd_sched_busy_threads;
+	}
+
+	ret = pthread_mutex_unlock(&fcd_sched_mutex);
+	if (ret != 0)
+		FCD_PT_ABRT("pthread_mutex_unlock", ret);
+
+	if (busy) {
+		fcd_sched_cycle_start = fcd_hist_now();
+		fcd_sched_cycle_cpu = fcd_hist_cpu_now();
+	}
+	else {
+		fcd_hist_record(fcd_sched_cycle_hist,
+				fcd_hist_now() - fcd_sched_cycle_start);
+		fcd_hist_record(fcd_sched_cpu_hist,
+				fcd_hist_cpu_now() - fcd_sched_cycle_cpu);
+	}
+
+	fcd_sched_busy = busy;
+}
+
+/* Called if a monitor thread exits (or is cancelled) while it is active */
+static void fcd_sched_cleanup(void *arg __attribute__((unused)))
+{
+	fcd_sched_set_busy(0);
+	fcd_conf_put();
+}
+
+/*
+ * Sleeps until the given time (nanoseconds since epoch), unless interrupted by
+ * SIGUSR1.  Returns the thread-local value of fcd_thread_exit_flag (or -1 on
+ * error).
+ *
+ * The thread doesn't hold a reference to the configuration while it sleeps, so
+ * a reloaded configuration takes effect when it wakes up (and the old one can
+ * be freed in the meantime).
+ */
+static int fcd_sched_sleep_until(const long long deadline)
+{
+	struct timespec ts;
+	struct pollfd pfd;
+	long long now;
+	uint64_t count;
+	int ret;
+
+	fcd_conf_put();
+
+	if ((now = fcd_sched_now()) == -1)
+		return -1;
+
+	fcd_sched_ns_to_ts(&ts, (deadline > now) ? deadline - now : 0);
+
+	pfd.fd = fcd_sched_wake_fds[fcd_sched_slot];
+	pfd.events = POLLIN;
+
+	fcd_sched_set_busy(0);
+
+	ret = ppoll(&pfd, 1, &ts, &fcd_mon_ppoll_sigmask);
+	if (ret == -1 && errno != EINTR) {
+		FCD_PERROR("ppoll");
+		return -1;
+	}
+
+	if (ret > 0 && pfd.revents & POLLIN) {
+		if (read(pfd.fd, &count, sizeof count) == -1
+				&& errno != EAGAIN) {
+			FCD_PERROR("read");
+		}
+		fcd_sched_woken = 1;
+	}
+
+	if (!fcd_thread_exit_flag) {
+		fcd_sched_set_busy(1);
+		fcd_conf_get();
+	}
+
+	return fcd_thread_exit_flag;
+}
+
+/*
+ * Called by fcd_lib_monitor_sleep.  Sleeps until the calling thread's next
+ * slot (plus optional random jitter).  If the thread has overrun its
+ * interval, any missed activations are skipped, rather than "catching up".
+ */
+int fcd_sched_sleep(const time_t seconds)
+{
+	long long interval, now, jitter;
+
+	interval = seconds * FCD_SCHED_NSEC / fcd_sched_speedup;
+
+	if (fcd_sched_deadline == 0) {
+		fcd_sched_deadline = interval * fcd_sched_slot / fcd_sched_slots;
+		if (fcd_sched_deadline == 0)
+			fcd_sched_deadline = 1;
+	}
+
+	if ((now = fcd_sched_now()) == -1)
+		return -1;
+
+	/* If woken early, the missed deadline is still in the future */
+	if (fcd_sched_woken) {
+		fcd_sched_woken = 0;
+		if (fcd_sched_deadline > now)
+			fcd_sched_deadline -= interval;
+	}
+
+	do {
+		fcd_sched_deadline += interval;
+	} while (fcd_sched_deadline <= now);
+
+	jitter = (long long)(fcd_cfg->sched_jitter * 1000.0);	/* ms */
+	if (jitter > 0)
+		jitter = rand_r(&fcd_sched_seed) % (jitter + 1) * 1000000LL
+							/ fcd_sched_speedup;
+
+	return fcd_sched_sleep_until(fcd_sched_deadline + jitter);
+}
+
+/*
+ * Called in the main thread, before any monitor threads are started.
+ */
+void fcd_sched_init(const unsigned slots)
+{
+	unsigned i;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &fcd_sched_epoch) == -1)
+		FCD_PABORT("clock_gettime");
+
+	fcd_sched_slots = (slots > 0) ? slots : 1;
+
+	fcd_sched_wake_fds = malloc(fcd_sched_slots * sizeof *fcd_sched_wake_fds);
+	if (fcd_sched_wake_fds == NULL)
+		FCD_PABORT("malloc");
+
+	for (i = 0; i < fcd_sched_slots; ++i) {
+		/* ppoll ignores -1, so the thread just can't be woken */
+		fcd_sched_wake_fds[i] = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+		if (fcd_sched_wake_fds[i] == -1)
+			FCD_PERROR("eventfd");
+	}
+}
+
+/*
+ * Called in the main thread to make a monitor's thread poll immediately.
+ * Returns -1 if the monitor doesn't have a (running) thread.  (mon->sched_slot
+ * is the slot of the thread that runs the monitor; see main.c.)
+ */
+int fcd_sched_wake(const struct fcd_monitor *const mon)
+{
+	static const uint64_t one = 1;
+	int fd;
+
+	if (mon->monitor_fn == 0 || !mon->enabled || fcd_sched_wake_fds == NULL)
+		return -1;
+
+	fd = fcd_sched_wake_fds[mon->sched_slot];
+	if (fd == -1)
+		return -1;
+
+	if (write(fd, &one, sizeof one) == -1 && errno != EAGAIN) {
+		FCD_PERROR("write");
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * Start routine for all monitor threads.  Waits for the thread's place in the
+ * startup ramp, then calls the monitor's actual thread function.
+ */
+void *fcd_sched_thread_fn(void *arg)
+{
+	struct fcd_monitor *mon = arg;
+	long long start;
+	void *ret;
+
+	fcd_sched_slot = mon->sched_slot;
+	fcd_sched_seed = (unsigned)fcd_sched_epoch.tv_nsec + mon->sched_slot;
+	fcd_sched_cycle_hist = fcd_hist_get(FCD_HIST_CYCLE, mon->name);
+	fcd_sched_cpu_hist = fcd_hist_get(FCD_HIST_CYCLE_CPU, mon->name);
+
+	fcd_conf_get();
+
+	start = (long long)(fcd_cfg->sched_ramp * 1000.0) * 1000000LL
+				* fcd_sched_slot / fcd_sched_slots;
+
+	FCD_DEBUG("%s monitor thread: slot %u of %u, start after %lld ms\n",
+		  mon->name, fcd_sched_slot + 1, fcd_sched_slots,
+		  start / 1000000LL);
+
+	if (start > 0) {
+		switch (fcd_sched_sleep_until(start)) {
+			case 0:		break;
+			case -1:	fcd_lib_fail_and_exit(mon);
+			default:	pthread_exit(NULL);
+		}
+	}
+	else {
+		fcd_sched_set_busy(1);
+	}
+
+	pthread_cleanup_push(fcd_sched_cleanup, NULL);
+	ret = mon->monitor_fn(mon);
+	pthread_cleanup_pop(1);
+
+	return ret;
+}
+
+void fcd_sched_log_stats(void)
+{
+	int ret;
+
+	ret = pthread_mutex_lock(&fcd_sched_mutex);
+	if (ret != 0)
+		FCD_PT_ABRT("pthread_mutex_lock", ret);
+
+	FCD_INFO("Monitor activations: %lu (%lu overlapped)\n",
+		 fcd_sched_activations, fcd_sched_overlaps);
+
+	ret = pthread_mutex_unlock(&fcd_sched_mutex);
+	if (ret != 0)
+		FCD_PT_ABRT("pthread_mutex_unlock", ret);
+}
+
+void fcd_sched_dump_cfg(void)
+{
+	FCD_DUMP("Monitor scheduling configuration:\n");
+	FCD_DUMP("\tstart ramp: %.3f seconds\n", fcd_cfg->sched_ramp);
+	FCD_DUMP("\tjitter: %.3f seconds\n", fcd_cfg->sched_jitter);
+	FCD_DUMP("\n");
+}
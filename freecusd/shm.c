@@ -0,0 +1,228 @@
+/*
+ * Copyright 2020 Ian Pilcher <arequipeno@gmail.com>
+ *
+ * This program is free software.  You can redistribute it or modify it under
+ * the terms of version 2 of the GNU General Public License (GPL), as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY -- without even the implied warranty of MERCHANTIBILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the text of the GPL for more details.
+ *
+ * Version 2 of the GNU General Public License is available at:
+ *
+ *   http://www.gnu.org/licenses/old-licenses/gpl-2.0.html
+ */
+
+#include "freecusd.h"
+#include "shm.h"
+
+#include <sys/mman.h>
+#include <string.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+
+/*
+ * Shared memory status segment; see shm.h for the layout.  Monitors update
+ * their values with:
+ *
+ *	if ((shm = fcd_shm_write_begin()) != NULL) {
+ *		shm->... = ...;
+ *		fcd_shm_write_end(shm);
+ *	}
+ *
+ * Writers (the monitor threads and the main thread) are serialized by
+ * fcd_shm_mutex; readers (other processes) use the sequence lock.  The
+ * segment is opened directly in /dev/shm, rather than with shm_open(), so that
+ * freecusd doesn't need librt on older systems.  With a fake root (-r), it is
+ * created under the root instead (see lib.c), so a test instance doesn't
+ * replace the real daemon's segment.
+ */
+
+static struct fcd_shm_status *fcd_shm;		/* NULL if disabled */
+static const char *fcd_shm_path;
+static char fcd_shm_path_buf[PATH_MAX];
+static pthread_mutex_t fcd_shm_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static uint64_t fcd_shm_now(void)
+{
+	struct timespec now;
+
+	if (clock_gettime(CLOCK_REALTIME, &now) == -1)
+		FCD_PABORT("clock_gettime");
+
+	return (uint64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+struct fcd_shm_status *fcd_shm_write_begin(void)
+{
+	int ret;
+
+	if (fcd_shm == NULL)
+		return NULL;
+
+	ret = pthread_mutex_lock(&fcd_shm_mutex);
+	if (ret != 0)
+		FCD_PT_ABRT("pthread_mutex_lock", ret);
+
+	/* Odd sequence number must be visible before any data is changed */
+	__atomic_store_n(&fcd_shm->seq, fcd_shm->seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	return fcd_shm;
+}
+
+void fcd_shm_write_end(struct fcd_shm_status *const shm)
+{
+	int ret;
+
+	shm->updated = fcd_shm_now();
+	__atomic_store_n(&shm->seq, shm->seq + 1, __ATOMIC_RELEASE);
+
+	ret = pthread_mutex_unlock(&fcd_shm_mutex);
+	if (ret != 0)
+		FCD_PT_ABRT("pthread_mutex_unlock", ret);
+}
+
+static uint8_t fcd_shm_alert(const enum fcd_alert_msg alert)
+{
+	return alert == FCD_ALERT_SET_REQ || alert == FCD_ALERT_SET_ACK;
+}
+
+/*
+ * Copies a monitor's LCD text & alert state into the segment.  Called with the
+ * monitor's mutex locked, whenever the monitor thread publishes its status.
+ */
+void fcd_shm_update_monitor(const struct fcd_monitor *const mon)
+{
+	struct fcd_shm_monitor *m;
+	struct fcd_shm_status *shm;
+	unsigned i;
+
+	for (i = 0; fcd_monitors[i] != mon; ++i) {
+		if (fcd_monitors[i] == NULL)
+			return;
+	}
+
+	if (i >= FCD_SHM_MONITORS || (shm = fcd_shm_write_begin()) == NULL)
+		return;
+
+	m = &shm->monitors[i];
+
+	if (mon->pages != NULL && mon->page_count != 0) {
+		memcpy(m->text, mon->pages, sizeof m->text);
+	}
+	else {
+		memcpy(m->text, mon->buf + 5, sizeof m->text / 2);
+		memcpy(m->text + sizeof m->text / 2, mon->buf + 45,
+		       sizeof m->text / 2);
+	}
+
+	m->sys_warn = fcd_shm_alert(mon->sys_warn);
+	m->sys_fail = fcd_shm_alert(mon->sys_fail);
+	m->pwm_flags = mon->new_pwm_flags;
+
+	for (i = 0; i < FCD_SHM_BAYS; ++i)
+		m->disk_alerts[i] = fcd_shm_alert(mon->disk_alerts[i]);
+
+	m->updated = fcd_shm_now();
+
+	fcd_shm_write_end(shm);
+}
+
+/* Called in the main thread, after the configuration has been parsed */
+void fcd_shm_open(void)
+{
+	struct fcd_shm_status *shm;
+	unsigned i;
+	int fd;
+
+	fcd_shm_path = fcd_lib_path(fcd_shm_path_buf, FCD_SHM_PATH);
+	if (fcd_shm_path == NULL) {
+		FCD_PERROR(FCD_SHM_PATH);
+		goto error;
+	}
+
+	if (unlink(fcd_shm_path) == -1 && errno != ENOENT)
+		FCD_PERROR(fcd_shm_path);
+
+	fd = open(fcd_shm_path, O_RDWR | O_CREAT | O_EXCL | O_NOFOLLOW
+					| O_CLOEXEC, 0644);
+	if (fd == -1) {
+		FCD_PERROR(fcd_shm_path);
+		goto error;
+	}
+
+	if (ftruncate(fd, sizeof *shm) == -1) {
+		FCD_PERROR("ftruncate");
+		goto error_close;
+	}
+
+	shm = mmap(NULL, sizeof *shm, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (shm == MAP_FAILED) {
+		FCD_PERROR("mmap");
+		goto error_close;
+	}
+
+	if (close(fd) == -1)
+		FCD_PERROR("close");
+
+	/* ftruncate() zero-filled the segment */
+	shm->version = FCD_SHM_VERSION;
+	shm->size = sizeof *shm;
+	shm->pid = (uint32_t)getpid();
+	shm->started = fcd_shm_now();
+
+	for (i = 0; i < FCD_SHM_TEMP_ARRAY_SIZE; ++i)
+		shm->temps[i] = FCD_SHM_NO_VALUE;
+
+	shm->fan_rpm = FCD_SHM_NO_VALUE;
+	shm->pwm_state = FCD_SHM_NO_VALUE;
+	shm->pwm_value = FCD_SHM_NO_VALUE;
+	shm->raid_ok = FCD_SHM_NO_VALUE;
+	shm->raid_warn = FCD_SHM_NO_VALUE;
+	shm->raid_fail = FCD_SHM_NO_VALUE;
+
+	for (i = 0; fcd_monitors[i] != NULL && i < FCD_SHM_MONITORS; ++i) {
+		strncpy(shm->monitors[i].name, fcd_monitors[i]->name,
+			sizeof shm->monitors[i].name - 1);
+		shm->monitors[i].enabled = fcd_monitors[i]->enabled;
+	}
+
+	shm->monitor_count = i;
+
+	/* Readers check the magic number first */
+	__atomic_store_n(&shm->magic, FCD_SHM_MAGIC, __ATOMIC_RELEASE);
+
+	fcd_shm = shm;
+	FCD_INFO("Publishing status in %s\n", fcd_shm_path);
+	return;
+
+error_close:
+	if (close(fd) == -1)
+		FCD_PERROR("close");
+	if (unlink(fcd_shm_path) == -1)
+		FCD_PERROR(fcd_shm_path);
+error:
+	FCD_WARN("Shared memory status disabled\n");
+}
+
+/*
+ * Called after all threads that update the segment have exited.  Readers that
+ * still have it mapped will see pid of a process that no longer exists.
+ */
+void fcd_shm_close(void)
+{
+	if (fcd_shm == NULL)
+		return;
+
+	if (munmap(fcd_shm, sizeof *fcd_shm) == -1)
+		FCD_PERROR("munmap");
+
+	if (unlink(fcd_shm_path) == -1)
+		FCD_PERROR(fcd_shm_path);
+
+	fcd_shm = NULL;
+}
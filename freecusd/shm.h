@@ -0,0 +1,152 @@
+/*
+ * Copyright 2020 Ian Pilcher <arequipeno@gmail.com>
+ *
+ * This program is free software.  You can redistribute it or modify it under
+ * the terms of version 2 of the GNU General Public License (GPL), as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY -- without even the implied warranty of MERCHANTIBILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the text of the GPL for more details.
+ *
+ * Version 2 of the GNU General Public License is available at:
+ *
+ *   http://www.gnu.org/licenses/old-licenses/gpl-2.0.html
+ */
+
+/*
+ * Layout of the shared memory status segment (FCD_SHM_PATH), which freecusd
+ * updates whenever a monitor publishes new values.  Local tools can mmap it
+ * (read-only) and call fcd_shm_read() to get a consistent snapshot without
+ * any system calls.  This file must not depend on freecusd.h.
+ *
+ * The segment is protected by a sequence lock.  seq is odd while freecusd is
+ * updating the segment; a reader must retry if seq is odd or if it changed
+ * while the reader was copying the segment.  Retries are bounded, so a reader
+ * doesn't hang if freecusd dies in the middle of an update.
+ *
+ * Any incompatible change to the layout must increment FCD_SHM_VERSION.
+ * Fields may be appended without changing the version (check size).
+ */
+
+#ifndef FREECUSD_SHM_H
+#define FREECUSD_SHM_H
+
+#include <stdint.h>
+#include <string.h>
+#include <sched.h>
+
+#define FCD_SHM_PATH		"/dev/shm/freecusd"
+#define FCD_SHM_MAGIC		0x53444346	/* "FCDS" (little-endian) */
+#define FCD_SHM_VERSION		1
+
+#define FCD_SHM_MONITORS	16
+#define FCD_SHM_DISKS		64	/* disks beyond this aren't included */
+#define FCD_SHM_BAYS		5	/* internal disk bays (alert LEDs) */
+
+/* fcd_shm_read() retries */
+#define FCD_SHM_READ_SPINS	1000	/* before yielding the CPU */
+#define FCD_SHM_READ_TRIES	10000	/* before giving up */
+
+/* Values that haven't been read (yet) */
+#define FCD_SHM_NO_VALUE	INT32_MIN
+
+/* temps[] indices */
+enum fcd_shm_temp {
+	FCD_SHM_TEMP_CORE0 = 0,
+	FCD_SHM_TEMP_CORE1,
+	FCD_SHM_TEMP_CPU,
+	FCD_SHM_TEMP_ICH,
+	FCD_SHM_TEMP_SYS,
+};
+#define FCD_SHM_TEMP_ARRAY_SIZE		(FCD_SHM_TEMP_SYS + 1)
+
+/*
+ * All timestamps are milliseconds since the epoch (CLOCK_REALTIME); 0 means
+ * never.  Alert states are 1 (set) or 0 (clear).
+ */
+
+struct fcd_shm_monitor {
+	char name[32];
+	char text[40];		/* LCD text (upper & lower line); not NUL-
+				   terminated; first subpage only */
+	uint64_t updated;
+	uint8_t enabled;
+	uint8_t sys_warn;
+	uint8_t sys_fail;
+	uint8_t pwm_flags;	/* see FCD_FAN_* in freecusd.h */
+	uint8_t disk_alerts[FCD_SHM_BAYS];
+	uint8_t reserved[3];
+};
+
+struct fcd_shm_disk {
+	uint32_t pos;		/* 1-5 internal bays, 6+ expansion */
+	char device[12];	/* "sda", etc. */
+	int32_t temp;		/* degrees Celsius */
+	int32_t smart_status;	/* see smart/status.h */
+};
+
+struct fcd_shm_status {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t size;		/* sizeof(struct fcd_shm_status) */
+	uint32_t seq;
+	uint32_t pid;		/* of freecusd */
+	uint32_t reserved;
+	uint64_t started;
+	uint64_t updated;
+	/* Values */
+	int32_t temps[FCD_SHM_TEMP_ARRAY_SIZE];	/* millidegrees Celsius */
+	int32_t fan_rpm;
+	double loadavg[3];
+	int32_t pwm_state;	/* 0 normal, 1 high, 2 maximum */
+	int32_t pwm_value;	/* 0 - 255 */
+	int32_t raid_ok;	/* number of arrays by status */
+	int32_t raid_warn;
+	int32_t raid_fail;
+	/* Per-monitor status, in LCD page order */
+	uint32_t monitor_count;
+	struct fcd_shm_monitor monitors[FCD_SHM_MONITORS];
+	/* RAID disks, sorted by position */
+	uint32_t disk_count;
+	struct fcd_shm_disk disks[FCD_SHM_DISKS];
+};
+
+/*
+ * Copies a consistent snapshot of the segment (shm) into status.  Returns 0 on
+ * success, -1 if the segment is not a compatible version, or -2 if no
+ * consistent snapshot could be read (freecusd is stuck in, or died during, an
+ * update).  Makes no system calls unless freecusd is updating the segment.
+ */
+static inline int fcd_shm_read(const struct fcd_shm_status *const shm,
+			       struct fcd_shm_status *const status)
+{
+	unsigned tries;
+	uint32_t seq;
+
+	if (shm->magic != FCD_SHM_MAGIC || shm->version != FCD_SHM_VERSION
+			|| shm->size < sizeof *status) {
+		return -1;
+	}
+
+	for (tries = 0; tries < FCD_SHM_READ_TRIES; ++tries) {
+
+		/* Let a preempted writer finish */
+		if (tries >= FCD_SHM_READ_SPINS)
+			sched_yield();
+
+		seq = __atomic_load_n(&shm->seq, __ATOMIC_ACQUIRE);
+		if (seq & 1)
+			continue;
+
+		memcpy(status, shm, sizeof *status);
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+		if (__atomic_load_n(&shm->seq, __ATOMIC_RELAXED) == seq)
+			return 0;
+	}
+
+	return -2;
+}
+
+#endif		/* FREECUSD_SHM_H */
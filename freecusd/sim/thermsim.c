@@ -0,0 +1,743 @@
+/*
+ * Copyright 2020 Ian Pilcher <arequipeno@gmail.com>
+ *
+ * This program is free software.  You can redistribute it or modify it under
+ * the terms of version 2 of the GNU General Public License (GPL), as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY -- without even the implied warranty of MERCHANTIBILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the text of the GPL for more details.
+ *
+ * Version 2 of the GNU General Public License is available at:
+ *
+ *   http://www.gnu.org/licenses/old-licenses/gpl-2.0.html
+ */
+
+/*
+ * thermsim - thermal model of an N5550, for benchmarking fan control
+ *
+ *	gcc -std=gnu99 -O2 -Wall -Wextra -o thermsim thermsim.c ../pwmstate.c -lm
+ *
+ * Usage: thermsim [OPTIONS]
+ *
+ *	-r DIR		closed loop with freecusd (freecusd -f -r DIR ...);
+ *			writes the sensor files under DIR once per second and
+ *			reads back the PWM value that freecusd writes
+ *	-c CONTROLLER	built-in controller, when -r isn't used; runs in
+ *			simulated time (as fast as possible):
+ *			  hyst	   freecusd's on/hysteresis logic (default)
+ *			  prop	   proportional, between the normal & max PWM
+ *			  fixed=N  constant PWM value
+ *	-d SECONDS	duration (default 3600)
+ *	-l PROFILE	load profile -- SECONDS:PERCENT,... (default
+ *			0:10,600:100,2400:10)
+ *	-a CELSIUS	ambient temperature (default 25)
+ *	-m FACTOR	thermal mass multiplier (default 1.0)
+ *	-f RPM,PWM	fan curve -- speed at PWM 255, and the lowest PWM value
+ *			at which the fan turns (default 2500,60)
+ *	-s SECONDS	fan stalls (0 RPM) after SECONDS
+ *	-t TYPE=MAX_ON,MAX_HYST,HIGH_ON,HIGH_HYST
+ *			fan thresholds (Celsius) for the built-in controllers;
+ *			TYPE is core, cpu, ich, sys or hdd (the defaults match
+ *			freecusd's); HIGH_HYST < HIGH_ON < MAX_ON and
+ *			HIGH_HYST < MAX_HYST < MAX_ON
+ *	-p NORMAL,HIGH,MAX
+ *			PWM values for the built-in controllers (default
+ *			170,215,255)
+ *	-v		print the temperatures & PWM value every minute
+ *
+ * Each component (CPU, ICH, 5 HDDs) is a lumped thermal mass, heated by its
+ * (load-dependent) power and cooled into the case air, which is itself cooled
+ * by the system fan.  The parameters are plausible, not calibrated against a
+ * real N5550, so compare controllers and thresholds with each other rather
+ * than with a real system.
+ *
+ * The score is the time that each sensor spent at or above its warning
+ * threshold (freecusd's defaults), fan duty-seconds (PWM / 255, integrated
+ * over time), and the number of PWM changes.
+ *
+ * In closed-loop mode, freecusd reads the CPU, ICH & case temperatures, the
+ * fan speed and the load average from DIR.  It reads disk temperatures from
+ * the real disks, so the S.M.A.R.T. & disk temperature monitors should be
+ * disabled; the simulated disk temperatures are scored, but they don't affect
+ * freecusd's fan control.
+ */
+
+#include <sys/stat.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <errno.h>
+#include <time.h>
+#include <math.h>
+
+#include "../pwmstate.h"
+
+#define TSIM_HDD_COUNT		5
+#define TSIM_MAX_STEPS		100
+
+/* Thermal nodes */
+enum tsim_node_id {
+	TSIM_NODE_CPU = 0,
+	TSIM_NODE_ICH,
+	TSIM_NODE_CASE,
+	TSIM_NODE_HDD,			/* first of TSIM_HDD_COUNT */
+	TSIM_NODE_COUNT = TSIM_NODE_HDD + TSIM_HDD_COUNT
+};
+
+struct tsim_node {
+	double mass;			/* heat capacity (J/K) */
+	double p_idle;			/* power (W) at 0% load */
+	double p_load;			/* additional power (W) at 100% load */
+	double g_still;			/* conductance (W/K) with the fan stopped */
+	double g_fan;			/* additional conductance at full speed */
+	double temp;			/* Celsius */
+};
+
+/*
+ * The case air loses heat to the ambient air (and its p_load is ignored);
+ * everything else loses heat to the case air.
+ */
+static struct tsim_node tsim_nodes[TSIM_NODE_COUNT] = {
+	[TSIM_NODE_CPU]		= { 150.0,  3.0,  7.0, 0.3,  1.5 },
+	[TSIM_NODE_ICH]		= { 100.0,  1.2,  0.5, 0.1,  0.3 },
+	[TSIM_NODE_CASE]	= { 2000.0, 10.0, 0.0, 1.0,  8.0 },
+	[TSIM_NODE_HDD + 0]	= { 600.0,  4.0,  2.0, 0.2,  0.6 },
+	[TSIM_NODE_HDD + 1]	= { 600.0,  4.0,  2.0, 0.2,  0.6 },
+	[TSIM_NODE_HDD + 2]	= { 600.0,  4.0,  2.0, 0.2,  0.6 },
+	[TSIM_NODE_HDD + 3]	= { 600.0,  4.0,  2.0, 0.2,  0.6 },
+	[TSIM_NODE_HDD + 4]	= { 600.0,  4.0,  2.0, 0.2,  0.6 },
+};
+
+/* Threshold types; see struct fcd_conf */
+enum tsim_type {
+	TSIM_TYPE_CORE = 0,
+	TSIM_TYPE_CPU,
+	TSIM_TYPE_ICH,
+	TSIM_TYPE_SYS,
+	TSIM_TYPE_HDD,
+	TSIM_TYPE_COUNT
+};
+
+static const char *const tsim_type_names[TSIM_TYPE_COUNT] = {
+	"core", "cpu", "ich", "sys", "hdd"
+};
+
+/* Celsius; must match the defaults in freecusd/conf.c & freecusd/smart.c */
+static int tsim_thresholds[TSIM_TYPE_COUNT][FCD_CONF_TEMP_ARRAY_SIZE] = {
+	/*			   WARN FAIL MAX_ON MAX_HYST HIGH_ON HIGH_HYST */
+	[TSIM_TYPE_CORE]	= { 43,  45,  42,    39,      40,     37 },
+	[TSIM_TYPE_CPU]		= { 43,  45,  42,    39,      40,     37 },
+	[TSIM_TYPE_ICH]		= { 39,  40,  39,    37,      38,     36 },
+	[TSIM_TYPE_SYS]		= { 39,  40,  39,    37,      38,     36 },
+	[TSIM_TYPE_HDD]		= { 45,  50,  43,    41,      40,     38 },
+};
+
+/* What freecusd sees; all sensors report whole degrees */
+struct tsim_sensor {
+	const char *name;
+	const char *path;		/* NULL for disks */
+	enum tsim_node_id node;
+	double load_offset;		/* core temp above package at 100% */
+	enum tsim_type type;
+	int temp;			/* Celsius */
+	int max;
+	double over;			/* seconds at or above warning */
+	int fd;
+};
+
+#define TSIM_SENSOR_COUNT	(5 + TSIM_HDD_COUNT)
+
+static struct tsim_sensor tsim_sensors[TSIM_SENSOR_COUNT] = {
+	{ "core0", "/sys/devices/platform/coretemp.0/hwmon/hwmon1/temp2_input",
+	  TSIM_NODE_CPU, 3.0, TSIM_TYPE_CORE, 0, 0, 0.0, -1 },
+	{ "core1", "/sys/devices/platform/coretemp.0/hwmon/hwmon1/temp3_input",
+	  TSIM_NODE_CPU, 2.5, TSIM_TYPE_CORE, 0, 0, 0.0, -1 },
+	{ "cpu", "/sys/devices/platform/it87.656/temp1_input",
+	  TSIM_NODE_CPU, 0.0, TSIM_TYPE_CPU, 0, 0, 0.0, -1 },
+	{ "ich", "/sys/devices/platform/it87.656/temp2_input",
+	  TSIM_NODE_ICH, 0.0, TSIM_TYPE_ICH, 0, 0, 0.0, -1 },
+	{ "sys", "/sys/devices/platform/it87.656/temp3_input",
+	  TSIM_NODE_CASE, 0.0, TSIM_TYPE_SYS, 0, 0, 0.0, -1 },
+	{ "hdd1", NULL, TSIM_NODE_HDD + 0, 0.0, TSIM_TYPE_HDD, 0, 0, 0.0, -1 },
+	{ "hdd2", NULL, TSIM_NODE_HDD + 1, 0.0, TSIM_TYPE_HDD, 0, 0, 0.0, -1 },
+	{ "hdd3", NULL, TSIM_NODE_HDD + 2, 0.0, TSIM_TYPE_HDD, 0, 0, 0.0, -1 },
+	{ "hdd4", NULL, TSIM_NODE_HDD + 3, 0.0, TSIM_TYPE_HDD, 0, 0, 0.0, -1 },
+	{ "hdd5", NULL, TSIM_NODE_HDD + 4, 0.0, TSIM_TYPE_HDD, 0, 0, 0.0, -1 },
+};
+
+/* Files that freecusd reads (other than temperatures) or writes */
+static const char tsim_fan_path[] = "/sys/devices/platform/it87.656/fan3_input";
+static const char tsim_pwm_path[] = "/sys/devices/platform/it87.656/pwm3";
+static const char tsim_loadavg_path[] = "/proc/loadavg";
+
+enum tsim_ctl {
+	TSIM_CTL_FREECUSD = 0,		/* closed loop (-r) */
+	TSIM_CTL_HYST,
+	TSIM_CTL_PROP,
+	TSIM_CTL_FIXED,
+};
+
+/* Load profile step */
+struct tsim_step {
+	long start;			/* seconds */
+	double load;			/* 0.0 - 1.0 */
+};
+
+static const char *tsim_name;
+static const char *tsim_root = NULL;
+static enum tsim_ctl tsim_ctl = TSIM_CTL_HYST;
+static int tsim_fixed_pwm;
+static long tsim_duration = 3600;
+static struct tsim_step tsim_steps[TSIM_MAX_STEPS];
+static unsigned tsim_step_count;
+static double tsim_ambient = 25.0;
+static double tsim_mass = 1.0;
+static double tsim_rpm_max = 2500.0;
+static int tsim_pwm_min = 60;
+static long tsim_stall = -1;
+static int tsim_pwm_values[FCD_PWM_STATE_ARRAY_SIZE] = { 170, 215, 255 };
+static _Bool tsim_verbose = 0;
+
+/* Controller & fan state */
+static enum fcd_pwm_state tsim_pwm_state;	/* built-in hyst controller */
+static int tsim_pwm = 255;
+static unsigned tsim_pwm_changes;
+static double tsim_duty;
+static int tsim_fan_fd = -1, tsim_pwm_fd = -1, tsim_loadavg_fd = -1;
+static double tsim_loadavg[3];
+
+__attribute__((noreturn))
+static void tsim_usage(void)
+{
+	fprintf(stderr,
+		"Usage: %s [-r DIR | -c hyst|prop|fixed=N] [-d SECONDS] "
+			"[-l PROFILE]\n"
+		"          [-a CELSIUS] [-m FACTOR] [-f RPM,PWM] "
+			"[-s SECONDS] [-v]\n"
+		"          [-t TYPE=MAX_ON,MAX_HYST,HIGH_ON,HIGH_HYST]... "
+			"[-p NORMAL,HIGH,MAX]\n"
+		"\n"
+		"See the comment at the top of freecusd/sim/thermsim.c\n",
+		tsim_name);
+	exit(EXIT_FAILURE);
+}
+
+__attribute__((noreturn))
+static void tsim_fatal(const char *const what)
+{
+	fprintf(stderr, "%s: %s: %s\n", tsim_name, what, strerror(errno));
+	exit(EXIT_FAILURE);
+}
+
+static void tsim_parse_profile(const char *s)
+{
+	char *end;
+	long start;
+	double pct;
+
+	for (tsim_step_count = 0; *s != 0; s = end + (*end == ',')) {
+
+		if (tsim_step_count == TSIM_MAX_STEPS)
+			tsim_usage();
+
+		start = strtol(s, &end, 10);
+		if (end == s || *end != ':' || start < 0)
+			tsim_usage();
+
+		s = end + 1;
+		pct = strtod(s, &end);
+		if (end == s || (*end != ',' && *end != 0) || pct < 0.0
+				|| pct > 100.0) {
+			tsim_usage();
+		}
+
+		if (tsim_step_count > 0
+			    && start <= tsim_steps[tsim_step_count - 1].start) {
+			tsim_usage();
+		}
+
+		tsim_steps[tsim_step_count].start = start;
+		tsim_steps[tsim_step_count].load = pct / 100.0;
+		++tsim_step_count;
+	}
+}
+
+static void tsim_parse_thresholds(const char *const s)
+{
+	int *t;
+	int i;
+
+	for (i = 0; i < TSIM_TYPE_COUNT; ++i) {
+		if (strncmp(s, tsim_type_names[i], strlen(tsim_type_names[i]))
+				== 0 && s[strlen(tsim_type_names[i])] == '=') {
+			break;
+		}
+	}
+
+	if (i == TSIM_TYPE_COUNT)
+		tsim_usage();
+
+	t = tsim_thresholds[i];
+
+	if (sscanf(strchr(s, '=') + 1, "%d,%d,%d,%d", &t[FCD_CONF_TEMP_FAN_MAX_ON],
+		   &t[FCD_CONF_TEMP_FAN_MAX_HYST], &t[FCD_CONF_TEMP_FAN_HIGH_ON],
+		   &t[FCD_CONF_TEMP_FAN_HIGH_HYST])
+			!= 4) {
+		tsim_usage();
+	}
+
+	/* Each "on" threshold is above its "hyst", and high is below max */
+	if (t[FCD_CONF_TEMP_FAN_HIGH_HYST] >= t[FCD_CONF_TEMP_FAN_HIGH_ON]
+		|| t[FCD_CONF_TEMP_FAN_HIGH_ON] >= t[FCD_CONF_TEMP_FAN_MAX_ON]
+		|| t[FCD_CONF_TEMP_FAN_HIGH_HYST]
+					>= t[FCD_CONF_TEMP_FAN_MAX_HYST]
+		|| t[FCD_CONF_TEMP_FAN_MAX_HYST]
+					>= t[FCD_CONF_TEMP_FAN_MAX_ON]) {
+		fprintf(stderr, "%s: Invalid thresholds: %s\n"
+				"(HIGH_HYST < HIGH_ON < MAX_ON and "
+				"HIGH_HYST < MAX_HYST < MAX_ON)\n",
+			tsim_name, s);
+		exit(EXIT_FAILURE);
+	}
+}
+
+static void tsim_parse_args(int argc, char *argv[])
+{
+	int opt;
+
+	tsim_parse_profile("0:10,600:100,2400:10");
+
+	while ((opt = getopt(argc, argv, "r:c:d:l:a:m:f:s:t:p:v")) != -1) {
+
+		switch (opt) {
+
+			case 'r':	tsim_root = optarg;
+					tsim_ctl = TSIM_CTL_FREECUSD;
+					break;
+
+			case 'c':	if (strcmp(optarg, "hyst") == 0)
+						tsim_ctl = TSIM_CTL_HYST;
+					else if (strcmp(optarg, "prop") == 0)
+						tsim_ctl = TSIM_CTL_PROP;
+					else if (sscanf(optarg, "fixed=%d",
+							&tsim_fixed_pwm) == 1
+						    && tsim_fixed_pwm >= 0
+						    && tsim_fixed_pwm <= 255)
+						tsim_ctl = TSIM_CTL_FIXED;
+					else
+						tsim_usage();
+					break;
+
+			case 'd':	tsim_duration = atol(optarg);
+					if (tsim_duration <= 0)
+						tsim_usage();
+					break;
+
+			case 'l':	tsim_parse_profile(optarg);
+					break;
+
+			case 'a':	tsim_ambient = atof(optarg);
+					break;
+
+			case 'm':	tsim_mass = atof(optarg);
+					if (tsim_mass <= 0.0)
+						tsim_usage();
+					break;
+
+			case 'f':	if (sscanf(optarg, "%lf,%d",
+						   &tsim_rpm_max,
+						   &tsim_pwm_min) != 2
+						    || tsim_rpm_max <= 0.0)
+						tsim_usage();
+					break;
+
+			case 's':	tsim_stall = atol(optarg);
+					if (tsim_stall < 0)
+						tsim_usage();
+					break;
+
+			case 't':	tsim_parse_thresholds(optarg);
+					break;
+
+			case 'p':	if (sscanf(optarg, "%d,%d,%d",
+						   &tsim_pwm_values[0],
+						   &tsim_pwm_values[1],
+						   &tsim_pwm_values[2]) != 3)
+						tsim_usage();
+					break;
+
+			case 'v':	tsim_verbose = 1;
+					break;
+
+			default:	tsim_usage();
+		}
+	}
+
+	if (optind != argc || (tsim_root != NULL && tsim_ctl
+							!= TSIM_CTL_FREECUSD))
+		tsim_usage();
+}
+
+static double tsim_load(const long now)
+{
+	unsigned i;
+
+	for (i = tsim_step_count - 1; i > 0 && tsim_steps[i].start > now; --i);
+
+	return (tsim_steps[i].start <= now) ? tsim_steps[i].load : 0.0;
+}
+
+static double tsim_fan_rpm(const long now)
+{
+	if (tsim_pwm < tsim_pwm_min || (tsim_stall >= 0 && now >= tsim_stall))
+		return 0.0;
+
+	return tsim_rpm_max * tsim_pwm / 255.0;
+}
+
+/*
+ * Advances the model by dt seconds.  Heat flows are computed from the current
+ * temperatures before any of them are updated.
+ */
+static void tsim_model_step(const double load, const double airflow,
+			    const double dt)
+{
+	double flow[TSIM_NODE_COUNT], g, q;
+	struct tsim_node *n;
+	int i;
+
+	n = &tsim_nodes[TSIM_NODE_CASE];
+	g = n->g_still + n->g_fan * airflow;
+	flow[TSIM_NODE_CASE] = n->p_idle - g * (n->temp - tsim_ambient);
+
+	for (i = 0; i < TSIM_NODE_COUNT; ++i) {
+
+		if (i == TSIM_NODE_CASE)
+			continue;
+
+		n = &tsim_nodes[i];
+		g = n->g_still + n->g_fan * airflow;
+		q = g * (n->temp - tsim_nodes[TSIM_NODE_CASE].temp);
+
+		flow[i] = n->p_idle + n->p_load * load - q;
+		flow[TSIM_NODE_CASE] += q;
+	}
+
+	for (i = 0; i < TSIM_NODE_COUNT; ++i) {
+		n = &tsim_nodes[i];
+		n->temp += flow[i] * dt / (n->mass * tsim_mass);
+	}
+}
+
+/* Starting point -- everything at ambient temperature, fan at full speed */
+static void tsim_model_init(void)
+{
+	int i;
+
+	for (i = 0; i < TSIM_NODE_COUNT; ++i)
+		tsim_nodes[i].temp = tsim_ambient;
+}
+
+static void tsim_sensors_update(const double load, const double dt)
+{
+	struct tsim_sensor *s;
+	int i;
+
+	for (i = 0; i < TSIM_SENSOR_COUNT; ++i) {
+
+		s = &tsim_sensors[i];
+		s->temp = (int)lround(tsim_nodes[s->node].temp
+						+ s->load_offset * load);
+
+		if (s->temp > s->max)
+			s->max = s->temp;
+		if (s->temp >= tsim_thresholds[s->type][FCD_CONF_TEMP_WARN])
+			s->over += dt;
+	}
+}
+
+/* freecusd's logic -- fcd_pwm_apply() in freecusd/pwm.c, without overrides */
+static int tsim_ctl_hyst(void)
+{
+	const struct tsim_sensor *s;
+	uint8_t flags;
+	int i;
+
+	for (flags = 0, i = 0; i < TSIM_SENSOR_COUNT; ++i) {
+		s = &tsim_sensors[i];
+		flags |= fcd_pwm_temp_flags(s->temp, tsim_thresholds[s->type]);
+	}
+
+	tsim_pwm_state = fcd_pwm_next_state(flags, tsim_pwm_state);
+
+	return tsim_pwm_values[tsim_pwm_state];
+}
+
+/*
+ * Proportional alternative -- normal PWM at or below the high hysteresis
+ * threshold of every sensor, max PWM at or above the max on threshold of any
+ * sensor, linear in between (in steps of 5).
+ */
+static int tsim_ctl_prop(void)
+{
+	const struct tsim_sensor *s;
+	double x, worst;
+	const int *t;
+	int i, pwm;
+
+	for (worst = 0.0, i = 0; i < TSIM_SENSOR_COUNT; ++i) {
+		s = &tsim_sensors[i];
+		t = tsim_thresholds[s->type];
+		x = (double)(s->temp - t[FCD_CONF_TEMP_FAN_HIGH_HYST])
+				/ (t[FCD_CONF_TEMP_FAN_MAX_ON]
+					- t[FCD_CONF_TEMP_FAN_HIGH_HYST]);
+		if (x > worst)
+			worst = x;
+	}
+
+	if (worst > 1.0)
+		worst = 1.0;
+
+	pwm = tsim_pwm_values[0]
+		+ (int)lround(worst * (tsim_pwm_values[2] - tsim_pwm_values[0])
+									/ 5) * 5;
+
+	return (pwm > 255) ? 255 : pwm;
+}
+
+/*
+ * Writes a value in a fixed-width field, without truncating the file, so that
+ * freecusd (which keeps the file open) never reads a partial value.
+ */
+static void tsim_write_value(const int fd, const char *const format, ...)
+	__attribute__((format(printf, 2, 3)));
+
+static void tsim_write_value(const int fd, const char *const format, ...)
+{
+	char buf[64];
+	va_list ap;
+	int len;
+
+	va_start(ap, format);
+	len = vsnprintf(buf, sizeof buf, format, ap);
+	va_end(ap);
+
+	if (pwrite(fd, buf, len, 0) != len)
+		tsim_fatal("pwrite");
+}
+
+static int tsim_open(const char *const path, const int flags)
+{
+	char buf[PATH_MAX], *c;
+	int fd;
+
+	if (snprintf(buf, sizeof buf, "%s%s", tsim_root, path)
+							>= (int)sizeof buf) {
+		errno = ENAMETOOLONG;
+		tsim_fatal(path);
+	}
+
+	/* mkdir -p */
+	for (c = strchr(buf + 1, '/'); c != NULL; c = strchr(c + 1, '/')) {
+		*c = 0;
+		if (mkdir(buf, 0755) == -1 && errno != EEXIST)
+			tsim_fatal(buf);
+		*c = '/';
+	}
+
+	fd = open(buf, flags | O_CLOEXEC, 0644);
+	if (fd == -1)
+		tsim_fatal(buf);
+
+	return fd;
+}
+
+/* Creates the sensor files; freecusd must be started afterwards */
+static void tsim_files_open(void)
+{
+	struct tsim_sensor *s;
+	int i;
+
+	for (i = 0; i < TSIM_SENSOR_COUNT; ++i) {
+		s = &tsim_sensors[i];
+		if (s->path != NULL)
+			s->fd = tsim_open(s->path, O_WRONLY | O_CREAT | O_TRUNC);
+	}
+
+	tsim_fan_fd = tsim_open(tsim_fan_path, O_WRONLY | O_CREAT | O_TRUNC);
+	tsim_loadavg_fd = tsim_open(tsim_loadavg_path,
+				    O_WRONLY | O_CREAT | O_TRUNC);
+	tsim_pwm_fd = tsim_open(tsim_pwm_path, O_RDWR | O_CREAT);
+
+	tsim_write_value(tsim_pwm_fd, "%d\n", tsim_pwm);
+}
+
+/* Reads the PWM value written by freecusd; keeps the old value if it can't */
+static int tsim_read_pwm(void)
+{
+	char buf[16];
+	ssize_t ret;
+	int pwm;
+
+	ret = pread(tsim_pwm_fd, buf, sizeof buf - 1, 0);
+	if (ret == -1)
+		tsim_fatal("pread");
+
+	buf[ret] = 0;
+
+	if (sscanf(buf, "%d", &pwm) != 1 || pwm < 0 || pwm > 255)
+		return tsim_pwm;
+
+	return pwm;
+}
+
+static void tsim_files_write(const double load, const double rpm)
+{
+	const struct tsim_sensor *s;
+	int i;
+
+	for (i = 0; i < TSIM_SENSOR_COUNT; ++i) {
+		s = &tsim_sensors[i];
+		if (s->path != NULL)
+			tsim_write_value(s->fd, "%7d\n", s->temp * 1000);
+	}
+
+	tsim_write_value(tsim_fan_fd, "%7d\n", (int)lround(rpm));
+
+	/* 4 logical CPUs; kernel's 1, 5 & 15 minute exponential decay */
+	tsim_loadavg[0] = tsim_loadavg[0] * exp(-1.0 / 60) + 4.0 * load
+						* (1.0 - exp(-1.0 / 60));
+	tsim_loadavg[1] = tsim_loadavg[1] * exp(-1.0 / 300) + 4.0 * load
+						* (1.0 - exp(-1.0 / 300));
+	tsim_loadavg[2] = tsim_loadavg[2] * exp(-1.0 / 900) + 4.0 * load
+						* (1.0 - exp(-1.0 / 900));
+
+	tsim_write_value(tsim_loadavg_fd, "%6.2f %6.2f %6.2f 1/100 1000\n",
+			 tsim_loadavg[0], tsim_loadavg[1], tsim_loadavg[2]);
+}
+
+static void tsim_sleep_until(struct timespec *const next)
+{
+	int ret;
+
+	++next->tv_sec;
+
+	do {
+		ret = clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, next,
+				      NULL);
+	} while (ret == EINTR);
+
+	if (ret != 0) {
+		errno = ret;
+		tsim_fatal("clock_nanosleep");
+	}
+}
+
+static void tsim_print_temps(const long now, const double load,
+			     const double rpm)
+{
+	int i;
+
+	printf("%6lds load %3.0f%% pwm %3d rpm %4.0f ", now, load * 100.0,
+	       tsim_pwm, rpm);
+
+	for (i = 0; i < TSIM_SENSOR_COUNT; ++i)
+		printf(" %s %d", tsim_sensors[i].name, tsim_sensors[i].temp);
+
+	putchar('\n');
+}
+
+static void tsim_report(void)
+{
+	static const char *const ctl_names[] = {
+		[TSIM_CTL_FREECUSD]	= "freecusd",
+		[TSIM_CTL_HYST]		= "hyst",
+		[TSIM_CTL_PROP]		= "prop",
+		[TSIM_CTL_FIXED]	= "fixed",
+	};
+
+	const struct tsim_sensor *s;
+	double total;
+	int i;
+
+	printf("controller %s, %ld seconds\n", ctl_names[tsim_ctl],
+	       tsim_duration);
+
+	for (total = 0.0, i = 0; i < TSIM_SENSOR_COUNT; ++i) {
+		s = &tsim_sensors[i];
+		printf("  %-6s max %3d C, %6.0f s at or above %d C\n", s->name,
+		       s->max, s->over, tsim_thresholds[s->type][FCD_CONF_TEMP_WARN]);
+		total += s->over;
+	}
+
+	printf("time over threshold: %.0f s\n", total);
+	printf("fan duty-seconds: %.0f (%.1f%%)\n", tsim_duty,
+	       100.0 * tsim_duty / tsim_duration);
+	printf("PWM changes: %u\n", tsim_pwm_changes);
+}
+
+int main(int argc, char *argv[])
+{
+	struct timespec next;
+	double load, rpm;
+	long now;
+	int pwm;
+
+	tsim_name = argv[0];
+	tsim_parse_args(argc, argv);
+	tsim_model_init();
+
+	if (tsim_ctl == TSIM_CTL_FREECUSD) {
+		tsim_files_open();
+		if (clock_gettime(CLOCK_MONOTONIC, &next) == -1)
+			tsim_fatal("clock_gettime");
+	}
+
+	for (now = 0; now < tsim_duration; ++now) {
+
+		load = tsim_load(now);
+		rpm = tsim_fan_rpm(now);
+
+		tsim_sensors_update(load, (now == 0) ? 0.0 : 1.0);
+
+		switch (tsim_ctl) {
+
+			case TSIM_CTL_FREECUSD:
+				tsim_files_write(load, rpm);
+				tsim_sleep_until(&next);
+				pwm = tsim_read_pwm();
+				break;
+
+			case TSIM_CTL_HYST:	pwm = tsim_ctl_hyst();
+						break;
+
+			case TSIM_CTL_PROP:	pwm = tsim_ctl_prop();
+						break;
+
+			case TSIM_CTL_FIXED:	pwm = tsim_fixed_pwm;
+						break;
+
+			default:		abort();
+		}
+
+		if (pwm != tsim_pwm && now > 0)
+			++tsim_pwm_changes;
+		tsim_pwm = pwm;
+		tsim_duty += tsim_pwm / 255.0;
+
+		if (tsim_verbose && now % 60 == 0)
+			tsim_print_temps(now, load, rpm);
+
+		tsim_model_step(load, tsim_fan_rpm(now) / tsim_rpm_max, 1.0);
+	}
+
+	tsim_report();
+
+	return EXIT_SUCCESS;
+}
@@ -16,6 +16,7 @@
 
 #include "freecusd.h"
 #include "smart/status.h"
+#include "shm.h"
 
 #include <ctype.h>
 #include <errno.h>
@@ -199,10 +200,9 @@ static int fcd_smart_temp_get_conf(cip_err_ctx *const ctx,
 }
 
 /*
- * Callback for disk temperatures in the main ([freecusd]) config section
- * Each value is copied to the fcd_conf_disks member for all detected
- * RAID disks, where it may subsequently be overwritten by a disk-specific
- * override.
+ * Callback for disk temperatures in the main ([freecusd]) config section.
+ * Each value is stored in the disk_default member (struct fcd_conf), which is
+ * copied for each disk-specific override section; see fcd_conf_parsing_disk().
  */
 static int fcd_smart_temp_cb(cip_err_ctx *const ctx,
 			     const cip_ini_value *const value,
@@ -211,22 +211,22 @@ static int fcd_smart_temp_cb(cip_err_ctx *const ctx,
 			     void *const post_parse_data)
 {
 	enum fcd_conf_temp_type temp_type;
-	int temp, i;
+	struct fcd_conf_disk *disk_default;
+	int temp;
 
 	if ((temp = fcd_smart_temp_get_conf(ctx, value)) == INT_MIN)
 		return -1;
 
 	temp_type = (enum fcd_conf_temp_type)post_parse_data;
-
-	for (i = 0; i < FCD_MAX_DISK_COUNT; ++i)
-		fcd_conf_disks[i].temps[temp_type] = temp;
+	disk_default = fcd_conf_member(FCD_CONF_OFFSET(disk_default));
+	disk_default->temps[temp_type] = temp;
 
 	return 0;
 }
 
 /*
  * Parse a RAID disk "name" (the X in a [raid_disk:X] config section).
- * X must a decimal integer in the range 1 - FCD_MAX_DISK_COUNT; any
+ * X must a decimal integer in the range 1 - FCD_MAX_DISK_POS; any
  * whitespace or extra characters are an error.
  *
  * Returns the parsed integer or -1 to indicate a parsing or out of
@@ -246,7 +246,7 @@ static int fcd_smart_parse_raid_num(const char *name)
 		i += *name - '0';
 
 		/* Leading zeroes not allowed, so i should never be 0 here */
-		if (i == 0 || i > FCD_MAX_DISK_COUNT)
+		if (i == 0 || i > FCD_MAX_DISK_POS)
 			return -1;
 
 		++name;
@@ -260,64 +260,50 @@ static int fcd_smart_parse_raid_num(const char *name)
 }
 
 /*
- * Finds the index (in fcd_conf_disks) for a disk-specific override section in
- * the config file (e.g. [raid_disk:X], where X is the disk number).
+ * Finds the settings for a disk-specific override section in the config file
+ * (e.g. [raid_disk:X], where X is the disk position).  Settings for a position
+ * apply to any disk that is in it, including a disk that is hot-plugged later.
  *
  * Returns one of the following:
  *
- * 	* The index, which is a positive integer in the range 1 through fcd_conf_disk_count - 1
- * 	* -1 indicates that "X" is not a valid integer or is out of range.
+ * 	* 0 - *disk points to the settings for the position
+ * 	* -1 indicates that "X" is not a valid integer or is out of range (or
+ * 		a memory allocation failure).
  * 	* -2 indicates that the main ([freecusd]) section has not yet been processed, so it's
  * 		too early to process disk-specific overrides.
- * 	* -3 indicates that no RAID disk is connected in position X
  */
-static int fcd_smart_disk_index(cip_err_ctx *const ctx,
-				const cip_ini_sect *const sect)
+static int fcd_smart_disk_pos(cip_err_ctx *const ctx,
+			      const cip_ini_sect *const sect,
+			      struct fcd_conf_disk **const disk)
 {
-	/* Save our results to avoid repeatedly searching for the same disk */
-	static const cip_ini_sect *last_sect = NULL;
-	static int last_index;
-
-	int disk, i;
+	const struct fcd_conf_disk *disk_default;
+	int pos;
 
 	/*
-	 * fcd_conf_disks[0].temps[FCD_CONF_TEMP_WARN] will be changed to a valid
+	 * disk_default.temps[FCD_CONF_TEMP_WARN] will be changed to a valid
 	 * value when the main (i.e. [freecusd]) config section is processed.  If
 	 * it's still INT_MIN, the main section hasn't been processed yet, so it's
 	 * too early to process disk-specific overrides.
 	 *
-	 * Callback needs to return 1 to libcip, to defer processing, but 1 is a
-	 * valid index, so return -2.  (-1 indicates error.)
+	 * Callback needs to return 1 to libcip, to defer processing.
 	 */
-	if (fcd_conf_disks[0].temps[FCD_CONF_TEMP_WARN] == INT_MIN)
+	disk_default = fcd_conf_member(FCD_CONF_OFFSET(disk_default));
+	if (disk_default->temps[FCD_CONF_TEMP_WARN] == INT_MIN)
 		return -2;
 
-	/* Same section as last time? */
-	if (sect == last_sect)
-		return last_index;
-
-	if ((disk = fcd_smart_parse_raid_num(sect->node.name)) == -1) {
+	if ((pos = fcd_smart_parse_raid_num(sect->node.name)) == -1) {
 		cip_err(ctx, "Invalid RAID disk number: %s (must be 1 - %d)",
-			sect->node.name, FCD_MAX_DISK_COUNT);
+			sect->node.name, FCD_MAX_DISK_POS);
 		return -1;
 	}
 
-	for (i = 0; i < (int)fcd_conf_disk_count; ++i) {
-		/* DOM is on port 1; RAID disks are on ports 2+ */
-		if ((int)fcd_conf_disks[i].port_no - 1 == disk)
-			break;
-	}
-
-	if (i == (int)fcd_conf_disk_count) {
-		cip_err(ctx, "Ignoring section: [raid_disk:%s]: no such disk", sect->node.name);
-		i = -3;
+	if ((*disk = fcd_conf_parsing_disk(pos)) == NULL) {
+		cip_err(ctx, "Failed to allocate settings for RAID disk %d",
+			pos);
+		return -1;
 	}
 
-	/* Save the result, including "missing disk" results */
-	last_sect = sect;
-	last_index = i;
-
-	return i;
+	return 0;
 }
 
 /*
@@ -332,20 +318,19 @@ static int fcd_smart_temp_disk_cb(cip_err_ctx *const ctx,
 				  void *const post_parse_data)
 {
 	enum fcd_conf_temp_type temp_type;
-	int temp, disk;
+	struct fcd_conf_disk *disk;
+	int temp;
 
-	switch (disk = fcd_smart_disk_index(ctx, sect)) {
+	switch (fcd_smart_disk_pos(ctx, sect, &disk)) {
 		case -1:	return -1;	/* error */
 		case -2:	return  1;	/* main section not yet proecessed; defer */
-		case -3:	return  0;	/* "missing" disk; nothing to do */
 	}
 
 	if ((temp = fcd_smart_temp_get_conf(ctx, value)) == INT_MIN)
 		return -1;
 
 	temp_type = (enum fcd_conf_temp_type)post_parse_data;
-
-	fcd_conf_disks[disk].temps[temp_type] = temp;
+	disk->temps[temp_type] = temp;
 
 	return 0;
 }
@@ -359,13 +344,12 @@ static int fcd_smart_ignore_cb(cip_err_ctx *const ctx,
 			       const cip_ini_file *const file __attribute__((unused)),
 			       void *const post_parse_data)
 {
+	struct fcd_conf_disk *disk;
 	_Bool ignore;
-	int disk;
 
-	switch (disk = fcd_smart_disk_index(ctx, sect)) {
+	switch (fcd_smart_disk_pos(ctx, sect, &disk)) {
 		case -1:	return -1;	/* error */
 		case -2:	return  1;	/* main section not yet proecessed; defer */
-		case -3:	return  0;	/* "missing" disk; nothing to do */
 	}
 
 	memcpy(&ignore, value->value, sizeof ignore);
@@ -374,11 +358,11 @@ static int fcd_smart_ignore_cb(cip_err_ctx *const ctx,
 
 	if (post_parse_data == &fcd_smart_monitor) {
 
-		fcd_conf_disks[disk].smart_ignore = ignore;
+		disk->smart_ignore = ignore;
 	}
 	else if (post_parse_data == &fcd_hddtemp_monitor) {
 
-		fcd_conf_disks[disk].temp_ignore = ignore;
+		disk->temp_ignore = ignore;
 	}
 	else {
 		FCD_ABORT("This should never happen!\n");
@@ -387,14 +371,111 @@ static int fcd_smart_ignore_cb(cip_err_ctx *const ctx,
 	return 0;
 }
 
+/*
+ * Per-disk results (indexed like fcd_cfg->disks) and LCD text (one subpage of
+ * FCD_PAGE_LINES_SIZE characters for each FCD_BAY_COUNT disk positions).  Used
+ * by the SMART monitor thread only; see fcd_smart_alloc().
+ */
+static int *fcd_smart_results;
+static int *fcd_smart_status;
+static int *fcd_smart_temps;
+static int *fcd_smart_alerts;
+static char *fcd_smart_text;
+static unsigned fcd_smart_pages;
+
+static void fcd_smart_free(void)
+{
+	free(fcd_smart_results);
+	free(fcd_smart_text);
+}
+
 __attribute__((noreturn))
 static void fcd_smart_disable(char *restrict cmd_buf,
 			      const int *const restrict pipe_fds)
 {
+	fcd_smart_free();
 	fcd_lib_fail(&fcd_hddtemp_monitor);
 	fcd_lib_parent_fail_and_exit(&fcd_smart_monitor, pipe_fds, cmd_buf);
 }
 
+/*
+ * (Re)sizes the per-disk arrays and the LCD text for the current RAID disks,
+ * which may have changed (hotplug) since the previous pass.  Returns 0 on
+ * success, -1 on error.
+ */
+static int fcd_smart_alloc(void)
+{
+	static unsigned results_size, text_size;
+	unsigned count, pos;
+
+	count = fcd_cfg->disk_count;
+
+	/* Disks are sorted by position, so the last one is the highest */
+	pos = (count > 0) ? fcd_cfg->disks[count - 1].pos : 1;
+	fcd_smart_pages = (pos + FCD_BAY_COUNT - 1) / FCD_BAY_COUNT;
+
+	if (fcd_lib_grow(&fcd_smart_results, &results_size, 3 * count,
+			 sizeof *fcd_smart_results) == -1) {
+		return -1;
+	}
+
+	if (fcd_lib_grow(&fcd_smart_text, &text_size,
+			 fcd_smart_pages * FCD_PAGE_LINES_SIZE,
+			 sizeof *fcd_smart_text) == -1) {
+		return -1;
+	}
+
+	fcd_smart_status = fcd_smart_results;
+	fcd_smart_temps = fcd_smart_results + count;
+	fcd_smart_alerts = fcd_smart_results + 2 * count;
+
+	return 0;
+}
+
+/*
+ * Blanks the LCD text and writes the upper line of each subpage.  If the
+ * disks don't fit on a single subpage, each subpage shows the positions that
+ * it covers, rather than the full title.
+ */
+static void fcd_smart_text_init(const char *const title,
+				const char *const short_title)
+{
+	char upper[FCD_PAGE_LINES_SIZE / 2 + 1];
+	unsigned i;
+	int ret;
+
+	memset(fcd_smart_text, ' ', fcd_smart_pages * FCD_PAGE_LINES_SIZE);
+
+	for (i = 0; i < fcd_smart_pages; ++i) {
+
+		if (fcd_smart_pages == 1) {
+			ret = snprintf(upper, sizeof upper, "%s", title);
+		}
+		else {
+			ret = snprintf(upper, sizeof upper, "%s %u-%u",
+				       short_title, i * FCD_BAY_COUNT + 1,
+				       (i + 1) * FCD_BAY_COUNT);
+		}
+
+		if (ret < 0 || ret >= (int)sizeof upper)
+			ret = sizeof upper - 1;
+
+		memcpy(fcd_smart_text + i * FCD_PAGE_LINES_SIZE, upper, ret);
+	}
+}
+
+/* Returns the (4-character) LCD text "cell" for a disk's position */
+static char *fcd_smart_cell(const struct fcd_raid_disk *const disk)
+{
+	unsigned i;
+
+	i = disk->pos - 1;
+
+	return fcd_smart_text + i / FCD_BAY_COUNT * FCD_PAGE_LINES_SIZE
+				+ FCD_PAGE_LINES_SIZE / 2
+				+ i % FCD_BAY_COUNT * 4;
+}
+
 static int fcd_smart_exec(const int disk,
 			  char **const restrict cmd_buf,
 			  size_t *const restrict buf_size,
@@ -407,7 +488,7 @@ static int fcd_smart_exec(const int disk,
 	timeout.tv_sec = 5;
 	timeout.tv_nsec = 0;
 
-	fcd_smart_cmd[2] = fcd_conf_disks[disk].name;
+	fcd_smart_cmd[2] = (char *)fcd_cfg->disks[disk].name;
 
 	ret = fcd_lib_cmd_output(&status,
 				 fcd_smart_cmd,
@@ -466,22 +547,36 @@ static void fcd_smart_parse(const int disk,
 	fcd_smart_disable(cmd_buf, pipe_fds);
 }
 
-static void process_status(int *const restrict status)
+static void process_status(const int *const restrict status)
 {
-	int alerts[FCD_MAX_DISK_COUNT], warn, fail;
-	char buf[21], *c;
+	int *const alerts = fcd_smart_alerts;
+	int warn, fail;
 	unsigned i;
+	char *c;
 
-	memset(alerts, 0, sizeof alerts);
-	memset(buf, ' ', sizeof buf);
+	memset(alerts, 0, fcd_cfg->disk_count * sizeof *alerts);
+	fcd_smart_text_init("S.M.A.R.T. STATUS", "S.M.A.R.T.");
 	warn = 0;
 	fail = 0;
 
-	for (i = 0; i < fcd_conf_disk_count; ++i) {
+	fcd_metrics_add(&fcd_smart_monitor,
+		"# HELP freecusd_disk_smart_status S.M.A.R.T. status (0 = OK, "
+			"1 = warning, 2 = failure, 3 = error, 4 = asleep, "
+			"5 = ignored)\n"
+		"# TYPE freecusd_disk_smart_status gauge\n");
 
-		c = buf + (fcd_conf_disks[i].port_no - 2) * 4;
+	for (i = 0; i < fcd_cfg->disk_count; ++i) {
 
-		if (fcd_conf_disks[i].smart_ignore) {
+		c = fcd_smart_cell(&fcd_cfg->disks[i]);
+
+		fcd_metrics_add(&fcd_smart_monitor,
+				"freecusd_disk_smart_status{disk=\"%u\",device=\"%s\"} %d\n",
+				fcd_cfg->disks[i].pos,
+				fcd_cfg->disks[i].name + 5,	/* skip "/dev/" */
+				fcd_conf_disk(&fcd_cfg->disks[i])->smart_ignore
+						? FCD_SMART_IGNORE : status[i]);
+
+		if (fcd_conf_disk(&fcd_cfg->disks[i])->smart_ignore) {
 			memset(c, '.', 2);
 		}
 		else if (status[i] == FCD_SMART_ASLEEP) {
@@ -508,31 +603,40 @@ static void process_status(int *const restrict status)
 		}
 	}
 
-	fcd_lib_set_mon_status(&fcd_smart_monitor, buf, warn, fail, alerts, 0);
+	fcd_lib_set_mon_pages(&fcd_smart_monitor, fcd_smart_text,
+			      fcd_smart_pages, warn, fail, alerts, 0);
+	fcd_metrics_publish(&fcd_smart_monitor);
 }
 
-static void process_temps(int *const restrict status,
-			  int *const restrict temps,
+static void process_temps(const int *const restrict status,
+			  const int *const restrict temps,
 			  char *const restrict cmd_buf,
 			  const int *const restrict pipe_fds)
 {
-	int alerts[FCD_MAX_DISK_COUNT], warn, fail;
-	char buf[21], *c;
+	int *const alerts = fcd_smart_alerts;
+	const struct fcd_conf_disk *cfg;
+	int warn, fail;
 	uint8_t pwm_flags;
 	unsigned i;
+	char *c;
 	int ret;
 
-	memset(alerts, 0, sizeof alerts);
-	memset(buf, ' ', sizeof buf);
+	memset(alerts, 0, fcd_cfg->disk_count * sizeof *alerts);
+	fcd_smart_text_init("HDD TEMPERATURE", "HDD TEMP");
 	warn = 0;
 	fail = 0;
 	pwm_flags = 0;
 
-	for (i = 0; i < fcd_conf_disk_count; ++i) {
+	fcd_metrics_add(&fcd_hddtemp_monitor,
+		"# HELP freecusd_disk_temperature_celsius Disk temperature\n"
+		"# TYPE freecusd_disk_temperature_celsius gauge\n");
+
+	for (i = 0; i < fcd_cfg->disk_count; ++i) {
 
-		c = buf + (fcd_conf_disks[i].port_no - 2) * 4;
+		c = fcd_smart_cell(&fcd_cfg->disks[i]);
+		cfg = fcd_conf_disk(&fcd_cfg->disks[i]);
 
-		if (fcd_conf_disks[i].temp_ignore) {
+		if (cfg->temp_ignore) {
 			memset(c, '.', 3);
 		}
 		else if (status[i] == FCD_SMART_ASLEEP) {
@@ -562,29 +666,77 @@ static void process_temps(int *const restrict status,
 
 			c[ret] = ' ';	/* sprintf 0-terminates */
 
-			if (temps[i] >= fcd_conf_disks[i].temps[FCD_CONF_TEMP_FAIL]) {
+			fcd_metrics_add(&fcd_hddtemp_monitor,
+					"freecusd_disk_temperature_celsius{disk=\"%u\",device=\"%s\"} %d\n",
+					fcd_cfg->disks[i].pos,
+					fcd_cfg->disks[i].name + 5, temps[i]);
+
+			fcd_trend_disk(fcd_cfg->disks[i].pos,
+				       fcd_cfg->disks[i].id);
+			fcd_trend_add(FCD_TREND_DISK + fcd_cfg->disks[i].pos - 1,
+				      temps[i] * 10);
+
+			if (temps[i] >= cfg->temps[FCD_CONF_TEMP_FAIL]) {
 				alerts[i] = 1;
 				fail = 1;
 				warn = 0;
 			}
-			else if (temps[i] >= fcd_conf_disks[i].temps[FCD_CONF_TEMP_WARN]
+			else if (temps[i] >= cfg->temps[FCD_CONF_TEMP_WARN]
 							|| temps[i] <= 0) {
 				alerts[i] = 1;
 				warn = !fail;
 			}
 
-			pwm_flags |= fcd_pwm_temp_flags(temps[i], fcd_conf_disks[i].temps);
+			pwm_flags |= fcd_pwm_temp_flags(temps[i], cfg->temps);
 		}
 	}
 
-	fcd_lib_set_mon_status(&fcd_hddtemp_monitor, buf, warn, fail, alerts, pwm_flags);
+	fcd_lib_set_mon_pages(&fcd_hddtemp_monitor, fcd_smart_text,
+			      fcd_smart_pages, warn, fail, alerts, pwm_flags);
+	fcd_metrics_publish(&fcd_hddtemp_monitor);
 }
 
+/* Publishes per-disk S.M.A.R.T. status & temperature; see shm.c */
+static void fcd_smart_shm(const int *const restrict status,
+			  const int *const restrict temps)
+{
+	const struct fcd_conf_disk *cfg;
+	struct fcd_shm_status *shm;
+	struct fcd_shm_disk *d;
+	unsigned i;
+
+	if ((shm = fcd_shm_write_begin()) == NULL)
+		return;
+
+	for (i = 0; i < fcd_cfg->disk_count && i < FCD_SHM_DISKS; ++i) {
+
+		cfg = fcd_conf_disk(&fcd_cfg->disks[i]);
+		d = &shm->disks[i];
+
+		d->pos = fcd_cfg->disks[i].pos;
+		strncpy(d->device, fcd_cfg->disks[i].name + 5,	/* "/dev/" */
+			sizeof d->device);
+		d->smart_status = cfg->smart_ignore ? FCD_SMART_IGNORE
+						    : status[i];
+
+		if (cfg->temp_ignore || status[i] == FCD_SMART_ASLEEP
+				|| status[i] == FCD_SMART_ERROR) {
+			d->temp = FCD_SHM_NO_VALUE;
+		}
+		else {
+			d->temp = temps[i];
+		}
+	}
+
+	shm->disk_count = i;
+
+	fcd_shm_write_end(shm);
+}
 
 __attribute__((noreturn))
 static void *fcd_smart_fn(void *arg __attribute__((unused)))
 {
-	int status[FCD_MAX_DISK_COUNT], temps[FCD_MAX_DISK_COUNT];
+	const struct fcd_conf_disk *cfg;
 	int pipe_fds[2];
 	int ret;
 	char *cmd_buf;
@@ -601,9 +753,14 @@ static void *fcd_smart_fn(void *arg __attribute__((unused)))
 	buf_size = 0;
 
 	do {
-		for (i = 0; i < fcd_conf_disk_count; ++i) {
+		if (fcd_smart_alloc() == -1)
+			fcd_smart_disable(cmd_buf, pipe_fds);
+
+		for (i = 0; i < fcd_cfg->disk_count; ++i) {
+
+			cfg = fcd_conf_disk(&fcd_cfg->disks[i]);
 
-			if (fcd_conf_disks[i].smart_ignore && fcd_conf_disks[i].temp_ignore)
+			if (cfg->smart_ignore && cfg->temp_ignore)
 				continue;
 
 			ret = fcd_smart_exec(i,	&cmd_buf, &buf_size, pipe_fds);
@@ -611,15 +768,18 @@ static void *fcd_smart_fn(void *arg __attribute__((unused)))
 				goto break_outer_loop;
 			}
 			else if (ret == -2) {
-				status[i] = FCD_SMART_ERROR;
+				fcd_smart_status[i] = FCD_SMART_ERROR;
 				continue;
 			}
 
-			fcd_smart_parse(i, status, temps, cmd_buf, pipe_fds);
+			fcd_smart_parse(i, fcd_smart_status, fcd_smart_temps,
+					cmd_buf, pipe_fds);
 		}
 
-		process_status(status);
-		process_temps(status, temps, cmd_buf, pipe_fds);
+		process_status(fcd_smart_status);
+		process_temps(fcd_smart_status, fcd_smart_temps, cmd_buf,
+			      pipe_fds);
+		fcd_smart_shm(fcd_smart_status, fcd_smart_temps);
 
 		ret = fcd_lib_monitor_sleep(30);
 		if (ret == -1)
@@ -628,6 +788,7 @@ static void *fcd_smart_fn(void *arg __attribute__((unused)))
 	} while (ret == 0);
 
 break_outer_loop:
+	fcd_smart_free();
 	free(cmd_buf);
 	fcd_proc_close_pipe(pipe_fds);
 	pthread_exit(NULL);
@@ -635,22 +796,26 @@ break_outer_loop:
 
 static void fcd_smart_dump_smart_cfg(void)
 {
-	int i;
+	const struct fcd_raid_disk *disk;
+	unsigned i;
 
-	for (i = 0; i < (int)fcd_conf_disk_count; ++i) {
-		FCD_DUMP("\t%s:\n", fcd_conf_disks[i].name);
-		FCD_DUMP("\t\tignore: %s\n", fcd_conf_disks[i].smart_ignore ? "true" : "false");
+	for (i = 0; i < fcd_cfg->disk_count; ++i) {
+		disk = &fcd_cfg->disks[i];
+		FCD_DUMP("\t%s (disk %u):\n", disk->name, disk->pos);
+		FCD_DUMP("\t\tignore: %s\n", fcd_conf_disk(disk)->smart_ignore ? "true" : "false");
 	}
 }
 
 static void fcd_smart_dump_temp_cfg(void)
 {
-	int i;
+	const struct fcd_raid_disk *disk;
+	unsigned i;
 
-	for (i = 0; i < (int)fcd_conf_disk_count; ++i) {
-		FCD_DUMP("\t%s:\n", fcd_conf_disks[i].name);
-		FCD_DUMP("\t\tignore: %s\n", fcd_conf_disks[i].temp_ignore ? "true" : "false");
-		fcd_lib_dump_temp_cfg(fcd_conf_disks[i].temps);
+	for (i = 0; i < fcd_cfg->disk_count; ++i) {
+		disk = &fcd_cfg->disks[i];
+		FCD_DUMP("\t%s (disk %u):\n", disk->name, disk->pos);
+		FCD_DUMP("\t\tignore: %s\n", fcd_conf_disk(disk)->temp_ignore ? "true" : "false");
+		fcd_lib_dump_temp_cfg(fcd_conf_disk(disk)->temps);
 	}
 }
 
@@ -15,13 +15,11 @@
  */
 
 #include "freecusd.h"
+#include "shm.h"
 
 #include <string.h>
 
-/* Alert thresholds */
-static int fcd_sysfan_warn = 1200;	/* sysfan_rpm_warn */
-static int fcd_sysfan_fail = 500;	/* sysfan_rpm_crit */
-
+/* Alert thresholds; see struct fcd_conf */
 static int fcd_sysfan_rpm_cb();
 
 static const cip_opt_info fcd_sysfan_opts[] = {
@@ -29,13 +27,13 @@ static const cip_opt_info fcd_sysfan_opts[] = {
 		.name			= "sysfan_rpm_warn",
 		.type			= CIP_OPT_TYPE_INT,
 		.post_parse_fn		= fcd_sysfan_rpm_cb,
-		.post_parse_data	= &fcd_sysfan_warn,
+		.post_parse_data	= FCD_CONF_OFFSET(sysfan_warn),
 	},
 	{
 		.name			= "sysfan_rpm_crit",
 		.type			= CIP_OPT_TYPE_INT,
 		.post_parse_fn		= fcd_sysfan_rpm_cb,
-		.post_parse_data	= &fcd_sysfan_fail,
+		.post_parse_data	= FCD_CONF_OFFSET(sysfan_fail),
 	},
 	{	.name			= NULL		}
 };
@@ -61,7 +59,7 @@ static int fcd_sysfan_rpm_cb(cip_err_ctx *ctx, const cip_ini_value *value,
 			rpm);
 	}
 
-	p = post_parse_data;
+	p = fcd_conf_member(post_parse_data);
 	*p = rpm;
 
 	return 0;
@@ -80,11 +78,12 @@ __attribute__((noreturn))
 static void *fcd_sysfan_fn(void *arg)
 {
 	struct fcd_monitor *mon = arg;
+	struct fcd_shm_status *shm;
 	int warn, fail, rpm, ret;
-	char buf[21];
+	char buf[21], attr[24];
 	FILE *fp;
 
-	fp = fopen(fcd_sysfan_input, "re");
+	fp = fcd_lib_fopen(fcd_sysfan_input, "re");
 	if (fp == NULL) {
 		FCD_PERROR(fcd_sysfan_input);
 		fcd_lib_fail_and_exit(mon);
@@ -96,28 +95,40 @@ static void *fcd_sysfan_fn(void *arg)
 	}
 
 	do {
-		rewind(fp);
 		memset(buf, ' ', sizeof buf);
 
-		ret = fscanf(fp, "%d", &rpm);
-		if (ret == EOF) {
-			FCD_PERROR("fscanf");
+		ret = fcd_lib_read_attr(fp, fcd_sysfan_input, attr, sizeof attr);
+		if (ret == -1) {
+			FCD_PERROR(fcd_sysfan_input);
 			fcd_sysfan_close_and_disable(fp, mon);
 		}
-		else if (ret != 1) {
+		else if (sscanf(attr, "%d", &rpm) != 1) {
 			FCD_WARN("Failed to parse contents of %s\n",
 				 fcd_sysfan_input);
 			fcd_sysfan_close_and_disable(fp, mon);
 		}
 
-		fail = (rpm <= fcd_sysfan_fail);
-		warn = fail ? 0 : (rpm <= fcd_sysfan_warn);
+		fail = (rpm <= fcd_cfg->sysfan_fail);
+		warn = fail ? 0 : (rpm <= fcd_cfg->sysfan_warn);
 
 		if (fcd_lib_snprintf(buf, sizeof buf, "%'d RPM", rpm) < 0)
 			fcd_sysfan_close_and_disable(fp, mon);
 
 		fcd_lib_set_mon_status(mon, buf, warn, fail, NULL, 0);
 
+		fcd_metrics_add(mon,
+			"# HELP freecusd_fan_rpm System fan speed\n"
+			"# TYPE freecusd_fan_rpm gauge\n"
+			"freecusd_fan_rpm %d\n", rpm);
+		fcd_metrics_publish(mon);
+
+		if ((shm = fcd_shm_write_begin()) != NULL) {
+			shm->fan_rpm = rpm;
+			fcd_shm_write_end(shm);
+		}
+
+		fcd_trend_add(FCD_TREND_FAN, rpm);
+
 		ret = fcd_lib_monitor_sleep(30);
 		if (ret == -1)
 			fcd_sysfan_close_and_disable(fp, mon);
@@ -132,8 +143,8 @@ static void *fcd_sysfan_fn(void *arg)
 
 static void fcd_sysfan_dump_cfg(void)
 {
-	FCD_DUMP("\twarning: %d RPM\n", fcd_sysfan_warn);
-	FCD_DUMP("\tcritical: %d RPM\n", fcd_sysfan_fail);
+	FCD_DUMP("\twarning: %d RPM\n", fcd_cfg->sysfan_warn);
+	FCD_DUMP("\tcritical: %d RPM\n", fcd_cfg->sysfan_fail);
 }
 
 struct fcd_monitor fcd_sysfan_monitor = {
@@ -15,47 +15,12 @@
  */
 
 #include "freecusd.h"
+#include "shm.h"
 
 #include <string.h>
 #include <limits.h>
 
-/* Alert & PWM thresholds */
-static int fcd_temp_core_cfg[FCD_CONF_TEMP_ARRAY_SIZE] = {
-	[FCD_CONF_TEMP_WARN]		= 43000,	/* cpu_core_temp_warn */
-	[FCD_CONF_TEMP_FAIL]		= 45000,	/* cpu_core_temp_crit */
-	[FCD_CONF_TEMP_FAN_MAX_ON]	= 42000,	/* cpu_core_temp_fan_max_on */
-	[FCD_CONF_TEMP_FAN_MAX_HYST]	= 39000,	/* cpu_core_temp_fan_max_hyst */
-	[FCD_CONF_TEMP_FAN_HIGH_ON]	= 40000,	/* cpu_core_temp_fan_high_on */
-	[FCD_CONF_TEMP_FAN_HIGH_HYST]	= 37000		/* cpu_core_temp_fan_high_hyst */
-};
-
-static int fcd_temp_cpu_cfg[FCD_CONF_TEMP_ARRAY_SIZE] = {
-	[FCD_CONF_TEMP_WARN]		= 43000,	/* cpu_temp_warn */
-	[FCD_CONF_TEMP_FAIL]		= 45000,	/* cpu_temp_crit */
-	[FCD_CONF_TEMP_FAN_MAX_ON]	= 42000,	/* cpu_temp_fan_max_on */
-	[FCD_CONF_TEMP_FAN_MAX_HYST]	= 39000,	/* cpu_temp_fan_max_hyst */
-	[FCD_CONF_TEMP_FAN_HIGH_ON]	= 40000,	/* cpu_temp_fan_high_on */
-	[FCD_CONF_TEMP_FAN_HIGH_HYST]	= 37000		/* cpu_temp_fan_high_hyst */
-};
-
-static int fcd_temp_sys_cfg[FCD_CONF_TEMP_ARRAY_SIZE] = {
-	[FCD_CONF_TEMP_WARN]		= 39000,	/* sys_temp_warn */
-	[FCD_CONF_TEMP_FAIL]		= 40000,	/* sys_temp_crit */
-	[FCD_CONF_TEMP_FAN_MAX_ON]	= 39000,	/* sys_temp_fan_max_on */
-	[FCD_CONF_TEMP_FAN_MAX_HYST]	= 37000,	/* sys_temp_fan_max_hyst */
-	[FCD_CONF_TEMP_FAN_HIGH_ON]	= 38000,	/* sys_temp_fan_high_on */
-	[FCD_CONF_TEMP_FAN_HIGH_HYST]	= 36000		/* sys_temp_fan_high_hyst */
-};
-
-static int fcd_temp_ich_cfg[FCD_CONF_TEMP_ARRAY_SIZE] = {
-	[FCD_CONF_TEMP_WARN]		= 39000,	/* ich_temp_warn */
-	[FCD_CONF_TEMP_FAIL]		= 40000,	/* ich_temp_crit */
-	[FCD_CONF_TEMP_FAN_MAX_ON]	= 39000,	/* ich_temp_fan_max_on */
-	[FCD_CONF_TEMP_FAN_MAX_HYST]	= 37000,	/* ich_temp_fan_max_hyst */
-	[FCD_CONF_TEMP_FAN_HIGH_ON]	= 38000,	/* ich_temp_fan_high_on */
-	[FCD_CONF_TEMP_FAN_HIGH_HYST]	= 36000		/* ich_temp_fan_high_hyst */
-};
-
+/* Alert & PWM thresholds; see struct fcd_conf */
 static int fcd_temp_cb();
 
 static const cip_opt_info fcd_temp_core_opts[] = {
@@ -63,37 +28,37 @@ static const cip_opt_info fcd_temp_core_opts[] = {
 		.name			= "cpu_core_temp_warn",
 		.type			= CIP_OPT_TYPE_FLOAT,
 		.post_parse_fn		= fcd_temp_cb,
-		.post_parse_data	= &fcd_temp_core_cfg[FCD_CONF_TEMP_WARN],
+		.post_parse_data	= FCD_CONF_OFFSET(temp_core[FCD_CONF_TEMP_WARN]),
 	},
 	{
 		.name			= "cpu_core_temp_crit",
 		.type			= CIP_OPT_TYPE_FLOAT,
 		.post_parse_fn		= fcd_temp_cb,
-		.post_parse_data	= &fcd_temp_core_cfg[FCD_CONF_TEMP_FAIL],
+		.post_parse_data	= FCD_CONF_OFFSET(temp_core[FCD_CONF_TEMP_FAIL]),
 	},
 	{
 		.name			= "cpu_core_temp_fan_max_on",
 		.type			= CIP_OPT_TYPE_FLOAT,
 		.post_parse_fn		= fcd_temp_cb,
-		.post_parse_data	= &fcd_temp_core_cfg[FCD_CONF_TEMP_FAN_MAX_ON],
+		.post_parse_data	= FCD_CONF_OFFSET(temp_core[FCD_CONF_TEMP_FAN_MAX_ON]),
 	},
 	{
 		.name			= "cpu_core_temp_fan_max_hyst",
 		.type			= CIP_OPT_TYPE_FLOAT,
 		.post_parse_fn		= fcd_temp_cb,
-		.post_parse_data	= &fcd_temp_core_cfg[FCD_CONF_TEMP_FAN_MAX_HYST],
+		.post_parse_data	= FCD_CONF_OFFSET(temp_core[FCD_CONF_TEMP_FAN_MAX_HYST]),
 	},
 	{
 		.name			= "cpu_core_temp_fan_high_on",
 		.type			= CIP_OPT_TYPE_FLOAT,
 		.post_parse_fn		= fcd_temp_cb,
-		.post_parse_data	= &fcd_temp_core_cfg[FCD_CONF_TEMP_FAN_HIGH_ON],
+		.post_parse_data	= FCD_CONF_OFFSET(temp_core[FCD_CONF_TEMP_FAN_HIGH_ON]),
 	},
 	{
 		.name			= "cpu_core_temp_fan_high_hyst",
 		.type			= CIP_OPT_TYPE_FLOAT,
 		.post_parse_fn		= fcd_temp_cb,
-		.post_parse_data	= &fcd_temp_core_cfg[FCD_CONF_TEMP_FAN_HIGH_HYST],
+		.post_parse_data	= FCD_CONF_OFFSET(temp_core[FCD_CONF_TEMP_FAN_HIGH_HYST]),
 	},
 	{
 		.name			= NULL
@@ -105,109 +70,109 @@ static const cip_opt_info fcd_temp_it87_opts[] = {
 		.name			= "cpu_temp_warn",
 		.type			= CIP_OPT_TYPE_FLOAT,
 		.post_parse_fn		= fcd_temp_cb,
-		.post_parse_data	= &fcd_temp_cpu_cfg[FCD_CONF_TEMP_WARN],
+		.post_parse_data	= FCD_CONF_OFFSET(temp_cpu[FCD_CONF_TEMP_WARN]),
 	},
 	{
 		.name			= "cpu_temp_crit",
 		.type			= CIP_OPT_TYPE_FLOAT,
 		.post_parse_fn		= fcd_temp_cb,
-		.post_parse_data	= &fcd_temp_cpu_cfg[FCD_CONF_TEMP_FAIL],
+		.post_parse_data	= FCD_CONF_OFFSET(temp_cpu[FCD_CONF_TEMP_FAIL]),
 	},
 	{
 		.name			= "cpu_temp_fan_max_on",
 		.type			= CIP_OPT_TYPE_FLOAT,
 		.post_parse_fn		= fcd_temp_cb,
-		.post_parse_data	= &fcd_temp_cpu_cfg[FCD_CONF_TEMP_FAN_MAX_ON],
+		.post_parse_data	= FCD_CONF_OFFSET(temp_cpu[FCD_CONF_TEMP_FAN_MAX_ON]),
 	},
 	{
 		.name			= "cpu_temp_fan_max_hyst",
 		.type			= CIP_OPT_TYPE_FLOAT,
 		.post_parse_fn		= fcd_temp_cb,
-		.post_parse_data	= &fcd_temp_cpu_cfg[FCD_CONF_TEMP_FAN_MAX_HYST],
+		.post_parse_data	= FCD_CONF_OFFSET(temp_cpu[FCD_CONF_TEMP_FAN_MAX_HYST]),
 	},
 	{
 		.name			= "cpu_temp_fan_high_on",
 		.type			= CIP_OPT_TYPE_FLOAT,
 		.post_parse_fn		= fcd_temp_cb,
-		.post_parse_data	= &fcd_temp_cpu_cfg[FCD_CONF_TEMP_FAN_HIGH_ON],
+		.post_parse_data	= FCD_CONF_OFFSET(temp_cpu[FCD_CONF_TEMP_FAN_HIGH_ON]),
 	},
 	{
 		.name			= "cpu_temp_fan_high_hyst",
 		.type			= CIP_OPT_TYPE_FLOAT,
 		.post_parse_fn		= fcd_temp_cb,
-		.post_parse_data	= &fcd_temp_cpu_cfg[FCD_CONF_TEMP_FAN_HIGH_HYST],
+		.post_parse_data	= FCD_CONF_OFFSET(temp_cpu[FCD_CONF_TEMP_FAN_HIGH_HYST]),
 	},
 	{
 		.name			= "sys_temp_warn",
 		.type			= CIP_OPT_TYPE_FLOAT,
 		.post_parse_fn		= fcd_temp_cb,
-		.post_parse_data	= &fcd_temp_sys_cfg[FCD_CONF_TEMP_WARN],
+		.post_parse_data	= FCD_CONF_OFFSET(temp_sys[FCD_CONF_TEMP_WARN]),
 	},
 	{
 		.name			= "sys_temp_crit",
 		.type			= CIP_OPT_TYPE_FLOAT,
 		.post_parse_fn		= fcd_temp_cb,
-		.post_parse_data	= &fcd_temp_sys_cfg[FCD_CONF_TEMP_FAIL],
+		.post_parse_data	= FCD_CONF_OFFSET(temp_sys[FCD_CONF_TEMP_FAIL]),
 	},
 	{
 		.name			= "sys_temp_fan_max_on",
 		.type			= CIP_OPT_TYPE_FLOAT,
 		.post_parse_fn		= fcd_temp_cb,
-		.post_parse_data	= &fcd_temp_sys_cfg[FCD_CONF_TEMP_FAN_MAX_ON],
+		.post_parse_data	= FCD_CONF_OFFSET(temp_sys[FCD_CONF_TEMP_FAN_MAX_ON]),
 	},
 	{
 		.name			= "sys_temp_fan_max_hyst",
 		.type			= CIP_OPT_TYPE_FLOAT,
 		.post_parse_fn		= fcd_temp_cb,
-		.post_parse_data	= &fcd_temp_sys_cfg[FCD_CONF_TEMP_FAN_MAX_HYST],
+		.post_parse_data	= FCD_CONF_OFFSET(temp_sys[FCD_CONF_TEMP_FAN_MAX_HYST]),
 	},
 	{
 		.name			= "sys_temp_fan_high_on",
 		.type			= CIP_OPT_TYPE_FLOAT,
 		.post_parse_fn		= fcd_temp_cb,
-		.post_parse_data	= &fcd_temp_sys_cfg[FCD_CONF_TEMP_FAN_HIGH_ON],
+		.post_parse_data	= FCD_CONF_OFFSET(temp_sys[FCD_CONF_TEMP_FAN_HIGH_ON]),
 	},
 	{
 		.name			= "sys_temp_fan_high_hyst",
 		.type			= CIP_OPT_TYPE_FLOAT,
 		.post_parse_fn		= fcd_temp_cb,
-		.post_parse_data	= &fcd_temp_sys_cfg[FCD_CONF_TEMP_FAN_HIGH_HYST],
+		.post_parse_data	= FCD_CONF_OFFSET(temp_sys[FCD_CONF_TEMP_FAN_HIGH_HYST]),
 	},
 	{
 		.name			= "ich_temp_warn",
 		.type			= CIP_OPT_TYPE_FLOAT,
 		.post_parse_fn		= fcd_temp_cb,
-		.post_parse_data	= &fcd_temp_ich_cfg[FCD_CONF_TEMP_WARN],
+		.post_parse_data	= FCD_CONF_OFFSET(temp_ich[FCD_CONF_TEMP_WARN]),
 	},
 	{
 		.name			= "ich_temp_crit",
 		.type			= CIP_OPT_TYPE_FLOAT,
 		.post_parse_fn		= fcd_temp_cb,
-		.post_parse_data	= &fcd_temp_ich_cfg[FCD_CONF_TEMP_FAIL],
+		.post_parse_data	= FCD_CONF_OFFSET(temp_ich[FCD_CONF_TEMP_FAIL]),
 	},
 	{
 		.name			= "ich_temp_fan_max_on",
 		.type			= CIP_OPT_TYPE_FLOAT,
 		.post_parse_fn		= fcd_temp_cb,
-		.post_parse_data	= &fcd_temp_ich_cfg[FCD_CONF_TEMP_FAN_MAX_ON],
+		.post_parse_data	= FCD_CONF_OFFSET(temp_ich[FCD_CONF_TEMP_FAN_MAX_ON]),
 	},
 	{
 		.name			= "ich_temp_fan_max_hyst",
 		.type			= CIP_OPT_TYPE_FLOAT,
 		.post_parse_fn		= fcd_temp_cb,
-		.post_parse_data	= &fcd_temp_ich_cfg[FCD_CONF_TEMP_FAN_MAX_HYST],
+		.post_parse_data	= FCD_CONF_OFFSET(temp_ich[FCD_CONF_TEMP_FAN_MAX_HYST]),
 	},
 	{
 		.name			= "ich_temp_fan_high_on",
 		.type			= CIP_OPT_TYPE_FLOAT,
 		.post_parse_fn		= fcd_temp_cb,
-		.post_parse_data	= &fcd_temp_ich_cfg[FCD_CONF_TEMP_FAN_HIGH_ON],
+		.post_parse_data	= FCD_CONF_OFFSET(temp_ich[FCD_CONF_TEMP_FAN_HIGH_ON]),
 	},
 	{
 		.name			= "ich_temp_fan_high_hyst",
 		.type			= CIP_OPT_TYPE_FLOAT,
 		.post_parse_fn		= fcd_temp_cb,
-		.post_parse_data	= &fcd_temp_ich_cfg[FCD_CONF_TEMP_FAN_HIGH_HYST],
+		.post_parse_data	= FCD_CONF_OFFSET(temp_ich[FCD_CONF_TEMP_FAN_HIGH_HYST]),
 	},
 	{
 		.name			= NULL
@@ -217,7 +182,7 @@ static const cip_opt_info fcd_temp_it87_opts[] = {
 struct fcd_temp_input {
 	const char *path;
 	FILE *fp;
-	const int *cfg;
+	size_t cfg;		/* offset in struct fcd_conf */
 	struct fcd_monitor *mon;
 };
 
@@ -234,27 +199,27 @@ enum fcd_temp_id {
 static struct fcd_temp_input fcd_temp_inputs[FCD_TEMP_ID_ARRAY_SIZE] = {
 	[FCD_TEMP_ID_CORE0] = {
 		.path	= "/sys/devices/platform/coretemp.0/hwmon/hwmon1/temp2_input",
-		.cfg	= fcd_temp_core_cfg,
+		.cfg	= offsetof(struct fcd_conf, temp_core),
 		.mon	= &fcd_temp_core_monitor,
 	},
 	[FCD_TEMP_ID_CORE1] = {
 		.path	= "/sys/devices/platform/coretemp.0/hwmon/hwmon1/temp3_input",
-		.cfg	= fcd_temp_core_cfg,
+		.cfg	= offsetof(struct fcd_conf, temp_core),
 		.mon	= &fcd_temp_core_monitor,
 	},
 	[FCD_TEMP_ID_CPU] = {
 		.path	= "/sys/devices/platform/it87.656/temp1_input",
-		.cfg	= fcd_temp_cpu_cfg,
+		.cfg	= offsetof(struct fcd_conf, temp_cpu),
 		.mon	= &fcd_temp_it87_monitor,
 	},
 	[FCD_TEMP_ID_ICH] = {
 		.path	= "/sys/devices/platform/it87.656/temp2_input",
-		.cfg	= fcd_temp_ich_cfg,
+		.cfg	= offsetof(struct fcd_conf, temp_ich),
 		.mon	= &fcd_temp_it87_monitor,
 	},
 	[FCD_TEMP_ID_SYS] = {
 		.path	= "/sys/devices/platform/it87.656/temp3_input",
-		.cfg	= fcd_temp_sys_cfg,
+		.cfg	= offsetof(struct fcd_conf, temp_sys),
 		.mon	= &fcd_temp_it87_monitor,
 	}
 };
@@ -287,7 +252,7 @@ static int fcd_temp_cb(cip_err_ctx *ctx, const cip_ini_value *value,
 	if (temp <= 0.0 || temp >= 1000.0)
 		cip_err(ctx, "Probably not a useful CPU temperature: %g", temp);
 
-	*(int *)post_parse_data = (int)(temp * 1000.0);
+	*(int *)fcd_conf_member(post_parse_data) = (int)(temp * 1000.0);
 
 	return 0;
 }
@@ -377,7 +342,8 @@ static void fcd_temp_open_inputs(struct fcd_monitor *const mon)
 		if (fcd_temp_inputs[i].mon != mon)
 			continue;
 
-		if ((fcd_temp_inputs[i].fp = fopen(fcd_temp_inputs[i].path, "re")) == NULL) {
+		fcd_temp_inputs[i].fp = fcd_lib_fopen(fcd_temp_inputs[i].path, "re");
+		if (fcd_temp_inputs[i].fp == NULL) {
 			FCD_PERROR(fcd_temp_inputs[i].path);
 			fcd_temp_fail(mon);
 		}
@@ -389,6 +355,11 @@ static void fcd_temp_open_inputs(struct fcd_monitor *const mon)
 	}
 }
 
+static const int *fcd_temp_cfg(const int i)
+{
+	return (const int *)((const char *)fcd_cfg + fcd_temp_inputs[i].cfg);
+}
+
 static void fcd_temp_process(const struct fcd_monitor *const mon,
 			     const int *const restrict temps,
 			     int *const restrict warn,
@@ -406,15 +377,15 @@ static void fcd_temp_process(const struct fcd_monitor *const mon,
 		if (fcd_temp_inputs[i].mon != mon)
 			continue;
 
-		if (temps[i] >= fcd_temp_inputs[i].cfg[FCD_CONF_TEMP_FAIL]) {
+		if (temps[i] >= fcd_temp_cfg(i)[FCD_CONF_TEMP_FAIL]) {
 			*fail = 1;
 			*warn = 0;
 		}
-		else if (temps[i] >= fcd_temp_inputs[i].cfg[FCD_CONF_TEMP_WARN]) {
+		else if (temps[i] >= fcd_temp_cfg(i)[FCD_CONF_TEMP_WARN]) {
 			*warn = !(*fail);
 		}
 
-		*pwm_flags |= fcd_pwm_temp_flags(temps[i], fcd_temp_inputs[i].cfg);
+		*pwm_flags |= fcd_pwm_temp_flags(temps[i], fcd_temp_cfg(i));
 	}
 }
 
@@ -422,8 +393,9 @@ __attribute__((noreturn))
 static void *fcd_temp_fn(void *const arg __attribute__((unused)))
 {
 	int warn, fail, i, ret, temps[FCD_TEMP_ID_ARRAY_SIZE];
+	struct fcd_shm_status *shm;
 	uint8_t pwm_flags;
-	char upper[21], lower[21];
+	char upper[21], lower[21], attr[24];
 
 	fcd_temp_exit_if_dupe_thread();
 	fcd_temp_open_inputs(&fcd_temp_core_monitor);
@@ -435,14 +407,14 @@ static void *fcd_temp_fn(void *const arg __attribute__((unused)))
 			if (fcd_temp_inputs[i].fp == NULL)
 				continue;
 
-			rewind(fcd_temp_inputs[i].fp);
-
-			ret = fscanf(fcd_temp_inputs[i].fp, "%d", &temps[i]);
-			if (ret == EOF) {
+			ret = fcd_lib_read_attr(fcd_temp_inputs[i].fp,
+						fcd_temp_inputs[i].path,
+						attr, sizeof attr);
+			if (ret == -1) {
 				FCD_PERROR(fcd_temp_inputs[i].path);
 				fcd_temp_fail(fcd_temp_inputs[i].mon);
 			}
-			else if (ret != 1) {
+			else if (sscanf(attr, "%d", &temps[i]) != 1) {
 				FCD_WARN("Failed to parse contents of %s\n",
 					 fcd_temp_inputs[i].path);
 				fcd_temp_fail(fcd_temp_inputs[i].mon);
@@ -464,6 +436,23 @@ static void *fcd_temp_fn(void *const arg __attribute__((unused)))
 			else {
 				fcd_lib_set_mon_status(&fcd_temp_core_monitor,
 						       lower, warn, fail, NULL, pwm_flags);
+				fcd_metrics_add(&fcd_temp_core_monitor,
+					"# HELP freecusd_cpu_core_temperature_celsius CPU core temperature\n"
+					"# TYPE freecusd_cpu_core_temperature_celsius gauge\n"
+					"freecusd_cpu_core_temperature_celsius{core=\"0\"} %g\n"
+					"freecusd_cpu_core_temperature_celsius{core=\"1\"} %g\n",
+					temps[FCD_TEMP_ID_CORE0] / 1000.0,
+					temps[FCD_TEMP_ID_CORE1] / 1000.0);
+				fcd_metrics_publish(&fcd_temp_core_monitor);
+
+				if ((shm = fcd_shm_write_begin()) != NULL) {
+					shm->temps[FCD_SHM_TEMP_CORE0] = temps[FCD_TEMP_ID_CORE0];
+					shm->temps[FCD_SHM_TEMP_CORE1] = temps[FCD_TEMP_ID_CORE1];
+					fcd_shm_write_end(shm);
+				}
+
+				fcd_trend_add(FCD_TREND_CORE0, temps[FCD_TEMP_ID_CORE0] / 100);
+				fcd_trend_add(FCD_TREND_CORE1, temps[FCD_TEMP_ID_CORE1] / 100);
 			}
 		}
 
@@ -485,6 +474,27 @@ static void *fcd_temp_fn(void *const arg __attribute__((unused)))
 			else {
 				fcd_lib_set_mon_status(&fcd_temp_it87_monitor,
 						       lower, warn, fail, NULL, pwm_flags);
+				fcd_metrics_add(&fcd_temp_it87_monitor,
+					"# HELP freecusd_temperature_celsius IT87 sensor temperature\n"
+					"# TYPE freecusd_temperature_celsius gauge\n"
+					"freecusd_temperature_celsius{sensor=\"cpu\"} %g\n"
+					"freecusd_temperature_celsius{sensor=\"ich\"} %g\n"
+					"freecusd_temperature_celsius{sensor=\"sys\"} %g\n",
+					temps[FCD_TEMP_ID_CPU] / 1000.0,
+					temps[FCD_TEMP_ID_ICH] / 1000.0,
+					temps[FCD_TEMP_ID_SYS] / 1000.0);
+				fcd_metrics_publish(&fcd_temp_it87_monitor);
+
+				if ((shm = fcd_shm_write_begin()) != NULL) {
+					shm->temps[FCD_SHM_TEMP_CPU] = temps[FCD_TEMP_ID_CPU];
+					shm->temps[FCD_SHM_TEMP_ICH] = temps[FCD_TEMP_ID_ICH];
+					shm->temps[FCD_SHM_TEMP_SYS] = temps[FCD_TEMP_ID_SYS];
+					fcd_shm_write_end(shm);
+				}
+
+				fcd_trend_add(FCD_TREND_CPU, temps[FCD_TEMP_ID_CPU] / 100);
+				fcd_trend_add(FCD_TREND_ICH, temps[FCD_TEMP_ID_ICH] / 100);
+				fcd_trend_add(FCD_TREND_SYS, temps[FCD_TEMP_ID_SYS] / 100);
 			}
 		}
 
@@ -501,17 +511,17 @@ static void *fcd_temp_fn(void *const arg __attribute__((unused)))
 static void fcd_temp_dump_core_config(void)
 {
 	FCD_DUMP("\tcore temperature thresholds:\n");
-	fcd_lib_dump_temp_cfg(fcd_temp_core_cfg);
+	fcd_lib_dump_temp_cfg(fcd_cfg->temp_core);
 }
 
 static void fcd_temp_dump_it87_config(void)
 {
 	FCD_DUMP("\tCPU temperature thresholds:\n");
-	fcd_lib_dump_temp_cfg(fcd_temp_cpu_cfg);
+	fcd_lib_dump_temp_cfg(fcd_cfg->temp_cpu);
 	FCD_DUMP("\tsystem temperature thresholds:\n");
-	fcd_lib_dump_temp_cfg(fcd_temp_sys_cfg);
+	fcd_lib_dump_temp_cfg(fcd_cfg->temp_sys);
 	FCD_DUMP("\tICH temperature thresholds:\n");
-	fcd_lib_dump_temp_cfg(fcd_temp_ich_cfg);
+	fcd_lib_dump_temp_cfg(fcd_cfg->temp_ich);
 }
 
 struct fcd_monitor fcd_temp_core_monitor = {
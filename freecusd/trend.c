@@ -0,0 +1,753 @@
+/*
+ * Copyright 2020 Ian Pilcher <arequipeno@gmail.com>
+ *
+ * This program is free software.  You can redistribute it or modify it under
+ * the terms of version 2 of the GNU General Public License (GPL), as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY -- without even the implied warranty of MERCHANTIBILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the text of the GPL for more details.
+ *
+ * Version 2 of the GNU General Public License is available at:
+ *
+ *   http://www.gnu.org/licenses/old-licenses/gpl-2.0.html
+ */
+
+#include "freecusd.h"
+
+#include <string.h>
+#include <time.h>
+
+/*
+ * Sensor history ("trends").  Each series (enum fcd_trend_id) keeps:
+ *
+ *   - the last FCD_TREND_RAW_SIZE samples, as reported by its monitor (more
+ *     than an hour at the normal 30-second polling interval; queries fall back
+ *     to the minute buckets if they don't go back far enough),
+ *   - the minimum, average & maximum of each minute for a week, and
+ *   - the minimum, average & maximum of each hour for a year.
+ *
+ * Everything is allocated at startup in a single block, so memory use is
+ * fixed (about 115 KiB per series).  Bucket values are 16 bits, in the units of
+ * the series (see fcd_trend_info).  Buckets are indexed by their number since
+ * the epoch (CLOCK_REALTIME), so the history survives gaps (monitor failures,
+ * suspend) without being shifted.  If the clock goes backwards, samples are
+ * added to the latest bucket until it catches up.
+ *
+ * A disk's series belongs to its position (enum fcd_trend_id), but it is
+ * cleared if a different disk (see fcd_disk_id()) is found at that position,
+ * so one disk's history is never shown as another's.
+ *
+ * Monitor threads add samples; the trend monitor thread and the control
+ * socket (main thread) query them.  Minute & hour buckets are saved to, and
+ * restored from, the history file (see histfile.c).  A single mutex protects
+ * everything.
+ */
+
+#define FCD_TREND_RAW_SIZE	240
+
+/* LCD page shows disk temperatures over this period */
+#define FCD_TREND_PAGE_HOURS	24
+
+const struct fcd_trend_tier fcd_trend_tiers[FCD_TREND_TIER_ARRAY_SIZE] = {
+	[FCD_TREND_MINUTES]	= {	.period = 60,	.size = 7 * 24 * 60	},
+	[FCD_TREND_HOURS]	= {	.period = 3600,	.size = 365 * 24	},
+};
+
+/* Empty if min > max */
+struct fcd_trend_bucket {
+	int16_t min;
+	int16_t max;
+	int16_t avg;
+};
+
+struct fcd_trend_sample {
+	uint32_t time;		/* 0 = empty */
+	int32_t value;
+};
+
+struct fcd_trend_series {
+	struct fcd_trend_sample *raw;
+	struct fcd_trend_bucket *buckets[FCD_TREND_TIER_ARRAY_SIZE];
+	uint32_t first[FCD_TREND_TIER_ARRAY_SIZE];	/* bucket # of first sample */
+	uint32_t current[FCD_TREND_TIER_ARRAY_SIZE];	/* bucket # of latest sample */
+	int64_t sum[FCD_TREND_TIER_ARRAY_SIZE];	/* of current bucket */
+	uint32_t count[FCD_TREND_TIER_ARRAY_SIZE];
+	uint64_t disk_id;	/* 0 = not a disk series or not yet known */
+	uint32_t disk_since;	/* time disk_id was found (0 = always there) */
+	unsigned raw_next;
+	_Bool started;
+};
+
+static const struct {
+	const char *name;
+	const char *unit;
+	int scale;		/* stored value / scale = value in unit */
+} fcd_trend_info[FCD_TREND_DISK] = {
+	[FCD_TREND_CORE0]	= { "core0",	"C",	10	},
+	[FCD_TREND_CORE1]	= { "core1",	"C",	10	},
+	[FCD_TREND_CPU]		= { "cpu",	"C",	10	},
+	[FCD_TREND_ICH]		= { "ich",	"C",	10	},
+	[FCD_TREND_SYS]		= { "sys",	"C",	10	},
+	[FCD_TREND_FAN]		= { "fan",	"RPM",	1	},
+	[FCD_TREND_LOADAVG]	= { "loadavg",	"",	100	},
+};
+
+static pthread_mutex_t fcd_trend_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct fcd_trend_series fcd_trend_series[FCD_TREND_ID_ARRAY_SIZE];
+static void *fcd_trend_arena;		/* NULL if allocation failed */
+
+static void fcd_trend_lock(void)
+{
+	int ret;
+
+	ret = pthread_mutex_lock(&fcd_trend_mutex);
+	if (ret != 0)
+		FCD_PT_ABRT("pthread_mutex_lock", ret);
+}
+
+static void fcd_trend_unlock(void)
+{
+	int ret;
+
+	ret = pthread_mutex_unlock(&fcd_trend_mutex);
+	if (ret != 0)
+		FCD_PT_ABRT("pthread_mutex_unlock", ret);
+}
+
+/*
+ * Called in the main thread, before any monitor threads are started.  If the
+ * memory can't be allocated, no history is kept.
+ */
+void fcd_trend_init(void)
+{
+	size_t series_size, size;
+	struct fcd_trend_series *s;
+	unsigned i, j;
+	char *p;
+
+	series_size = FCD_TREND_RAW_SIZE * sizeof *s->raw;
+	for (j = 0; j < FCD_TREND_TIER_ARRAY_SIZE; ++j)
+		series_size += fcd_trend_tiers[j].size * sizeof **s->buckets;
+
+	size = FCD_TREND_ID_ARRAY_SIZE * series_size;
+
+	/* Pages aren't touched until they're used */
+	fcd_trend_arena = calloc(1, size);
+	if (fcd_trend_arena == NULL) {
+		FCD_PERROR("calloc");
+		FCD_WARN("Sensor history disabled\n");
+		return;
+	}
+
+	for (p = fcd_trend_arena, i = 0; i < FCD_TREND_ID_ARRAY_SIZE; ++i) {
+
+		s = &fcd_trend_series[i];
+
+		s->raw = (struct fcd_trend_sample *)p;
+		p += FCD_TREND_RAW_SIZE * sizeof *s->raw;
+
+		for (j = 0; j < FCD_TREND_TIER_ARRAY_SIZE; ++j) {
+			s->buckets[j] = (struct fcd_trend_bucket *)p;
+			p += fcd_trend_tiers[j].size * sizeof **s->buckets;
+		}
+	}
+
+	FCD_INFO("Sensor history: %u series, %zu KiB\n",
+		 (unsigned)FCD_TREND_ID_ARRAY_SIZE, size / 1024);
+}
+
+/* Called in the main thread after all monitor threads have exited */
+void fcd_trend_fini(void)
+{
+	free(fcd_trend_arena);
+	fcd_trend_arena = NULL;
+	memset(fcd_trend_series, 0, sizeof fcd_trend_series);
+}
+
+static int16_t fcd_trend_clamp(const int value)
+{
+	if (value > INT16_MAX)
+		return INT16_MAX;
+	if (value < INT16_MIN)
+		return INT16_MIN;
+	return value;
+}
+
+static void fcd_trend_bucket_add(struct fcd_trend_series *const s,
+				 const unsigned i, const uint32_t now,
+				 const int value)
+{
+	const struct fcd_trend_tier *const tier = &fcd_trend_tiers[i];
+	struct fcd_trend_bucket *b;
+	uint32_t n, skip;
+	int16_t v;
+
+	n = now / tier->period;
+
+	if (!s->started) {
+		s->first[i] = n;
+		s->current[i] = n;
+		s->count[i] = 0;
+	}
+	else if (n > s->current[i]) {
+
+		/* Empty any buckets that were skipped */
+		skip = n - s->current[i];
+		if (skip > tier->size)
+			skip = tier->size;
+
+		while (skip-- > 1) {
+			b = &s->buckets[i][(n - skip) % tier->size];
+			b->min = INT16_MAX;
+			b->max = INT16_MIN;
+		}
+
+		s->current[i] = n;
+		s->count[i] = 0;
+	}
+
+	b = &s->buckets[i][s->current[i] % tier->size];
+	v = fcd_trend_clamp(value);
+
+	if (s->count[i] == 0) {
+		b->min = v;
+		b->max = v;
+		s->sum[i] = 0;
+	}
+	else if (v < b->min) {
+		b->min = v;
+	}
+	else if (v > b->max) {
+		b->max = v;
+	}
+
+	s->sum[i] += v;
+	++s->count[i];
+	b->avg = s->sum[i] / s->count[i];
+}
+
+/*
+ * Adds a sample to a series.  value is in the units of the series (e.g. tenths
+ * of a degree); see enum fcd_trend_id.  Disks beyond FCD_TREND_DISKS are
+ * ignored.
+ */
+void fcd_trend_add(const unsigned id, const int value)
+{
+	struct fcd_trend_series *s;
+	uint32_t now;
+	unsigned i;
+
+	if (id >= FCD_TREND_ID_ARRAY_SIZE || fcd_trend_arena == NULL)
+		return;
+
+	now = time(NULL);
+	s = &fcd_trend_series[id];
+
+	fcd_trend_lock();
+
+	s->raw[s->raw_next].time = now;
+	s->raw[s->raw_next].value = value;
+	s->raw_next = (s->raw_next + 1) % FCD_TREND_RAW_SIZE;
+
+	for (i = 0; i < FCD_TREND_TIER_ARRAY_SIZE; ++i)
+		fcd_trend_bucket_add(s, i, now, value);
+
+	s->started = 1;
+
+	fcd_trend_unlock();
+}
+
+/*
+ * Sets the identity of the disk at a position (1-based).  If a different disk
+ * was previously at that position, its history is discarded.  Positions beyond
+ * FCD_TREND_DISKS are ignored.
+ */
+void fcd_trend_disk(const unsigned pos, const uint64_t id)
+{
+	struct fcd_trend_series *s;
+	unsigned i;
+
+	if (pos < 1 || pos > FCD_TREND_DISKS || fcd_trend_arena == NULL)
+		return;
+
+	s = &fcd_trend_series[FCD_TREND_DISK + pos - 1];
+
+	fcd_trend_lock();
+
+	if (s->disk_id != id) {
+
+		if (s->disk_id != 0 && s->started) {
+
+			FCD_INFO("Disk %u replaced; discarding its history\n",
+				 pos);
+
+			/* Buckets outside [first, current] are ignored */
+			memset(s->raw, 0, FCD_TREND_RAW_SIZE * sizeof *s->raw);
+			for (i = 0; i < FCD_TREND_TIER_ARRAY_SIZE; ++i) {
+				s->first[i] = 0;
+				s->current[i] = 0;
+				s->sum[i] = 0;
+				s->count[i] = 0;
+			}
+			s->raw_next = 0;
+			s->started = 0;
+		}
+
+		if (s->disk_id != 0)
+			s->disk_since = time(NULL);
+
+		s->disk_id = id;
+	}
+
+	fcd_trend_unlock();
+}
+
+/*
+ * Gets the identity of the disk at a position (0 if not yet known) and when it
+ * was found there, for the history file.
+ */
+void fcd_trend_get_disk(const unsigned pos, uint64_t *const id,
+			uint32_t *const since)
+{
+	const struct fcd_trend_series *s;
+
+	*id = 0;
+	*since = 0;
+
+	if (pos < 1 || pos > FCD_TREND_DISKS || fcd_trend_arena == NULL)
+		return;
+
+	s = &fcd_trend_series[FCD_TREND_DISK + pos - 1];
+
+	fcd_trend_lock();
+	*id = s->disk_id;
+	*since = s->disk_since;
+	fcd_trend_unlock();
+}
+
+/*
+ * Restores the identity of the disk at a position from the history file.
+ * Called in the main thread, before any monitor threads are started.
+ */
+void fcd_trend_restore_disk(const unsigned pos, const uint64_t id,
+			    const uint32_t since)
+{
+	struct fcd_trend_series *s;
+
+	if (pos < 1 || pos > FCD_TREND_DISKS || fcd_trend_arena == NULL)
+		return;
+
+	s = &fcd_trend_series[FCD_TREND_DISK + pos - 1];
+
+	fcd_trend_lock();
+	s->disk_id = id;
+	s->disk_since = since;
+	fcd_trend_unlock();
+}
+
+/*
+ * Gets a single bucket (n is its number since the epoch).  Returns 0 on
+ * success, or -1 if the bucket is empty or no longer (or not yet) kept.
+ */
+int fcd_trend_get_bucket(const unsigned id, const enum fcd_trend_tier_id i,
+			 const uint32_t n, struct fcd_trend_stats *const stats)
+{
+	const struct fcd_trend_tier *const tier = &fcd_trend_tiers[i];
+	const struct fcd_trend_series *s;
+	const struct fcd_trend_bucket *b;
+	int ret;
+
+	if (id >= FCD_TREND_ID_ARRAY_SIZE || fcd_trend_arena == NULL)
+		return -1;
+
+	s = &fcd_trend_series[id];
+
+	fcd_trend_lock();
+
+	b = &s->buckets[i][n % tier->size];
+
+	if (!s->started || n < s->first[i] || n > s->current[i]
+			|| s->current[i] - n >= tier->size || b->min > b->max) {
+		ret = -1;
+	}
+	else {
+		stats->min = b->min;
+		stats->max = b->max;
+		stats->avg = b->avg;
+		ret = 0;
+	}
+
+	fcd_trend_unlock();
+
+	return ret;
+}
+
+/*
+ * Restores a bucket from the history file.  Called in the main thread, before
+ * any monitor threads are started, in any order.  If the bucket is the latest
+ * one, new samples in the same period are merged into it.
+ */
+void fcd_trend_restore_bucket(const unsigned id, const enum fcd_trend_tier_id i,
+			      const uint32_t n,
+			      const struct fcd_trend_stats *const stats)
+{
+	const struct fcd_trend_tier *const tier = &fcd_trend_tiers[i];
+	struct fcd_trend_series *s;
+	struct fcd_trend_bucket *b;
+	unsigned j;
+
+	if (id >= FCD_TREND_ID_ARRAY_SIZE || fcd_trend_arena == NULL)
+		return;
+
+	s = &fcd_trend_series[id];
+
+	fcd_trend_lock();
+
+	/* Zero-filled buckets aren't empty; see struct fcd_trend_bucket */
+	if (s->first[i] == 0) {
+		for (j = 0; j < tier->size; ++j) {
+			s->buckets[i][j].min = INT16_MAX;
+			s->buckets[i][j].max = INT16_MIN;
+		}
+		s->first[i] = n;
+		s->current[i] = n;
+	}
+	else if (n < s->first[i]) {
+		s->first[i] = n;
+	}
+	else if (n > s->current[i]) {
+		s->current[i] = n;
+	}
+
+	b = &s->buckets[i][n % tier->size];
+	b->min = fcd_trend_clamp(stats->min);
+	b->max = fcd_trend_clamp(stats->max);
+	b->avg = fcd_trend_clamp(stats->avg);
+
+	if (n == s->current[i]) {
+		s->sum[i] = b->avg;
+		s->count[i] = 1;
+	}
+
+	s->started = 1;
+
+	fcd_trend_unlock();
+}
+
+/*
+ * Returns 1 if the raw samples go back to since (or to the first sample), 0 if
+ * older ones have been overwritten -- e.g. with -x or forced polls, when the
+ * ring covers much less than an hour.  Called with fcd_trend_mutex locked.
+ */
+static int fcd_trend_raw_covers(const struct fcd_trend_series *const s,
+				const uint32_t since)
+{
+	const struct fcd_trend_sample *oldest;
+
+	/* The next sample to be overwritten; empty if the ring isn't full */
+	oldest = &s->raw[s->raw_next];
+
+	return oldest->time == 0 || oldest->time <= since;
+}
+
+/* Raw samples; called with fcd_trend_mutex locked */
+static int fcd_trend_query_raw(const struct fcd_trend_series *const s,
+			       const uint32_t since,
+			       struct fcd_trend_stats *const stats)
+{
+	const struct fcd_trend_sample *r;
+	long long sum;
+	unsigned i, n;
+
+	for (sum = 0, n = 0, i = 0; i < FCD_TREND_RAW_SIZE; ++i) {
+
+		r = &s->raw[i];
+		if (r->time == 0 || r->time <= since)
+			continue;
+
+		if (n == 0 || r->value < stats->min)
+			stats->min = r->value;
+		if (n == 0 || r->value > stats->max)
+			stats->max = r->value;
+
+		sum += r->value;
+		++n;
+	}
+
+	if (n == 0)
+		return -1;
+
+	stats->avg = sum / n;
+
+	return 0;
+}
+
+/*
+ * Buckets of a tier; called with fcd_trend_mutex locked.  The average is the
+ * average of the buckets' averages (i.e. weighted by time).
+ */
+static int fcd_trend_query_tier(const struct fcd_trend_series *const s,
+				const unsigned i, const uint32_t since,
+				struct fcd_trend_stats *const stats)
+{
+	const struct fcd_trend_tier *const tier = &fcd_trend_tiers[i];
+	const struct fcd_trend_bucket *b;
+	uint32_t lo, hi, n;
+	long long sum;
+	unsigned count;
+
+	hi = s->current[i];
+	lo = since / tier->period;
+
+	if (lo < s->first[i])
+		lo = s->first[i];
+	if (lo > hi)
+		return -1;		/* no samples since then */
+	if (hi - lo >= tier->size)
+		lo = hi - tier->size + 1;
+
+	for (sum = 0, count = 0, n = lo; n <= hi; ++n) {
+
+		b = &s->buckets[i][n % tier->size];
+		if (b->min > b->max)
+			continue;
+
+		if (count == 0 || b->min < stats->min)
+			stats->min = b->min;
+		if (count == 0 || b->max > stats->max)
+			stats->max = b->max;
+
+		sum += b->avg;
+		++count;
+	}
+
+	if (count == 0)
+		return -1;
+
+	stats->avg = sum / count;
+
+	return 0;
+}
+
+/*
+ * Gets the minimum, average & maximum of a series over the last seconds
+ * seconds, from the finest tier that covers the period.  (The raw samples are
+ * only used if they go back far enough; see fcd_trend_raw_covers().)  Returns
+ * 0 on success, or -1 if there are no samples in the period.
+ */
+int fcd_trend_query(const unsigned id, const unsigned seconds,
+		    struct fcd_trend_stats *const stats)
+{
+	const struct fcd_trend_series *s;
+	uint32_t now, since;
+	unsigned i;
+	int ret;
+
+	if (id >= FCD_TREND_ID_ARRAY_SIZE || fcd_trend_arena == NULL)
+		return -1;
+
+	now = time(NULL);
+	since = (seconds < now) ? now - seconds : 0;
+	s = &fcd_trend_series[id];
+
+	fcd_trend_lock();
+
+	if (!s->started) {
+		ret = -1;
+	}
+	else if (seconds <= 3600 && fcd_trend_raw_covers(s, since)) {
+		ret = fcd_trend_query_raw(s, since, stats);
+	}
+	else {
+		for (i = 0; i < FCD_TREND_TIER_ARRAY_SIZE - 1; ++i) {
+			if (seconds <= fcd_trend_tiers[i].period
+						* fcd_trend_tiers[i].size) {
+				break;
+			}
+		}
+
+		ret = fcd_trend_query_tier(s, i, since, stats);
+	}
+
+	fcd_trend_unlock();
+
+	return ret;
+}
+
+static void fcd_trend_write_value(FILE *const out, const int value,
+				  const int scale)
+{
+	switch (scale) {
+		case 1:		fprintf(out, " %8d", value);
+				break;
+		case 10:	fprintf(out, " %8.1f", value / 10.0);
+				break;
+		default:	fprintf(out, " %8.2f", (double)value / scale);
+	}
+}
+
+/* Writes the trends of all series with samples; see ctl.c */
+void fcd_trend_write(FILE *const out, const unsigned hours)
+{
+	struct fcd_trend_stats stats;
+	const char *unit;
+	char name[16];
+	unsigned i;
+	int scale;
+
+	if (fcd_trend_arena == NULL) {
+		fputs("error: sensor history is disabled\n", out);
+		return;
+	}
+
+	fprintf(out, "Last %u hours:\n%-10s %8s %8s %8s\n", hours, "series",
+		"min", "avg", "max");
+
+	for (i = 0; i < FCD_TREND_ID_ARRAY_SIZE; ++i) {
+
+		if (fcd_trend_query(i, hours * 3600, &stats) != 0)
+			continue;
+
+		if (i < FCD_TREND_DISK) {
+			snprintf(name, sizeof name, "%s", fcd_trend_info[i].name);
+			unit = fcd_trend_info[i].unit;
+			scale = fcd_trend_info[i].scale;
+		}
+		else {
+			snprintf(name, sizeof name, "disk%u",
+				 i - FCD_TREND_DISK + 1);
+			unit = "C";
+			scale = 10;
+		}
+
+		fprintf(out, "%-10s", name);
+		fcd_trend_write_value(out, stats.min, scale);
+		fcd_trend_write_value(out, stats.avg, scale);
+		fcd_trend_write_value(out, stats.max, scale);
+		fprintf(out, "%s%s\n", *unit ? " " : "", unit);
+	}
+}
+
+/*
+ * Trend monitor -- shows the minimum & maximum temperature of each disk over
+ * the last FCD_TREND_PAGE_HOURS hours, with the same layout as the disk
+ * temperature page (one 4-character cell per position).  Each group of
+ * FCD_BAY_COUNT positions has a minimum subpage and a maximum subpage.
+ */
+
+static void fcd_trend_text(char *const text, const unsigned groups)
+{
+	char upper[FCD_PAGE_LINES_SIZE / 2 + 1];
+	_Bool present[FCD_TREND_DISKS];
+	struct fcd_trend_stats stats;
+	unsigned i, pos, page;
+	char *c;
+	int ret;
+
+	memset(present, 0, sizeof present);
+	for (i = 0; i < fcd_cfg->disk_count; ++i) {
+		if (fcd_cfg->disks[i].pos <= FCD_TREND_DISKS)
+			present[fcd_cfg->disks[i].pos - 1] = 1;
+	}
+
+	memset(text, ' ', 2 * groups * FCD_PAGE_LINES_SIZE);
+
+	for (page = 0; page < 2 * groups; ++page) {
+
+		if (groups == 1) {
+			ret = snprintf(upper, sizeof upper, "HDD TEMP %uH %s",
+				       FCD_TREND_PAGE_HOURS,
+				       page % 2 ? "MAX" : "MIN");
+		}
+		else {
+			ret = snprintf(upper, sizeof upper, "HDD %uH %s %u-%u",
+				       FCD_TREND_PAGE_HOURS,
+				       page % 2 ? "MAX" : "MIN",
+				       page / 2 * FCD_BAY_COUNT + 1,
+				       (page / 2 + 1) * FCD_BAY_COUNT);
+		}
+
+		if (ret < 0 || ret >= (int)sizeof upper)
+			ret = sizeof upper - 1;
+
+		memcpy(text + page * FCD_PAGE_LINES_SIZE, upper, ret);
+	}
+
+	for (pos = 1; pos <= groups * FCD_BAY_COUNT; ++pos) {
+
+		c = text + (pos - 1) / FCD_BAY_COUNT * 2 * FCD_PAGE_LINES_SIZE
+			 + FCD_PAGE_LINES_SIZE / 2
+			 + (pos - 1) % FCD_BAY_COUNT * 4;
+
+		if (fcd_trend_query(FCD_TREND_DISK + pos - 1,
+				    FCD_TREND_PAGE_HOURS * 3600, &stats) != 0) {
+			if (present[pos - 1]) {
+				memset(c, '-', 2);
+				memset(c + FCD_PAGE_LINES_SIZE, '-', 2);
+			}
+			continue;
+		}
+
+		/* Clamped to 3 characters, like the disk temperature page */
+		ret = snprintf(upper, sizeof upper, "%d", stats.min / 10);
+		memcpy(c, upper, ret < 3 ? ret : 3);
+
+		ret = snprintf(upper, sizeof upper, "%d", stats.max / 10);
+		memcpy(c + FCD_PAGE_LINES_SIZE, upper, ret < 3 ? ret : 3);
+	}
+}
+
+__attribute__((noreturn))
+static void *fcd_trend_fn(void *arg)
+{
+	struct fcd_monitor *mon = arg;
+	unsigned text_size, groups, pos;
+	char *text;
+	int ret;
+
+	text = NULL;
+	text_size = 0;
+
+	do {
+		/* Disks are sorted by position, so the last one is the highest */
+		pos = (fcd_cfg->disk_count > 0)
+			? fcd_cfg->disks[fcd_cfg->disk_count - 1].pos : 1;
+		if (pos > FCD_TREND_DISKS)
+			pos = FCD_TREND_DISKS;
+		groups = (pos + FCD_BAY_COUNT - 1) / FCD_BAY_COUNT;
+
+		if (fcd_lib_grow(&text, &text_size,
+				 2 * groups * FCD_PAGE_LINES_SIZE,
+				 sizeof *text) == -1) {
+			free(text);
+			fcd_lib_fail_and_exit(mon);
+		}
+
+		fcd_trend_text(text, groups);
+		fcd_lib_set_mon_pages(mon, text, 2 * groups, 0, 0, NULL, 0);
+
+		ret = fcd_lib_monitor_sleep(60);
+
+	} while (ret == 0);
+
+	free(text);
+
+	if (ret == -1)
+		fcd_lib_fail_and_exit(mon);
+
+	pthread_exit(NULL);
+}
+
+struct fcd_monitor fcd_trend_monitor = {
+	.mutex			= PTHREAD_MUTEX_INITIALIZER,
+	.name			= "disk temperature trend",
+	.monitor_fn		= fcd_trend_fn,
+	.buf			= "....."
+				  "HDD TEMP TRENDS     "
+				  "                    ",
+	.enabled		= true,
+	.no_replay		= true,
+	.enabled_opt_name	= "enable_trend_monitor",
+};
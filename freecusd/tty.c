@@ -1,5 +1,5 @@
 /*
- * Copyright 2013 Ian Pilcher <arequipeno@gmail.com>
+ * Copyright 2013, 2020 Ian Pilcher <arequipeno@gmail.com>
  *
  * This program is free software.  You can redistribute it or modify it under
  * the terms of version 2 of the GNU General Public License (GPL), as published
@@ -15,21 +15,141 @@
  */
 
 #include "freecusd.h"
+#include "picproto.h"
 
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <termios.h>
 #include <string.h>
+#include <errno.h>
 #include <fcntl.h>
+#include <time.h>
+#include <poll.h>
 
-int fcd_tty_open(const char *tty)
+/*
+ * Frames are sent to the LCD PIC by a dedicated thread, so the main thread
+ * never waits on the (9600 baud) serial port.  The main thread adds messages
+ * to a small queue; if the queue is full, the oldest queued message is
+ * dropped.  (Messages are only useful if they are current.)  The LCD thread
+ * encodes each message (see picproto.c) when it is sent.  The serial port is
+ * non-blocking, and partial writes are resumed when it becomes writable.
+ */
+
+#define FCD_TTY_FRAME_SIZE	(FCD_PICPROTO_MSG_SIZE + 5)
+#define FCD_TTY_QUEUE_SIZE	8
+
+struct fcd_tty_msg {
+	uint8_t text[FCD_PICPROTO_TEXT_SIZE];
+};
+
+struct fcd_tty_frame {
+	uint8_t buf[FCD_PICPROTO_MAX_FRAME];
+	size_t size;
+};
+
+/*
+ * The 0x11 (2-line message) command always redraws the entire display, so
+ * there's no way to send a "partial" update.  We can, however, avoid sending a
+ * frame that would not change what's already on the display (when only one
+ * page is enabled, for example).  The display is refreshed anyway every
+ * FCD_TTY_REFRESH_SECS seconds, in case the PIC has been reset behind our back.
+ */
+
+#define FCD_TTY_TEXT_OFFSET	5
+#define FCD_TTY_TEXT_SIZE	FCD_PICPROTO_TEXT_SIZE
+#define FCD_TTY_REFRESH_SECS	60
+
+/*
+ * The PIC also sends frames to us -- button presses and (possibly) ACKs; see
+ * picproto.h.  All other received frames are logged (at debug level) to aid
+ * further reverse engineering.
+ *
+ * Each frame is tracked until it is ACKed.  A newer message always supersedes
+ * an older one, so only the latest frame is ever retransmitted, and only if
+ * the PIC has ACKed at least one frame.  (Otherwise every frame would be sent
+ * FCD_TTY_ACK_TRIES times to a PIC that doesn't send ACKs.)
+ */
+
+#define FCD_TTY_ACK_TIMEOUT	500	/* milliseconds */
+#define FCD_TTY_ACK_TRIES	3
+
+enum fcd_tty_backend {
+	FCD_TTY_UART = 0,
+	FCD_TTY_PTY,
+	FCD_TTY_NULL,
+};
+
+static const char *const fcd_tty_backend_names[] = {
+	[FCD_TTY_UART]	= "UART",
+	[FCD_TTY_PTY]	= "pseudo-terminal",
+	[FCD_TTY_NULL]	= "null",
+};
+
+static enum fcd_tty_backend fcd_tty_type;
+static const char *fcd_tty_dev;
+static int fcd_tty_fd = -1;		/* set by LCD thread */
+static int fcd_tty_wake_pipe[2] = { -1, -1 };
+static int fcd_tty_button_pipe[2] = { -1, -1 };
+
+/* Everything below is protected by fcd_tty_mutex */
+static pthread_mutex_t fcd_tty_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t fcd_tty_cond = PTHREAD_COND_INITIALIZER;	/* progress */
+
+static struct fcd_tty_msg fcd_tty_queue[FCD_TTY_QUEUE_SIZE];
+static unsigned fcd_tty_queue_head;
+static unsigned fcd_tty_queue_count;
+
+/* What will be on the display once the queue has been sent */
+static uint8_t fcd_tty_screen[FCD_TTY_TEXT_SIZE];
+static _Bool fcd_tty_screen_valid = 0;
+static time_t fcd_tty_screen_time;
+
+/* LCD thread couldn't open the device; messages are discarded */
+static _Bool fcd_tty_failed = 0;
+
+/* Statistics */
+static unsigned long fcd_tty_frames_sent;
+static unsigned long fcd_tty_frames_skipped;
+static unsigned long fcd_tty_frames_dropped;
+static unsigned long fcd_tty_partial_writes;
+static unsigned long long fcd_tty_bytes_sent;
+static unsigned long long fcd_tty_bytes_saved;
+static unsigned long fcd_tty_acks;
+
+/* Only accessed by the LCD thread (and fcd_tty_close, after it exits) */
+static struct fcd_picproto_tracker fcd_tty_tracker;
+
+static void fcd_tty_lock(void)
 {
-	struct termios tio;
-	int fd;
+	int ret;
+
+	ret = pthread_mutex_lock(&fcd_tty_mutex);
+	if (ret != 0)
+		FCD_PT_ABRT("pthread_mutex_lock", ret);
+}
+
+static void fcd_tty_unlock(void)
+{
+	int ret;
+
+	ret = pthread_mutex_unlock(&fcd_tty_mutex);
+	if (ret != 0)
+		FCD_PT_ABRT("pthread_mutex_unlock", ret);
+}
 
-	fd = open(tty, O_RDWR | O_NOCTTY | O_CLOEXEC);
-	if (fd == -1)
-		FCD_PFATAL(tty);
+/* Wakes any thread in fcd_tty_wait().  Call with fcd_tty_mutex locked. */
+static void fcd_tty_progress_made(void)
+{
+	int ret;
+
+	ret = pthread_cond_broadcast(&fcd_tty_cond);
+	if (ret != 0)
+		FCD_PT_ABRT("pthread_cond_broadcast", ret);
+}
+
+static void fcd_tty_set_params(const int fd)
+{
+	struct termios tio;
 
 	if (tcgetattr(fd, &tio) == -1) {
 		FCD_PERROR("tcgetattr");
@@ -78,28 +198,599 @@ int fcd_tty_open(const char *tty)
 		}
 	}
 
-	return fd;
+	return;
 
 tty_setup_failed:
 	FCD_WARN("Failed to set LCD serial port parameters\n");
-	return fd;
 }
 
-void fcd_tty_write_msg(int fd, struct fcd_monitor *mon)
+/*
+ * Display backends:
+ *
+ *	uart:DEVICE (or just DEVICE) - the real PIC, which is reset first
+ *	pty:DEVICE - a pseudo-terminal, such as the one created by lcd/fakepic
+ *	null - frames are discarded, and there is no button input
+ *
+ * Only the backend is selected here; the device is opened (and the PIC reset,
+ * which takes over 2 seconds) by the LCD thread -- see fcd_tty_start().  Any
+ * messages queued in the meantime are sent once the device is ready.
+ */
+void fcd_tty_open(const char *spec)
 {
-	static uint8_t seq = 1;
+	if (strcmp(spec, "null") == 0) {
+		fcd_tty_type = FCD_TTY_NULL;
+		fcd_tty_dev = "/dev/null";
+	}
+	else if (strncmp(spec, "pty:", 4) == 0) {
+		fcd_tty_type = FCD_TTY_PTY;
+		fcd_tty_dev = spec + 4;
+	}
+	else if (strncmp(spec, "uart:", 5) == 0) {
+		fcd_tty_type = FCD_TTY_UART;
+		fcd_tty_dev = spec + 5;
+	}
+	else {
+		fcd_tty_type = FCD_TTY_UART;
+		fcd_tty_dev = spec;
+	}
+
+	FCD_INFO("Using %s LCD backend: %s\n",
+		 fcd_tty_backend_names[fcd_tty_type], fcd_tty_dev);
+
+	if (pipe2(fcd_tty_wake_pipe, O_NONBLOCK | O_CLOEXEC) == -1)
+		FCD_PFATAL("pipe2");
+
+	if (pipe2(fcd_tty_button_pipe, O_NONBLOCK | O_CLOEXEC) == -1)
+		FCD_PFATAL("pipe2");
+}
+
+/*******************************************************************************
+ *
+ * Called in the main thread
+ *
+ ******************************************************************************/
+
+static time_t fcd_tty_now(void)
+{
+	struct timespec now;
+
+	if (clock_gettime(CLOCK_MONOTONIC_COARSE, &now) == -1) {
+		FCD_PERROR("clock_gettime");
+		return -1;
+	}
+
+	return now.tv_sec;
+}
+
+/*
+ * Returns 1 if the display already shows (or will show) the monitor's text and
+ * doesn't need to be refreshed, 0 otherwise.  Call with fcd_tty_mutex locked.
+ */
+static int fcd_tty_on_screen(const struct fcd_monitor *const mon,
+			     const time_t now)
+{
+	if (!fcd_tty_screen_valid || now == -1)
+		return 0;
+
+	if (now - fcd_tty_screen_time >= FCD_TTY_REFRESH_SECS)
+		return 0;
+
+	return memcmp(fcd_tty_screen, mon->buf + FCD_TTY_TEXT_OFFSET,
+		      FCD_TTY_TEXT_SIZE) == 0;
+}
+
+/*
+ * Adds a message to the queue.  Call with fcd_tty_mutex locked.
+ */
+static void fcd_tty_enqueue(struct fcd_monitor *const mon, const time_t now)
+{
+	struct fcd_tty_msg *msg;
+
+	if (fcd_tty_queue_count == FCD_TTY_QUEUE_SIZE) {
+		fcd_tty_queue_head =
+			(fcd_tty_queue_head + 1) % FCD_TTY_QUEUE_SIZE;
+		--fcd_tty_queue_count;
+		++fcd_tty_frames_dropped;
+	}
+
+	msg = &fcd_tty_queue[(fcd_tty_queue_head + fcd_tty_queue_count)
+							% FCD_TTY_QUEUE_SIZE];
+	memcpy(msg->text, mon->buf + FCD_TTY_TEXT_OFFSET, sizeof msg->text);
+	++fcd_tty_queue_count;
+
+	memcpy(fcd_tty_screen, mon->buf + FCD_TTY_TEXT_OFFSET,
+	       FCD_TTY_TEXT_SIZE);
+	fcd_tty_screen_time = now;
+	fcd_tty_screen_valid = 1;
+}
+
+/*
+ * Queues the monitor's message to be sent to the LCD.  Never blocks on the
+ * serial port.
+ */
+void fcd_tty_write_msg(struct fcd_monitor *mon)
+{
+	time_t now;
+
+	now = fcd_tty_now();
+
+	fcd_tty_lock();
+
+	if (fcd_tty_failed) {
+		fcd_tty_unlock();
+		return;
+	}
+
+	if (fcd_tty_on_screen(mon, now)) {
+		++fcd_tty_frames_skipped;
+		fcd_tty_bytes_saved += FCD_TTY_FRAME_SIZE;
+		fcd_tty_unlock();
+		return;
+	}
+
+	fcd_tty_enqueue(mon, now);
+
+	fcd_tty_unlock();
+
+	/* Pipe is non-blocking; if it's full, the LCD thread will wake up */
+	if (write(fcd_tty_wake_pipe[1], "", 1) == -1 && errno != EAGAIN)
+		FCD_PERROR("write");
+}
+
+/*
+ * File descriptor that becomes readable when a button has been pressed
+ */
+int fcd_tty_button_fd(void)
+{
+	return fcd_tty_button_pipe[0];
+}
+
+/*
+ * Returns the next button press (FCD_BUTTON_NONE if there are none pending).
+ */
+enum fcd_button fcd_tty_read_button(void)
+{
+	uint8_t button;
+	ssize_t ret;
+
+	ret = read(fcd_tty_button_pipe[0], &button, 1);
+	if (ret == -1) {
+		if (errno != EAGAIN)
+			FCD_PERROR("read");
+		return FCD_BUTTON_NONE;
+	}
+
+	if (ret != 1)
+		return FCD_BUTTON_NONE;
+
+	return button;
+}
+
+void fcd_tty_get_progress(struct fcd_tty_progress *const progress)
+{
+	fcd_tty_lock();
+
+	progress->sent = fcd_tty_frames_sent;
+	progress->acked = fcd_tty_acks;
+	progress->queued = fcd_tty_queue_count;
+
+	fcd_tty_unlock();
+}
+
+/*
+ * Waits until at least target->sent frames have been sent, target->acked
+ * frames have been ACKed, and no more than target->queued messages are
+ * queued.  Returns 0 on success, -1 on timeout.  (Used by the benchmark.)
+ */
+int fcd_tty_wait(const struct fcd_tty_progress *const target,
+		 const int timeout)
+{
+	struct timespec deadline;
 	int ret;
 
-	mon->buf[0]  = 0x02;
-	mon->buf[1]  = seq++;
-	mon->buf[2]  = 0x00;
-	mon->buf[3]  = 0x3d;
-	mon->buf[4]  = 0x11;
-	mon->buf[65] = 0x03;
+	if (clock_gettime(CLOCK_REALTIME, &deadline) == -1)
+		FCD_PABORT("clock_gettime");
+
+	deadline.tv_sec += timeout / 1000;
+	deadline.tv_nsec += timeout % 1000 * 1000000L;
+	if (deadline.tv_nsec >= 1000000000L) {
+		deadline.tv_nsec -= 1000000000L;
+		++deadline.tv_sec;
+	}
+
+	fcd_tty_lock();
+
+	while (fcd_tty_frames_sent < target->sent
+			|| fcd_tty_acks < target->acked
+			|| fcd_tty_queue_count > target->queued) {
+
+		ret = pthread_cond_timedwait(&fcd_tty_cond, &fcd_tty_mutex,
+					     &deadline);
+		if (ret == ETIMEDOUT) {
+			fcd_tty_unlock();
+			return -1;
+		}
+		if (ret != 0)
+			FCD_PT_ABRT("pthread_cond_timedwait", ret);
+	}
+
+	fcd_tty_unlock();
+
+	return 0;
+}
+
+void fcd_tty_close(void)
+{
+	int i;
+
+	/* LCD thread may have been stopped before opening the device */
+	if (fcd_tty_fd != -1 && close(fcd_tty_fd) == -1)
+		FCD_PERROR("close");
 
-	ret = write(fd, mon->buf, sizeof mon->buf);
-	if (ret == -1)
+	for (i = 0; i < 2; ++i) {
+		if (close(fcd_tty_wake_pipe[i]) == -1)
+			FCD_PERROR("close");
+		if (close(fcd_tty_button_pipe[i]) == -1)
+			FCD_PERROR("close");
+	}
+
+	FCD_INFO("LCD frames sent: %lu (%llu bytes); skipped: %lu "
+		 "(%llu bytes saved); dropped: %lu; partial writes: %lu\n",
+		 fcd_tty_frames_sent, fcd_tty_bytes_sent,
+		 fcd_tty_frames_skipped, fcd_tty_bytes_saved,
+		 fcd_tty_frames_dropped, fcd_tty_partial_writes);
+	FCD_INFO("LCD frames ACKed: %lu; retransmitted: %lu; unacknowledged: "
+		 "%lu\n", fcd_tty_tracker.acked, fcd_tty_tracker.retransmits,
+		 fcd_tty_tracker.expired);
+}
+
+/*******************************************************************************
+ *
+ * The LCD thread
+ *
+ ******************************************************************************/
+
+/*
+ * Resets the PIC (if necessary) and opens the device.  Returns 0 on success,
+ * -1 if the device can't be opened.
+ */
+static int fcd_tty_start(void)
+{
+	struct timespec start, end;
+	int fd;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &start) == -1)
+		FCD_PABORT("clock_gettime");
+
+	if (fcd_tty_type == FCD_TTY_UART) {
+		fcd_pic_setup_gpio();
+		fcd_pic_reset();
+	}
+
+	fd = open(fcd_tty_dev, ((fcd_tty_type == FCD_TTY_NULL) ? O_WRONLY
+								  : O_RDWR)
+				| O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+	if (fd == -1) {
+		FCD_PERROR(fcd_tty_dev);
+		return -1;
+	}
+
+	if (fcd_tty_type != FCD_TTY_NULL)
+		fcd_tty_set_params(fd);
+
+	fcd_tty_fd = fd;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &end) == -1)
+		FCD_PABORT("clock_gettime");
+
+	FCD_INFO("LCD ready after %.1f ms\n",
+		 (end.tv_sec - start.tv_sec) * 1000.0
+		 + (end.tv_nsec - start.tv_nsec) / 1000000.0);
+
+	return 0;
+}
+
+static long long fcd_tty_msec(void)
+{
+	struct timespec now;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &now) == -1)
+		FCD_PABORT("clock_gettime");
+
+	return now.tv_sec * 1000LL + now.tv_nsec / 1000000;
+}
+
+/*
+ * Removes the oldest message from the queue and encodes it.  Returns 1 if a
+ * frame is ready to be sent, 0 if the queue is empty.
+ */
+static int fcd_tty_dequeue(struct fcd_tty_frame *const frame)
+{
+	uint8_t body[FCD_PICPROTO_MAX_BODY];
+	struct fcd_tty_msg msg;
+	int ret;
+
+	fcd_tty_lock();
+
+	if (fcd_tty_queue_count == 0) {
+		ret = 0;
+	}
+	else {
+		msg = fcd_tty_queue[fcd_tty_queue_head];
+		fcd_tty_queue_head =
+			(fcd_tty_queue_head + 1) % FCD_TTY_QUEUE_SIZE;
+		--fcd_tty_queue_count;
+		fcd_tty_progress_made();
+		ret = 1;
+	}
+
+	fcd_tty_unlock();
+
+	if (ret == 1) {
+		/* This message supersedes any unacknowledged ones */
+		fcd_picproto_cancel(&fcd_tty_tracker);
+		frame->size = fcd_picproto_send(&fcd_tty_tracker, frame->buf,
+					body,
+					fcd_picproto_msg_text(body, msg.text),
+					fcd_tty_msec());
+	}
+
+	return ret;
+}
+
+/*
+ * Returns 1 if the last frame hasn't been ACKed in time and should be sent
+ * again, 0 otherwise.
+ */
+static int fcd_tty_retransmit(struct fcd_tty_frame *const frame)
+{
+	const struct fcd_picproto_pending *p;
+
+	if (fcd_tty_tracker.acked == 0)
+		return 0;
+
+	p = fcd_picproto_retransmit(&fcd_tty_tracker, fcd_tty_msec());
+	if (p == NULL)
+		return 0;
+
+	FCD_DEBUG("Retransmitting LCD frame (sequence %u)\n", p->frame[1]);
+
+	memcpy(frame->buf, p->frame, p->size);
+	frame->size = p->size;
+
+	return 1;
+}
+
+/*
+ * ppoll timeout for retransmission (NULL if nothing to retransmit).  A frame
+ * can't be retransmitted while another one is being written, so there's no
+ * timeout then either; POLLOUT will end the wait.  (Otherwise an overdue
+ * retransmission would make the timeout 0 and the thread would spin until the
+ * serial port accepted more data.)
+ */
+static const struct timespec *fcd_tty_timeout(struct timespec *const ts,
+					      const size_t remaining)
+{
+	long long msec;
+
+	if (fcd_tty_tracker.acked == 0 || remaining > 0)
+		return NULL;
+
+	msec = fcd_picproto_next_timeout(&fcd_tty_tracker, fcd_tty_msec());
+	if (msec == -1)
+		return NULL;
+
+	ts->tv_sec = msec / 1000;
+	ts->tv_nsec = msec % 1000 * 1000000;
+
+	return ts;
+}
+
+static void fcd_tty_drain_wake_pipe(void)
+{
+	char buf[FCD_TTY_QUEUE_SIZE];
+	ssize_t ret;
+
+	do {
+		ret = read(fcd_tty_wake_pipe[0], buf, sizeof buf);
+	} while (ret > 0);
+
+	if (ret == -1 && errno != EAGAIN)
+		FCD_PERROR("read");
+}
+
+/*
+ * Writes as much of the current frame as the serial port will accept.  Returns
+ * the number of bytes of the frame that remain to be written (0 when the frame
+ * is complete or has been abandoned due to an error).
+ */
+static size_t fcd_tty_write_frame(const struct fcd_tty_frame *const frame,
+				  const size_t remaining)
+{
+	ssize_t ret;
+
+	ret = write(fcd_tty_fd, frame->buf + frame->size - remaining,
+		    remaining);
+	if (ret == -1) {
+		if (errno == EAGAIN || errno == EINTR)
+			return remaining;
 		FCD_PERROR("write");
-	else if (ret != sizeof mon->buf)
-		FCD_ERR("Incomplete write (%d bytes)\n", ret);
+		fcd_tty_lock();
+		fcd_tty_screen_valid = 0;	/* don't know what's on it */
+		fcd_tty_unlock();
+		return 0;
+	}
+
+	fcd_tty_lock();
+
+	fcd_tty_bytes_sent += ret;
+	if ((size_t)ret < remaining) {
+		++fcd_tty_partial_writes;
+	}
+	else {
+		++fcd_tty_frames_sent;
+		fcd_tty_progress_made();
+	}
+
+	fcd_tty_unlock();
+
+	return remaining - ret;
+}
+
+static void fcd_tty_rx_frame(const struct fcd_picproto_parser *const rx)
+{
+	char hex[3 * sizeof rx->body + 1];
+	long long delay;
+	uint8_t button;
+	unsigned i;
+
+	if (fcd_picproto_is_ack(rx)) {
+		delay = fcd_picproto_ack(&fcd_tty_tracker, rx->seq,
+					 fcd_tty_msec());
+		if (delay == -1) {
+			FCD_DEBUG("Unexpected ACK (sequence %u)\n", rx->seq);
+			return;
+		}
+		FCD_DEBUG("LCD frame %u ACKed after %lld ms\n", rx->seq, delay);
+		fcd_tty_lock();
+		++fcd_tty_acks;
+		fcd_tty_progress_made();
+		fcd_tty_unlock();
+		return;
+	}
+
+	button = fcd_picproto_button(rx);
+
+	if (button > FCD_BUTTON_NONE && button <= FCD_BUTTON_ESC) {
+		FCD_DEBUG("Button pressed: %u\n", button);
+		if (write(fcd_tty_button_pipe[1], &button, 1) == -1)
+			FCD_PERROR("write");
+		return;
+	}
+
+	for (i = 0; i < rx->len; ++i)
+		sprintf(hex + 3 * i, " %02x", rx->body[i]);
+	hex[3 * i] = 0;
+
+	FCD_DEBUG("Received frame (sequence %u):%s\n", rx->seq, hex);
+}
+
+/*
+ * Reads whatever the PIC has sent.  Returns 0 on success, -1 if reading from
+ * the serial port has failed (and shouldn't be retried).
+ */
+static int fcd_tty_read(struct fcd_picproto_parser *const rx)
+{
+	uint8_t buf[64];
+	ssize_t ret, i;
+
+	ret = read(fcd_tty_fd, buf, sizeof buf);
+	if (ret == -1) {
+		if (errno == EAGAIN)
+			return 0;
+		FCD_PERROR("read");
+		return -1;
+	}
+
+	if (ret == 0) {
+		FCD_WARN("Unexpected EOF on LCD serial port\n");
+		return -1;
+	}
+
+	fcd_rec_write(FCD_REC_TTY, "tty", 0, buf, ret);
+
+	for (i = 0; i < ret; ++i) {
+
+		switch (fcd_picproto_parse(rx, buf[i])) {
+
+			case FCD_PICPROTO_FRAME:
+				fcd_tty_rx_frame(rx);
+				break;
+
+			case FCD_PICPROTO_DISCARD:
+				FCD_DEBUG("Discarding byte: %02x\n", buf[i]);
+				break;
+
+			case FCD_PICPROTO_BAD:
+				FCD_WARN("Invalid frame from LCD PIC\n");
+				break;
+
+			case FCD_PICPROTO_MORE:
+				break;
+		}
+	}
+
+	return 0;
+}
+
+__attribute__((noreturn))
+void *fcd_tty_fn(void *arg __attribute__((unused)))
+{
+	struct fcd_picproto_parser rx;
+	struct fcd_tty_frame frame;
+	struct pollfd pfds[2];
+	struct timespec ts;
+	size_t remaining;
+	_Bool rx_ok;
+	int ret;
+
+	/*
+	 * The monitors (and fan control) are already running, so a missing LCD
+	 * mustn't take the daemon down.  Carry on without it.
+	 */
+	if (fcd_tty_start() == -1) {
+		FCD_ERR("Failed to open LCD device; LCD disabled\n");
+		fcd_tty_lock();
+		fcd_tty_failed = 1;
+		fcd_tty_queue_count = 0;
+		fcd_tty_progress_made();
+		fcd_tty_unlock();
+		pthread_exit(NULL);
+	}
+
+	fcd_picproto_tracker_init(&fcd_tty_tracker, 1, FCD_TTY_ACK_TIMEOUT,
+				  FCD_TTY_ACK_TRIES);
+	fcd_picproto_parser_init(&rx);
+	remaining = 0;
+	rx_ok = (fcd_tty_type != FCD_TTY_NULL);
+
+	pfds[0].fd = fcd_tty_wake_pipe[0];
+	pfds[0].events = POLLIN;
+
+	while (!fcd_thread_exit_flag) {
+
+		if (remaining == 0 && (fcd_tty_dequeue(&frame)
+					|| fcd_tty_retransmit(&frame)))
+			remaining = frame.size;
+
+		/* poll ignores negative file descriptors */
+		pfds[1].fd = (rx_ok || remaining > 0) ? fcd_tty_fd : -1;
+		pfds[1].events = (rx_ok ? POLLIN : 0) |
+					((remaining > 0) ? POLLOUT : 0);
+
+		ret = ppoll(pfds, 2, fcd_tty_timeout(&ts, remaining),
+			    &fcd_mon_ppoll_sigmask);
+		if (ret == -1) {
+			if (errno == EINTR)
+				continue;
+			FCD_PABORT("ppoll");
+		}
+
+		if (pfds[0].revents & POLLIN)
+			fcd_tty_drain_wake_pipe();
+
+		if (rx_ok && (pfds[1].revents & (POLLIN | POLLERR | POLLHUP))) {
+			if (fcd_tty_read(&rx) == -1) {
+				FCD_WARN("Disabling LCD button input\n");
+				rx_ok = 0;
+			}
+		}
+
+		if (remaining > 0
+			&& (pfds[1].revents & (POLLOUT | POLLERR | POLLHUP))) {
+			remaining = fcd_tty_write_frame(&frame, remaining);
+		}
+	}
+
+	pthread_exit(NULL);
 }
@@ -0,0 +1,211 @@
+/*
+ * Copyright 2020 Ian Pilcher <arequipeno@gmail.com>
+ *
+ * This program is free software.  You can redistribute it or modify it under
+ * the terms of version 2 of the GNU General Public License (GPL), as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY -- without even the implied warranty of MERCHANTIBILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the text of the GPL for more details.
+ *
+ * Version 2 of the GNU General Public License is available at:
+ *
+ *   http://www.gnu.org/licenses/old-licenses/gpl-2.0.html
+ */
+
+/*
+ * Fake front-panel PIC, for testing freecusd without an N5550.  Creates a
+ * pseudo-terminal, prints its name, and displays the 2-line LCD messages that
+ * are written to it.  Every frame received is ACKed.  Button presses are
+ * simulated by typing a command (followed by enter):
+ *
+ *	u - UP		d - DOWN	e - ENTER	x - ESC
+ *
+ * Usage:
+ *
+ *	fakepic &
+ *	freecusd -f -t pty:/dev/pts/N
+ *
+ * Build with:
+ *
+ *	gcc -std=gnu99 -Os -Wall -Wextra -o fakepic fakepic.c \
+ *		../freecusd/picproto.c
+ */
+
+#define _XOPEN_SOURCE 600
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <poll.h>
+
+#include "../freecusd/picproto.h"
+
+/* Must match enum fcd_button in freecusd/freecusd.h */
+static const char button_keys[] = "udex";
+
+static struct fcd_picproto_parser parser;
+static unsigned char tx_seq = 0;
+
+static int open_pty(void)
+{
+	int fd;
+
+	fd = posix_openpt(O_RDWR | O_NOCTTY);
+	if (fd == -1) {
+		perror("posix_openpt");
+		exit(__LINE__);
+	}
+
+	if (grantpt(fd) == -1) {
+		perror("grantpt");
+		exit(__LINE__);
+	}
+
+	if (unlockpt(fd) == -1) {
+		perror("unlockpt");
+		exit(__LINE__);
+	}
+
+	printf("Fake PIC listening on %s\n", ptsname(fd));
+
+	return fd;
+}
+
+static void show_frame(void)
+{
+	size_t i;
+
+	if (parser.len == FCD_PICPROTO_MSG_SIZE
+			&& parser.body[0] == FCD_PICPROTO_CMD_MSG) {
+		printf("+--------------------+\n");
+		printf("|%.20s|\n", parser.body + 1);
+		printf("|%.20s|\n",
+		       parser.body + 1 + 2 * FCD_PICPROTO_LINE_LEN);
+		printf("+--------------------+\n");
+		return;
+	}
+
+	printf("Received frame (sequence %u):", parser.seq);
+	for (i = 0; i < parser.len; ++i)
+		printf(" %02x", parser.body[i]);
+	putchar('\n');
+}
+
+static void send_frame(int pty_fd, unsigned char seq, const uint8_t *body,
+		       size_t body_size)
+{
+	uint8_t frame[FCD_PICPROTO_MAX_FRAME];
+	size_t size;
+
+	size = fcd_picproto_encode(frame, seq, body, body_size);
+
+	if (write(pty_fd, frame, size) != (ssize_t)size) {
+		perror("write: pty");
+		exit(__LINE__);
+	}
+}
+
+static void read_pty(int pty_fd)
+{
+	unsigned char buf[256];
+	ssize_t ret, i;
+
+	ret = read(pty_fd, buf, sizeof buf);
+	if (ret == -1) {
+		/* EIO just means that nothing has the slave open */
+		if (errno == EIO)
+			return;
+		perror("read: pty");
+		exit(__LINE__);
+	}
+
+	for (i = 0; i < ret; ++i) {
+
+		switch (fcd_picproto_parse(&parser, buf[i])) {
+
+			case FCD_PICPROTO_FRAME:
+				show_frame();
+				send_frame(pty_fd, parser.seq, parser.body, 0);
+				break;
+
+			case FCD_PICPROTO_DISCARD:
+				printf("Discarding byte: %02x\n", buf[i]);
+				break;
+
+			case FCD_PICPROTO_BAD:
+				puts("Bad frame");
+				break;
+
+			case FCD_PICPROTO_MORE:
+				break;
+		}
+	}
+}
+
+static void send_button(int pty_fd, unsigned char button)
+{
+	uint8_t body[2];
+
+	body[0] = FCD_PICPROTO_CMD_BUTTON;
+	body[1] = button;
+
+	send_frame(pty_fd, tx_seq++, body, sizeof body);
+}
+
+static void read_stdin(int pty_fd)
+{
+	char buf[80], *key;
+
+	if (fgets(buf, sizeof buf, stdin) == NULL)
+		exit(0);
+
+	if (buf[0] == '\n')
+		return;
+
+	key = strchr(button_keys, buf[0]);
+	if (key == NULL || buf[0] == 0) {
+		fputs("Unknown button (use u, d, e, or x)\n", stderr);
+		return;
+	}
+
+	send_button(pty_fd, (unsigned char)(key - button_keys + 1));
+}
+
+int main(void)
+{
+	struct pollfd pfds[2];
+	int pty_fd;
+
+	/* Keep output readable when redirected to a file */
+	setvbuf(stdout, NULL, _IOLBF, 0);
+
+	pty_fd = open_pty();
+	fcd_picproto_parser_init(&parser);
+
+	pfds[0].fd = pty_fd;
+	pfds[0].events = POLLIN;
+	pfds[1].fd = STDIN_FILENO;
+	pfds[1].events = POLLIN;
+
+	while (1) {
+
+		if (poll(pfds, 2, -1) == -1) {
+			perror("poll");
+			exit(__LINE__);
+		}
+
+		/* POLLHUP until freecusd opens the slave; don't spin */
+		if (pfds[0].revents & POLLHUP)
+			usleep(100000);
+		else if (pfds[0].revents & POLLIN)
+			read_pty(pty_fd);
+
+		if (pfds[1].revents & (POLLIN | POLLHUP))
+			read_stdin(pty_fd);
+	}
+}
@@ -1,5 +1,5 @@
 /*
- * Copyright 2013 Ian Pilcher <arequipeno@gmail.com>
+ * Copyright 2013, 2020 Ian Pilcher <arequipeno@gmail.com>
  *
  * This program is free software.  You can redistribute it or modify it under
  * the terms of version 2 of the GNU General Public License (GPL), as published
@@ -25,6 +25,27 @@
 #include <errno.h>
 #include <time.h>
 #include <pthread.h>
+#include <poll.h>
+
+#include "../freecusd/picproto.h"
+
+/*
+ * Build with:
+ *
+ *	gcc -std=gnu99 -Os -Wall -Wextra -pthread -o test2 test2.c \
+ *		../freecusd/picproto.c
+ */
+
+/* ACK timeout (milliseconds) and maximum number of times to send a frame */
+#define ACK_TIMEOUT	500
+#define ACK_TRIES	3
+
+/*
+ * Shared by the main & output threads.  The mutex is also held while a frame
+ * is written, so a retransmitted frame can't be interleaved with a new one.
+ */
+static pthread_mutex_t tracker_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct fcd_picproto_tracker tracker;
 
 static int pic_gpio_is_exported(void)
 {
@@ -202,38 +223,54 @@ static int open_tty(void)
 	return fd;
 }
 
-static void write_msg(int tty_fd, const void *msg_body, size_t msg_body_size)
+static long long now_msec(void)
 {
-	static unsigned char buf[1024];
-	static unsigned char seq = 0;
-	ssize_t ret;
-	size_t i;
+	struct timespec now;
 
-	if (msg_body_size > 255) {
-		fputs("Message too large\n", stderr);
-		return;
+	if (clock_gettime(CLOCK_MONOTONIC, &now) == -1) {
+		perror("clock_gettime");
+		exit(__LINE__);
 	}
 
-	buf[0] = 0x02;
-	buf[1] = seq++;
-	buf[2] = 0x00;
-	buf[3] = (unsigned char)msg_body_size;
-	memcpy(buf + 4, msg_body, msg_body_size);
-	buf[msg_body_size + 4] = 0x03;
+	return now.tv_sec * 1000LL + now.tv_nsec / 1000000;
+}
 
-	printf("Sending %zu bytes:", msg_body_size + 5);
-        for (i = 0; i < msg_body_size + 5; ++i) {
-                printf(" %02x", buf[i]);
-        }
-        putchar('\n');
+static void write_frame(int tty_fd, const unsigned char *frame, size_t size)
+{
+	size_t i;
+
+	printf("Sending %zu bytes:", size);
+	for (i = 0; i < size; ++i)
+		printf(" %02x", frame[i]);
+	putchar('\n');
 
-	ret = write(tty_fd, buf, msg_body_size + 5);
-	if (ret != (ssize_t)msg_body_size + 5) {
+	if (write(tty_fd, frame, size) != (ssize_t)size) {
 		perror("write: /dev/ttyS0");
 		exit(__LINE__);
 	}
 }
 
+/*
+ * Frames are not spaced out; the output thread tracks ACKs and retransmits as
+ * needed.
+ */
+static void write_msg(int tty_fd, const void *msg_body, size_t msg_body_size)
+{
+	unsigned char frame[FCD_PICPROTO_MAX_FRAME];
+	size_t size;
+
+	pthread_mutex_lock(&tracker_mutex);
+
+	size = fcd_picproto_send(&tracker, frame, msg_body, msg_body_size,
+				 now_msec());
+	if (size == 0)
+		fputs("Invalid or too large message\n", stderr);
+	else
+		write_frame(tty_fd, frame, size);
+
+	pthread_mutex_unlock(&tracker_mutex);
+}
+
 static inline void get_line(char *buf, size_t size)
 {
 	char *nl;
@@ -244,51 +281,39 @@ static inline void get_line(char *buf, size_t size)
 		*nl = 0;
 }
 
-static const unsigned char btmsg_hdr[32] = {
-	0x1d, 0x61, 0x67, 0x65, 0x6e, 0x74, 0x32, 0x00, 0xb4, 0x0c, 0x00
-};
-
 static void do_btmsg(int tty_fd, const char *msg)
 {
-	unsigned char msg_body[32];
-	size_t msg_len;
-
-	msg_len = strlen(msg);
-	if (msg_len > 20)
-		msg_len = 20;
-
-	memcpy(msg_body, btmsg_hdr, sizeof btmsg_hdr);
-	memcpy(msg_body + 11, msg, msg_len);
+	unsigned char msg_body[FCD_PICPROTO_MAX_BODY];
 
-	write_msg(tty_fd, msg_body, sizeof msg_body);
+	write_msg(tty_fd, msg_body, fcd_picproto_btmsg(msg_body, msg));
 }
 
 static void do_setbto_100(int tty_fd, int bto)
 {
-	unsigned char setbto_100_msg[2] = { 0x13 };
+	unsigned char msg_body[FCD_PICPROTO_MAX_BODY];
+	size_t size;
 
-	if (bto < 0 || bto > 255) {
+	size = fcd_picproto_setbto(msg_body, bto);
+	if (size == 0) {
 		fputs("Invalid BTO value\n", stderr);
 		return;
 	}
 
-	setbto_100_msg[1] = (unsigned char)bto;
-	write_msg(tty_fd, setbto_100_msg, sizeof setbto_100_msg);
+	write_msg(tty_fd, msg_body, size);
 }
 
 static void do_setlogo(int tty_fd, const char *logo)
 {
-	char msg_buf[255];
-	size_t logo_len = strlen(logo);
+	unsigned char msg_body[FCD_PICPROTO_MAX_BODY];
+	size_t size;
 
-	if (logo_len > sizeof msg_buf - 1) {
+	size = fcd_picproto_logo(msg_body, logo);
+	if (size == 0) {
 		fputs("Logo too long\n", stderr);
 		return;
 	}
 
-	msg_buf[0] = 0x11;
-	memcpy(msg_buf + 1, logo, logo_len);
-	write_msg(tty_fd, msg_buf, logo_len + 1);
+	write_msg(tty_fd, msg_body, size);
 }
 
 static const unsigned char MAGIC0[] = { 0x15 };
@@ -318,20 +343,16 @@ static void do_startwd_setexcfg_90(int tty_fd)
 
 static void do_status_msg(int tty_fd, const char *msg)
 {
-	unsigned char buf[34];
-	size_t msg_len;
+	unsigned char msg_body[FCD_PICPROTO_MAX_BODY];
+	size_t size;
 
-	msg_len = strlen(msg);
-	if (msg_len > 33) {
+	size = fcd_picproto_status(msg_body, msg);
+	if (size == 0) {
 		fputs("Message too long\n", stderr);
 		return;
 	}
 
-	memset(buf, 0, sizeof buf);
-	buf[0] = 0x19;
-	memcpy(buf +1, msg, msg_len);
-
-	write_msg(tty_fd, buf, sizeof buf);
+	write_msg(tty_fd, msg_body, size);
 }
 
 static FILE *open_output(int argc, char *argv[])
@@ -359,33 +380,111 @@ struct output_thread_params {
 	int	ttyS0_fd;
 };
 
+static void print_frame(FILE *out, const struct fcd_picproto_parser *parser)
+{
+	long long delay;
+	unsigned i;
+
+	if (fcd_picproto_is_ack(parser)) {
+		pthread_mutex_lock(&tracker_mutex);
+		delay = fcd_picproto_ack(&tracker, parser->seq, now_msec());
+		pthread_mutex_unlock(&tracker_mutex);
+		if (out == NULL)
+			return;
+		if (delay == -1)
+			fprintf(out, "Unexpected ACK: %u\n", parser->seq);
+		else
+			fprintf(out, "ACK: %u (%lld ms)\n", parser->seq, delay);
+		return;
+	}
+
+	if (out == NULL)
+		return;
+
+	fprintf(out, "Frame %u:", parser->seq);
+	for (i = 0; i < parser->len; ++i)
+		fprintf(out, " %02x", parser->body[i]);
+	fputc('\n', out);
+}
+
+/*
+ * Like freecusd (see tty.c), nothing is retransmitted until the PIC has ACKed
+ * a frame, in case it doesn't send ACKs at all.
+ */
+static void retransmit(int tty_fd)
+{
+	const struct fcd_picproto_pending *p;
+
+	pthread_mutex_lock(&tracker_mutex);
+
+	while (tracker.acked > 0
+		&& (p = fcd_picproto_retransmit(&tracker, now_msec())) != NULL) {
+
+		printf("Retransmitting frame %u\n", p->frame[1]);
+		write_frame(tty_fd, p->frame, p->size);
+	}
+
+	pthread_mutex_unlock(&tracker_mutex);
+}
+
 static void *output_thread_fn(void *arg)
 {
 	struct output_thread_params *params = arg;
+	static struct fcd_picproto_parser parser;
 	static unsigned char buf[1024];
 	ssize_t i, bytes_read;
+	struct pollfd pfd;
+
+	fcd_picproto_parser_init(&parser);
+
+	pfd.fd = params->ttyS0_fd;
+	pfd.events = POLLIN;
 
 	while (1) {
 
+		if (poll(&pfd, 1, ACK_TIMEOUT / 5) == -1) {
+			perror("poll: /dev/ttyS0");
+			exit(__LINE__);
+		}
+
+		retransmit(params->ttyS0_fd);
+
+		if (!(pfd.revents & POLLIN))
+			continue;
+
 		bytes_read = read(params->ttyS0_fd, buf, sizeof buf);
 		if (bytes_read == -1) {
 			perror("read: /dev/ttyS0");
 			exit(__LINE__);
 		}
 
-		if (params->out_tty == NULL)
-			continue;
+		for (i = 0; i < bytes_read; ++i) {
 
-		fprintf(params->out_tty, "Read %zd bytes:", bytes_read);
-		for (i = 0; i < bytes_read; ++i)
-			fprintf(params->out_tty, " %02hx", buf[i]);
-		fputc('\n', params->out_tty);
+			switch (fcd_picproto_parse(&parser, buf[i])) {
+
+				case FCD_PICPROTO_FRAME:
+					print_frame(params->out_tty, &parser);
+					break;
+
+				case FCD_PICPROTO_DISCARD:
+				case FCD_PICPROTO_BAD:
+					if (params->out_tty != NULL) {
+						fprintf(params->out_tty,
+							"Unframed byte: %02x\n",
+							buf[i]);
+					}
+					break;
+
+				case FCD_PICPROTO_MORE:
+					break;
+			}
+		}
 	}
 }
 
 static void start_output_thread(int argc, char *argv[], int ttyS0_fd)
 {
-	struct output_thread_params params;
+	static struct output_thread_params params;
 	pthread_t tid;
 
 	params.out_tty = open_output(argc, argv);
@@ -450,53 +549,31 @@ static char **prompt_for_message(void)
 
 static void do_menu(int tty_fd, char **items)
 {
-	static unsigned char buf[213]; /* up to 10 messages */
+	unsigned char msg_body[FCD_PICPROTO_MAX_BODY];
 	int i, num_items;
-	size_t item_len;
 
 	for (num_items = 0; items[num_items] != NULL; ++num_items);
 
-	memset(buf, 0, sizeof buf);
-	buf[0] = 0x16;
-	buf[1] = 0x00;
-	buf[2] = (unsigned char)num_items;
+	write_msg(tty_fd, msg_body,
+		  fcd_picproto_menu(msg_body, (const char *const *)items,
+				    num_items));
 
-	for (i = 0; i < num_items; ++i) {
-		item_len = strlen(items[i]);
-		if (item_len > 20)
-			item_len = 20;
-		memcpy(buf + 3 + i * 21, items[i], item_len);
+	for (i = 0; i < num_items; ++i)
 		free(items[i]);
-	}
 
 	free(items);
-
-	write_msg(tty_fd, buf, num_items * 21 + 3);
 }
 
 static void do_message(int tty_fd, char **lines)
 {
-	static unsigned char buf[61];
-	size_t line_len;
+	unsigned char msg_body[FCD_PICPROTO_MAX_BODY];
 
-	memset(buf, ' ', sizeof buf);
-	buf[0] = 0x11;
-
-	line_len = strlen(lines[0]);
-	if (line_len > 20)
-		line_len = 20;
-	memcpy(buf + 1, lines[0], line_len);
-
-	line_len = strlen(lines[1]);
-	if (line_len > 20)
-		line_len = 20;
-	memcpy(buf + 41, lines[1], line_len);
+	write_msg(tty_fd, msg_body,
+		  fcd_picproto_msg(msg_body, lines[0], lines[1]));
 
 	free(lines[0]);
 	free(lines[1]);
 	free(lines);
-
-	write_msg(tty_fd, buf, sizeof buf);
 }
 
 static const char prompt[] =
@@ -521,12 +598,14 @@ int main(int argc, char *argv[])
 	int tty_fd, selection;
 	char **items;
 
+	fcd_picproto_tracker_init(&tracker, 0, ACK_TIMEOUT, ACK_TRIES);
+
 	puts("Configuring PIC GPIO");
 	setup_pic_gpio();
 	//puts("Resetting PIC");
 	//reset_pic();
 	tty_fd = open_tty();
-	//start_output_thread(argc, argv, tty_fd);
+	start_output_thread(argc, argv, tty_fd);
 	//puts("Setting BTO to 100");
 	//do_setbto_100(tty_fd, 100);
 
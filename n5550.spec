@@ -21,18 +21,22 @@ LCD display and LEDs to report system status.
 cd freecusd
 gcc -std=gnu99 -Os -Wall -Wextra -pthread -o freecusd *.c -lcip
 gcc -std=gnu99 -Os -Wall -Wextra -pthread -o helper smart/helper.c -latasmart
+gcc -std=gnu99 -Os -Wall -Wextra -o freecusctl ctl/freecusctl.c
+gcc -std=gnu99 -O2 -Wall -Wextra -o thermsim sim/thermsim.c pwmstate.c -lm
 
 %install
 rm -rf %{buildroot}
 # Monitoring daemon
 mkdir -p %{buildroot}/usr/bin
 cp freecusd/freecusd %{buildroot}/usr/bin/
+cp freecusd/freecusctl %{buildroot}/usr/bin/
 mkdir -p %{buildroot}/usr/libexec
 cp freecusd/helper %{buildroot}/usr/libexec/freecusd-smart-helper
 mkdir -p %{buildroot}/usr/lib/systemd/system
 cp freecusd/freecusd.service %{buildroot}/usr/lib/systemd/system/
 mkdir %{buildroot}/etc
 cp freecusd/freecusd.conf %{buildroot}/etc/
+mkdir -p %{buildroot}/var/lib/freecusd
 # Kernel module sources
 mkdir -p %{buildroot}/usr/src/n5550/modules
 cp modules/{Makefile,n5550_ahci_leds.c,n5550_board.c} %{buildroot}/usr/src/n5550/modules/
@@ -55,9 +59,11 @@ rm -rf %{buildroot}
 
 %files
 %attr(0755,root,root) /usr/bin/freecusd
+%attr(0755,root,root) /usr/bin/freecusctl
 %attr(0755,root,root) /usr/libexec/freecusd-smart-helper
 %attr(0644,root,root) /usr/lib/systemd/system/freecusd.service
 %attr(0644,root,root) %config /etc/freecusd.conf
+%attr(0755,root,root) %dir /var/lib/freecusd
 %attr(0755,root,root) %dir /usr/src/n5550
 %attr(0755,root,root) %dir /usr/src/n5550/modules
 %attr(0644,root,root) /usr/src/n5550/modules/Makefile